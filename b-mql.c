@@ -0,0 +1,483 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : b-mql.c
+ * Description     : Microbenchmarks of mql library hot paths
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:06:42 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:11:28 2026
+ * Update Count    : 11
+ */
+
+/*
+ * Runs against mql_stub.c instead of libmosquitto, no broker needed.
+ * Output is one JSON object per line and benchmark:
+ *	{"bench":"<name>","iters":<n>,"ns_per_op":<f>,"allocs_per_op":<f>}
+ *
+ * b-mql [-t min-seconds] [<name-substring>...]
+ *
+ * The store benchmarks write a store in a new directory in $MQL_BENCH_DIR,
+ * or in /tmp, and remove it afterwards.  They include the writer thread
+ * and a final fdatasync(), so 1e9 / ns_per_op is the sustained rate.
+ * $MQL_BENCH_IO selects the writer: uring (default), write, uring+direct
+ * or write+direct.
+ */
+
+#include "mql.h"
+#include "mql_int.h"
+#include "mql_stub.h"
+#include "mql_store.h"
+#include "mql_match.h"
+#include "mql_out.h"
+#include "mql_filter.h"
+#include "mql_topic.h"
+
+#include <mosquitto.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+
+int opt_d = 0;				/* Used by mql_listen.c */
+char mql_prefix[ MQL_PREFIX_MAX_LEN ] = "mql";	/* Used by mql_listen.c */
+
+static double opt_t = 0.5;		/* Minimum time per benchmark */
+
+
+/* Count allocations by interposing the allocator (glibc only). */
+static unsigned long n_allocs = 0;
+
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+
+void*
+malloc(size_t size)
+{
+    ++n_allocs;
+    return __libc_malloc(size);
+}
+
+void*
+calloc(size_t n, size_t size)
+{
+    ++n_allocs;
+    return __libc_calloc(n,size);
+}
+
+void*
+realloc(void* p, size_t size)
+{
+    ++n_allocs;
+    return __libc_realloc(p,size);
+}
+#endif
+
+
+/* Results end up here so nothing is optimised away. */
+static volatile unsigned long sink;
+
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Listener internals, see mql_listen.c */
+extern unsigned message_severities;
+void mql_listen_message_callback(mql_transport_t* ptp, void *obj,
+				 const char* topic, const void* payload,
+				 int len);
+void mql_listen_filter(const mql_filter_t* text, const mql_filter_t* id);
+
+char transport_spec[ 80 ];
+
+static mql_transport_t* loop_tx;
+
+static char store_dir[ 256 ];
+static mql_store_t* store;
+
+// The store, opened at first use.
+static mql_store_t*
+b_store()
+{
+    mql_store_conf_t conf;
+    const char* d = getenv("MQL_BENCH_DIR");
+    const char* io = getenv("MQL_BENCH_IO");
+
+    if ( store )
+	return store;
+    snprintf( store_dir, sizeof(store_dir), "%s/b-mql.XXXXXX", d ? d : "/tmp" );
+    if ( !mkdtemp(store_dir) ) {
+	perror("mkdtemp: ");
+	exit( EXIT_FAILURE );
+    }
+    mql_store_defaults(&conf);
+    conf.dir = store_dir;
+    if ( io && !strncmp(io, "write", 5) )
+	conf.io = MQL_STORE_IO_WRITE;
+    if ( io && strstr(io, "+direct") )
+	conf.direct = 1;
+    store = mql_store_open(&conf);
+    if ( !store ) {
+	perror("mql_store_open: ");
+	exit( EXIT_FAILURE );
+    }
+    return store;
+}
+
+// Close the store and remove its directory, segments, indexes, rollups
+// and manifest.
+static void
+b_store_remove()
+{
+    struct dirent* e;
+    char path[ 512 ];
+    DIR* d;
+
+    if ( !store )
+	return;
+    mql_store_close(store);
+    d = opendir(store_dir);
+    while ( d && (e = readdir(d)) ) {
+	if ( !strcmp(e->d_name, ".") || !strcmp(e->d_name, "..") )
+	    continue;
+	snprintf( path, sizeof(path), "%s/%s", store_dir, e->d_name );
+	unlink( path );
+    }
+    if ( d )
+	closedir(d);
+    if ( rmdir(store_dir) )
+	perror(store_dir);
+}
+
+static void
+b_store_message_cb(mql_transport_t* tp, void* obj,
+		   const char* topic, const void* payload, int len)
+{
+    sink += mql_store_message(store, topic, payload, len);
+}
+
+
+static void
+b_log_filtered(unsigned long n)
+{
+    while ( n-- )
+	sink += mql_log( MQL_S_DEBUG, "Connection from 10.0.0.1 accepted" );
+}
+
+static void
+b_log_enabled(unsigned long n)
+{
+    while ( n-- )
+	sink += mql_log( MQL_S_INFO, "Connection from 10.0.0.1 accepted" );
+}
+
+static void
+b_logf_filtered(unsigned long n)
+{
+    while ( n-- )
+	sink += mql_logf( MQL_S_DEBUG, "request %u done in %u us", n, 17U );
+}
+
+static void
+b_logf_int(unsigned long n)
+{
+    while ( n-- )
+	sink += mql_logf( MQL_S_INFO, "request %u done in %u us", n, 17U );
+}
+
+static void
+b_logf_str(unsigned long n)
+{
+    while ( n-- )
+	sink += mql_logf( MQL_S_ERROR, "%s: %s (%d)",
+			  "open", "/var/lib/app/state.db", -2 );
+}
+
+static void
+b_logf_float(unsigned long n)
+{
+    while ( n-- )
+	sink += mql_logf( MQL_S_INFO, "load %.2f mem %.1f%%", 0.75, 42.5 );
+}
+
+static void
+b_split(unsigned long n)
+{
+    mql_fragment_t frag[8];
+    while ( n-- )
+	sink += mql_split( "mql/log/testapp/3", frag, 8 );
+}
+
+static void
+b_topic_parse(unsigned long n)
+{
+    /* 256 sources, as the listener parses them. */
+    static char topic[ 256 ][ 32 ];
+    static mql_topic_parser_t p;
+    mql_topic_t t;
+    unsigned i;
+
+    if ( !topic[0][0] ) {
+	for ( i = 0; i < 256; ++i )
+	    snprintf( topic[i], sizeof(topic[i]), "mql/log/node%u/%x", i, i & 15 );
+	mql_topic_init( &p, "mql" );
+    }
+    for ( i = 0; n--; ++i ) {
+	sink += mql_topic_parse( &p, topic[ i & 255 ], &t );
+	mql_topic_intern( &p, &t );
+	sink += t.sev + t.src;
+    }
+}
+
+static void
+b_decode_lvl(unsigned long n)
+{
+    unsigned lvl;
+    while ( n-- ) {
+	sink += mql_decode_lvl( " a", &lvl );
+	sink += lvl;
+    }
+}
+
+static void
+b_decode_count(unsigned long n)
+{
+    unsigned count;
+    while ( n-- ) {
+	sink += mql_decode_count( " 12345", &count );
+	sink += count;
+    }
+}
+
+static void
+b_listen_parse(unsigned long n)
+{
+    /* Severity not in message_severities: parsed but not printed. */
+    char topic[] = "mql/log/testapp/4";
+    char pload[] = "Connection from 10.0.0.1 accepted";
+
+    message_severities = (2U << MQL_S_ERROR) - 1;
+    while ( n-- )
+	mql_listen_message_callback( 0, 0, topic, pload, sizeof(pload) - 1 );
+    sink += message_severities;
+}
+
+static void
+b_listen_print(unsigned long n)
+{
+    /* Queued for the output thread, formatted and written to /dev/null. */
+    static int started = 0;
+    char topic[] = "mql/log/testapp/4";
+    char pload[] = "Connection from 10.0.0.1 accepted";
+
+    if ( !started++ && mql_out_start(open("/dev/null", O_WRONLY),
+				     0, MQL_OUT_WAIT) ) {
+	perror("mql_out_start: ");
+	exit( EXIT_FAILURE );
+    }
+    message_severities = (1U << MQL_S_MAX) - 1;
+    while ( n-- )
+	mql_listen_message_callback( 0, 0, topic, pload, sizeof(pload) - 1 );
+    sink += message_severities;
+}
+
+static void
+b_loop_publish(unsigned long n)
+{
+    /* Through the loop transport to the listener callback. */
+    char pload[] = "Connection from 10.0.0.1 accepted";
+
+    message_severities = (2U << MQL_S_ERROR) - 1;
+    while ( n-- )
+	sink += mql_transport_publish( loop_tx, "mql/log/testapp/4",
+				       sizeof(pload) - 1, pload, 0, 0 );
+    sink += message_severities;
+}
+
+static void
+b_store_append(unsigned long n)
+{
+    /* Straight into the store, a typical message. */
+    char pload[] = "404 Connection from 10.0.0.1 refused, no such service";
+    mql_store_t* st = b_store();
+
+    while ( n-- )
+	sink += mql_store_append( st, "testapp", 7, MQL_S_INFO,
+				  pload, sizeof(pload) - 1 );
+    mql_store_flush( st );
+}
+
+static void
+b_mqld_ingest(unsigned long n)
+{
+    /* As mqld: loop transport, topic parse, store. */
+    static mql_transport_t* rx;
+    char pload[] = "404 Connection from 10.0.0.1 refused, no such service";
+
+    if ( !rx ) {
+	b_store();
+	rx = mql_transport_new( "loop" );
+	mql_transport_callbacks( rx, 0, 0, b_store_message_cb, 0 );
+	mql_transport_subscribe( rx, "mqld/log/#" );
+	mql_transport_loop_start( rx );
+    }
+    while ( n-- )
+	sink += mql_transport_publish( loop_tx, "mqld/log/testapp/4",
+				       sizeof(pload) - 1, pload, 0, 0 );
+    mql_store_flush( store );
+}
+
+static void
+b_match_scan(unsigned long n)
+{
+    /* As mql query --scan, three strings that must all be there. */
+    static mql_match_t* m;
+    char text[] = "404 Connection from 10.0.0.1 refused, no such service";
+
+    if ( !m ) {
+	m = mql_match_new( 0 );
+	mql_match_add( m, "refused", 7 );
+	mql_match_add( m, "10.0.0.1", 8 );
+	mql_match_add( m, "service", 7 );
+	mql_match_build( m );
+    }
+    while ( n-- )
+	sink += mql_match_scan( m, text, sizeof(text) - 1,
+				mql_match_all(m) );
+}
+
+static void
+b_listen_filter(unsigned long n)
+{
+    /* --grep refused --grep timeout --grep-v health, not printed. */
+    static mql_filter_t* f;
+    char topic[] = "mql/log/testapp/4";
+    char pload[] = "Connection from 10.0.0.1 accepted";
+
+    if ( !f ) {
+	f = mql_filter_new( 0 );
+	mql_filter_string( f, MQL_FILTER_INCLUDE, "refused" );
+	mql_filter_string( f, MQL_FILTER_INCLUDE, "timeout" );
+	mql_filter_string( f, MQL_FILTER_EXCLUDE, "health" );
+	mql_filter_build( f );
+    }
+    mql_listen_filter( f, 0 );
+    message_severities = (1U << MQL_S_MAX) - 1;
+    while ( n-- )
+	mql_listen_message_callback( 0, 0, topic, pload, sizeof(pload) - 1 );
+    mql_listen_filter( 0, 0 );
+    sink += message_severities;
+}
+
+
+typedef struct {
+    const char*	name;
+    void	(*fn)(unsigned long n);
+} bench_t;
+
+static const bench_t benches[] = {
+    { "mql_log_filtered",	b_log_filtered },
+    { "mql_log_enabled",	b_log_enabled },
+    { "mql_logf_filtered",	b_logf_filtered },
+    { "mql_logf_int",		b_logf_int },
+    { "mql_logf_str",		b_logf_str },
+    { "mql_logf_float",		b_logf_float },
+    { "mql_split",		b_split },
+    { "topic_parse",		b_topic_parse },
+    { "mql_decode_lvl",		b_decode_lvl },
+    { "mql_decode_count",	b_decode_count },
+    { "listen_parse",		b_listen_parse },
+    { "listen_print",		b_listen_print },
+    { "loop_publish",		b_loop_publish },
+    { "store_append",		b_store_append },
+    { "mqld_ingest",		b_mqld_ingest },
+    { "match_scan",		b_match_scan },
+    { "listen_filter",		b_listen_filter },
+    { 0, 0 }
+};
+
+
+static void
+run(const bench_t* b)
+{
+    unsigned long n = 1000;
+    unsigned long a0;
+    double t0, t;
+
+    b->fn( n );				/* Warm up */
+
+    /* Grow the iteration count until the run takes long enough. */
+    for (;;) {
+	a0 = n_allocs;
+	t0 = now();
+	b->fn( n );
+	t = now() - t0;
+	if ( t >= opt_t )
+	    break;
+	if ( t < opt_t / 100 )
+	    n *= 10;
+	else
+	    n = (unsigned long)(n * 1.2 * opt_t / t);
+    }
+
+    printf("{\"bench\":\"%s\",\"iters\":%lu,"
+	   "\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f}\n",
+	   b->name, n, t * 1e9 / n, (double)(n_allocs - a0) / n );
+}
+
+
+int
+main(int argc, const char** argv)
+{
+    struct mosquitto* mqc;
+    mql_transport_t* rx;
+    const bench_t* b;
+
+    --argc;
+    ++argv;
+    if ( argc >= 2 && !strcmp(*argv,"-t") ) {
+	opt_t = atof( argv[1] );
+	argc -= 2;
+	argv += 2;
+    }
+
+    mqc = mosquitto_new( 0, true, 0 );
+    mql_init( mqc, "mql", "bench", MQL_S_INFO );
+
+    loop_tx = mql_transport_new( "loop" );
+    rx = mql_transport_new( "loop" );
+    mql_transport_callbacks( rx, 0, 0, mql_listen_message_callback, 0 );
+    mql_transport_subscribe( rx, "mql/log/#" );
+    mql_transport_loop_start( rx );
+
+    for ( b = benches; b->name; ++b ) {
+	int i;
+	int match = !argc;
+	for ( i = 0; i < argc; ++i )
+	    if ( strstr(b->name,argv[i]) )
+		match = 1;
+	if ( match )
+	    run( b );
+    }
+
+    b_store_remove();
+    mql_transport_destroy( rx );
+    mql_transport_destroy( loop_tx );
+    mosquitto_destroy( mqc );
+    return 0;
+}
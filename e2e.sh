@@ -0,0 +1,94 @@
+#!/bin/sh
+######################### -*- Mode: Shell-script -*- ##########################
+## Copyright (C) 2025, Mats Bergstrom
+##
+## File name       : e2e.sh
+## Description     : mql tools end to end through the test broker
+##
+## Author          : Mats Bergstrom
+## Created On      : Mon Oct 19 14:28:12 2026
+##
+## Last Modified By: Mats Bergstrom
+## Last Modified On: Mon Oct 19 14:28:12 2026
+## Update Count    : 1
+###############################################################################
+#
+# Starts t-broker on a free port and runs against it, over mqtt:
+#	t-mql -> mql listen --measure, no message lost
+#	mql level, t-mql sees messages filtered
+#	mql count, accepted
+# Prints throughput and latency from the listener.
+#
+# Environment: SECONDS_RUN (3), RATE (20000), THREADS (2).
+
+SECONDS_RUN=${SECONDS_RUN:-3}
+RATE=${RATE:-20000}
+THREADS=${THREADS:-2}
+
+dir=$(mktemp -d /tmp/mql-e2e.XXXXXX)
+fail=0
+
+cleanup() {
+    [ -n "$listen" ] && kill -INT $listen 2>/dev/null
+    [ -n "$broker" ] && kill -INT $broker 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+check() {
+    if [ "$1" = 0 ] ; then
+	echo "ok   $2"
+    else
+	echo "FAIL $2"
+	fail=1
+    fi
+}
+
+./t-broker > "$dir/broker" &
+broker=$!
+for i in 1 2 3 4 5 6 7 8 9 10 ; do
+    PORT=$(sed -n 's/^port //p' "$dir/broker")
+    [ -n "$PORT" ] && break
+    sleep 0.1
+done
+[ -n "$PORT" ] || { echo "FAIL t-broker did not start" ; exit 1 ; }
+echo "broker on port $PORT"
+
+# Throughput, latency and loss.
+./mql -p $PORT listen --measure $((SECONDS_RUN + 2)) ALL ALL > "$dir/listen" &
+listen=$!
+sleep 0.5
+./t-mql -p $PORT -T $SECONDS_RUN -r $RATE -n $THREADS > "$dir/tmql"
+check $? "t-mql"
+sleep 2
+kill -INT $listen
+wait $listen
+listen=
+cat "$dir/tmql"
+grep TOTAL "$dir/listen"
+grep TOTAL "$dir/listen" | grep -q "recv=[1-9][0-9]* lost=0 "
+check $? "listen received all, lost=0"
+
+# Level, sent while t-mql runs.
+./t-mql -p $PORT -i e2elvl -T 2 -r 1000 -m 8 > "$dir/tmql" &
+tmql=$!
+sleep 0.5
+./mql -p $PORT level e2elvl 4
+check $? "mql level"
+wait $tmql
+cat "$dir/tmql"
+grep -q "filtered=[1-9]" "$dir/tmql"
+check $? "level applied, messages filtered"
+
+# Count.
+./mql -p $PORT count e2elvl 4 10
+check $? "mql count"
+
+kill -INT $broker
+wait $broker
+broker=
+tail -1 "$dir/broker"
+
+[ $fail = 0 ] && echo "OK" || echo "FAILED"
+exit $fail
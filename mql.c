@@ -8,8 +8,8 @@
  * Created On      : Thu Jul  3 21:27:06 2025
  * 
  * Last Modified By: Mats Bergstrom
- * Last Modified On: Sun Nov 23 17:16:02 2025
- * Update Count    : 68
+ * Last Modified On: Mon Oct 19 16:16:06 2026
+ * Update Count    : 86
  */
 
 
@@ -18,28 +18,36 @@ extern "C" {
 #endif
 
 #include "mql.h"
+#include "mql_out.h"
+#include "mql_filter.h"
 
 #include <mosquitto.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
 
 
 #define STR_MAX (80)
-char mqtt_host[ STR_MAX ];
+char mqtt_host[ STR_MAX ];		/* Empty: from the transport spec */
 
-#define MQTT_PORT	(1883)
-int mqtt_port = MQTT_PORT;
+int mqtt_port;				/* 0: from the transport spec */
+
+char transport_spec[ STR_MAX ];		/* Empty: $MQL_TRANSPORT or mqtt */
 
 #define MQL_PREFIX_MAX_LEN	(32)
 #define MQL_ID_MAX_LEN		(32)
 #define MQL_TOPIC_MAX_LEN	(128)
 
-static char mql_prefix[ MQL_PREFIX_MAX_LEN ];
+char mql_prefix[ MQL_PREFIX_MAX_LEN ];		/* Used by mql_listen.c */
 /* unused: static char mql_id[ MQL_ID_MAX_LEN ]; */
 static char mql_topic[ MQL_TOPIC_MAX_LEN ];
 
+extern const char* mql_sev_name[MQL_S_MAX];	/* In mql_listen.c */
+
 int opt_d = 0;
 #define DD if(opt_d)printf
 
@@ -71,18 +79,8 @@ set_prefix(const char* p)
 void
 set_host(const char* h)
 {
-    if ( h && *h ) {
+    if ( h )
 	strncpy( mqtt_host, h, STR_MAX-1 );
-    }
-    else {
-	char* s = getenv("MQTT_HOST");
-	if ( s ) {
-	    strncpy( mqtt_host, s, STR_MAX-1 );
-	}
-	else {
-	    strncpy( mqtt_host, "127.0.0.1", STR_MAX-1 );
-	}
-    }
     DD ("host=\"%s\"\n",mqtt_host);
 }
 
@@ -94,6 +92,13 @@ set_port(const char* p)
     mqtt_port = atoi( p );
 }
 
+void
+set_transport(const char* t)
+{
+    strncpy( transport_spec, t, STR_MAX-1 );
+    DD ("transport=\"%s\"\n",transport_spec);
+}
+
 unsigned
 set_severity(const char* s)
 {
@@ -126,7 +131,11 @@ set_severity(const char* s)
 	    n = MQL_S_INFO;
 	}
 	else {
-	    do_help("Unrecognised severity.");
+	    /* DEBUG, INFO_2 and the others by their printed names */
+	    for ( n = 0; n < MQL_S_MAX && strcmp(mql_sev_name[n],s); ++n )
+		;
+	    if ( n == MQL_S_MAX )
+		do_help("Unrecognised severity.");
 	}
     }
     if ( n >= MQL_S_MAX )
@@ -141,34 +150,302 @@ do_help(const char* msg)
     if ( msg )
 	printf("Error: %s\n", msg);
     printf(
-"mql [-h host] [-p port] [-x prefix] <command> [<args>]\n"
+"mql [-h host] [-p port] [-x prefix] [-t transport] <command> [<args>]\n"
+"	-t	mqtt[://host[:port]], loop, unix[:path] or shm[:name]\n"
+"		default $MQL_TRANSPORT or mqtt, -h and -p override its\n"
+"		host and port, which default to $MQTT_HOST or 127.0.0.1, 1883\n"
 "	Command	Description\n"
 "	help	This text.\n"
-"	listen	<target> <severity>\n"
-"		<target>	ALL or name of target\n"
-"		<severity>	[FEWID] or [0-9,a-f] or ALL\n"
+"	hub	[<path>]\n"
+"		Route messages between unix transport clients,\n"
+"		default path " MQL_UNIX_PATH "\n"
+"	listen	[--measure [<seconds>]] [--queue <MiB>] [--drop <what>]\n"
+"		[--grep[-v] <text>] [--regex[-v] <re>] [--id[-v] <text>]\n"
+"		[--icase] [--format <what>] [--timestamp] <target> <severity>\n"
+"		--measure	Measure latency and loss of t-mql messages,\n"
+"				print summaries every <seconds> (10)\n"
+"		--queue		Most queued for output, 0 no limit (64)\n"
+"		--drop		When full: wait, oldest, or severity for\n"
+"				the least severe first (severity)\n"
+"		--grep		Print only messages with <text>, or one of\n"
+"				them when more are given; --grep-v not\n"
+"				those with <text>\n"
+"		--regex		As --grep, for a POSIX extended <re>\n"
+"		--id		As --grep, for the id of the source\n"
+"		--icase		ASCII letters in any case\n"
+"		--format	line, ndjson for a JSON object per line,\n"
+"				or bin for binary records, see README.md\n"
+"				(line)\n"
+"		--timestamp	With ndjson or bin, the time received\n"
+"		<target>	ALL or names of targets, comma separated\n"
+"		<severity>	[FEWID] or [0-9,a-f] or ALL, and all more\n"
+"				severe, or a comma separated list of\n"
+"				exactly those\n"
 "	count	<target> <severity> <count>\n"
 "		<target>	ALL or name of target\n"
 "		<severity>	[FEWID] or [0-9,a-f] or ALL\n"
 "		<count>		No of messages to use severity for\n"
+"	query	[--dir <dir>] [--since <time>] [--until <time>] [--scan]\n"
+"		[--threads <n>] [--count] [--by <what>]\n"
+"		<target> <severity> [<word>...]\n"
+"		Records of the mqld store in <dir> (.), oldest first\n"
+"		<time>		<n>[smhd] ago, @<seconds since 1970>\n"
+"				or YYYY-MM-DD[THH:MM[:SS]] local time\n"
+"		--scan		<word>s are strings to search for\n"
+"		--threads	Threads reading the store (all cores)\n"
+"		--count		Count the records instead\n"
+"		--by		Count by source, severity, minute, hour or day\n"
+"		<target>	ALL or name of target\n"
+"		<severity>	[FEWID] or [0-9,a-f] or ALL\n"
+"		<word>		Words that must all be in the text, any case\n"
+"	stats	[--dir <dir>] [--since <time>] [--until <time>] [--by <what>]\n"
+"		[<target> [<severity>]]\n"
+"		Message counts and rates of the mqld store in <dir> (.),\n"
+"		from its rollups, to the minute\n"
+"		--by		By source, severity, minute, hour or day (UTC),\n"
+"				default by source and severity\n"
+"	tail	[--dir <dir>] [--socket <path>] [--since <time>]\n"
+"		[<target> [<severity>]]\n"
+"		Records of the mqld store in <dir> (.) since <time> (now),\n"
+"		then new ones as mqld writes them, from its tail socket\n"
+"		--socket	The socket, default <dir>/tail.sock\n"
+"	record	[--seconds <n>] [--count <n>] <file> [<target>]\n"
+"		Write the log messages as they come to a capture file,\n"
+"		until interrupted or a limit\n"
+"		<target>	ALL or name of target\n"
+"	replay	[--speed <x>|max] [--connections <n>] <file>\n"
+"		Publish the messages of a capture file again\n"
+"		--speed		Times between messages divided by <x> (1),\n"
+"				max for no waiting\n"
+"		--connections	Connections to publish on (1), the\n"
+"				messages of a topic all on one\n"
 	   );
     exit(0);
 }
 
 
 void mql_command_listen(const char* host, int port,
-			const char* topic, unsigned severity);
+			const char* const* target, unsigned n_target,
+			unsigned severities, size_t queue_max, unsigned policy);
+
+void mql_command_measure(const char* host, int port,
+			 const char* const* target, unsigned n_target,
+			 unsigned severities, unsigned interval);
+
+void mql_listen_filter(const mql_filter_t* text, const mql_filter_t* id);
+
+#define LISTEN_TARGETS_MAX	(64)
+#define LISTEN_FILTERS_MAX	(64)
+
+// Split a comma separated list in place, at most max items.
+//	RETURNS	number of items, max+1 if more
+static unsigned
+split_list(char* s, const char** item, unsigned max)
+{
+    unsigned n = 0;
+    for (;;) {
+	if ( n == max )
+	    return max + 1;
+	item[ n++ ] = s;
+	s = strchr(s, ',');
+	if ( !s )
+	    return n;
+	*s++ = '\0';
+    }
+}
+
+// Targets of a listen, ALL for all.
+//	RETURNS	number of targets, 0 all
+static unsigned
+set_targets(const char* s, const char** target)
+{
+    static char buf[ MQL_STRING_MAX ];
+    unsigned i, n;
+
+    if ( strlen(s) >= sizeof(buf) )
+	do_help("Too long target list.");
+    strcpy( buf, s );
+    n = split_list(buf, target, LISTEN_TARGETS_MAX);
+    if ( n > LISTEN_TARGETS_MAX )
+	do_help("Too many targets.");
+    for ( i = 0; i < n; ++i ) {
+	if ( !strcmp("ALL",target[i]) || !strcmp("*",target[i]) )
+	    return 0;
+	if ( !*target[i] || strlen(target[i]) > MQL_ID_MAX_LEN
+	     || strpbrk(target[i], "/+#") )
+	    do_help("Bad target.");
+    }
+    return n;
+}
+
+// Compile the --grep, --regex and --id options of a listen, each the
+// option and its argument, into the filters of the payload and the id.
+static void
+set_filters(const char** opt[], unsigned n, unsigned flags,
+	    mql_filter_t** text, mql_filter_t** id)
+{
+    char err[ 128 ];
+    mql_filter_t** f;
+    const char* o;
+    unsigned how;
+    unsigned i;
+    int e;
+
+    for ( i = 0; i < n; ++i ) {
+	o = opt[i][0];
+	how = strstr(o, "-v") ? MQL_FILTER_EXCLUDE : MQL_FILTER_INCLUDE;
+	f = strncmp(o, "--id", 4) ? text : id;
+	if ( !*f && !(*f = mql_filter_new(flags)) ) {
+	    perror("listen: ");
+	    exit( EXIT_FAILURE );
+	}
+	if ( !strncmp(o, "--regex", 7) ) {
+	    e = mql_filter_regex(*f, how, opt[i][1]);
+	    if ( e ) {
+		mql_filter_error(*f, e, err, sizeof(err));
+		printf("Error: %s: %s\n", opt[i][1], err);
+		exit( EXIT_FAILURE );
+	    }
+	}
+	else if ( mql_filter_string(*f, how, opt[i][1]) ) {
+	    do_help("Too many or too long strings.");
+	}
+    }
+    if ( (*text && mql_filter_build(*text))
+	 || (*id && mql_filter_build(*id)) ) {
+	perror("listen: ");
+	exit( EXIT_FAILURE );
+    }
+}
+
+// Output format of a listen.
+static unsigned
+set_format(const char* s)
+{
+    if ( !strcmp(s, "line") )
+	return MQL_OUT_LINE;
+    if ( !strcmp(s, "ndjson") || !strcmp(s, "json") )
+	return MQL_OUT_NDJSON;
+    if ( !strcmp(s, "bin") )
+	return MQL_OUT_BIN;
+    do_help("Unrecognised format.");
+    return MQL_OUT_LINE;
+}
+
+// Severities of a listen: one for it and all more severe, or a comma
+// separated list of exactly those.
+//	RETURNS	a bit per severity
+static unsigned
+set_severities(const char* s)
+{
+    char buf[ MQL_STRING_MAX ];
+    const char* item[ MQL_S_MAX ];
+    unsigned sevs = 0;
+    unsigned i, n;
+
+    if ( !strchr(s, ',') )
+	return (2U << set_severity(s)) - 1;
+    if ( strlen(s) >= sizeof(buf) )
+	do_help("Too long severity list.");
+    strcpy( buf, s );
+    n = split_list(buf, item, MQL_S_MAX);
+    if ( n > MQL_S_MAX )
+	do_help("Too many severities.");
+    for ( i = 0; i < n; ++i ) {
+	if ( !*item[i] )
+	    do_help("Unrecognised severity.");
+	if ( !strcmp("ALL",item[i]) )
+	    sevs |= (1U << MQL_S_MAX) - 1;
+	else
+	    sevs |= 1U << set_severity(item[i]);
+    }
+    return sevs;
+}
 
 void
 do_listen( int argc, const char** argv )
-/* listen [(target|ALL) [severity]]  */
+/* listen [--measure [seconds]] [--queue MiB] [--drop policy] */
+/*	  [(target[,target...]|ALL) [severity[,severity...]]]  */
 /* topics: <prefix>/log/<target>/<severity> */
 {
     const char* target_str = 0;
     const char* severity_str = 0;
-    unsigned severity = MQL_S_MAX-1;
-    int i;
-    
+    const char* target[ LISTEN_TARGETS_MAX ];
+    unsigned n_target = 0;
+    unsigned severities = (1U << MQL_S_MAX) - 1;
+    unsigned interval = 0;
+    size_t queue_max = 64;		/* MiB */
+    unsigned policy = MQL_OUT_SEVERITY;
+    const char** filter[ LISTEN_FILTERS_MAX ];
+    unsigned n_filter = 0;
+    unsigned filter_flags = 0;
+    mql_filter_t* text = 0;
+    mql_filter_t* id = 0;
+    unsigned format = MQL_OUT_LINE;
+    int timestamp = 0;
+    char* e;
+
+    while ( argc && !strncmp(*argv,"--",2) ) {
+	if ( !strcmp(*argv,"--measure") ) {
+	    --argc;
+	    ++argv;
+	    interval = 10;
+	    if ( argc && ('0' <= **argv) && (**argv <= '9') ) {
+		interval = strtoul(*argv,&e,0);
+		if ( !interval || *e )
+		    do_help("Bad measure interval.");
+		--argc;
+		++argv;
+	    }
+	    continue;
+	}
+	if ( !strcmp(*argv,"--icase") ) {
+	    filter_flags |= MQL_FILTER_NOCASE;
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+	if ( !strcmp(*argv,"--timestamp") ) {
+	    timestamp = 1;
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+	if ( !strncmp(*argv,"--format=",9) ) {
+	    format = set_format(*argv + 9);
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+	if ( argc < 2 )
+	    do_help("Missing argument to listen option.");
+	if ( !strcmp(*argv,"--grep") || !strcmp(*argv,"--grep-v")
+	     || !strcmp(*argv,"--regex") || !strcmp(*argv,"--regex-v")
+	     || !strcmp(*argv,"--id") || !strcmp(*argv,"--id-v") ) {
+	    if ( n_filter == LISTEN_FILTERS_MAX )
+		do_help("Too many filters.");
+	    filter[ n_filter++ ] = argv;
+	}
+	else if ( !strcmp(*argv,"--format") )
+	    format = set_format(argv[1]);
+	else if ( !strcmp(*argv,"--queue") ) {
+	    queue_max = strtoul(argv[1],&e,0);
+	    if ( !('0' <= *argv[1] && *argv[1] <= '9') || *e
+		 || queue_max > (SIZE_MAX >> 20) )
+		do_help("Bad queue size.");
+	}
+	else if ( !strcmp(*argv,"--drop") && !strcmp(argv[1],"wait") )
+	    policy = MQL_OUT_WAIT;
+	else if ( !strcmp(*argv,"--drop") && !strcmp(argv[1],"oldest") )
+	    policy = MQL_OUT_OLDEST;
+	else if ( !strcmp(*argv,"--drop") && !strcmp(argv[1],"severity") )
+	    policy = MQL_OUT_SEVERITY;
+	else
+	    do_help("Bad listen option.");
+	argc -= 2;
+	argv += 2;
+    }
+
     if ( argc ) {
 	target_str = *argv;
 	--argc;
@@ -181,26 +458,30 @@ do_listen( int argc, const char** argv )
 	    if ( argc )
 		do_help("Too many arguments to listen command.");
 
-	    severity = set_severity(severity_str);
+	    severities = set_severities(severity_str);
 	}
+	if ( *target_str )
+	    n_target = set_targets(target_str, target);
     }
 
-    DD ("host=\"%s\" port=%d\n",mqtt_host, mqtt_port );
-    DD ("target=\"%s\" severity=%u\n", (target_str?target_str:"ALL"), severity);
+    if ( n_filter && interval )
+	do_help("Filters are not for --measure.");
+    if ( timestamp && format == MQL_OUT_LINE )
+	do_help("--timestamp is for --format ndjson or bin.");
+    mql_out_format(format, timestamp);
+    set_filters(filter, n_filter, filter_flags, &text, &id);
+    mql_listen_filter(text, id);
 
-    if ( !target_str || !*target_str ||
-	 !strcmp("ALL",target_str) || !strcmp("*",target_str) ) {
-	i = snprintf(mql_topic,MQL_TOPIC_MAX_LEN,
-		     "%s/%s/#", mql_prefix, MQL_LOG_TAG);
-	if ( !(i<MQL_TOPIC_MAX_LEN) ) abort();
-    }
-    else {
-	i = snprintf(mql_topic,MQL_TOPIC_MAX_LEN,
-		     "%s/%s/%s/#", mql_prefix, MQL_LOG_TAG, target_str);
-	if ( !(i<MQL_TOPIC_MAX_LEN) ) abort();
-    }
-    
-    mql_command_listen(mqtt_host,mqtt_port,mql_topic,severity);
+    DD ("host=\"%s\" port=%d\n",mqtt_host, mqtt_port );
+    DD ("target=\"%s\" severities=%04x\n", (target_str?target_str:"ALL"),
+	severities);
+
+    if ( interval )
+	mql_command_measure(mqtt_host,mqtt_port,target,n_target,severities,
+			    interval);
+    else
+	mql_command_listen(mqtt_host,mqtt_port,target,n_target,severities,
+			   queue_max << 20, policy);
     
 }
 
@@ -323,6 +604,306 @@ do_count( int argc, const char** argv )
 }
 
 
+void
+mql_command_query(const char* dir, const char* target, unsigned severity,
+		  uint64_t since_ns, uint64_t until_ns, int scan,
+		  const char* by, unsigned threads,
+		  int n_words, const char** words);
+
+// Time of a query option as ns since 1970.
+uint64_t
+parse_time(const char* s)
+{
+    uint64_t now = (uint64_t)time(0) * 1000000000ULL;
+    unsigned long long n;
+    struct tm tm;
+    char unit, c;
+    int k;
+
+    if ( *s == '@' && sscanf(s+1, "%llu%c", &n, &c) == 1 )
+	return n * 1000000000ULL;
+    if ( sscanf(s, "%llu%c%c", &n, &unit, &c) == 2 && strchr("smhd",unit) ) {
+	n *= unit == 's' ? 1 : unit == 'm' ? 60 : unit == 'h' ? 3600 : 86400;
+	n *= 1000000000ULL;
+	return n < now ? now - n : 0;
+    }
+    memset( &tm, 0, sizeof(tm) );
+    k = sscanf(s, "%d-%d-%d%c%d:%d:%d%c", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+	       &c, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &unit);
+    if ( (k == 3 || ((k == 6 || k == 7) && (c == 'T' || c == ' ')))
+	 && tm.tm_year >= 1970 ) {
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+	return (uint64_t)mktime(&tm) * 1000000000ULL;
+    }
+    do_help("Bad time.");
+    return 0;
+}
+
+void
+do_query( int argc, const char** argv )
+/* query [--dir d] [--since t] [--until t] [--scan] [--threads n] */
+/*	 [--count] [--by what] */
+/*	 (target|ALL) severity [word...] */
+{
+    const char* dir = ".";
+    const char* target_str = 0;
+    unsigned severity = MQL_S_MAX-1;
+    uint64_t since = 0;
+    uint64_t until = ~0ULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* by = 0;
+    int scan = 0;
+
+    while ( argc && !strncmp(*argv,"--",2) ) {
+	if ( !strcmp(*argv,"--scan") || !strcmp(*argv,"--count") ) {
+	    if ( !strcmp(*argv,"--scan") )
+		scan = 1;
+	    else if ( !by )
+		by = "";
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+	if ( argc < 2 )
+	    do_help("Missing argument to query option.");
+	if ( !strcmp(*argv,"--dir") )
+	    dir = argv[1];
+	else if ( !strcmp(*argv,"--since") )
+	    since = parse_time(argv[1]);
+	else if ( !strcmp(*argv,"--until") )
+	    until = parse_time(argv[1]);
+	else if ( !strcmp(*argv,"--by") )
+	    by = argv[1];
+	else if ( !strcmp(*argv,"--threads") ) {
+	    threads = strtol(argv[1],0,0);
+	    if ( threads < 1 )
+		do_help("Bad number of threads.");
+	}
+	else
+	    do_help("Bad query option.");
+	argc -= 2;
+	argv += 2;
+    }
+
+    if ( argc < 2 )
+	do_help("Missing target or severity to query command.");
+    target_str = *argv;
+    severity = set_severity(argv[1]);
+    argc -= 2;
+    argv += 2;
+
+    DD ("dir=\"%s\" target=\"%s\" severity=%u since=%llu until=%llu\n",
+	dir, target_str, severity,
+	(unsigned long long)since, (unsigned long long)until);
+
+    mql_command_query(dir, target_str, severity, since, until, scan, by,
+		      threads > 0 ? threads : 1, argc, argv);
+}
+
+
+void
+mql_command_stats(const char* dir, const char* target, unsigned severity,
+		  uint64_t since_ns, uint64_t until_ns, const char* by);
+
+void
+do_stats( int argc, const char** argv )
+/* stats [--dir d] [--since t] [--until t] [--by what] */
+/*	 [(target|ALL) [severity]] */
+{
+    const char* dir = ".";
+    const char* target_str = 0;
+    unsigned severity = MQL_S_MAX-1;
+    uint64_t since = 0;
+    uint64_t until = ~0ULL;
+    const char* by = 0;
+
+    while ( argc && !strncmp(*argv,"--",2) ) {
+	if ( argc < 2 )
+	    do_help("Missing argument to stats option.");
+	if ( !strcmp(*argv,"--dir") )
+	    dir = argv[1];
+	else if ( !strcmp(*argv,"--since") )
+	    since = parse_time(argv[1]);
+	else if ( !strcmp(*argv,"--until") )
+	    until = parse_time(argv[1]);
+	else if ( !strcmp(*argv,"--by") )
+	    by = argv[1];
+	else
+	    do_help("Bad stats option.");
+	argc -= 2;
+	argv += 2;
+    }
+
+    if ( argc > 2 )
+	do_help("Too many arguments to stats command.");
+    if ( argc )
+	target_str = argv[0];
+    if ( argc > 1 )
+	severity = set_severity(argv[1]);
+
+    DD ("dir=\"%s\" target=\"%s\" severity=%u since=%llu until=%llu\n",
+	dir, target_str ? target_str : "ALL", severity,
+	(unsigned long long)since, (unsigned long long)until);
+
+    mql_command_stats(dir, target_str, severity, since, until, by);
+}
+
+
+void
+mql_command_tail(const char* dir, const char* sock, const char* target,
+		 unsigned severity, uint64_t since_ns);
+
+void
+do_tail( int argc, const char** argv )
+/* tail [--dir d] [--socket path] [--since t] [(target|ALL) [severity]] */
+{
+    const char* dir = ".";
+    const char* sock = 0;
+    const char* target_str = 0;
+    unsigned severity = MQL_S_MAX-1;
+    uint64_t since = (uint64_t)time(0) * 1000000000ULL;
+
+    while ( argc && !strncmp(*argv,"--",2) ) {
+	if ( argc < 2 )
+	    do_help("Missing argument to tail option.");
+	if ( !strcmp(*argv,"--dir") )
+	    dir = argv[1];
+	else if ( !strcmp(*argv,"--socket") )
+	    sock = argv[1];
+	else if ( !strcmp(*argv,"--since") )
+	    since = parse_time(argv[1]);
+	else
+	    do_help("Bad tail option.");
+	argc -= 2;
+	argv += 2;
+    }
+
+    if ( argc > 2 )
+	do_help("Too many arguments to tail command.");
+    if ( argc )
+	target_str = argv[0];
+    if ( argc > 1 )
+	severity = set_severity(argv[1]);
+
+    DD ("dir=\"%s\" target=\"%s\" severity=%u since=%llu\n",
+	dir, target_str ? target_str : "ALL", severity,
+	(unsigned long long)since);
+
+    mql_command_tail(dir, sock, target_str, severity, since);
+}
+
+
+void
+mql_command_record(const char* host, int port, const char* topic,
+		   const char* file, unsigned seconds, uint64_t count);
+
+void
+do_record( int argc, const char** argv )
+/* record [--seconds n] [--count n] file [(target|ALL)] */
+{
+    const char* file;
+    const char* target_str = 0;
+    unsigned seconds = 0;
+    uint64_t count = 0;
+    int i;
+
+    while ( argc && !strncmp(*argv,"--",2) ) {
+	if ( argc < 2 )
+	    do_help("Missing argument to record option.");
+	if ( !strcmp(*argv,"--seconds") )
+	    seconds = strtoul(argv[1],0,0);
+	else if ( !strcmp(*argv,"--count") )
+	    count = strtoull(argv[1],0,0);
+	else
+	    do_help("Bad record option.");
+	argc -= 2;
+	argv += 2;
+    }
+
+    if ( !argc )
+	do_help("Missing file to record command.");
+    if ( argc > 2 )
+	do_help("Too many arguments to record command.");
+    file = argv[0];
+    if ( argc > 1 )
+	target_str = argv[1];
+
+    if ( !target_str || !*target_str ||
+	 !strcmp("ALL",target_str) || !strcmp("*",target_str) )
+	i = snprintf(mql_topic,MQL_TOPIC_MAX_LEN,
+		     "%s/%s/#", mql_prefix, MQL_LOG_TAG);
+    else
+	i = snprintf(mql_topic,MQL_TOPIC_MAX_LEN,
+		     "%s/%s/%s/#", mql_prefix, MQL_LOG_TAG, target_str);
+    if ( !(i<MQL_TOPIC_MAX_LEN) ) abort();
+
+    DD ("file=\"%s\" topic=\"%s\" seconds=%u count=%llu\n",
+	file, mql_topic, seconds, (unsigned long long)count);
+
+    mql_command_record(mqtt_host, mqtt_port, mql_topic, file, seconds, count);
+}
+
+
+void
+mql_command_replay(const char* host, int port, const char* file,
+		   double speed, unsigned connections);
+
+void
+do_replay( int argc, const char** argv )
+/* replay [--speed x|max] [--connections n] file */
+{
+    double speed = 1;
+    unsigned connections = 1;
+    char* e;
+
+    while ( argc && !strncmp(*argv,"--",2) ) {
+	if ( argc < 2 )
+	    do_help("Missing argument to replay option.");
+	if ( !strcmp(*argv,"--speed") ) {
+	    if ( !strcmp(argv[1],"max") ) {
+		speed = 0;
+	    }
+	    else {
+		speed = strtod(argv[1],&e);
+		if ( *e == 'x' )
+		    ++e;
+		if ( *e || !(speed > 0) )
+		    do_help("Bad replay speed.");
+	    }
+	}
+	else if ( !strcmp(*argv,"--connections") )
+	    connections = strtoul(argv[1],0,0);
+	else
+	    do_help("Bad replay option.");
+	argc -= 2;
+	argv += 2;
+    }
+
+    if ( argc != 1 )
+	do_help("Replay command takes one file.");
+
+    DD ("file=\"%s\" speed=%g connections=%u\n", *argv, speed, connections);
+
+    mql_command_replay(mqtt_host, mqtt_port, *argv, speed, connections);
+}
+
+
+void mql_command_hub(const char* path);
+
+void
+do_hub( int argc, const char** argv )
+/* hub [path] */
+{
+    if ( argc > 1 )
+	do_help("Too many arguments to hub command.");
+    if ( argc && **argv == '-' )
+	do_help("Unrecognised hub option.");
+    mql_command_hub( argc ? *argv : 0 );
+}
+
+
 
 int
 main(int argc, const char** argv)
@@ -330,7 +911,6 @@ main(int argc, const char** argv)
     
     setbuf(stdout,0);
 
-    set_host(0);			/* Set default host */
     set_prefix(0);			/* Set default prefix */
 
     /* Decode arguments. */
@@ -388,6 +968,18 @@ main(int argc, const char** argv)
 	    continue;
 	}
 
+	if ( !strcmp(*argv,"-t") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -t option");
+
+	    set_transport( *argv );
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
 	printf("Bad option: %s\n",*argv);
 	do_help(0);
 	break;
@@ -412,6 +1004,36 @@ main(int argc, const char** argv)
 	++argv;
 	do_count(argc,argv);
     }
+    else if ( !strcmp("hub", *argv) ) {
+	--argc;
+	++argv;
+	do_hub(argc,argv);
+    }
+    else if ( !strcmp("query", *argv) ) {
+	--argc;
+	++argv;
+	do_query(argc,argv);
+    }
+    else if ( !strcmp("stats", *argv) ) {
+	--argc;
+	++argv;
+	do_stats(argc,argv);
+    }
+    else if ( !strcmp("tail", *argv) ) {
+	--argc;
+	++argv;
+	do_tail(argc,argv);
+    }
+    else if ( !strcmp("record", *argv) ) {
+	--argc;
+	++argv;
+	do_record(argc,argv);
+    }
+    else if ( !strcmp("replay", *argv) ) {
+	--argc;
+	++argv;
+	do_replay(argc,argv);
+    }
     else if ( !strcmp("help", *argv) ) {
 	do_help(0);
     }
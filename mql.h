@@ -8,8 +8,8 @@
  * Created On      : Sun Jun 29 10:59:37 2025
  * 
  * Last Modified By: Mats Bergstrom
- * Last Modified On: Sun Nov 23 17:26:59 2025
- * Update Count    : 27
+ * Last Modified On: Mon Oct 19 14:24:08 2026
+ * Update Count    : 29
  */
 
 #ifndef __MQL_H__
@@ -28,6 +28,11 @@ extern "C" {
  *	<severity>	hex coded number 0..f
  *	<string>	User defined string, length < 256.
  *
+ * batch-topics:	<prefix>/<unit-id>/<severity>/batch
+ * batch-message:	<record>...
+ *	<record>	<len>:<string>,	(netstring, <len> decimal)
+ *		Messages of one unit and severity, in order, from mqlagent.
+ *
  * control-topics:	<prefix>/{<unit-id>|ALL}/control
  * control-message:	<command><space><arg0>[<space><arg1>]
  *	<command>	L	<arg0>=hex coded level
@@ -37,6 +42,7 @@ extern "C" {
  */
 
 #include <mosquitto.h>
+#include "mql_transport.h"
 
 #define MQL_S_FATAL	(0)
 #define MQL_S_ERROR	(1)
@@ -73,6 +79,7 @@ extern "C" {
 #define MQL_LOG_TAG	"log"
 #define MQL_CMD_TAG	"cmd"
 #define MQL_RSP_TAG	"rsp"
+#define MQL_BATCH_TAG	"batch"
 
 
 // Initialise
@@ -99,6 +106,28 @@ int mql_connect_cb(struct mosquitto* mqc);
 int mql_message_cb(struct mosquitto* mqc,const struct mosquitto_message *msg);
 
 
+// Initialise with any transport, see mql_transport.h.
+// Call after mql_transport_new() and before mql_transport_connect().
+int mql_init_transport(mql_transport_t* tp,
+		       const char* prefix, const char* id, unsigned lvl);
+
+// Use in transport connect callback.  Subscribes to control topics.
+//	RETURNS	0	OK
+//		-1	Error
+int mql_subscribe_commands();
+
+// Use in transport message callback.  Returns as mql_message_cb().
+int mql_message(const char* topic, const void* payload, int len);
+
+// Create a transport from spec (see mql_transport.h), initialise,
+// connect and start it, with callbacks that handle control messages.
+// host/port override the spec when set.  For applications that do not
+// use the transport for anything else.
+//	RETURNS	transport, or 0 on error
+mql_transport_t* mql_open(const char* spec, const char* host, int port,
+			  const char* prefix, const char* id, unsigned lvl);
+
+
 // Use to send log messages
 //	severity	Severity of message, MQL_S_FATAL..MQL_S_MAX-1
 //	msg_id		Message id (user defined value)
@@ -132,6 +161,13 @@ typedef struct {
 int mql_split(const char* topic,
 	      mql_fragment_t* frag_array, unsigned frag_array_len );
 
+// Get the next record of a batch message, start with *pos = 0.
+//	RETURNS	1	OK, record in rec/rec_len, *pos advanced
+//		0	End of batch
+//		-1	Malformed batch
+int mql_batch_next(const char* payload, int len, int* pos,
+		   const char** rec, int* rec_len);
+
 #ifdef __cplusplus
 }
 #endif
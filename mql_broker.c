@@ -0,0 +1,703 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_broker.c
+ * Description     : Minimal MQTT broker, test fixture
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:28:12 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:07:58 2026
+ * Update Count    : 2
+ */
+
+/*
+ * One thread polls the listening socket and all clients.  Input is
+ * buffered until a whole packet has arrived, output is buffered and
+ * written when the socket takes it.  A client whose output buffer grows
+ * past BRK_OUT_MAX is disconnected rather than slowing down the others.
+ */
+
+#include "mql_broker.h"
+#include "mql_transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define BRK_CLIENTS_MAX		(1024)
+#define BRK_IN_MAX		(1 << 20)	/* Largest packet */
+#define BRK_OUT_MAX		(64 << 20)	/* Unsent bytes per client */
+
+// Packet types, high nibble of the first byte.
+#define BRK_CONNECT		(1)
+#define BRK_CONNACK		(2)
+#define BRK_PUBLISH		(3)
+#define BRK_PUBACK		(4)
+#define BRK_PUBREC		(5)
+#define BRK_PUBREL		(6)
+#define BRK_PUBCOMP		(7)
+#define BRK_SUBSCRIBE		(8)
+#define BRK_SUBACK		(9)
+#define BRK_UNSUBSCRIBE		(10)
+#define BRK_UNSUBACK		(11)
+#define BRK_PINGREQ		(12)
+#define BRK_PINGRESP		(13)
+#define BRK_DISCONNECT		(14)
+
+typedef struct {
+    char*	filter;
+    int		qos;
+} brk_sub_t;
+
+typedef struct {
+    int		fd;
+    int		connected;		/* CONNECT seen */
+    char*	in;
+    size_t	in_len;
+    size_t	in_cap;
+    char*	out;
+    size_t	out_off;		/* Sent up to here */
+    size_t	out_len;
+    size_t	out_cap;
+    brk_sub_t*	sub;
+    unsigned	n_subs;
+    uint16_t	next_id;
+    unsigned char* rel;			/* QoS 2 ids waiting for PUBREL, bits */
+} brk_client_t;
+
+typedef struct brk_retain {
+    struct brk_retain*	next;
+    char*		topic;
+    char*		payload;
+    size_t		len;
+    int			qos;
+} brk_retain_t;
+
+struct mql_broker {
+    int			lfd;
+    int			port;
+    int			wake[2];	/* Pipe, written to stop */
+    pthread_t		tid;
+    pthread_mutex_t	mtx;		/* Protects st */
+    mql_broker_stats_t	st;
+    brk_client_t*	client[ BRK_CLIENTS_MAX ];
+    struct pollfd	pfd[ BRK_CLIENTS_MAX + 2 ];
+    unsigned		n_clients;
+    brk_retain_t*	retain;
+};
+
+
+static void
+brk_count(mql_broker_t* b, unsigned long* c, long n)
+{
+    pthread_mutex_lock( &b->mtx );
+    *c += n;
+    pthread_mutex_unlock( &b->mtx );
+}
+
+
+/*
+ * Output
+ */
+
+static int
+brk_flush(brk_client_t* c)
+{
+    while ( c->out_off < c->out_len ) {
+	ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+			 MSG_DONTWAIT | MSG_NOSIGNAL);
+	if ( n < 0 ) {
+	    if ( errno == EAGAIN || errno == EWOULDBLOCK )
+		break;
+	    if ( errno == EINTR )
+		continue;
+	    return -1;
+	}
+	c->out_off += n;
+    }
+    if ( c->out_off == c->out_len )
+	c->out_off = c->out_len = 0;
+    return 0;
+}
+
+static int
+brk_put(brk_client_t* c, const void* p, size_t n)
+{
+    if ( c->out_len + n > c->out_cap ) {
+	size_t cap = c->out_cap ? c->out_cap : 4096;
+	char* out;
+	if ( c->out_off ) {
+	    memmove( c->out, c->out + c->out_off, c->out_len - c->out_off );
+	    c->out_len -= c->out_off;
+	    c->out_off = 0;
+	}
+	while ( cap < c->out_len + n )
+	    cap *= 2;
+	if ( cap > BRK_OUT_MAX )
+	    return -1;
+	if ( cap > c->out_cap ) {
+	    out = realloc(c->out, cap);
+	    if ( !out )
+		return -1;
+	    c->out = out;
+	    c->out_cap = cap;
+	}
+    }
+    memcpy( c->out + c->out_len, p, n );
+    c->out_len += n;
+    return 0;
+}
+
+// Fixed header: type/flags byte and remaining length.
+static int
+brk_put_header(brk_client_t* c, unsigned char type, size_t rlen)
+{
+    unsigned char h[5];
+    int n = 0;
+    h[n++] = type;
+    do {
+	h[n] = rlen % 128;
+	rlen /= 128;
+	if ( rlen )
+	    h[n] |= 0x80;
+	++n;
+    } while ( rlen );
+    return brk_put(c, h, n);
+}
+
+static int
+brk_put_publish(brk_client_t* c, const char* topic, const void* payload,
+		size_t len, int qos, int retain)
+{
+    size_t tlen = strlen(topic);
+    unsigned char w[2];
+    if ( brk_put_header(c, (BRK_PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0),
+			2 + tlen + (qos ? 2 : 0) + len) )
+	return -1;
+    w[0] = tlen >> 8;
+    w[1] = tlen;
+    if ( brk_put(c, w, 2) || brk_put(c, topic, tlen) )
+	return -1;
+    if ( qos ) {
+	if ( !++c->next_id )
+	    ++c->next_id;
+	w[0] = c->next_id >> 8;
+	w[1] = c->next_id;
+	if ( brk_put(c, w, 2) )
+	    return -1;
+    }
+    return brk_put(c, payload, len);
+}
+
+static int
+brk_put_ack(brk_client_t* c, int type, const unsigned char* id)
+{
+    return brk_put_header(c, type << 4, 2) || brk_put(c, id, 2);
+}
+
+
+/*
+ * Clients
+ */
+
+static void
+brk_close(mql_broker_t* b, unsigned i)
+{
+    brk_client_t* c = b->client[i];
+    unsigned k;
+    close(c->fd);
+    for ( k = 0; k < c->n_subs; ++k )
+	free(c->sub[k].filter);
+    free(c->sub);
+    free(c->rel);
+    free(c->in);
+    free(c->out);
+    free(c);
+    --b->n_clients;
+    b->client[i] = b->client[ b->n_clients ];
+    b->client[ b->n_clients ] = 0;
+}
+
+static void
+brk_accept(mql_broker_t* b)
+{
+    brk_client_t* c;
+    int one = 1;
+    int fd = accept(b->lfd, 0, 0);
+    if ( fd < 0 )
+	return;
+    c = (b->n_clients < BRK_CLIENTS_MAX) ? calloc(1,sizeof(brk_client_t)) : 0;
+    if ( !c ) {
+	close(fd);
+	return;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->fd = fd;
+    b->client[ b->n_clients++ ] = c;
+    brk_count(b, &b->st.connects, 1);
+}
+
+
+// Read a length prefixed string at *p, advance *p.
+static int
+brk_get_str(const unsigned char** p, const unsigned char* end,
+	    const char** s, size_t* n)
+{
+    if ( end - *p < 2 )
+	return -1;
+    *n = ((*p)[0] << 8) | (*p)[1];
+    if ( (size_t)(end - *p - 2) < *n )
+	return -1;
+    *s = (const char*)*p + 2;
+    *p += 2 + *n;
+    return 0;
+}
+
+static char*
+brk_strndup(const char* s, size_t n)
+{
+    char* d = malloc(n + 1);
+    if ( d ) {
+	memcpy( d, s, n );
+	d[n] = '\0';
+    }
+    return d;
+}
+
+
+static void
+brk_retain(mql_broker_t* b, const char* topic,
+	   const void* payload, size_t len, int qos)
+{
+    brk_retain_t** pp;
+    brk_retain_t* r;
+
+    for ( pp = &b->retain; *pp; pp = &(*pp)->next )
+	if ( !strcmp((*pp)->topic, topic) )
+	    break;
+    r = *pp;
+    if ( r ) {
+	/* Replaced or, for an empty payload, removed. */
+	*pp = r->next;
+	free(r->topic);
+	free(r->payload);
+	free(r);
+	brk_count(b, &b->st.retained, -1);
+    }
+    if ( !len )
+	return;
+    r = calloc(1,sizeof(brk_retain_t));
+    if ( !r )
+	return;
+    r->topic = strdup(topic);
+    r->payload = malloc(len);
+    if ( !r->topic || !r->payload ) {
+	free(r->topic);
+	free(r->payload);
+	free(r);
+	return;
+    }
+    memcpy( r->payload, payload, len );
+    r->len = len;
+    r->qos = qos;
+    r->next = b->retain;
+    b->retain = r;
+    brk_count(b, &b->st.retained, 1);
+}
+
+
+static int
+brk_publish(mql_broker_t* b, brk_client_t* from, unsigned char flags,
+	    const unsigned char* p, const unsigned char* end)
+{
+    int qos = (flags >> 1) & 3;
+    int retain = flags & 1;
+    const unsigned char* id = 0;
+    const char* t;
+    char topic[ 1024 ];
+    size_t tlen;
+    unsigned i, k;
+
+    if ( brk_get_str(&p, end, &t, &tlen) || tlen >= sizeof(topic) || qos > 2 )
+	return -1;
+    memcpy( topic, t, tlen );
+    topic[tlen] = '\0';
+    if ( strpbrk(topic, "+#") )
+	return -1;
+    if ( qos ) {
+	if ( end - p < 2 )
+	    return -1;
+	id = p;
+	p += 2;
+	if ( qos == 1 && brk_put_ack(from, BRK_PUBACK, id) )
+	    return -1;
+	if ( qos == 2 ) {
+	    unsigned n = id[0] << 8 | id[1];
+	    if ( !from->rel && !(from->rel = calloc(1, 65536 / 8)) )
+		return -1;
+	    if ( brk_put_ack(from, BRK_PUBREC, id) )
+		return -1;
+	    if ( from->rel[n / 8] & (1 << n % 8) )
+		return 0;		/* Sent again before PUBREL */
+	    from->rel[n / 8] |= 1 << n % 8;
+	}
+	qos = 1;			/* Forwarded as QoS 1 */
+    }
+    brk_count(b, &b->st.published, 1);
+
+    if ( retain )
+	brk_retain(b, topic, p, end - p, qos);
+
+    for ( i = 0; i < b->n_clients; ++i ) {
+	brk_client_t* c = b->client[i];
+	int q = -1;
+	if ( !c->connected )
+	    continue;
+	for ( k = 0; k < c->n_subs; ++k )
+	    if ( c->sub[k].qos > q && mql_topic_match(c->sub[k].filter, topic) )
+		q = c->sub[k].qos;
+	if ( q < 0 )
+	    continue;
+	if ( brk_put_publish(c, topic, p, end - p, q < qos ? q : qos, 0) ) {
+	    /* Too far behind, cut off when polled. */
+	    close(c->fd);
+	    c->fd = -1;
+	    brk_count(b, &b->st.dropped, 1);
+	    continue;
+	}
+	brk_count(b, &b->st.delivered, 1);
+    }
+    return 0;
+}
+
+
+static int
+brk_subscribe(mql_broker_t* b, brk_client_t* c,
+	      const unsigned char* p, const unsigned char* end)
+{
+    const unsigned char* id = p;
+    unsigned char rc[ 256 ];
+    unsigned sub[ 256 ];		/* Index in c->sub of each filter */
+    unsigned n = 0;
+    unsigned i, k;
+
+    if ( end - p < 2 )
+	return -1;
+    p += 2;
+    while ( p < end && n < sizeof(rc) ) {
+	const char* f;
+	size_t flen;
+	brk_sub_t* s;
+	char* filter;
+	int qos;
+
+	if ( brk_get_str(&p, end, &f, &flen) || p >= end || !flen )
+	    return -1;
+	qos = *p++ & 3;
+	if ( qos > 1 )
+	    qos = 1;
+	filter = brk_strndup(f, flen);
+	if ( !filter )
+	    return -1;
+	for ( k = 0; k < c->n_subs; ++k )
+	    if ( !strcmp(c->sub[k].filter, filter) )
+		break;
+	if ( k < c->n_subs ) {
+	    free(c->sub[k].filter);	/* Same filter again, new QoS */
+	}
+	else {
+	    s = realloc(c->sub, (c->n_subs + 1) * sizeof(brk_sub_t));
+	    if ( !s ) {
+		free(filter);
+		return -1;
+	    }
+	    c->sub = s;
+	    ++c->n_subs;
+	}
+	c->sub[k].filter = filter;
+	c->sub[k].qos = qos;
+	sub[n] = k;
+	rc[ n++ ] = qos;
+    }
+    if ( !n || brk_put_header(c, (BRK_SUBACK << 4), 2 + n)
+	 || brk_put(c, id, 2) || brk_put(c, rc, n) )
+	return -1;
+
+    /* Retained messages for the filters subscribed to, new or again. */
+    for ( i = 0; i < n; ++i ) {
+	brk_retain_t* r;
+	k = sub[i];
+	for ( r = b->retain; r; r = r->next ) {
+	    if ( !mql_topic_match(c->sub[k].filter, r->topic) )
+		continue;
+	    if ( brk_put_publish(c, r->topic, r->payload, r->len,
+				 r->qos < c->sub[k].qos ? r->qos : c->sub[k].qos,
+				 1) )
+		return -1;
+	    brk_count(b, &b->st.delivered, 1);
+	}
+    }
+    return 0;
+}
+
+
+static int
+brk_unsubscribe(brk_client_t* c, const unsigned char* p,
+		const unsigned char* end)
+{
+    const unsigned char* id = p;
+    unsigned k;
+
+    if ( end - p < 2 )
+	return -1;
+    p += 2;
+    while ( p < end ) {
+	const char* f;
+	size_t flen;
+	if ( brk_get_str(&p, end, &f, &flen) )
+	    return -1;
+	for ( k = 0; k < c->n_subs; ++k ) {
+	    if ( strlen(c->sub[k].filter) == flen
+		 && !memcmp(c->sub[k].filter, f, flen) ) {
+		free(c->sub[k].filter);
+		c->sub[k] = c->sub[ --c->n_subs ];
+		break;
+	    }
+	}
+    }
+    return brk_put_ack(c, BRK_UNSUBACK, id);
+}
+
+
+// Handle one packet.  Returns -1 to close the connection.
+static int
+brk_packet(mql_broker_t* b, brk_client_t* c, unsigned char h,
+	   const unsigned char* p, size_t n)
+{
+    const unsigned char* end = p + n;
+    unsigned char connack[2] = { 0, 0 };
+
+    if ( !c->connected && (h >> 4) != BRK_CONNECT )
+	return -1;
+
+    switch ( h >> 4 ) {
+    case BRK_CONNECT:
+	if ( c->connected || n < 10 )
+	    return -1;
+	c->connected = 1;
+	return brk_put_header(c, BRK_CONNACK << 4, 2)
+	    || brk_put(c, connack, 2);
+    case BRK_PUBLISH:
+	return brk_publish(b, c, h & 0x0f, p, end);
+    case BRK_PUBACK:
+	return 0;			/* Nothing is resent anyway */
+    case BRK_PUBREL:
+	if ( n != 2 || (h & 0x0f) != 2 )
+	    return -1;
+	if ( c->rel ) {
+	    unsigned id = p[0] << 8 | p[1];
+	    c->rel[id / 8] &= ~(1 << id % 8);
+	}
+	return brk_put_ack(c, BRK_PUBCOMP, p);
+    case BRK_SUBSCRIBE:
+	return brk_subscribe(b, c, p, end);
+    case BRK_UNSUBSCRIBE:
+	return brk_unsubscribe(c, p, end);
+    case BRK_PINGREQ:
+	return brk_put_header(c, BRK_PINGRESP << 4, 0);
+    case BRK_DISCONNECT:
+    default:
+	return -1;
+    }
+}
+
+
+// Read what there is and handle all whole packets.
+static int
+brk_read(mql_broker_t* b, brk_client_t* c)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    if ( c->in_cap - c->in_len < 4096 ) {
+	size_t cap = c->in_cap ? 2 * c->in_cap : 16384;
+	char* in;
+	if ( cap > 2 * BRK_IN_MAX )
+	    return -1;
+	in = realloc(c->in, cap);
+	if ( !in )
+	    return -1;
+	c->in = in;
+	c->in_cap = cap;
+    }
+    n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, MSG_DONTWAIT);
+    if ( n == 0 )
+	return -1;
+    if ( n < 0 )
+	return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    c->in_len += n;
+
+    for (;;) {
+	const unsigned char* p = (const unsigned char*)c->in + off;
+	size_t avail = c->in_len - off;
+	size_t rlen = 0;
+	unsigned i, shift = 0;
+
+	/* Remaining length, 1..4 bytes of 7 bits. */
+	for ( i = 1; i < avail && i <= 4; ++i ) {
+	    rlen |= (size_t)(p[i] & 0x7f) << shift;
+	    shift += 7;
+	    if ( !(p[i] & 0x80) )
+		break;
+	}
+	if ( i > 4 || rlen > BRK_IN_MAX )
+	    return -1;
+	if ( i >= avail || avail < 1 + i + rlen )
+	    break;			/* Not all here yet */
+	if ( brk_packet(b, c, p[0], p + 1 + i, rlen) )
+	    return -1;
+	off += 1 + i + rlen;
+    }
+    if ( off ) {
+	memmove( c->in, c->in + off, c->in_len - off );
+	c->in_len -= off;
+    }
+    return 0;
+}
+
+
+static void*
+brk_thread(void* arg)
+{
+    mql_broker_t* b = arg;
+
+    for (;;) {
+	unsigned i;
+
+	b->pfd[0].fd = b->wake[0];
+	b->pfd[0].events = POLLIN;
+	b->pfd[1].fd = b->lfd;
+	b->pfd[1].events = POLLIN;
+	for ( i = 0; i < b->n_clients; ++i ) {
+	    brk_client_t* c = b->client[i];
+	    b->pfd[i+2].fd = c->fd;
+	    b->pfd[i+2].events = POLLIN | (c->out_len ? POLLOUT : 0);
+	    b->pfd[i+2].revents = 0;
+	}
+	if ( poll(b->pfd, b->n_clients + 2, -1) < 0 && errno != EINTR )
+	    break;
+	if ( b->pfd[0].revents )
+	    break;
+
+	/* Backwards, brk_close() moves the last client into the hole. */
+	for ( i = b->n_clients; i > 0; --i ) {
+	    brk_client_t* c = b->client[i-1];
+	    short ev = b->pfd[i+1].revents;
+	    if ( c->fd < 0
+		 || ((ev & (POLLIN|POLLHUP|POLLERR)) && brk_read(b, c)) )
+		brk_close(b, i-1);
+	}
+	/* Write what the packets above produced. */
+	for ( i = b->n_clients; i > 0; --i ) {
+	    brk_client_t* c = b->client[i-1];
+	    if ( c->fd < 0 || (c->out_len && brk_flush(c)) )
+		brk_close(b, i-1);
+	}
+	if ( b->pfd[1].revents )
+	    brk_accept(b);
+    }
+    return 0;
+}
+
+
+mql_broker_t*
+mql_broker_start(int port)
+{
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    mql_broker_t* b;
+    int one = 1;
+
+    b = calloc(1,sizeof(mql_broker_t));
+    if ( !b )
+	return 0;
+    b->lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if ( b->lfd < 0 ) {
+	free(b);
+	return 0;
+    }
+    setsockopt(b->lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if ( bind(b->lfd, (struct sockaddr*)&addr, sizeof(addr))
+	 || listen(b->lfd, 128)
+	 || getsockname(b->lfd, (struct sockaddr*)&addr, &alen)
+	 || pipe(b->wake) ) {
+	close(b->lfd);
+	free(b);
+	return 0;
+    }
+    b->port = ntohs(addr.sin_port);
+    pthread_mutex_init( &b->mtx, 0 );
+    if ( pthread_create(&b->tid, 0, brk_thread, b) ) {
+	close(b->wake[0]);
+	close(b->wake[1]);
+	close(b->lfd);
+	free(b);
+	return 0;
+    }
+    return b;
+}
+
+
+int
+mql_broker_port(const mql_broker_t* b)
+{
+    return b->port;
+}
+
+
+void
+mql_broker_stats(mql_broker_t* b, mql_broker_stats_t* st)
+{
+    pthread_mutex_lock( &b->mtx );
+    *st = b->st;
+    pthread_mutex_unlock( &b->mtx );
+}
+
+
+void
+mql_broker_stop(mql_broker_t* b)
+{
+    brk_retain_t* r;
+    if ( write(b->wake[1], "", 1) < 0 )
+	perror("write: ");
+    pthread_join(b->tid, 0);
+    while ( b->n_clients )
+	brk_close(b, 0);
+    while ( (r = b->retain) ) {
+	b->retain = r->next;
+	free(r->topic);
+	free(r->payload);
+	free(r);
+    }
+    close(b->wake[0]);
+    close(b->wake[1]);
+    close(b->lfd);
+    pthread_mutex_destroy( &b->mtx );
+    free(b);
+}
@@ -0,0 +1,62 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_broker.h
+ * Description     : Minimal MQTT broker, test fixture
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:28:12 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:07:58 2026
+ * Update Count    : 2
+ */
+
+#ifndef __MQL_BROKER_H__
+#define __MQL_BROKER_H__ (1)
+
+/*
+ * Just enough of an MQTT 3.1/3.1.1 broker to run the mql tools against,
+ * for tests and benchmarks on a box without mosquitto or a network.
+ *
+ * QoS 0 and 1 publish and subscribe (QoS 2 is granted as 1), '+' and
+ * '#' wildcards, retained messages.  No sessions, wills, authentication
+ * or redelivery: QoS 1 messages are acknowledged and forwarded, but
+ * never resent.  A QoS 2 PUBLISH is answered with PUBREC and forwarded
+ * once as QoS 1, and PUBREL with PUBCOMP.  Listens on 127.0.0.1 only.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mql_broker mql_broker_t;
+
+// Counters, read with mql_broker_stats().
+typedef struct {
+    unsigned long	connects;
+    unsigned long	published;	/* PUBLISH received */
+    unsigned long	delivered;	/* PUBLISH sent */
+    unsigned long	retained;	/* Retained topics now */
+    unsigned long	dropped;	/* Clients cut off for not reading */
+} mql_broker_stats_t;
+
+// Start a broker on its own thread.
+//	port	TCP port on 127.0.0.1, 0 for any free port
+//	RETURNS	broker, or 0 on error (errno set)
+mql_broker_t* mql_broker_start(int port);
+
+// The port the broker listens on.
+int mql_broker_port(const mql_broker_t* b);
+
+// Copy the counters.
+void mql_broker_stats(mql_broker_t* b, mql_broker_stats_t* st);
+
+// Stop the thread, close all connections and free.
+void mql_broker_stop(mql_broker_t* b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_capture.h
+ * Description     : Mqtt Logging, capture files of raw messages
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:30:13 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:30:13 2026
+ * Update Count    : 1
+ */
+
+#ifndef __MQL_CAPTURE_H__
+#define __MQL_CAPTURE_H__ (1)
+
+/*
+ * "mql record" writes the messages it gets, topic and payload as they
+ * came, to a capture file and "mql replay" publishes them again.  The
+ * file is a mql_cap_header_t and then the records one after the other,
+ * with no padding:
+ *
+ *	mql_cap_rec_t, topic_len bytes of topic, len bytes of payload
+ *
+ * Times are CLOCK_REALTIME when received, each the time since the one
+ * before.  A gap too long for dt_ns is written as a time record, of
+ * topic_len 0 and an 8 byte payload, the time itself.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_CAP_MAGIC		"MQLCAP01"
+
+typedef struct {
+    char	magic[ 8 ];		/* MQL_CAP_MAGIC, no NUL */
+    uint64_t	start_ns;		/* Time of the first record */
+    uint64_t	reserved[ 2 ];
+} mql_cap_header_t;
+
+typedef struct {
+    uint32_t	dt_ns;			/* Since the record before */
+    uint16_t	topic_len;		/* 0 for a time record */
+    uint16_t	reserved;
+    uint32_t	len;			/* Of the payload */
+} mql_cap_rec_t;
+
+#define MQL_CAP_LEN(r)		(sizeof(mql_cap_rec_t) + (r)->topic_len + (r)->len)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
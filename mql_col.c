@@ -0,0 +1,887 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_col.c
+ * Description     : Mqtt Logging, columnar files of compacted segments
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:57:00 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:19:32 2026
+ * Update Count    : 2
+ */
+
+
+/*
+ * Compaction reads the segment twice, once for the source dictionary and
+ * to check the sequence numbers, once to write the groups.  The header
+ * and group directory are written last, over the zeros they start as,
+ * and the file is renamed in place when it is synced.  A rewrite does the
+ * same over its columnar files, the first pass deciding what is kept from
+ * the source, severity and time columns only.
+ */
+
+#include "mql.h"
+#include "mql_col.h"
+#include "mql_lz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+typedef struct {
+    const char** name;			/* In the mapped segment */
+    uint8_t*	len;
+    unsigned	n;
+    unsigned	max;
+    uint32_t*	slot;			/* Index + 1, 0 free */
+    unsigned	n_slots;		/* Power of two */
+} col_dict_t;
+
+
+static uint32_t
+col_hash(const char* p, unsigned len)
+{
+    uint32_t h = 2166136261U;		/* FNV-1a */
+    while ( len-- )
+	h = (h ^ (uint8_t)*p++) * 16777619U;
+    return h;
+}
+
+// Dictionary index of a source, added when new.
+//	RETURNS	index, -1 out of memory or too many
+static int
+col_dict_add(col_dict_t* d, const char* id, unsigned len)
+{
+    unsigned i, k;
+    uint32_t* s;
+
+    if ( 2 * d->n >= d->n_slots ) {
+	unsigned n = d->n_slots ? 2 * d->n_slots : 256;
+	s = calloc(n, sizeof(uint32_t));
+	if ( !s )
+	    return -1;
+	for ( k = 0; k < d->n; ++k ) {
+	    i = col_hash(d->name[k], d->len[k]) & (n - 1);
+	    while ( s[i] )
+		i = (i + 1) & (n - 1);
+	    s[i] = k + 1;
+	}
+	free(d->slot);
+	d->slot = s;
+	d->n_slots = n;
+    }
+    i = col_hash(id, len) & (d->n_slots - 1);
+    for ( ; d->slot[i]; i = (i + 1) & (d->n_slots - 1) ) {
+	k = d->slot[i] - 1;
+	if ( d->len[k] == len && !memcmp(d->name[k], id, len) )
+	    return k;
+    }
+    if ( d->n == MQL_COL_SOURCES )
+	return -1;
+    if ( d->n == d->max ) {
+	unsigned n = d->max ? 2 * d->max : 64;
+	const char** name = realloc(d->name, n * sizeof(char*));
+	uint8_t* l = name ? realloc(d->len, n) : 0;
+	if ( name )
+	    d->name = name;
+	if ( !l )
+	    return -1;
+	d->len = l;
+	d->max = n;
+    }
+    d->name[ d->n ] = id;
+    d->len[ d->n ] = len;
+    d->slot[i] = d->n + 1;
+    return d->n++;
+}
+
+static void
+col_dict_free(col_dict_t* d)
+{
+    free(d->name);
+    free(d->len);
+    free(d->slot);
+}
+
+static uint8_t*
+col_varint(uint8_t* p, uint64_t v)
+{
+    while ( v >= 0x80 ) {
+	*p++ = v | 0x80;
+	v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+// Decode a varint of [*p, e).
+//	RETURNS	0 OK, -1 past e or too long
+static int
+col_get_varint(const uint8_t** p, const uint8_t* e, uint64_t* v)
+{
+    unsigned shift = 0;
+
+    *v = 0;
+    while ( *p < e && shift < 64 ) {
+	uint8_t b = *(*p)++;
+	*v |= (uint64_t)(b & 0x7f) << shift;
+	if ( !(b & 0x80) )
+	    return 0;
+	shift += 7;
+    }
+    return -1;
+}
+
+
+/*
+ * Reading
+ */
+
+int
+mql_col_open(mql_col_t* col, const char* path)
+{
+    const mql_col_header_t* h;
+    const uint8_t* d;
+    const uint8_t* de;
+    struct stat sb;
+    size_t need;
+    unsigned i;
+    void* p;
+
+    memset( col, 0, sizeof(mql_col_t) );
+    col->fd = open(path, O_RDONLY);
+    if ( col->fd < 0 )
+	return -1;
+    if ( fstat(col->fd, &sb) )
+	goto fail;
+    if ( sb.st_size < (off_t)sizeof(mql_col_header_t) ) {
+	errno = EINVAL;
+	goto fail;
+    }
+    p = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, col->fd, 0);
+    if ( p == MAP_FAILED )
+	goto fail;
+    col->base = p;
+    col->size = sb.st_size;
+    col->hdr = h = p;
+    need = sizeof(mql_col_header_t) + (size_t)h->dict_len
+	+ (size_t)h->n_groups * sizeof(mql_col_group_t);
+    if ( memcmp(h->magic, MQL_COL_MAGIC, sizeof(h->magic))
+	 || h->n_sources > MQL_COL_SOURCES
+	 || (h->src_width != 1 && h->src_width != 2)
+	 || need > col->size )
+	goto bad;
+
+    col->src = calloc(h->n_sources + 1, sizeof(char*));
+    col->src_len = calloc(h->n_sources + 1, 1);
+    if ( !col->src || !col->src_len ) {
+	mql_col_close(col);
+	errno = ENOMEM;
+	return -1;
+    }
+    d = (const uint8_t*)col->base + sizeof(mql_col_header_t);
+    de = d + h->dict_len;
+    for ( i = 0; i < h->n_sources; ++i ) {
+	if ( d == de || *d >= de - d )
+	    goto bad;
+	col->src_len[i] = *d;
+	col->src[i] = (const char*)d + 1;
+	d += 1 + *d;
+    }
+    col->groups = (const mql_col_group_t*)de;
+    return 0;
+
+ bad:
+    mql_col_close(col);
+    errno = EINVAL;
+    return -1;
+
+ fail:
+    close(col->fd);
+    col->fd = -1;
+    return -1;
+}
+
+void
+mql_col_close(mql_col_t* col)
+{
+    if ( col->base )
+	munmap( (void*)col->base, col->size );
+    if ( col->fd >= 0 )
+	close( col->fd );
+    free(col->src);
+    free(col->src_len);
+    col->src = 0;
+    col->src_len = 0;
+    col->base = 0;
+    col->fd = -1;
+}
+
+int
+mql_col_source(const mql_col_t* col, const char* id, unsigned len)
+{
+    unsigned i;
+
+    for ( i = 0; i < col->hdr->n_sources; ++i )
+	if ( col->src_len[i] == len && !memcmp(col->src[i], id, len) )
+	    return i;
+    return -1;
+}
+
+int
+mql_col_get(const mql_col_t* col, unsigned g, unsigned what,
+	    mql_col_rows_t* rows)
+{
+    const mql_col_group_t* k = &col->groups[g];
+    unsigned w = col->hdr->src_width;
+    const uint8_t* p = (const uint8_t*)col->base + k->off;
+    const uint8_t* sev = p + (size_t)k->n_records * w;
+    const uint8_t* ts = sev + (k->n_records + 1) / 2;
+    const uint8_t* text = ts + k->ts_len;
+    unsigned i, n = k->n_records;
+    uint64_t t, d;
+
+    if ( n > MQL_COL_GROUP || k->off > col->size
+	 || col->size - k->off < (size_t)(text - p) + k->text_len
+	 + ((k->flags & MQL_COL_GAPS) ? k->seq_len : 0) )
+	goto bad;
+    rows->n = n;
+
+    if ( what & MQL_COL_SRC ) {
+	if ( w == 1 ) {
+	    for ( i = 0; i < n; ++i )
+		rows->src[i] = p[i];
+	}
+	else {
+	    memcpy( rows->src, p, n * sizeof(uint16_t) );
+	}
+	for ( i = 0; i < n; ++i )
+	    if ( rows->src[i] >= col->hdr->n_sources )
+		goto bad;
+    }
+
+    if ( what & MQL_COL_SEV )
+	for ( i = 0; i < n; ++i )
+	    rows->sev[i] = sev[ i / 2 ] >> (i % 2 * 4) & 15;
+
+    if ( what & MQL_COL_TS ) {
+	t = k->first_ts;
+	for ( i = 0; i < n; ++i ) {
+	    if ( col_get_varint(&ts, text, &d) )
+		goto bad;
+	    t += (d >> 1) ^ -(d & 1);	/* Zigzag */
+	    rows->ts[i] = t;
+	}
+    }
+
+    if ( what & MQL_COL_TEXT ) {
+	if ( rows->text_cap < k->text_raw ) {
+	    char* b = realloc(rows->text, k->text_raw);
+	    if ( !b )
+		return -1;
+	    rows->text = b;
+	    rows->text_cap = k->text_raw;
+	}
+	if ( mql_lz_decompress(text, k->text_len, rows->text, k->text_raw)
+	     != (long)k->text_raw )
+	    goto bad;
+	rows->text_len = k->text_raw;
+    }
+
+    if ( what & MQL_COL_SEQ ) {
+	const uint8_t* q = text + k->text_len;
+	t = k->first_seq;
+	for ( i = 0; i < n; ++i ) {
+	    if ( k->flags & MQL_COL_GAPS ) {
+		if ( col_get_varint(&q, text + k->text_len + k->seq_len, &d) )
+		    goto bad;
+		t += d;
+	    }
+	    rows->seq[i] = t++;
+	}
+    }
+    return 0;
+
+ bad:
+    errno = EINVAL;
+    return -1;
+}
+
+int
+mql_col_text(const mql_col_rows_t* rows, size_t* pos,
+	     const char** text, unsigned* len)
+{
+    const uint8_t* p = (const uint8_t*)rows->text + *pos;
+    const uint8_t* e = (const uint8_t*)rows->text + rows->text_len;
+    uint64_t n;
+
+    if ( p == e )
+	return 0;
+    if ( col_get_varint(&p, e, &n) || n > (uint64_t)(e - p) )
+	return -1;
+    *text = (const char*)p;
+    *len = n;
+    *pos = (const char*)p + n - rows->text;
+    return 1;
+}
+
+int
+mql_col_list(const char* dir, char*** names)
+{
+    return mql_store_list(dir, MQL_COL_SUFFIX, names);
+}
+
+
+/*
+ * Compaction
+ */
+
+typedef struct {
+    uint64_t	rate;			/* Bytes per second, 0 no limit */
+    uint64_t	start_ns;
+    uint64_t	bytes;			/* Since start_ns */
+    uint64_t	checked;		/* At the last look at the clock */
+} col_rate_t;
+
+static uint64_t
+col_now(void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+col_rate_init(col_rate_t* r, const mql_col_opt_t* opt)
+{
+    memset( r, 0, sizeof(col_rate_t) );
+    r->rate = opt ? opt->rate : 0;
+    r->start_ns = col_now();
+}
+
+// Account n bytes of I/O, and sleep while ahead of the rate.
+static void
+col_rate(col_rate_t* r, uint64_t n)
+{
+    uint64_t due, now;
+    struct timespec ts;
+
+    r->bytes += n;
+    if ( !r->rate || r->bytes - r->checked < 65536 )
+	return;
+    r->checked = r->bytes;
+    due = r->start_ns + (uint64_t)((double)r->bytes * 1e9 / r->rate);
+    now = col_now();
+    if ( due > now ) {
+	ts.tv_sec = (due - now) / 1000000000;
+	ts.tv_nsec = (due - now) % 1000000000;
+	nanosleep( &ts, 0 );
+    }
+}
+
+// Write the group of the rows, text as in mql_col_rows_t.
+//	RETURNS	0 OK, -1 on error
+static int
+col_put(FILE* f, const mql_col_rows_t* rows, unsigned w, int pack,
+	mql_col_group_t* k, uint8_t* buf, uint8_t** z, size_t* z_max)
+{
+    unsigned i, n = rows->n;
+    uint8_t* sev = buf + (size_t)n * w;
+    uint8_t* ts = sev + (n + 1) / 2;
+    uint8_t* tp = ts;
+    uint8_t* sq;
+    uint8_t* sp;
+    uint64_t prev;
+    int64_t d;
+
+    memset( k, 0, sizeof(mql_col_group_t) );
+    memset( sev, 0, (n + 1) / 2 );
+    k->n_records = n;
+    k->first_seq = rows->seq[0];
+    k->first_ts = prev = rows->ts[0];
+    k->min_ts = ~0ULL;
+    for ( i = 0; i < n; ++i ) {
+	if ( w == 1 )
+	    buf[i] = rows->src[i];
+	else
+	    memcpy( buf + 2 * i, &rows->src[i], 2 );
+	sev[ i / 2 ] |= (rows->sev[i] & 15) << (i % 2 * 4);
+	k->sev_mask |= 1 << (rows->sev[i] & 15);
+	d = rows->ts[i] - prev;
+	tp = col_varint(tp, (uint64_t)d << 1 ^ (uint64_t)(d >> 63));
+	prev = rows->ts[i];
+	if ( rows->ts[i] < k->min_ts )
+	    k->min_ts = rows->ts[i];
+	if ( rows->ts[i] > k->max_ts )
+	    k->max_ts = rows->ts[i];
+	if ( rows->seq[i] != k->first_seq + i )
+	    k->flags |= MQL_COL_GAPS;
+    }
+    if ( rows->text_len > UINT32_MAX ) {
+	errno = EINVAL;
+	return -1;
+    }
+    if ( MQL_LZ_BOUND(rows->text_len) + 10 * n > *z_max ) {
+	size_t m = MQL_LZ_BOUND(rows->text_len) + 10 * n;
+	uint8_t* t = realloc(*z, m);
+	if ( !t )
+	    return -1;
+	*z = t;
+	*z_max = m;
+    }
+    k->ts_len = tp - ts;
+    k->text_raw = rows->text_len;
+    k->text_len = pack ? mql_lz_compress_hc(rows->text, rows->text_len, *z)
+	: mql_lz_compress(rows->text, rows->text_len, *z);
+    sq = sp = *z + k->text_len;
+    if ( k->flags & MQL_COL_GAPS ) {
+	for ( prev = k->first_seq, i = 0; i < n; prev = rows->seq[i++] + 1 )
+	    sp = col_varint(sp, rows->seq[i] - prev);
+	k->seq_len = sp - sq;
+    }
+    if ( fwrite(buf, tp - buf, 1, f) != 1
+	 || (sp > *z && fwrite(*z, sp - *z, 1, f) != 1) )
+	return -1;
+    return 0;
+}
+
+// Append a text to the text of rows.
+//	RETURNS	0 OK, -1 out of memory
+static int
+col_add_text(mql_col_rows_t* rows, const char* text, unsigned len)
+{
+    if ( rows->text_len + 10 + len > rows->text_cap ) {
+	size_t m = 2 * (rows->text_len + 10 + len);
+	char* t = realloc(rows->text, m);
+	if ( !t )
+	    return -1;
+	rows->text = t;
+	rows->text_cap = m;
+    }
+    rows->text_len = (char*)col_varint((uint8_t*)rows->text + rows->text_len,
+				       len) - rows->text;
+    memcpy( rows->text + rows->text_len, text, len );
+    rows->text_len += len;
+    return 0;
+}
+
+// Read the n records from *pos into rows, advanced past them.
+//	RETURNS	0 OK, -1 on error
+static int
+col_group(const mql_seg_t* seg, size_t* pos, col_dict_t* dict, unsigned n,
+	  mql_col_rows_t* rows)
+{
+    const mql_rec_t* r;
+    unsigned i;
+
+    rows->text_len = 0;
+    for ( i = 0; i < n && mql_seg_next(seg, pos, &r) > 0; ++i ) {
+	rows->src[i] = col_dict_add(dict, MQL_REC_ID(r), r->id_len);
+	rows->sev[i] = r->sev & 15;
+	rows->ts[i] = r->ts_ns;
+	rows->seq[i] = r->seq;
+	if ( col_add_text(rows, MQL_REC_TEXT(r), r->text_len) )
+	    return -1;
+    }
+    rows->n = i;
+    if ( i < n ) {
+	errno = EINVAL;			/* Changed under us */
+	return -1;
+    }
+    return 0;
+}
+
+// Write the header, dictionary and group directory of f at tmp, sync it
+// and rename it to path.
+//	RETURNS	0 OK, -1 on error, f closed either way
+static int
+col_finish(FILE* f, const mql_col_header_t* h, const col_dict_t* dict,
+	   const mql_col_group_t* grp, const char* tmp, const char* path)
+{
+    char dir[ 4096 ];
+    size_t n;
+    unsigned i;
+    int dfd, err;
+
+    rewind(f);
+    fwrite(h, sizeof(*h), 1, f);
+    for ( i = 0; i < dict->n; ++i ) {
+	fputc(dict->len[i], f);
+	fwrite(dict->name[i], dict->len[i], 1, f);
+    }
+    if ( fwrite(grp, sizeof(*grp), h->n_groups, f) != h->n_groups
+	 || fflush(f) || fdatasync(fileno(f)) ) {
+	err = errno;
+	fclose(f);
+	errno = err;
+	return -1;
+    }
+    if ( fclose(f) || rename(tmp, path) )
+	return -1;
+
+    /* The new name. */
+    n = strrchr(path, '/') ? strrchr(path, '/') - path : 0;
+    if ( n && n < sizeof(dir) ) {
+	memcpy( dir, path, n );
+	dir[n] = 0;
+	dfd = open(dir, O_RDONLY | O_DIRECTORY);
+    }
+    else {
+	dfd = open(".", O_RDONLY | O_DIRECTORY);
+    }
+    if ( dfd >= 0 ) {
+	fsync(dfd);
+	close(dfd);
+    }
+    return 0;
+}
+
+int
+mql_col_compact(const char* seg_path, const mql_col_opt_t* opt)
+{
+    mql_col_header_t h;
+    mql_col_group_t* grp = 0;
+    mql_col_rows_t* rows = 0;
+    col_dict_t dict;
+    col_rate_t rate;
+    mql_seg_t seg;
+    const mql_rec_t* r;
+    char path[ 4096 ], tmp[ 4096 + 4 ];
+    size_t pos = 0, n = strlen(seg_path);
+    uint8_t* z = 0;
+    uint8_t* buf = 0;
+    size_t z_max = 0, last;
+    uint64_t off;
+    unsigned g, i;
+    FILE* f = 0;
+    int err, k;
+
+    if ( n < sizeof(MQL_SEG_SUFFIX) - 1 || n + 8 > sizeof(path) ) {
+	errno = EINVAL;
+	return -1;
+    }
+    memcpy( path, seg_path, n - (sizeof(MQL_SEG_SUFFIX) - 1) );
+    strcpy( path + n - (sizeof(MQL_SEG_SUFFIX) - 1), MQL_COL_SUFFIX );
+    snprintf( tmp, sizeof(tmp), "%s.tmp", path );
+    if ( mql_seg_open(&seg, seg_path) )
+	return -1;
+    col_rate_init(&rate, opt);
+    memset( &dict, 0, sizeof(dict) );
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, MQL_COL_MAGIC, sizeof(h.magic) );
+    h.first_seq = seg.hdr->first_seq;
+    h.created_ns = seg.hdr->created_ns;
+    h.min_ts = ~0ULL;
+    h.flags = opt && opt->pack ? MQL_COL_PACKED : 0;
+
+    /* Sources, time range and gaps. */
+    last = 0;
+    while ( (k = mql_seg_next(&seg, &pos, &r)) > 0 ) {
+	if ( r->seq != h.first_seq + h.n_records
+	     || col_dict_add(&dict, MQL_REC_ID(r), r->id_len) < 0 ) {
+	    k = -1;
+	    break;
+	}
+	if ( r->ts_ns < h.min_ts )
+	    h.min_ts = r->ts_ns;
+	if ( r->ts_ns > h.max_ts )
+	    h.max_ts = r->ts_ns;
+	++h.n_records;
+	col_rate(&rate, pos - last);
+	last = pos;
+    }
+    if ( k < 0 ) {
+	if ( errno != ENOMEM )
+	    errno = EINVAL;
+	goto fail;
+    }
+    if ( !h.n_records )
+	h.min_ts = 0;
+    h.n_sources = dict.n;
+    h.src_width = dict.n <= 256 ? 1 : 2;
+    h.n_groups = (h.n_records + MQL_COL_GROUP - 1) / MQL_COL_GROUP;
+    for ( i = 0; i < dict.n; ++i )
+	h.dict_len += 1 + dict.len[i];
+
+    grp = calloc(h.n_groups + 1, sizeof(mql_col_group_t));
+    rows = calloc(1, sizeof(mql_col_rows_t));
+    buf = malloc(MQL_COL_GROUP * (2 + 1 + 10));
+    f = fopen(tmp, "w");
+    if ( !grp || !rows || !buf || !f )
+	goto fail;
+
+    /* Room for the header and directory, then the groups. */
+    off = sizeof(h) + h.dict_len + (uint64_t)h.n_groups * sizeof(*grp);
+    if ( fseek(f, off, SEEK_SET) )
+	goto fail;
+    pos = last = 0;
+    for ( g = 0; g < h.n_groups; ++g ) {
+	unsigned m = h.n_records - (uint64_t)g * MQL_COL_GROUP;
+	if ( m > MQL_COL_GROUP )
+	    m = MQL_COL_GROUP;
+	if ( opt && opt->stop && *opt->stop ) {
+	    errno = ECANCELED;
+	    goto fail;
+	}
+	if ( col_group(&seg, &pos, &dict, m, rows)
+	     || col_put(f, rows, h.src_width, h.flags & MQL_COL_PACKED, &grp[g],
+			buf, &z, &z_max) )
+	    goto fail;
+	grp[g].off = off;
+	col_rate(&rate, pos - last + (ftell(f) - off));
+	last = pos;
+	off = ftell(f);
+    }
+    err = col_finish(f, &h, &dict, grp, tmp, path);
+    f = 0;
+    if ( err )
+	goto fail;
+
+    mql_seg_close(&seg);
+    col_dict_free(&dict);
+    free(grp);
+    free(buf);
+    if ( rows )
+	free(rows->text);
+    free(rows);
+    free(z);
+    return 0;
+
+ fail:
+    err = errno;
+    if ( f )
+	fclose(f);
+    unlink(tmp);
+    mql_seg_close(&seg);
+    col_dict_free(&dict);
+    free(grp);
+    free(buf);
+    if ( rows )
+	free(rows->text);
+    free(rows);
+    free(z);
+    errno = err;
+    return -1;
+}
+
+// Bytes of the columns of a group but the text.
+static uint64_t
+col_group_size(const mql_col_t* col, const mql_col_group_t* k)
+{
+    return (uint64_t)k->n_records * col->hdr->src_width
+	+ (k->n_records + 1) / 2 + k->ts_len;
+}
+
+int
+mql_col_rewrite(char* const* paths, unsigned n, const mql_col_opt_t* opt,
+		uint64_t* kept, uint64_t* dropped)
+{
+    mql_col_header_t h;
+    mql_col_t* in;
+    mql_col_group_t* grp = 0;
+    mql_col_rows_t* rows = 0;
+    mql_col_rows_t* out = 0;
+    col_dict_t dict;
+    col_rate_t rate;
+    char tmp[ 4096 + 4 ];
+    uint8_t* keep = 0;
+    uint8_t* buf = 0;
+    uint8_t* z = 0;
+    int* map = 0;
+    size_t z_max = 0, pos, j;
+    uint64_t total = 0, off;
+    unsigned i, g, r, m;
+    const char* text;
+    unsigned len;
+    FILE* f = 0;
+    int err, s, ret = -1;
+
+    *kept = *dropped = 0;
+    in = calloc(n + 1, sizeof(mql_col_t));
+    if ( !in )
+	return -1;
+    for ( i = 0; i < n; ++i )
+	in[i].fd = -1;
+    memset( &dict, 0, sizeof(dict) );
+    col_rate_init(&rate, opt);
+    snprintf( tmp, sizeof(tmp), "%s.tmp", paths[0] );
+    for ( i = 0; i < n; ++i ) {
+	if ( mql_col_open(&in[i], paths[i]) )
+	    goto fail;
+	total += in[i].hdr->n_records;
+    }
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, MQL_COL_MAGIC, sizeof(h.magic) );
+    h.first_seq = in[0].hdr->first_seq;
+    h.end_seq = MQL_COL_END(in[n-1].hdr);
+    h.created_ns = in[0].hdr->created_ns;
+    h.min_ts = ~0ULL;
+    h.flags = opt && opt->pack ? MQL_COL_PACKED : 0;
+
+    /* What is kept, and its sources, from the small columns. */
+    keep = malloc(total + 1);
+    rows = calloc(1, sizeof(mql_col_rows_t));
+    if ( !keep || !rows )
+	goto fail;
+    for ( j = 0, i = 0; i < n; ++i ) {
+	const mql_col_t* c = &in[i];
+	for ( g = 0; g < c->hdr->n_groups; ++g ) {
+	    if ( mql_col_get(c, g, MQL_COL_SRC | MQL_COL_SEV | MQL_COL_TS, rows) )
+		goto fail;
+	    if ( j + rows->n > total ) {
+		errno = EINVAL;
+		goto fail;
+	    }
+	    for ( r = 0; r < rows->n; ++r, ++j ) {
+		const char* id = c->src[ rows->src[r] ];
+		unsigned id_len = c->src_len[ rows->src[r] ];
+		keep[j] = !opt || !opt->keep
+		    || opt->keep(opt->arg, id, id_len, rows->sev[r], rows->ts[r]);
+		if ( !keep[j] )
+		    continue;
+		if ( col_dict_add(&dict, id, id_len) < 0 ) {
+		    if ( errno != ENOMEM )
+			errno = EINVAL;
+		    goto fail;
+		}
+		if ( rows->ts[r] < h.min_ts )
+		    h.min_ts = rows->ts[r];
+		if ( rows->ts[r] > h.max_ts )
+		    h.max_ts = rows->ts[r];
+		++h.n_records;
+	    }
+	    col_rate(&rate, col_group_size(c, &c->groups[g]));
+	}
+    }
+    if ( j != total ) {
+	errno = EINVAL;
+	goto fail;
+    }
+    *kept = h.n_records;
+    *dropped = total - h.n_records;
+    if ( n == 1 && !*dropped
+	 && (in[0].hdr->flags & MQL_COL_PACKED) == h.flags ) {
+	ret = 1;
+	goto done;
+    }
+    if ( !h.n_records ) {
+	ret = 0;
+	goto done;
+    }
+
+    h.n_sources = dict.n;
+    h.src_width = dict.n <= 256 ? 1 : 2;
+    h.n_groups = (h.n_records + MQL_COL_GROUP - 1) / MQL_COL_GROUP;
+    for ( i = 0; i < dict.n; ++i )
+	h.dict_len += 1 + dict.len[i];
+    grp = calloc(h.n_groups + 1, sizeof(mql_col_group_t));
+    out = calloc(1, sizeof(mql_col_rows_t));
+    buf = malloc(MQL_COL_GROUP * (2 + 1 + 10));
+    f = fopen(tmp, "w");
+    if ( !grp || !out || !buf || !f )
+	goto fail;
+    off = sizeof(h) + h.dict_len + (uint64_t)h.n_groups * sizeof(*grp);
+    if ( fseek(f, off, SEEK_SET) )
+	goto fail;
+
+    /* The kept records, into full groups. */
+    for ( j = 0, m = 0, i = 0; i < n; ++i ) {
+	const mql_col_t* c = &in[i];
+	free(map);
+	map = malloc((c->hdr->n_sources + 1) * sizeof(int));
+	if ( !map )
+	    goto fail;
+	for ( s = 0; s < (int)c->hdr->n_sources; ++s )
+	    map[s] = -1;
+	for ( g = 0; g < c->hdr->n_groups; ++g ) {
+	    if ( opt && opt->stop && *opt->stop ) {
+		errno = ECANCELED;
+		goto fail;
+	    }
+	    if ( mql_col_get(c, g, MQL_COL_SRC | MQL_COL_SEV | MQL_COL_TS
+			     | MQL_COL_TEXT | MQL_COL_SEQ, rows) )
+		goto fail;
+	    col_rate(&rate, col_group_size(c, &c->groups[g])
+		     + c->groups[g].text_len);
+	    for ( pos = 0, r = 0; r < rows->n; ++r, ++j ) {
+		if ( mql_col_text(rows, &pos, &text, &len) <= 0 ) {
+		    errno = EINVAL;
+		    goto fail;
+		}
+		if ( !keep[j] )
+		    continue;
+		s = rows->src[r];
+		if ( map[s] < 0 )
+		    map[s] = col_dict_add(&dict, c->src[s], c->src_len[s]);
+		out->src[ out->n ] = map[s];
+		out->sev[ out->n ] = rows->sev[r];
+		out->ts[ out->n ] = rows->ts[r];
+		out->seq[ out->n ] = rows->seq[r];
+		if ( col_add_text(out, text, len) )
+		    goto fail;
+		if ( ++out->n < MQL_COL_GROUP )
+		    continue;
+		if ( col_put(f, out, h.src_width, h.flags & MQL_COL_PACKED,
+			     &grp[m], buf, &z, &z_max) )
+		    goto fail;
+		grp[m++].off = off;
+		col_rate(&rate, ftell(f) - off);
+		off = ftell(f);
+		out->n = 0;
+		out->text_len = 0;
+	    }
+	}
+    }
+    if ( out->n ) {
+	if ( col_put(f, out, h.src_width, h.flags & MQL_COL_PACKED, &grp[m],
+		     buf, &z, &z_max) )
+	    goto fail;
+	grp[m++].off = off;
+    }
+    if ( m != h.n_groups ) {
+	errno = EINVAL;
+	goto fail;
+    }
+    err = col_finish(f, &h, &dict, grp, tmp, paths[0]);
+    f = 0;
+    if ( err )
+	goto fail;
+    ret = 0;
+    goto done;
+
+ fail:
+    err = errno;
+    if ( f )
+	fclose(f);
+    unlink(tmp);
+    errno = err;
+ done:
+    err = errno;
+    for ( i = 0; i < n; ++i )
+	if ( in[i].fd >= 0 || in[i].base )
+	    mql_col_close(&in[i]);
+    col_dict_free(&dict);
+    free(in);
+    free(keep);
+    free(map);
+    free(grp);
+    free(buf);
+    free(z);
+    if ( rows )
+	free(rows->text);
+    free(rows);
+    if ( out )
+	free(out->text);
+    free(out);
+    errno = err;
+    return ret;
+}
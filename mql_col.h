@@ -0,0 +1,179 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_col.h
+ * Description     : Mqtt Logging, columnar files of compacted segments
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:57:00 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:19:32 2026
+ * Update Count    : 2
+ */
+
+#ifndef __MQL_COL_H__
+#define __MQL_COL_H__ (1)
+
+/*
+ * An old segment can be compacted into "<seq>.col", the same records in
+ * columns, so that counting reads a few bytes per record and not the
+ * text:
+ *
+ *	mql_col_header_t
+ *	n_sources sources, a length byte and the name each
+ *	n_groups mql_col_group_t
+ *	the groups, of up to MQL_COL_GROUP records:
+ *	  source	dictionary index, src_width bytes each
+ *	  severity	a nibble each, the first in the low nibble
+ *	  time		ns since the previous record, zigzag varints
+ *	  text		varint length and text of each, mql_lz.h compressed
+ *	  [sequence]	seq - previous seq - 1, varints, MQL_COL_GAPS only
+ *
+ * Sequence numbers are first_seq of the group and up unless the group has
+ * gaps, compaction refuses a segment with gaps.  Records come back exactly
+ * as they were written.  Host byte order, as segments.
+ *
+ * Columnar files can be rewritten, several consecutive ones into one of
+ * the first name, with records dropped and the text compressed harder
+ * (mql_col_rewrite()).  The file covers first_seq to end_seq whatever was
+ * dropped.
+ */
+
+#include "mql_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_COL_MAGIC		"MQLCOL01"
+#define MQL_COL_SUFFIX		".col"
+#define MQL_COL_GROUP		(4096)	/* Records per group */
+#define MQL_COL_SOURCES		(65535)
+
+typedef struct {
+    char	magic[ 8 ];		/* MQL_COL_MAGIC, no NUL */
+    uint64_t	first_seq;
+    uint64_t	created_ns;		/* Of the segment */
+    uint64_t	min_ts;
+    uint64_t	max_ts;
+    uint64_t	n_records;
+    uint32_t	n_groups;
+    uint32_t	n_sources;
+    uint32_t	dict_len;		/* Bytes of sources */
+    uint32_t	src_width;		/* 1 or 2 */
+    uint64_t	end_seq;		/* 0 for first_seq + n_records */
+    uint32_t	flags;			/* MQL_COL_PACKED */
+    uint32_t	reserved;
+} mql_col_header_t;
+
+#define MQL_COL_PACKED	(1)		/* Text by mql_lz_compress_hc() */
+
+// Sequence number after the last record the file covers.
+#define MQL_COL_END(h) \
+    ((h)->end_seq ? (h)->end_seq : (h)->first_seq + (h)->n_records)
+
+typedef struct {
+    uint64_t	off;			/* Of the source column */
+    uint64_t	first_seq;
+    uint64_t	first_ts;
+    uint64_t	min_ts;
+    uint64_t	max_ts;
+    uint32_t	n_records;
+    uint16_t	sev_mask;		/* Bit per severity */
+    uint16_t	flags;			/* MQL_COL_GAPS */
+    uint32_t	ts_len;			/* Bytes of the time column */
+    uint32_t	text_len;		/* Compressed */
+    uint32_t	text_raw;		/* Decompressed */
+    uint32_t	seq_len;		/* Bytes of the sequence column */
+} mql_col_group_t;
+
+#define MQL_COL_GAPS	(1)		/* Has a sequence column */
+
+typedef struct {
+    int		fd;
+    const char*	base;			/* Mapped file */
+    size_t	size;
+    const mql_col_header_t* hdr;
+    const mql_col_group_t* groups;
+    const char** src;			/* Names, n_sources */
+    uint8_t*	src_len;
+} mql_col_t;
+
+// Columns of a group, decoded by mql_col_get().
+typedef struct {
+    unsigned	n;
+    uint16_t	src[ MQL_COL_GROUP ];
+    uint8_t	sev[ MQL_COL_GROUP ];
+    uint64_t	ts[ MQL_COL_GROUP ];
+    uint64_t	seq[ MQL_COL_GROUP ];
+    char*	text;			/* Length varints and texts */
+    size_t	text_len;
+    size_t	text_cap;
+} mql_col_rows_t;
+
+#define MQL_COL_SRC	(1)
+#define MQL_COL_SEV	(2)
+#define MQL_COL_TS	(4)
+#define MQL_COL_TEXT	(8)
+#define MQL_COL_SEQ	(16)
+
+// Whether a rewrite keeps a record.  Asked once per record.
+typedef int (*mql_col_keep_t)(void* arg, const char* id, unsigned id_len,
+			      unsigned sev, uint64_t ts_ns);
+
+// How to compact or rewrite, all 0 for the defaults.
+typedef struct {
+    int		pack;			/* mql_lz_compress_hc(), MQL_COL_PACKED */
+    uint64_t	rate;			/* Bytes read and written per second */
+    mql_col_keep_t keep;		/* 0 keeps all */
+    void*	arg;
+    volatile int* stop;			/* Give up when set, ECANCELED */
+} mql_col_opt_t;
+
+// Map a columnar file read-only.
+//	RETURNS	0 OK, -1 on error (errno set, EINVAL for no columnar file)
+int mql_col_open(mql_col_t* col, const char* path);
+
+void mql_col_close(mql_col_t* col);
+
+// Dictionary index of a source.
+//	RETURNS	index, -1 not in this file
+int mql_col_source(const mql_col_t* col, const char* id, unsigned len);
+
+// Decode the columns of group g in what, MQL_COL_..., into rows.
+// Free rows->text when done with rows.
+//	RETURNS	0 OK, -1 damaged group (errno set)
+int mql_col_get(const mql_col_t* col, unsigned g, unsigned what,
+		mql_col_rows_t* rows);
+
+// Next text of the text column, start with *pos = 0.
+//	RETURNS	1 text in *text/*len, 0 no more, -1 damaged
+int mql_col_text(const mql_col_rows_t* rows, size_t* pos,
+		 const char** text, unsigned* len);
+
+// Write the columnar file of a closed segment, next to it, opt 0 for the
+// defaults.  The segment is left for the caller to remove.
+//	RETURNS	0 OK, -1 on error (errno set, EINVAL for gaps or too many
+//		sources)
+int mql_col_compact(const char* seg_path, const mql_col_opt_t* opt);
+
+// Rewrite the n consecutive columnar files of paths into paths[0], with
+// the records opt->keep keeps.  The others are left for the caller to
+// remove, and paths[0] too when none are kept.  One file already packed
+// as asked and with nothing dropped is left as it is.
+//	RETURNS	0 rewritten or none kept, 1 left as it is, -1 on error
+//		(errno set, EINVAL for damaged files or too many sources);
+//		*kept and *dropped records
+int mql_col_rewrite(char* const* paths, unsigned n, const mql_col_opt_t* opt,
+		    uint64_t* kept, uint64_t* dropped);
+
+// Columnar file names in dir, sorted, free with mql_seg_list_free().
+//	RETURNS	number of names, -1 on error
+int mql_col_list(const char* dir, char*** names);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
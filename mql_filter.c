@@ -0,0 +1,145 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_filter.c
+ * Description     : Mqtt Logging, include and exclude filters on text
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:48:15 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:48:15 2026
+ * Update Count    : 2
+ */
+
+#include "mql_filter.h"
+#include "mql_match.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <regex.h>
+
+#define FILTER_RE_MAX		(16)	/* Expressions of each kind */
+
+
+struct mql_filter {
+    unsigned	flags;
+    mql_match_t* match;			/* 0 without strings */
+    uint64_t	string[2];		/* Bits of the strings, by how */
+    unsigned	n_re[2];
+    regex_t	re[2][ FILTER_RE_MAX ];
+    regex_t	bad;			/* The last that did not compile */
+};
+
+
+mql_filter_t*
+mql_filter_new(unsigned flags)
+{
+    mql_filter_t* f = calloc(1, sizeof(mql_filter_t));
+    if ( f )
+	f->flags = flags;
+    return f;
+}
+
+int
+mql_filter_string(mql_filter_t* f, unsigned how, const char* s)
+{
+    int id;
+
+    if ( !f->match ) {
+	f->match = mql_match_new((f->flags & MQL_FILTER_NOCASE)
+				 ? MQL_MATCH_NOCASE : 0);
+	if ( !f->match )
+	    return -1;
+    }
+    id = mql_match_add(f->match, s, strlen(s));
+    if ( id < 0 )
+	return -1;
+    f->string[ how & 1 ] |= 1ULL << id;
+    return 0;
+}
+
+int
+mql_filter_regex(mql_filter_t* f, unsigned how, const char* re)
+{
+    int cflags = REG_EXTENDED | REG_NOSUB;
+    int err;
+
+    how &= 1;
+    if ( f->n_re[how] == FILTER_RE_MAX )
+	return -1;
+    if ( f->flags & MQL_FILTER_NOCASE )
+	cflags |= REG_ICASE;
+    err = regcomp(&f->re[how][ f->n_re[how] ], re, cflags);
+    if ( err ) {
+	memcpy( &f->bad, &f->re[how][ f->n_re[how] ], sizeof(regex_t) );
+	return err;
+    }
+    ++f->n_re[how];
+    return 0;
+}
+
+void
+mql_filter_error(const mql_filter_t* f, int err, char* buf, size_t size)
+{
+    if ( err < 0 )
+	snprintf(buf, size, "More than %d expressions", FILTER_RE_MAX);
+    else
+	regerror(err, &f->bad, buf, size);
+}
+
+int
+mql_filter_build(mql_filter_t* f)
+{
+    return f->match ? mql_match_build(f->match) : 0;
+}
+
+
+// Does re match text[len].
+static int
+filter_re(const regex_t* re, const char* text, size_t len)
+{
+    regmatch_t m;
+    m.rm_so = 0;
+    m.rm_eo = len;
+    return !regexec(re, text, 1, &m, REG_STARTEND);
+}
+
+int
+mql_filter_pass(const mql_filter_t* f, const char* text, size_t len)
+{
+    uint64_t found = 0;
+    unsigned i;
+    int in;
+
+    if ( f->match )
+	found = mql_match_scan(f->match, text, len, 0);
+    if ( found & f->string[ MQL_FILTER_EXCLUDE ] )
+	return 0;
+    in = !f->string[ MQL_FILTER_INCLUDE ] && !f->n_re[ MQL_FILTER_INCLUDE ];
+    in |= !!(found & f->string[ MQL_FILTER_INCLUDE ]);
+    for ( i = 0; !in && i < f->n_re[ MQL_FILTER_INCLUDE ]; ++i )
+	in = filter_re(&f->re[ MQL_FILTER_INCLUDE ][i], text, len);
+    if ( !in )
+	return 0;
+    for ( i = 0; i < f->n_re[ MQL_FILTER_EXCLUDE ]; ++i )
+	if ( filter_re(&f->re[ MQL_FILTER_EXCLUDE ][i], text, len) )
+	    return 0;
+    return 1;
+}
+
+void
+mql_filter_free(mql_filter_t* f)
+{
+    unsigned how, i;
+
+    if ( !f )
+	return;
+    for ( how = 0; how < 2; ++how )
+	for ( i = 0; i < f->n_re[how]; ++i )
+	    regfree( &f->re[how][i] );
+    mql_match_free(f->match);
+    free(f);
+}
@@ -0,0 +1,70 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_filter.h
+ * Description     : Mqtt Logging, include and exclude filters on text
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:48:15 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:48:15 2026
+ * Update Count    : 2
+ */
+
+#ifndef __MQL_FILTER_H__
+#define __MQL_FILTER_H__ (1)
+
+/*
+ * A text passes when it holds one of the included strings or matches one
+ * of the included regular expressions, if there are any, and holds none
+ * of the excluded strings and matches none of the excluded expressions.
+ * The strings, included and excluded, are found in one pass with
+ * mql_match_scan(); the expressions, POSIX extended, are only tried when
+ * the strings have not already decided.
+ *
+ * A built filter is read-only and may be used by many threads.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mql_filter mql_filter_t;
+
+#define MQL_FILTER_NOCASE	(1)	/* ASCII letters in any case */
+
+#define MQL_FILTER_INCLUDE	(0)
+#define MQL_FILTER_EXCLUDE	(1)
+
+// New filter that passes all.
+//	RETURNS	filter, or 0 out of memory
+mql_filter_t* mql_filter_new(unsigned flags);
+
+// Add a string, before mql_filter_build().
+//	RETURNS	0 OK, -1 too many or too long
+int mql_filter_string(mql_filter_t* f, unsigned how, const char* s);
+
+// Add a POSIX extended regular expression, before mql_filter_build().
+//	RETURNS	0 OK, else the regcomp() error, told by mql_filter_error()
+int mql_filter_regex(mql_filter_t* f, unsigned how, const char* re);
+
+// The text of an error from mql_filter_regex().
+void mql_filter_error(const mql_filter_t* f, int err, char* buf, size_t size);
+
+// Compile the strings.
+//	RETURNS	0 OK, -1 out of memory
+int mql_filter_build(mql_filter_t* f);
+
+// Does text pass, it need not be '\0' terminated.
+int mql_filter_pass(const mql_filter_t* f, const char* text, size_t len);
+
+void mql_filter_free(mql_filter_t* f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
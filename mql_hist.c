@@ -0,0 +1,116 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_hist.c
+ * Description     : Latency histograms
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:08:20 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:08:20 2026
+ * Update Count    : 1
+ */
+
+#include "mql_hist.h"
+
+#include <string.h>
+
+
+static unsigned
+mql_hist_index(uint64_t v)
+{
+    unsigned e;
+    if ( v < 2 * MQL_HIST_SUB )
+	return v;
+    e = 63 - __builtin_clzll(v);
+    return (e - MQL_HIST_SUB_BITS) * MQL_HIST_SUB
+	+ (v >> (e - MQL_HIST_SUB_BITS));
+}
+
+// Lowest value counted in bucket i.
+static uint64_t
+mql_hist_value(unsigned i)
+{
+    unsigned e;
+    if ( i < 2 * MQL_HIST_SUB )
+	return i;
+    e = i / MQL_HIST_SUB + MQL_HIST_SUB_BITS - 1;
+    return (uint64_t)(i % MQL_HIST_SUB + MQL_HIST_SUB)
+	<< (e - MQL_HIST_SUB_BITS);
+}
+
+
+void
+mql_hist_init(mql_hist_t* h)
+{
+    memset( h, 0, sizeof(*h) );
+    h->min = ~(uint64_t)0;
+}
+
+void
+mql_hist_add(mql_hist_t* h, uint64_t v)
+{
+    ++h->bucket[ mql_hist_index(v) ];
+    ++h->count;
+    h->sum += v;
+    if ( v < h->min )
+	h->min = v;
+    if ( v > h->max )
+	h->max = v;
+}
+
+void
+mql_hist_merge(mql_hist_t* dst, const mql_hist_t* src)
+{
+    unsigned i;
+    for ( i = 0; i < MQL_HIST_BUCKETS; ++i )
+	dst->bucket[i] += src->bucket[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if ( src->min < dst->min )
+	dst->min = src->min;
+    if ( src->max > dst->max )
+	dst->max = src->max;
+}
+
+uint64_t
+mql_hist_percentile(const mql_hist_t* h, double pct)
+{
+    uint64_t want;
+    uint64_t n = 0;
+    unsigned i;
+
+    if ( !h->count )
+	return 0;
+    want = (uint64_t)(h->count * pct / 100.0 + 0.5);
+    if ( want < 1 )
+	want = 1;
+    for ( i = 0; i < MQL_HIST_BUCKETS; ++i ) {
+	n += h->bucket[i];
+	if ( n >= want )
+	    break;
+    }
+    if ( i >= MQL_HIST_BUCKETS )
+	return h->max;
+    // Report the top of the bucket, but never beyond what was seen.
+    if ( i + 1 < MQL_HIST_BUCKETS && mql_hist_value(i+1) - 1 < h->max )
+	return mql_hist_value(i+1) - 1;
+    return h->max;
+}
+
+void
+mql_hist_print(const mql_hist_t* h, FILE* fp)
+{
+    fprintf(fp,
+	    "n=%llu min=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f"
+	    " p99.99=%.1f max=%.1f us",
+	    (unsigned long long)h->count,
+	    (h->count ? h->min : 0) / 1e3,
+	    mql_hist_percentile(h,50.0) / 1e3,
+	    mql_hist_percentile(h,90.0) / 1e3,
+	    mql_hist_percentile(h,99.0) / 1e3,
+	    mql_hist_percentile(h,99.9) / 1e3,
+	    mql_hist_percentile(h,99.99) / 1e3,
+	    h->max / 1e3 );
+}
@@ -0,0 +1,58 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_hist.h
+ * Description     : Latency histograms
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:08:20 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:08:20 2026
+ * Update Count    : 1
+ */
+
+#ifndef __MQL_HIST_H__
+#define __MQL_HIST_H__ (1)
+
+/*
+ * HDR-style log-linear histogram of 64-bit values (typically ns).
+ * Values below 64 are exact, above that each power of two is split in
+ * 32 sub-buckets, i.e. a relative error of at most ~3%.
+ * Not thread safe, use one per thread and merge.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_HIST_SUB_BITS	(5)
+#define MQL_HIST_SUB		(1 << MQL_HIST_SUB_BITS)
+#define MQL_HIST_BUCKETS	((64 - MQL_HIST_SUB_BITS + 1) * MQL_HIST_SUB)
+
+typedef struct {
+    uint64_t	count;
+    uint64_t	min;
+    uint64_t	max;
+    double	sum;
+    uint64_t	bucket[ MQL_HIST_BUCKETS ];
+} mql_hist_t;
+
+void mql_hist_init(mql_hist_t* h);
+void mql_hist_add(mql_hist_t* h, uint64_t v);
+void mql_hist_merge(mql_hist_t* dst, const mql_hist_t* src);
+
+// Value at percentile pct (0..100), 0 for an empty histogram.
+uint64_t mql_hist_percentile(const mql_hist_t* h, double pct);
+
+// Print "n=.. min=.. p50=.. p90=.. p99=.. p99.9=.. p99.99=.. max=.." in us.
+void mql_hist_print(const mql_hist_t* h, FILE* fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_hub.c
+ * Description     : Hub command, router for the unix transport
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:17:28 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:02:58 2026
+ * Update Count    : 2
+ */
+
+/*
+ * "mql hub [<path>]" listens on a Unix-domain socket and routes
+ * messages between the processes connected to it with the unix
+ * transport, like a broker restricted to one host.  Each published
+ * frame is forwarded as is to every client with a matching
+ * subscription.  A client that does not keep up loses messages
+ * instead of stalling the others.
+ */
+
+#include "mql.h"
+#include "mql_int.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern int opt_d;
+#define DD if(opt_d)printf
+
+#define HUB_CLIENTS_MAX		(1024)
+#define HUB_FILTERS_MAX		(16)
+
+typedef struct {
+    int		fd;
+    unsigned	n_filters;
+    char	filter[ HUB_FILTERS_MAX ][ MQL_TOPIC_MAX_LEN ];
+    unsigned long dropped;
+} hub_client_t;
+
+static hub_client_t* hub_client[ HUB_CLIENTS_MAX ];
+static struct pollfd hub_pfd[ HUB_CLIENTS_MAX + 1 ];
+static unsigned hub_n = 0;
+
+
+static void
+hub_accept(int lfd)
+{
+    hub_client_t* c;
+    int fd = accept(lfd, 0, 0);
+    if ( fd < 0 )
+	return;
+    if ( hub_n >= HUB_CLIENTS_MAX ) {
+	close(fd);
+	return;
+    }
+    c = calloc(1,sizeof(hub_client_t));
+    if ( !c ) {
+	close(fd);
+	return;
+    }
+    c->fd = fd;
+    hub_client[ hub_n ] = c;
+    hub_pfd[ hub_n + 1 ].fd = fd;
+    hub_pfd[ hub_n + 1 ].events = POLLIN;
+    ++hub_n;
+    DD ("hub: client %d connected, %u clients\n", fd, hub_n);
+}
+
+
+static void
+hub_close(unsigned i)
+{
+    hub_client_t* c = hub_client[i];
+    DD ("hub: client %d closed, %lu dropped\n", c->fd, c->dropped);
+    close(c->fd);
+    free(c);
+    --hub_n;
+    hub_client[i] = hub_client[ hub_n ];
+    hub_pfd[ i + 1 ] = hub_pfd[ hub_n + 1 ];
+}
+
+
+static void
+hub_route(const char* frame, size_t n, const char* topic)
+{
+    unsigned i, j;
+    for ( i = 0; i < hub_n; ++i ) {
+	hub_client_t* c = hub_client[i];
+	for ( j = 0; j < c->n_filters; ++j ) {
+	    if ( mql_topic_match(c->filter[j],topic) ) {
+		if ( send(c->fd, frame, n, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 )
+		    ++c->dropped;
+		break;
+	    }
+	}
+    }
+}
+
+
+static void
+hub_frame(hub_client_t* c, char* frame, size_t n)
+{
+    const char* topic = frame + 1;
+    size_t tlen;
+
+    if ( n < 2 )
+	return;
+    tlen = strnlen(topic, n - 1);
+    if ( tlen == n - 1 )
+	return;				/* No end of topic */
+
+    switch ( frame[0] ) {
+    case MQL_UNIX_SUBSCRIBE:
+	DD ("hub: client %d subscribe \"%s\"\n", c->fd, topic);
+	if ( c->n_filters < HUB_FILTERS_MAX && tlen < MQL_TOPIC_MAX_LEN )
+	    strcpy( c->filter[ c->n_filters++ ], topic );
+	break;
+    case MQL_UNIX_PUBLISH:
+	hub_route(frame, n, topic);
+	break;
+    default:
+	break;
+    }
+}
+
+
+void
+mql_command_hub(const char* path)
+{
+    struct sockaddr_un addr;
+    char* frame;
+    int lfd;
+
+    if ( !path || !*path )
+	path = MQL_UNIX_PATH;
+    if ( strlen(path) >= sizeof(addr.sun_path) ) {
+	printf("Socket path too long: %s\n", path);
+	exit( EXIT_FAILURE );
+    }
+
+    frame = malloc(MQL_UNIX_FRAME_MAX);
+    if ( !frame ) {
+	perror("malloc: ");
+	exit( EXIT_FAILURE );
+    }
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+
+    lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ( lfd < 0 ) {
+	perror("socket: ");
+	exit( EXIT_FAILURE );
+    }
+    if ( mql_unix_unlink_stale(path, SOCK_SEQPACKET) ) {
+	fprintf(stderr, "hub: %s: ", path);
+	perror("");
+	exit( EXIT_FAILURE );
+    }
+    if ( bind(lfd, (struct sockaddr*)&addr, sizeof(addr))
+	 || listen(lfd, 64) ) {
+	perror("bind: ");
+	exit( EXIT_FAILURE );
+    }
+    DD ("hub: listening on \"%s\"\n", path);
+
+    hub_pfd[0].fd = lfd;
+    hub_pfd[0].events = POLLIN;
+
+    for (;;) {
+	unsigned i;
+	int n = poll(hub_pfd, hub_n + 1, -1);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("poll: ");
+	    exit( EXIT_FAILURE );
+	}
+
+	/* Backwards, hub_close() moves the last client into the hole. */
+	for ( i = hub_n; i > 0; --i ) {
+	    hub_client_t* c = hub_client[i-1];
+	    ssize_t len;
+	    if ( !hub_pfd[i].revents )
+		continue;
+	    len = recv(c->fd, frame, MQL_UNIX_FRAME_MAX, MSG_DONTWAIT);
+	    if ( len > 0 )
+		hub_frame(c, frame, len);
+	    else if ( len == 0 || (errno != EAGAIN && errno != EINTR) )
+		hub_close(i-1);
+	}
+
+	if ( hub_pfd[0].revents )
+	    hub_accept(lfd);
+    }
+}
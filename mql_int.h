@@ -0,0 +1,83 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_int.h
+ * Description     : Mqtt Logging, library internals
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:06:42 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:02:58 2026
+ * Update Count    : 4
+ */
+
+#ifndef __MQL_INT_H__
+#define __MQL_INT_H__ (1)
+
+/*
+ * Functions internal to libmql.a and the mql tools.  Not installed.
+ */
+
+#include "mql.h"
+#include "mql_transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Transport backends implement these.  Return 0 for OK, -1 for error.
+typedef struct {
+    const char*	name;
+    int		(*connect)(mql_transport_t* tp, const char* host, int port);
+    int		(*loop_start)(mql_transport_t* tp);
+    int		(*publish)(mql_transport_t* tp, const char* topic,
+			   int len, const void* payload, int qos, int retain);
+    int		(*subscribe)(mql_transport_t* tp, const char* filter);
+    void	(*destroy)(mql_transport_t* tp);
+} mql_tp_ops_t;
+
+// Common part, first in each backend's own struct.
+struct mql_transport {
+    const mql_tp_ops_t*	ops;
+    mql_tp_connect_cb_t	on_connect;
+    mql_tp_connect_cb_t	on_disconnect;
+    mql_tp_message_cb_t	on_message;
+    void*		obj;
+};
+
+// Backend constructors, arg is the part of the spec after ':' or 0.
+mql_transport_t* mql_tp_mosquitto_new(const char* arg);
+mql_transport_t* mql_tp_loop_new(const char* arg);
+mql_transport_t* mql_tp_unix_new(const char* arg);
+mql_transport_t* mql_tp_shm_new(const char* arg);
+
+// Publish/subscribe through an application's handle, see mql_init().
+mql_transport_t* mql_tp_mosquitto_wrap(struct mosquitto* mqc);
+
+// Unix socket frames (SOCK_SEQPACKET):
+//	<type> <topic> '\0' <payload>
+#define MQL_UNIX_PUBLISH	'P'
+#define MQL_UNIX_SUBSCRIBE	'S'
+#define MQL_UNIX_FRAME_MAX	(1 + MQL_TOPIC_MAX_LEN + 65536)
+
+// Make way for a server socket of type at path: remove a socket left
+// there by a server that is gone, one that refuses connections.  Any
+// other file, or a socket that is answered on, is left alone.
+//	RETURNS	0 path free, -1 not (errno set, EEXIST not a socket,
+//		EADDRINUSE in use)
+int mql_unix_unlink_stale(const char* path, int type);
+
+// Decode " <hex digit>" to a level.
+// Returns: >0 number of characters used, 0 on failure.
+unsigned mql_decode_lvl(const char* s, unsigned* lvl_ptr );
+
+// Decode " <decimal>" to a count.
+// Returns: >0 number of characters used, 0 on failure.
+unsigned mql_decode_count(const char* s, unsigned* count_ptr );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
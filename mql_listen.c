@@ -8,15 +8,23 @@
  * Created On      : Sun Jul  6 09:55:40 2025
  * 
  * Last Modified By: Mats Bergstrom
- * Last Modified On: Sat Nov 22 17:53:09 2025
- * Update Count    : 105
+ * Last Modified On: Mon Oct 19 16:25:51 2026
+ * Update Count    : 117
  */
 
 
 #include "mql.h"
+#include "mql_sdt.h"
+#include "mql_hist.h"
+#include "mql_out.h"
+#include "mql_topic.h"
+#include "mql_filter.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 
@@ -28,8 +36,12 @@
 extern int opt_d;
 #define DD if(opt_d)printf
 
-struct mosquitto* mqc = 0;
+extern char transport_spec[];
+extern char mql_prefix[];
+
+mql_transport_t* tp = 0;
 unsigned message_severity = MQL_S_MAX-1;
+unsigned message_severities = (1U << MQL_S_MAX) - 1;	/* Bit per severity */
 char subscribe_topic[ MQL_STRING_MAX ];
 
 
@@ -38,9 +50,18 @@ pthread_mutex_t	mtx;
 pthread_cond_t	cv;
 bool connected = false;
 
+MQL_PROBE_DEFINE(listen_parse);
+extern unsigned short mql_listen_print_semaphore;	/* In mql_out.c */
+
+static void mql_measure_message(const char* id, unsigned sev,
+				const char* pload, int len);
+unsigned measure_interval = 0;		/* !0: measure instead of print */
+#define LISTEN_REPORT_S	(10)		/* Drops printed this often */
+static volatile sig_atomic_t listen_stop = 0;
+static int listen_failed = 0;		/* Disconnected */
 
 
-static const char* mql_sev_name[MQL_S_MAX] = {
+const char* mql_sev_name[MQL_S_MAX] = {
     "FATAL",
     "ERROR",
     "WARNING",
@@ -60,91 +81,227 @@ static const char* mql_sev_name[MQL_S_MAX] = {
 };
 
 
-int
-ends_in(const char* topic, const char* end)
+// Batch from mqlagent, records are not '\0' terminated.
+static void
+mql_measure_batch(const char* mql_id, unsigned tsev,
+		  const char* pload, int len)
 {
-    const char* s = strstr(topic,end);
-    int l = strlen(end);
-    if ( !s )
-	return 0;
-    if ( *(s+l) != '\0' )
-	return 0;
-    return 1;
-    
+    char rec[ MQL_STRING_MAX * 4 ];
+    const char* r;
+    int rlen;
+    int pos = 0;
+
+    while ( mql_batch_next(pload, len, &pos, &r, &rlen) > 0 ) {
+	if ( rlen >= (int)sizeof(rec) )
+	    rlen = sizeof(rec) - 1;
+	memcpy( rec, r, rlen );
+	rec[ rlen ] = '\0';
+	mql_measure_message(mql_id, tsev, rec, rlen);
+    }
 }
 
-unsigned decode_hexdigit(const char* p, size_t len)
+
+static mql_topic_parser_t listen_topic;
+static int listen_topic_ready = 0;
+
+/*
+ * The listener subscribes to <prefix>/log/<target>/<severity>/# for each
+ * target and severity asked for, so the broker sends nothing else; "+"
+ * is any target and one "#" all severities.  That is more filters than
+ * the hub, loop and shm transports keep when many targets are asked for
+ * with some severities, and then there is one filter per target, or per
+ * severity for any target, and the rest is checked here.
+ */
+#define LISTEN_SUBS_MAX		(16)
+
+static char listen_sub[ LISTEN_SUBS_MAX ][ MQL_TOPIC_MAX_LEN ];
+static unsigned listen_n_subs = 0;
+static const char* const* listen_target = 0;	/* Checked here, if any */
+static unsigned listen_n_target = 0;
+static unsigned char listen_want[ MQL_TOPIC_IDS ];	/* 1 yes, 2 no */
+
+static const mql_filter_t* listen_text = 0;	/* --grep, --regex */
+static const mql_filter_t* listen_id = 0;	/* --id */
+
+
+static void
+listen_add_sub(const char* target, int sev)
+{
+    int i;
+
+    if ( listen_n_subs >= LISTEN_SUBS_MAX )
+	abort();
+    if ( !target )
+	i = snprintf(listen_sub[ listen_n_subs ], MQL_TOPIC_MAX_LEN,
+		     "%s/%s/#", mql_prefix, MQL_LOG_TAG);
+    else if ( sev < 0 )
+	i = snprintf(listen_sub[ listen_n_subs ], MQL_TOPIC_MAX_LEN,
+		     "%s/%s/%s/#", mql_prefix, MQL_LOG_TAG, target);
+    else
+	i = snprintf(listen_sub[ listen_n_subs ], MQL_TOPIC_MAX_LEN,
+		     "%s/%s/%s/%x/#", mql_prefix, MQL_LOG_TAG, target, sev);
+    if ( !(i<MQL_TOPIC_MAX_LEN) ) abort();
+    DD ("plan: \"%s\"\n", listen_sub[ listen_n_subs ]);
+    ++listen_n_subs;
+}
+
+
+// The subscriptions for target[n_target], 0 for all, and a bit per
+// severity in sevs.
+static void
+listen_plan(const char* const* target, unsigned n_target, unsigned sevs)
 {
-    unsigned val = ~0U;
-    if ( p && (len == 1) ) {
-	/* Translate one single hex digit */
-	if ( ('0' <= *p) && (*p <= '9') ) {
-	    val = *p - '0';
+    const unsigned all = (1U << MQL_S_MAX) - 1;
+    unsigned n_sev = 0;
+    unsigned i;
+    int j;
+
+    message_severities = sevs & all;
+    for ( j = 0; j < MQL_S_MAX; ++j )
+	n_sev += (sevs >> j) & 1;
+    if ( n_sev == MQL_S_MAX )
+	n_sev = 1;
+
+    listen_n_subs = 0;
+    if ( n_target * n_sev > LISTEN_SUBS_MAX ) {
+	if ( n_target <= LISTEN_SUBS_MAX ) {
+	    sevs = all;			/* Severity checked here */
 	}
-	else if ( ('a' <= *p) && (*p <= 'f') ) {
-	    val = *p - 'a' + 10;
+	else {
+	    listen_target = target;	/* Target checked here */
+	    listen_n_target = n_target;
+	    n_target = 0;
 	}
-	else if ( ('A' <= *p) && (*p <= 'F') ) {
-	    val = *p - 'A' + 10;
+    }
+
+    if ( !n_target && (sevs & all) == all ) {
+	listen_add_sub(0, -1);
+	return;
+    }
+    for ( i = 0; i < (n_target ? n_target : 1); ++i ) {
+	if ( (sevs & all) == all ) {
+	    listen_add_sub(target[i], -1);
+	    continue;
 	}
+	for ( j = 0; j < MQL_S_MAX; ++j )
+	    if ( (sevs >> j) & 1 )
+		listen_add_sub(n_target ? target[i] : "+", j);
     }
-    return val;
 }
 
 
-#define N_FRAG (8)
-void
-mql_listen_message_callback(struct mosquitto *pmqc, void *obj,
-			    const struct mosquitto_message *msg)
+// Is the source of t one of the targets, when they are checked here,
+// and does its id pass the filter.  Once per interned source.
+static int
+listen_wanted(const mql_topic_t* t)
 {
-    const char*	topic = msg->topic;
-    const char*	pload = msg->payload;
-    mql_fragment_t frag[N_FRAG];
-    char mql_id[ MQL_ID_MAX_LEN + 1];
-    size_t mql_id_len = MQL_ID_MAX_LEN;
-    int n;
-    unsigned tsev;
-    const size_t mql_cmd_tag_len = strlen(MQL_CMD_TAG);
-    const size_t mql_log_tag_len = strlen(MQL_LOG_TAG);
-    
-    DD ("%s: \"%s\"\n",__func__, "called");
+    unsigned i;
+    int want;
+
+    if ( t->src >= 0 && listen_want[ t->src ] )
+	return listen_want[ t->src ] == 1;
+    for ( i = 0; i < listen_n_target; ++i )
+	if ( !strcmp(listen_target[i], t->id) )
+	    break;
+    want = !listen_n_target || i < listen_n_target;
+    if ( want && listen_id )
+	want = mql_filter_pass(listen_id, t->id, t->id_len);
+    if ( t->src >= 0 )
+	listen_want[ t->src ] = want ? 1 : 2;
+    return want;
+}
 
-    n = mql_split(topic,frag,N_FRAG);
 
-    // Ignore control messages: <prefix>/cmd/<id>
-    if ( (n == 3) &&
-	 (frag[1].len == mql_cmd_tag_len) &&
-	 strncmp(MQL_CMD_TAG, frag[1].ptr, mql_cmd_tag_len)  )
-	return;
+// Queue what passes the payload filter, the records of a batch one by
+// one.  Text after a '\0' is not printed, nor looked at.
+static void
+listen_filter_put(int kind, const mql_topic_t* t,
+		  const char* pload, int len, uint64_t t1)
+{
+    char line[ MQL_ID_MAX_LEN + 64 ];
+    const char* r;
+    int rlen;
+    int pos = 0;
+    int i;
 
-    // Log messages: <prefix>/log/<id>/<severity>
-    if ( n != 4					// Must be 4 fragments in topic
-	 || frag[1].len != mql_log_tag_len	// Must be a log tag
-	 || strncmp(MQL_LOG_TAG, frag[1].ptr, mql_log_tag_len)
-	 || frag[3].len != 1 ) {		// Severity must be 1 character
-	printf("Error: Malformed topic: \"%s\"! fragments=%d\n\n",topic,n);
+    if ( kind != MQL_TOPIC_BATCH ) {
+	if ( mql_filter_pass(listen_text, pload, strnlen(pload, len)) )
+	    mql_out_put(MQL_OUT_REC, t->id, t->id_len, t->sev, pload, len, t1);
 	return;
     }
+    while ( (i = mql_batch_next(pload, len, &pos, &r, &rlen)) > 0 )
+	if ( mql_filter_pass(listen_text, r, strnlen(r, rlen)) )
+	    mql_out_put(MQL_OUT_REC, t->id, t->id_len, t->sev, r, rlen, t1);
+    if ( i < 0 ) {
+	snprintf(line, sizeof(line), "Error: Malformed batch from \"%.*s\"!\n",
+		 (int)t->id_len, t->id);
+	mql_out_text(line);
+    }
+}
+
+
+void
+mql_listen_filter(const mql_filter_t* text, const mql_filter_t* id)
+{
+    listen_text = text;
+    listen_id = id;
+    memset( listen_want, 0, sizeof(listen_want) );
+}
+
+void
+mql_listen_message_callback(mql_transport_t* ptp, void *obj,
+			    const char* topic, const void* payload, int len)
+{
+    const char*	pload = payload;
+    mql_topic_t t;
+    char line[ MQL_TOPIC_MAX_LEN + 64 ];
+    int kind;
+    uint64_t t0 = 0;
+    uint64_t t1 = 0;
+
+    if ( MQL_PROBE_ENABLED(listen_parse) || MQL_PROBE_ENABLED(listen_print) )
+	t0 = mql_probe_ns();
 
+    DD ("%s: \"%s\"\n",__func__, "called");
 
-    /* Extract the id and put in a buffer for easy print later. */
-    if ( frag[2].len < mql_id_len )
-	mql_id_len = frag[2].len;
-    strncpy(mql_id,frag[2].ptr,mql_id_len);
-    mql_id[ mql_id_len ] = '\0';
+    if ( !listen_topic_ready++ )
+	mql_topic_init(&listen_topic, mql_prefix);
+
+    // Log messages: <prefix>/log/<id>/<severity>[/batch]
+    kind = mql_topic_parse(&listen_topic, topic, &t);
+    if ( kind == MQL_TOPIC_CMD )
+	return;				// Control messages are ignored
+    if ( kind < 0 ) {
+	snprintf(line, sizeof(line),
+		 "Error: Malformed topic: \"%s\"!\n", topic);
+	mql_out_text(line);
+	return;
+    }
 
-    /* Get severity */
-    tsev = decode_hexdigit(frag[3].ptr,frag[3].len);
+    if ( t0 )
+	t1 = mql_probe_ns();
+    MQL_PROBE3(listen_parse, t.sev, t.len, (t0 ? t1 - t0 : 0));
 
-    if ( tsev >= MQL_S_MAX ) {
-	printf("Error: Malformed topic: \"%s\"!\n\n",topic);
+    if ( !((message_severities >> t.sev) & 1) )
+	return;
+    mql_topic_intern(&listen_topic, &t);
+    if ( (listen_n_target || listen_id) && !listen_wanted(&t) )
+	return;
+    if ( measure_interval ) {
+	if ( kind == MQL_TOPIC_BATCH )
+	    mql_measure_batch(t.id, t.sev, pload, len);
+	else
+	    mql_measure_message(t.id, t.sev, pload, len);
 	return;
     }
 
-    // Only print if severity is below limit.
-    if ( tsev <= message_severity )
-	printf("%-16s : %x : %-9s : \"%s\"\n",
-	       mql_id, tsev, mql_sev_name[tsev],pload);
+    /* The output thread prints it. */
+    if ( listen_text ) {
+	listen_filter_put(kind, &t, pload, len, t1);
+	return;
+    }
+    mql_out_put(kind == MQL_TOPIC_BATCH ? MQL_OUT_BATCH : MQL_OUT_REC,
+		t.id, t.id_len, t.sev, pload, len, t1);
 }
 
 
@@ -153,88 +310,381 @@ mql_sub(const char* topic)
 {
     int i;
     DD ("%s: topic=%s\n",__func__,topic);
-    i = mosquitto_subscribe(mqc, NULL, topic, 0);
-    if ( i != MOSQ_ERR_SUCCESS ) {
-	perror("mosquitto_subscribe: ");
+    i = mql_transport_subscribe(tp, topic);
+    if ( i ) {
+	perror("mql_transport_subscribe: ");
 	exit( EXIT_FAILURE );
     }
 }
 
 void
-mql_listen_connect_callback(struct mosquitto *mqc, void *obj, int result)
+mql_listen_connect_callback(mql_transport_t* tp, void *obj, int result)
 {
-    DD ("%s: \"%s\"\n",__func__, subscribe_topic);
-    mql_sub(subscribe_topic);
+    unsigned i;
+    for ( i = 0; i < listen_n_subs; ++i ) {
+	DD ("%s: \"%s\"\n",__func__, listen_sub[i]);
+	mql_sub(listen_sub[i]);
+    }
 }
 
 void
-mql_listen_disconnect_callback(struct mosquitto *mqc, void *obj, int result)
+mql_listen_disconnect_callback(mql_transport_t* tp, void *obj, int result)
 {
-    printf("MQTT Disonnected: %d\n", result);
-    exit( EXIT_FAILURE );
+    char line[ 64 ];
+
+    if ( measure_interval ) {
+	printf("MQTT Disonnected: %d\n", result);
+	exit( EXIT_FAILURE );
+    }
+    snprintf(line, sizeof(line), "MQTT Disonnected: %d", result);
+    mql_out_text(line);
+    listen_failed = 1;
+    listen_stop = 1;
 }
 
 void
 mql_listen_init(const char* host, int port )
-	/* Initialise the mosquitto lib */
+	/* Initialise the transport */
 {
     int i;
-    i = mosquitto_lib_init();
-    if ( i != MOSQ_ERR_SUCCESS) {
-	perror("mosquitto_lib_init: ");
-	exit( EXIT_FAILURE );
-    }
-    
-    mqc = mosquitto_new(0, true, 0);
-    if ( !mqc ) {
-	perror("mosquitto_new: ");
+    tp = mql_transport_new(transport_spec);
+    if ( !tp ) {
+	printf("Bad transport: \"%s\"\n", transport_spec);
 	exit( EXIT_FAILURE );
     }
 
-    mosquitto_connect_callback_set(mqc, mql_listen_connect_callback);
-    mosquitto_disconnect_callback_set(mqc, mql_listen_disconnect_callback);
-    mosquitto_message_callback_set(mqc, mql_listen_message_callback);
+    mql_transport_callbacks(tp, mql_listen_connect_callback,
+			    mql_listen_disconnect_callback,
+			    mql_listen_message_callback, 0);
 
-    i = mosquitto_connect(mqc, host, port, 60);
-    if ( i != MOSQ_ERR_SUCCESS) {
-	perror("mosquitto_connect: ");
+    i = mql_transport_connect(tp, host, port);
+    if ( i ) {
+	perror("mql_transport_connect: ");
 	exit( EXIT_FAILURE );
     }
 
 
 }
 
+static void
+listen_on_signal(int sig)
+{
+    listen_stop = 1;
+}
+
 void
 mql_command_listen(const char* host, int port,
-		   const char* topic, unsigned severity)
+		   const char* const* target, unsigned n_target,
+		   unsigned severities, size_t queue_max, unsigned policy)
 {
     int i;
     unsigned int n = 0;
+    time_t last = time(0);
+
+    if ( !severities ) abort();
+
+    listen_plan(target, n_target, severities);
+
+    if ( mql_out_start(STDOUT_FILENO, queue_max, policy) ) {
+	perror("listen: ");
+	exit( EXIT_FAILURE );
+    }
+    signal( SIGINT, listen_on_signal );
+    signal( SIGTERM, listen_on_signal );
 
-    if ( !topic ) abort();
-    if ( !*topic ) abort();
-    
-    message_severity = severity;
-    strncpy(subscribe_topic,topic,MQL_STRING_MAX-1);
-    
     mql_listen_init(host,port);
 
-    i = mosquitto_loop_start(mqc);
-    if(i != MOSQ_ERR_SUCCESS){
-	mosquitto_destroy(mqc);
-	fprintf(stderr, "Error: %s\n", mosquitto_strerror(i));
+    i = mql_transport_loop_start(tp);
+    if ( i ) {
+	mql_transport_destroy(tp);
+	fprintf(stderr, "Error: %s\n", "Can not start transport");
 	exit( EXIT_FAILURE );
     }
 
-    for(;;) {
-	/* Do nothing, all happens in the mosquitto thread. */
+    while ( !listen_stop ) {
+	/* Do nothing, all happens in the transport and output threads. */
 	if ( opt_d && (n < 5) )
 	    printf("loop: %d\n",n++);
 	sleep(1);
+	if ( time(0) - last >= LISTEN_REPORT_S ) {
+	    mql_out_report(stderr, 0);
+	    last = time(0);
+	}
     }
+
+    /* Print what was received before stopping. */
+    mql_transport_destroy(tp);
+    mql_out_stop();
+    mql_out_report(stderr, 1);
+    exit( listen_failed ? EXIT_FAILURE : EXIT_SUCCESS );
 }
 
 
+/*
+ * Measurement mode, "mql listen --measure".
+ *
+ * Payloads from t-mql are "M <stream> <seq> <send-ns> ...", where
+ * <send-ns> is CLOCK_REALTIME at the sender.  Per source (<id>/<stream>)
+ * we keep a histogram of delivery latency and count gaps, reorders and
+ * duplicates.  Other payloads are only counted.
+ */
+
+#define MEASURE_SOURCES_MAX	(4096)
+#define MEASURE_WINDOW		(1024)		/* Duplicate detection window */
+
+typedef struct {
+    char	id[ MQL_ID_MAX_LEN + 16 ];
+    uint64_t	received;
+    uint64_t	high;		/* Highest sequence number seen */
+    uint64_t	seen[ MEASURE_WINDOW / 64 ];	/* Bit seq%WINDOW */
+    uint64_t	lost;		/* Missing, not (yet) arrived late */
+    uint64_t	reordered;
+    uint64_t	duplicates;
+    uint64_t	restarts;
+    uint64_t	skewed;		/* Send time after receive time */
+    mql_hist_t	lat;
+} measure_source_t;
+
+static measure_source_t* measure_source[ MEASURE_SOURCES_MAX ];
+static unsigned measure_n_sources = 0;
+static uint64_t measure_other = 0;	/* Not measurement payloads */
+static uint64_t measure_dropped = 0;	/* Source table full */
+static uint64_t measure_total = 0;
+static pthread_mutex_t measure_mtx = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t measure_stop = 0;
+
+
+static measure_source_t*
+measure_lookup(const char* id, unsigned stream)
+{
+    char key[ MQL_ID_MAX_LEN + 16 ];
+    unsigned h = 2166136261U;
+    unsigned i;
+    const char* p;
+
+    snprintf(key, sizeof(key), "%s/%u", id, stream);
+    for ( p = key; *p; ++p )
+	h = (h ^ (unsigned char)*p) * 16777619U;
+
+    for ( i = 0; i < MEASURE_SOURCES_MAX; ++i ) {
+	measure_source_t** e = &measure_source[ (h + i) % MEASURE_SOURCES_MAX ];
+	if ( !*e ) {
+	    if ( measure_n_sources >= MEASURE_SOURCES_MAX / 2 )
+		return 0;
+	    *e = calloc(1, sizeof(measure_source_t));
+	    if ( !*e )
+		return 0;
+	    strcpy( (*e)->id, key );
+	    mql_hist_init( &(*e)->lat );
+	    ++measure_n_sources;
+	    return *e;
+	}
+	if ( !strcmp((*e)->id, key) )
+	    return *e;
+    }
+    return 0;
+}
+
+
+#define SEEN_BIT(seq)	(1ULL << ((seq) % 64))
+#define SEEN_WORD(s,seq)	((s)->seen[ ((seq) % MEASURE_WINDOW) / 64 ])
+
+static void
+measure_seq(measure_source_t* s, uint64_t seq)
+{
+    uint64_t d;
+
+    if ( !s->received || (seq == 0 && s->high > MEASURE_WINDOW) ) {
+	/* First message, or the sender was restarted. */
+	if ( s->received )
+	    ++s->restarts;
+	memset( s->seen, 0, sizeof(s->seen) );
+	s->high = seq;
+	SEEN_WORD(s,seq) |= SEEN_BIT(seq);
+	return;
+    }
+
+    if ( seq > s->high ) {
+	d = seq - s->high;
+	s->lost += d - 1;
+	if ( d >= MEASURE_WINDOW ) {
+	    memset( s->seen, 0, sizeof(s->seen) );
+	}
+	else {
+	    uint64_t x;
+	    for ( x = s->high + 1; x < seq; ++x )
+		SEEN_WORD(s,x) &= ~SEEN_BIT(x);
+	}
+	s->high = seq;
+	SEEN_WORD(s,seq) |= SEEN_BIT(seq);
+	return;
+    }
+
+    d = s->high - seq;
+    if ( d < MEASURE_WINDOW ) {
+	if ( SEEN_WORD(s,seq) & SEEN_BIT(seq) ) {
+	    ++s->duplicates;
+	    return;
+	}
+	SEEN_WORD(s,seq) |= SEEN_BIT(seq);
+    }
+    /* Beyond the window a late message can not be told from a duplicate. */
+    ++s->reordered;
+    if ( s->lost )
+	--s->lost;
+}
+
+
+static void
+mql_measure_message(const char* id, unsigned sev, const char* pload, int len)
+{
+    struct timespec ts;
+    uint64_t now;
+    unsigned long stream;
+    unsigned long long seq, sent;
+    measure_source_t* s;
+    char* e;
+
+    clock_gettime( CLOCK_REALTIME, &ts );
+    now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    pthread_mutex_lock( &measure_mtx );
+    ++measure_total;
+    do {
+	if ( len < 2 || pload[0] != 'M' || pload[1] != ' ' ) {
+	    ++measure_other;
+	    break;
+	}
+	stream = strtoul(pload+2, &e, 10);
+	seq = strtoull(e, &e, 10);
+	sent = strtoull(e, &e, 10);
+	if ( *e != ' ' && *e != '\0' ) {
+	    ++measure_other;
+	    break;
+	}
+
+	s = measure_lookup(id, stream);
+	if ( !s ) {
+	    ++measure_dropped;
+	    break;
+	}
+
+	measure_seq(s, seq);
+	++s->received;
+	if ( now >= sent ) {
+	    mql_hist_add( &s->lat, now - sent );
+	}
+	else {
+	    ++s->skewed;
+	    mql_hist_add( &s->lat, 0 );
+	}
+    } while(0);
+    pthread_mutex_unlock( &measure_mtx );
+}
+
+
+static void
+measure_print(const char* what, double secs, uint64_t interval_total)
+{
+    mql_hist_t all;
+    uint64_t received = 0, lost = 0, reordered = 0, duplicates = 0;
+    unsigned i;
+
+    mql_hist_init( &all );
+
+    pthread_mutex_lock( &measure_mtx );
+    printf("--- %s: %.0f s, %llu messages (%.0f msg/s), %u sources,"
+	   " %llu other, %llu untracked\n",
+	   what, secs, (unsigned long long)measure_total,
+	   interval_total / (secs > 0 ? secs : 1), measure_n_sources,
+	   (unsigned long long)measure_other,
+	   (unsigned long long)measure_dropped );
+    for ( i = 0; i < MEASURE_SOURCES_MAX; ++i ) {
+	const measure_source_t* s = measure_source[i];
+	if ( !s )
+	    continue;
+	printf("%-24s recv=%llu lost=%llu reord=%llu dup=%llu",
+	       s->id, (unsigned long long)s->received,
+	       (unsigned long long)s->lost, (unsigned long long)s->reordered,
+	       (unsigned long long)s->duplicates);
+	if ( s->restarts )
+	    printf(" restarts=%llu", (unsigned long long)s->restarts);
+	if ( s->skewed )
+	    printf(" skewed=%llu", (unsigned long long)s->skewed);
+	printf(" : ");
+	mql_hist_print( &s->lat, stdout );
+	printf("\n");
+
+	received += s->received;
+	lost += s->lost;
+	reordered += s->reordered;
+	duplicates += s->duplicates;
+	mql_hist_merge( &all, &s->lat );
+    }
+    printf("%-24s recv=%llu lost=%llu reord=%llu dup=%llu : ",
+	   "TOTAL", (unsigned long long)received, (unsigned long long)lost,
+	   (unsigned long long)reordered, (unsigned long long)duplicates );
+    mql_hist_print( &all, stdout );
+    printf("\n");
+    pthread_mutex_unlock( &measure_mtx );
+}
+
+
+static void
+measure_on_signal(int sig)
+{
+    measure_stop = 1;
+}
+
+
+void
+mql_command_measure(const char* host, int port,
+		    const char* const* target, unsigned n_target,
+		    unsigned severities, unsigned interval)
+{
+    int i;
+    unsigned n = 0;
+    uint64_t total, last_total = 0;
+    time_t start;
+
+    if ( !severities ) abort();
+    if ( !interval ) abort();
+
+    listen_plan(target, n_target, severities);
+    measure_interval = interval;
+
+    signal( SIGINT, measure_on_signal );
+    signal( SIGTERM, measure_on_signal );
+
+    mql_listen_init(host,port);
+
+    i = mql_transport_loop_start(tp);
+    if ( i ) {
+	mql_transport_destroy(tp);
+	fprintf(stderr, "Error: %s\n", "Can not start transport");
+	exit( EXIT_FAILURE );
+    }
+
+    start = time(0);
+    while ( !measure_stop ) {
+	sleep(1);
+	if ( ++n % measure_interval == 0 ) {
+	    pthread_mutex_lock( &measure_mtx );
+	    total = measure_total;
+	    pthread_mutex_unlock( &measure_mtx );
+	    measure_print("interval", measure_interval, total - last_total);
+	    last_total = total;
+	}
+    }
+
+    pthread_mutex_lock( &measure_mtx );
+    total = measure_total;
+    pthread_mutex_unlock( &measure_mtx );
+    measure_print("final", difftime(time(0),start), total);
+    exit( EXIT_SUCCESS );
+}
+
+
 void
 set_connected( bool con )
 {
@@ -265,7 +715,7 @@ wait_connected()
 
 
 void
-mql_level_connect_callback(struct mosquitto *mqc, void *obj, int result)
+mql_level_connect_callback(mql_transport_t* tp, void *obj, int result)
 {
     DD ("%s: \"%s\"\n",__func__, subscribe_topic);
     mql_sub(subscribe_topic);
@@ -274,7 +724,7 @@ mql_level_connect_callback(struct mosquitto *mqc, void *obj, int result)
 
 
 void
-mql_level_disconnect_callback(struct mosquitto *mqc, void *obj, int result)
+mql_level_disconnect_callback(mql_transport_t* tp, void *obj, int result)
 {
     printf("MQTT Disonnected: %d\n", result);
     set_connected(false);
@@ -282,27 +732,22 @@ mql_level_disconnect_callback(struct mosquitto *mqc, void *obj, int result)
 
 void
 mql_level_init(const char* host, int port )
-	/* Initialise the mosquitto lib */
+	/* Initialise the transport */
 {
     int i;
-    i = mosquitto_lib_init();
-    if ( i != MOSQ_ERR_SUCCESS) {
-	perror("mosquitto_lib_init: ");
-	exit( EXIT_FAILURE );
-    }
-    
-    mqc = mosquitto_new(0, true, 0);
-    if ( !mqc ) {
-	perror("mosquitto_new: ");
+    tp = mql_transport_new(transport_spec);
+    if ( !tp ) {
+	printf("Bad transport: \"%s\"\n", transport_spec);
 	exit( EXIT_FAILURE );
     }
 
-    mosquitto_connect_callback_set(mqc, mql_level_connect_callback);
-    mosquitto_disconnect_callback_set(mqc, mql_level_disconnect_callback);
+    mql_transport_callbacks(tp, mql_level_connect_callback,
+			    mql_level_disconnect_callback,
+			    0, 0);
 
-    i = mosquitto_connect(mqc, host, port, 60);
-    if ( i != MOSQ_ERR_SUCCESS) {
-	perror("mosquitto_connect: ");
+    i = mql_transport_connect(tp, host, port);
+    if ( i ) {
+	perror("mql_transport_connect: ");
 	exit( EXIT_FAILURE );
     }
 
@@ -328,10 +773,10 @@ mql_command_level(const char* host, int port,
     
     mql_level_init(host,port);
 
-    i = mosquitto_loop_start(mqc);
-    if(i != MOSQ_ERR_SUCCESS){
-	mosquitto_destroy(mqc);
-	fprintf(stderr, "Error: %s\n", mosquitto_strerror(i));
+    i = mql_transport_loop_start(tp);
+    if ( i ) {
+	mql_transport_destroy(tp);
+	fprintf(stderr, "Error: %s\n", "Can not start transport");
 	exit( EXIT_FAILURE );
     }
 
@@ -340,7 +785,7 @@ mql_command_level(const char* host, int port,
 	char val[MQL_BUFFER_LEN+1];
 	int lval;
 
-	/* Do nothing, all happens in the mosquitto thread. */
+	/* Do nothing, all happens in the transport thread. */
 	if ( opt_d && (n < 5) )
 	    printf("loop: %d\n",n++);
 
@@ -351,14 +796,14 @@ mql_command_level(const char* host, int port,
 	    printf("Bad message len, %d, expected 3!\n",lval);
 	    exit( EXIT_FAILURE );
 	}
-	status = mosquitto_publish(mqc, 0,
-				   topic, 
-				   lval,
-				   val,
-				   0,
-				   false ); /* retain is ON */
-	if ( status != MOSQ_ERR_SUCCESS ) {
-	    printf("mosquitto_publish FAILED: %d\n",status);
+	status = mql_transport_publish(tp,
+				       topic, 
+				       lval,
+				       val,
+				       0,
+				       0 ); /* retain is OFF */
+	if ( status ) {
+	    printf("mql_transport_publish FAILED: %d\n",status);
 	    exit( EXIT_FAILURE );
 	}
 
@@ -377,11 +822,12 @@ mql_command_level(const char* host, int port,
 	break;
     } while(0);
 
-    // Do not wait for result.
+    // Do not wait for result, but let the transport send it.
+    mql_transport_destroy(tp);
 }
 
 void
-mql_count_connect_callback(struct mosquitto *mqc, void *obj, int result)
+mql_count_connect_callback(mql_transport_t* tp, void *obj, int result)
 {
     DD ("%s: \"%s\"\n",__func__, subscribe_topic);
     mql_sub(subscribe_topic);
@@ -390,7 +836,7 @@ mql_count_connect_callback(struct mosquitto *mqc, void *obj, int result)
 
 
 void
-mql_count_disconnect_callback(struct mosquitto *mqc, void *obj, int result)
+mql_count_disconnect_callback(mql_transport_t* tp, void *obj, int result)
 {
     printf("MQTT Disonnected: %d\n", result);
     set_connected(false);
@@ -398,27 +844,22 @@ mql_count_disconnect_callback(struct mosquitto *mqc, void *obj, int result)
 
 void
 mql_count_init(const char* host, int port )
-	/* Initialise the mosquitto lib */
+	/* Initialise the transport */
 {
     int i;
-    i = mosquitto_lib_init();
-    if ( i != MOSQ_ERR_SUCCESS) {
-	perror("mosquitto_lib_init: ");
-	exit( EXIT_FAILURE );
-    }
-    
-    mqc = mosquitto_new(0, true, 0);
-    if ( !mqc ) {
-	perror("mosquitto_new: ");
+    tp = mql_transport_new(transport_spec);
+    if ( !tp ) {
+	printf("Bad transport: \"%s\"\n", transport_spec);
 	exit( EXIT_FAILURE );
     }
 
-    mosquitto_connect_callback_set(mqc, mql_count_connect_callback);
-    mosquitto_disconnect_callback_set(mqc, mql_count_disconnect_callback);
+    mql_transport_callbacks(tp, mql_count_connect_callback,
+			    mql_count_disconnect_callback,
+			    0, 0);
 
-    i = mosquitto_connect(mqc, host, port, 60);
-    if ( i != MOSQ_ERR_SUCCESS) {
-	perror("mosquitto_connect: ");
+    i = mql_transport_connect(tp, host, port);
+    if ( i ) {
+	perror("mql_transport_connect: ");
 	exit( EXIT_FAILURE );
     }
 
@@ -444,10 +885,10 @@ mql_command_count(const char* host, int port,
     
     mql_count_init(host,port);
 
-    i = mosquitto_loop_start(mqc);
-    if(i != MOSQ_ERR_SUCCESS){
-	mosquitto_destroy(mqc);
-	fprintf(stderr, "Error: %s\n", mosquitto_strerror(i));
+    i = mql_transport_loop_start(tp);
+    if ( i ) {
+	mql_transport_destroy(tp);
+	fprintf(stderr, "Error: %s\n", "Can not start transport");
 	exit( EXIT_FAILURE );
     }
 
@@ -456,7 +897,7 @@ mql_command_count(const char* host, int port,
 	char val[MQL_BUFFER_LEN+1];
 	int lval;
 
-	/* Do nothing, all happens in the mosquitto thread. */
+	/* Do nothing, all happens in the transport thread. */
 	if ( opt_d && (n < 5) )
 	    printf("loop: %d\n",n++);
 
@@ -467,14 +908,14 @@ mql_command_count(const char* host, int port,
 	    printf("Bad message len, %d, expected 5 or more!\n",lval);
 	    exit( EXIT_FAILURE );
 	}
-	status = mosquitto_publish(mqc, 0,
-				   topic, 
-				   lval,
-				   val,
-				   0,
-				   false ); /* retain is ON */
-	if ( status != MOSQ_ERR_SUCCESS ) {
-	    printf("mosquitto_publish FAILED: %d\n",status);
+	status = mql_transport_publish(tp,
+				       topic, 
+				       lval,
+				       val,
+				       0,
+				       0 ); /* retain is OFF */
+	if ( status ) {
+	    printf("mql_transport_publish FAILED: %d\n",status);
 	    exit( EXIT_FAILURE );
 	}
 
@@ -493,5 +934,6 @@ mql_command_count(const char* host, int port,
 	break;
     } while(0);
 
-    // Do not wait for result.
+    // Do not wait for result, but let the transport send it.
+    mql_transport_destroy(tp);
 }
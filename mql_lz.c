@@ -0,0 +1,254 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_lz.c
+ * Description     : Mqtt Logging, small LZ77 compressor
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:57:00 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:19:32 2026
+ * Update Count    : 2
+ */
+
+/*
+ * Greedy, one hash table entry per 4-byte prefix, as LZ4 at its fastest
+ * level.  Log messages repeat a lot, that is enough for 3-5 times.  The
+ * hc variant, for data rewritten when it is old, keeps a chain of earlier
+ * positions per hash as LZ4 HC does and takes the longest match of the
+ * last LZ_HC_DEPTH.
+ */
+
+#include "mql_lz.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define LZ_HASH_BITS	(14)
+#define LZ_MIN_MATCH	(4)
+#define LZ_MAX_OFF	(65535)
+#define LZ_HC_BITS	(15)
+#define LZ_HC_DEPTH	(64)		/* Matches tried per position */
+
+
+typedef struct {
+    uint32_t	head[ 1 << LZ_HC_BITS ];	/* Last position per hash */
+    uint16_t	chain[ LZ_MAX_OFF + 1 ];	/* Back to the one before */
+} lz_hc_t;
+
+
+static uint32_t
+lz_read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy( &v, p, sizeof(v) );
+    return v;
+}
+
+// Length beyond the token, 255 per byte until one is smaller.
+static uint8_t*
+lz_len(uint8_t* op, size_t n)
+{
+    while ( n >= 255 ) {
+	*op++ = 255;
+	n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+// A sequence, match length m 0 for the last one.
+static uint8_t*
+lz_seq(uint8_t* op, const uint8_t* lit, size_t n_lit, size_t off, size_t m)
+{
+    uint8_t* tok = op++;
+    size_t ml = m ? m - LZ_MIN_MATCH : 0;
+
+    *tok = (n_lit < 15 ? n_lit : 15) << 4 | (ml < 15 ? ml : 15);
+    if ( n_lit >= 15 )
+	op = lz_len(op, n_lit - 15);
+    memcpy( op, lit, n_lit );
+    op += n_lit;
+    if ( !m )
+	return op;
+    *op++ = off & 255;
+    *op++ = off >> 8;
+    if ( ml >= 15 )
+	op = lz_len(op, ml - 15);
+    return op;
+}
+
+size_t
+mql_lz_compress(const void* src, size_t n, void* dst)
+{
+    const uint8_t* s = src;
+    uint8_t* op = dst;
+    uint32_t tab[ 1 << LZ_HASH_BITS ];
+    size_t anchor = 0, i = 0;
+
+    memset( tab, 0, sizeof(tab) );
+    while ( i + LZ_MIN_MATCH <= n ) {
+	uint32_t v = lz_read32(s + i);
+	uint32_t h = (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+	size_t c = tab[h];
+	size_t m;
+
+	tab[h] = i;
+	if ( c >= i || i - c > LZ_MAX_OFF || lz_read32(s + c) != v ) {
+	    ++i;
+	    continue;
+	}
+	for ( m = LZ_MIN_MATCH; i + m < n && s[c + m] == s[i + m]; ++m )
+	    ;
+	op = lz_seq(op, s + anchor, i - anchor, i - c, m);
+	i += m;
+	anchor = i;
+    }
+    op = lz_seq(op, s + anchor, n - anchor, 0, 0);
+    return op - (uint8_t*)dst;
+}
+
+static uint32_t
+lz_hc_hash(const uint8_t* p)
+{
+    return (lz_read32(p) * 2654435761U) >> (32 - LZ_HC_BITS);
+}
+
+// Chain the positions from *next up to i.
+static void
+lz_hc_insert(lz_hc_t* t, const uint8_t* s, size_t* next, size_t i)
+{
+    for ( ; *next < i; ++*next ) {
+	uint32_t h = lz_hc_hash(s + *next);
+	size_t d = *next - t->head[h];
+	t->chain[ *next & LZ_MAX_OFF ] = d > LZ_MAX_OFF ? 0 : d;
+	t->head[h] = *next;
+    }
+}
+
+// Longest match at i of the chain, its offset in *off.
+//	RETURNS	match length, < LZ_MIN_MATCH none
+static size_t
+lz_hc_find(const lz_hc_t* t, const uint8_t* s, size_t n, size_t i, size_t* off)
+{
+    uint32_t v = lz_read32(s + i);
+    size_t c = t->head[ lz_hc_hash(s + i) ];
+    size_t best = 0, m, d;
+    unsigned depth;
+
+    for ( depth = LZ_HC_DEPTH; depth && c < i && i - c <= LZ_MAX_OFF; --depth ) {
+	if ( i + best < n && s[c + best] == s[i + best]
+	     && lz_read32(s + c) == v ) {
+	    for ( m = LZ_MIN_MATCH; i + m < n && s[c + m] == s[i + m]; ++m )
+		;
+	    if ( m > best ) {
+		best = m;
+		*off = i - c;
+	    }
+	}
+	d = t->chain[ c & LZ_MAX_OFF ];
+	if ( !d || d > c )
+	    break;
+	c -= d;
+    }
+    return best;
+}
+
+size_t
+mql_lz_compress_hc(const void* src, size_t n, void* dst)
+{
+    const uint8_t* s = src;
+    uint8_t* op = dst;
+    lz_hc_t* t = calloc(1, sizeof(lz_hc_t));
+    size_t anchor = 0, i = 0, next = 0;
+    size_t m, off = 0, m2, off2 = 0;
+
+    if ( !t )
+	return mql_lz_compress(src, n, dst);
+    while ( i + LZ_MIN_MATCH <= n ) {
+	lz_hc_insert(t, s, &next, i);
+	m = lz_hc_find(t, s, n, i, &off);
+	if ( m < LZ_MIN_MATCH ) {
+	    ++i;
+	    continue;
+	}
+	/* A longer match a byte on is worth a literal. */
+	while ( i + 1 + LZ_MIN_MATCH <= n ) {
+	    lz_hc_insert(t, s, &next, i + 1);
+	    m2 = lz_hc_find(t, s, n, i + 1, &off2);
+	    if ( m2 <= m )
+		break;
+	    ++i;
+	    m = m2;
+	    off = off2;
+	}
+	op = lz_seq(op, s + anchor, i - anchor, off, m);
+	i += m;
+	anchor = i;
+    }
+    op = lz_seq(op, s + anchor, n - anchor, 0, 0);
+    free(t);
+    return op - (uint8_t*)dst;
+}
+
+long
+mql_lz_decompress(const void* src, size_t n, void* dst, size_t cap)
+{
+    const uint8_t* ip = src;
+    const uint8_t* ie = ip + n;
+    uint8_t* o = dst;
+    uint8_t* op = o;
+    uint8_t* oe = o + cap;
+    size_t lit, ml, off;
+    uint8_t b;
+
+    while ( ip < ie ) {
+	uint8_t tok = *ip++;
+
+	lit = tok >> 4;
+	if ( lit == 15 )
+	    do {
+		if ( ip == ie )
+		    return -1;
+		b = *ip++;
+		lit += b;
+	    } while ( b == 255 );
+	if ( lit > (size_t)(ie - ip) || lit > (size_t)(oe - op) )
+	    return -1;
+	memcpy( op, ip, lit );
+	op += lit;
+	ip += lit;
+	if ( ip == ie )
+	    break;			/* The last sequence */
+
+	if ( ie - ip < 2 )
+	    return -1;
+	off = ip[0] | ip[1] << 8;
+	ip += 2;
+	ml = (tok & 15) + LZ_MIN_MATCH;
+	if ( (tok & 15) == 15 )
+	    do {
+		if ( ip == ie )
+		    return -1;
+		b = *ip++;
+		ml += b;
+	    } while ( b == 255 );
+	if ( !off || off > (size_t)(op - o) || ml > (size_t)(oe - op) )
+	    return -1;
+	if ( off >= ml ) {
+	    memcpy( op, op - off, ml );
+	    op += ml;
+	}
+	else {
+	    /* Overlapping, a repeated run. */
+	    while ( ml-- ) {
+		*op = *(op - off);
+		++op;
+	    }
+	}
+    }
+    return op - o;
+}
@@ -0,0 +1,58 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_lz.h
+ * Description     : Mqtt Logging, small LZ77 compressor
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:57:00 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:19:32 2026
+ * Update Count    : 2
+ */
+
+#ifndef __MQL_LZ_H__
+#define __MQL_LZ_H__ (1)
+
+/*
+ * Byte-oriented LZ77 for the text column of columnar files, fast to
+ * decompress and without a library to depend on.  A block is a list of
+ * sequences:
+ *
+ *	token		literals << 4 | (match length - 4), 15 = more
+ *	[255...]	more literal length, bytes until one is < 255
+ *	literals
+ *	offset		2 bytes, little endian, 1..65535 back
+ *	[255...]	more match length
+ *
+ * The last sequence has literals only.  The same block format as LZ4.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest compressed size of n bytes.
+#define MQL_LZ_BOUND(n)	((n) + (n) / 255 + 16)
+
+// Compress n bytes of src to dst, which has room for MQL_LZ_BOUND(n).
+//	RETURNS	compressed size
+size_t mql_lz_compress(const void* src, size_t n, void* dst);
+
+// The same, slower for a smaller block: the longest of the last matches
+// of a hash chain, one byte lazy.  The same format and decompressor.
+//	RETURNS	compressed size
+size_t mql_lz_compress_hc(const void* src, size_t n, void* dst);
+
+// Decompress a block of n bytes to dst of cap bytes.
+//	RETURNS	decompressed size, -1 for a damaged block
+long mql_lz_decompress(const void* src, size_t n, void* dst, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
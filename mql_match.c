@@ -0,0 +1,215 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_match.c
+ * Description     : Mqtt Logging, multi-pattern substring search
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:48:17 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:48:17 2026
+ * Update Count    : 1
+ */
+
+#define _GNU_SOURCE			/* memmem */
+
+#include "mql_match.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+struct mql_match {
+    unsigned	flags;
+    unsigned	n_pat;
+    char*	pat[ MQL_MATCH_MAX ];
+    unsigned	pat_len[ MQL_MATCH_MAX ];
+    size_t	bytes;
+
+    /* Built. */
+    unsigned	n_states;
+    uint16_t*	delta;			/* [state][byte], full */
+    uint64_t*	out;			/* Patterns ending in a state */
+    int		first;			/* The only first byte, or -1 */
+    unsigned	lead;			/* Longest pattern */
+};
+
+
+static unsigned char
+match_fold(const mql_match_t* m, unsigned char c)
+{
+    if ( (m->flags & MQL_MATCH_NOCASE) && 'A' <= c && c <= 'Z' )
+	return c + 'a' - 'A';
+    return c;
+}
+
+mql_match_t*
+mql_match_new(unsigned flags)
+{
+    mql_match_t* m = calloc(1, sizeof(mql_match_t));
+    if ( m )
+	m->flags = flags;
+    return m;
+}
+
+int
+mql_match_add(mql_match_t* m, const char* pat, unsigned len)
+{
+    unsigned i;
+
+    if ( m->n_pat == MQL_MATCH_MAX || m->bytes + len > MQL_MATCH_BYTES
+	 || m->delta )
+	return -1;
+    m->pat[ m->n_pat ] = malloc(len + 1);
+    if ( !m->pat[ m->n_pat ] )
+	return -1;
+    for ( i = 0; i < len; ++i )
+	m->pat[ m->n_pat ][i] = match_fold(m, pat[i]);
+    m->pat_len[ m->n_pat ] = len;
+    m->bytes += len;
+    return m->n_pat++;
+}
+
+int
+mql_match_build(mql_match_t* m)
+{
+    unsigned max = m->bytes + 1;
+    uint16_t* fail;
+    uint16_t* queue;
+    unsigned qh = 0, qt = 0;
+    unsigned p, i, c, s;
+
+    m->delta = calloc((size_t)max * 256, sizeof(uint16_t));
+    m->out = calloc(max, sizeof(uint64_t));
+    fail = calloc(max, sizeof(uint16_t));
+    queue = calloc(max, sizeof(uint16_t));
+    if ( !m->delta || !m->out || !fail || !queue ) {
+	free(fail);
+	free(queue);
+	free(m->delta);
+	free(m->out);
+	m->delta = 0;
+	m->out = 0;
+	return -1;
+    }
+
+    /* The trie, 0 is the root and no child. */
+    m->n_states = 1;
+    for ( p = 0; p < m->n_pat; ++p ) {
+	s = 0;
+	for ( i = 0; i < m->pat_len[p]; ++i ) {
+	    uint16_t* t = &m->delta[ s * 256 + (unsigned char)m->pat[p][i] ];
+	    if ( !*t )
+		*t = m->n_states++;
+	    s = *t;
+	}
+	m->out[s] |= 1ULL << p;
+    }
+
+    /* Failure links breadth first, filling in the missing moves. */
+    for ( c = 0; c < 256; ++c )
+	if ( m->delta[c] )
+	    queue[ qt++ ] = m->delta[c];
+    while ( qh < qt ) {
+	s = queue[ qh++ ];
+	m->out[s] |= m->out[ fail[s] ];
+	for ( c = 0; c < 256; ++c ) {
+	    uint16_t* t = &m->delta[ s * 256 + c ];
+	    uint16_t f = m->delta[ fail[s] * 256 + c ];
+	    if ( *t ) {
+		fail[*t] = f;
+		queue[ qt++ ] = *t;
+	    }
+	    else {
+		*t = f;
+	    }
+	}
+    }
+    free(fail);
+    free(queue);
+
+    /* Upper case moves as lower case. */
+    if ( m->flags & MQL_MATCH_NOCASE )
+	for ( s = 0; s < m->n_states; ++s )
+	    for ( c = 'A'; c <= 'Z'; ++c )
+		m->delta[ s * 256 + c ] = m->delta[ s * 256 + c + 'a' - 'A' ];
+
+    for ( p = 0; p < m->n_pat; ++p )
+	if ( m->pat_len[p] > m->pat_len[ m->lead ] )
+	    m->lead = p;
+    m->first = -1;
+    for ( c = 0; c < 256; ++c ) {
+	if ( !m->delta[c] )
+	    continue;
+	if ( m->first >= 0 ) {
+	    m->first = -1;
+	    break;
+	}
+	m->first = c;
+    }
+    return 0;
+}
+
+uint64_t
+mql_match_all(const mql_match_t* m)
+{
+    return m->n_pat == 64 ? ~0ULL : (1ULL << m->n_pat) - 1;
+}
+
+uint64_t
+mql_match_scan(const mql_match_t* m, const char* text, size_t len,
+	       uint64_t want)
+{
+    const unsigned char* p = (const unsigned char*)text;
+    const unsigned char* e = p + len;
+    const uint16_t* d = m->delta;
+    uint64_t found = m->out[0];		/* Empty patterns */
+    unsigned s = 0;
+
+    /* The rarest is likely the longest, and without it want is lost. */
+    if ( !(m->flags & MQL_MATCH_NOCASE)
+	 && (m->n_pat == 1 || (want >> m->lead & 1))
+	 && !memmem(text, len, m->pat[ m->lead ], m->pat_len[ m->lead ]) )
+	return found;
+    if ( !(m->flags & MQL_MATCH_NOCASE) && m->n_pat == 1 )
+	return 1;
+
+    while ( p < e ) {
+	if ( !s ) {
+	    /* Nothing started, skip to a first byte. */
+	    if ( m->first >= 0 ) {
+		p = memchr(p, m->first, e - p);
+		if ( !p )
+		    break;
+	    }
+	    else {
+		while ( p < e && !d[*p] )
+		    ++p;
+		if ( p == e )
+		    break;
+	    }
+	}
+	s = d[ s * 256 + *p++ ];
+	if ( m->out[s] ) {
+	    found |= m->out[s];
+	    if ( want && (found & want) == want )
+		break;
+	}
+    }
+    return found;
+}
+
+void
+mql_match_free(mql_match_t* m)
+{
+    unsigned i;
+
+    if ( !m )
+	return;
+    for ( i = 0; i < m->n_pat; ++i )
+	free(m->pat[i]);
+    free(m->delta);
+    free(m->out);
+    free(m);
+}
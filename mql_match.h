@@ -0,0 +1,70 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_match.h
+ * Description     : Mqtt Logging, multi-pattern substring search
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:48:17 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:48:17 2026
+ * Update Count    : 1
+ */
+
+#ifndef __MQL_MATCH_H__
+#define __MQL_MATCH_H__ (1)
+
+/*
+ * Finds which of a set of byte strings occur in a text, in one pass.
+ * Patterns are compiled into an Aho-Corasick automaton with a full
+ * transition table.  Outside of a match the scan jumps with memchr() when
+ * all patterns start with the same byte, and a single pattern is searched
+ * with memmem(), as is the longest pattern first when all are wanted.
+ * Both are vectorised in the C library.
+ *
+ * A compiled matcher is read-only and may be used by many threads.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mql_match mql_match_t;
+
+#define MQL_MATCH_MAX		(64)	/* Patterns, a bit each */
+#define MQL_MATCH_BYTES		(4096)	/* All patterns together */
+
+#define MQL_MATCH_NOCASE	(1)	/* ASCII letters in any case */
+
+// New matcher without patterns.
+//	RETURNS	matcher, or 0 out of memory
+mql_match_t* mql_match_new(unsigned flags);
+
+// Add a pattern, before mql_match_build().
+//	RETURNS	id of the pattern, its bit in scan results, -1 too many
+int mql_match_add(mql_match_t* m, const char* pat, unsigned len);
+
+// Compile the patterns.
+//	RETURNS	0 OK, -1 out of memory
+int mql_match_build(mql_match_t* m);
+
+// Patterns that occur in text, bit (1 << id) each.  Stops early once all
+// of want are found, or once one of them is known to be missing, so other
+// bits may be left out.
+uint64_t mql_match_scan(const mql_match_t* m, const char* text, size_t len,
+			uint64_t want);
+
+// All patterns, (1 << n) - 1.
+uint64_t mql_match_all(const mql_match_t* m);
+
+void mql_match_free(mql_match_t* m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
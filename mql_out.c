@@ -0,0 +1,786 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_out.c
+ * Description     : Listener output thread and formatter
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:35:10 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:13:17 2026
+ * Update Count    : 5
+ */
+
+
+/*
+ * Messages are copied into a queue per severity, entry after entry in
+ * blocks, under a mutex held only for the copy.  The output thread moves
+ * a chunk of the oldest entries, by sequence number over all queues, to
+ * a buffer of its own, formats them into a chunk without the lock and
+ * writes the chunk when it is full, and when the queues are empty.
+ *
+ * With a bound, when an entry would take the queued bytes over it the
+ * receiving thread waits for the output thread, or drops the oldest
+ * entry of all, or the oldest of the least severe queue, or the new one
+ * when it is less severe than all queued, until it fits.  Drops are
+ * counted per source and severity for mql_out_report().
+ *
+ * Lines are those listen always printed,
+ *	<id, at least 16> : <sev hex> : <sev name, 9> : "<text>"
+ * the text up to a '\0' as printf("%s") would.  JSON is
+ *	{"rx_ns":<ns>,"id":"<id>","sev":<n>,"severity":"<name>","text":"<text>"}
+ * without rx_ns unless asked for, escaped straight into the chunk.
+ */
+
+#include "mql.h"
+#include "mql_sdt.h"
+#include "mql_out.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+extern int opt_d;
+#define DD if(opt_d)printf
+
+extern const char* mql_sev_name[MQL_S_MAX];
+
+MQL_PROBE_DEFINE(listen_print);
+
+#define OUT_CHUNK	(256 * 1024)	/* Written when this full */
+#define OUT_TAKE	(256 * 1024)	/* Taken from the queues at a time */
+#define OUT_BLOCK	(64 * 1024)
+#define OUT_POOL	(16)		/* Free blocks kept */
+#define OUT_SOURCES	(1024)		/* Drop counts, the rest as one */
+#define OUT_ID_W	(16)
+#define OUT_SEV_W	(9)
+
+typedef struct {
+    uint32_t	len;			/* Of the entry, padded to 8 */
+    uint32_t	text_len;
+    uint8_t	kind;			/* MQL_OUT_... */
+    uint8_t	sev;
+    uint8_t	id_len;
+    uint8_t	reserved[ 5 ];
+    uint64_t	t1;
+    uint64_t	rx_ns;			/* With out_timestamp */
+    uint64_t	seq;			/* Order over all queues */
+} out_ent_t;
+
+#define OUT_ENT_LEN(id_len,text_len) \
+    ((sizeof(out_ent_t) + (id_len) + (text_len) + 7) & ~(size_t)7)
+
+typedef struct out_block {
+    struct out_block* next;
+    size_t	size;			/* Of the entries after the header */
+    size_t	head;			/* First entry */
+    size_t	tail;			/* After the last */
+} out_block_t;
+
+#define OUT_HEAD(b)	((out_ent_t*)((char*)((b) + 1) + (b)->head))
+
+typedef struct {
+    out_block_t* first;
+    out_block_t* last;
+} out_queue_t;
+
+typedef struct {
+    char	id[ MQL_ID_MAX_LEN + 1 ];
+    uint64_t	n[ MQL_S_MAX ];
+    uint64_t	reported[ MQL_S_MAX ];
+} out_drop_t;
+
+static out_queue_t out_q[ MQL_S_MAX ];
+static unsigned out_mask;		/* Bit per queue with entries */
+static out_block_t* out_pool;
+static unsigned out_n_pool;
+static size_t out_bytes;		/* Queued */
+static size_t out_max;			/* 0 no bound */
+static unsigned out_policy;
+static uint64_t out_seq;
+static uint64_t out_lost;		/* No memory for them */
+static int out_waiting;			/* The output thread */
+static int out_full;			/* Receivers waiting for room */
+static int out_stop;
+static pthread_mutex_t out_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t out_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t out_room = PTHREAD_COND_INITIALIZER;
+static pthread_t out_tid;
+
+static out_drop_t* out_drop[ OUT_SOURCES ];
+static unsigned out_n_drop;
+static out_drop_t out_drop_other = { "(other)" };
+
+static unsigned out_format = MQL_OUT_LINE;
+static int out_timestamp;
+static int out_fd = -1;
+static char* out_chunk;
+static size_t out_n;			/* In out_chunk */
+static char out_sev[ MQL_S_MAX ][ OUT_SEV_W + 1 ];
+
+
+static void
+out_write(const char* p, size_t n)
+{
+    ssize_t k;
+
+    while ( n ) {
+	k = write(out_fd, p, n);
+	if ( k < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("listen: write: ");
+	    exit( EXIT_FAILURE );
+	}
+	p += k;
+	n -= k;
+    }
+}
+
+static void
+out_flush(void)
+{
+    out_write( out_chunk, out_n );
+    out_n = 0;
+}
+
+// Add bytes to the chunk, those longer than a chunk written directly.
+static void
+out_add(const void* s, size_t n)
+{
+    if ( n > OUT_CHUNK - out_n ) {
+	out_flush();
+	if ( n > OUT_CHUNK ) {
+	    out_write( s, n );
+	    return;
+	}
+    }
+    memcpy( out_chunk + out_n, s, n );
+    out_n += n;
+}
+
+static void
+out_line(const char* id, unsigned id_len, unsigned sev,
+	 const char* text, size_t len)
+{
+    char* p;
+    const char* e;
+
+    e = memchr(text, '\0', len);
+    if ( e )
+	len = e - text;
+
+    /* Common case, the whole line fits. */
+    if ( len + 64 > OUT_CHUNK - out_n )
+	out_flush();
+    if ( len + 64 <= OUT_CHUNK ) {
+	p = out_chunk + out_n;
+	memcpy( p, id, id_len );
+	p += id_len;
+	while ( id_len++ < OUT_ID_W )
+	    *p++ = ' ';
+	memcpy( p, " : ", 3 );
+	p[3] = "0123456789abcdef"[ sev & 15 ];
+	memcpy( p + 4, " : ", 3 );
+	memcpy( p + 7, out_sev[ sev & 15 ], OUT_SEV_W );
+	memcpy( p + 7 + OUT_SEV_W, " : \"", 4 );
+	p += 11 + OUT_SEV_W;
+	memcpy( p, text, len );
+	p += len;
+	*p++ = '"';
+	*p++ = '\n';
+	out_n = p - out_chunk;
+	return;
+    }
+
+    /* A line longer than the chunk. */
+    out_line(id, id_len, sev, "", 0);
+    out_n -= 2;
+    out_add( text, len );
+    out_add( "\"\n", 2 );
+}
+
+// Escapes of the bytes of JSON strings, 0 for none, 'u' for \u00XX.
+static const char out_esc[ 256 ] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    ['\\'] = '\\'
+};
+
+// Length of the UTF-8 sequence at p, of at most n bytes.
+//	RETURNS	1-4, 0 not valid: overlong, a surrogate, past U+10FFFF
+//		or cut short
+static unsigned
+out_utf8(const unsigned char* p, size_t n)
+{
+    unsigned k, i;
+    uint32_t u, min;
+
+    if ( *p < 0x80 )
+	return 1;
+    if ( *p < 0xc2 )
+	return 0;
+    else if ( *p < 0xe0 )
+	k = 2, u = *p & 0x1f, min = 0x80;
+    else if ( *p < 0xf0 )
+	k = 3, u = *p & 0x0f, min = 0x800;
+    else if ( *p < 0xf5 )
+	k = 4, u = *p & 0x07, min = 0x10000;
+    else
+	return 0;
+    if ( n < k )
+	return 0;
+    for ( i = 1; i < k; ++i ) {
+	if ( (p[i] & 0xc0) != 0x80 )
+	    return 0;
+	u = u << 6 | (p[i] & 0x3f);
+    }
+    if ( u < min || u > 0x10ffff || (u >= 0xd800 && u < 0xe000) )
+	return 0;
+    return k;
+}
+
+// Add s[len] as the inside of a JSON string.  Valid UTF-8 is copied as
+// it is, any other byte from 0x80 becomes \ufffd, so that the output is
+// always valid JSON.
+static void
+out_json_str(const char* s, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)s;
+    const unsigned char* end = p + len;
+    const unsigned char* e;
+    unsigned k;
+    size_t n;
+    char* d;
+    char c;
+
+    while ( p < end ) {
+	/* At most 6 bytes out for each that starts a character. */
+	n = end - p < OUT_CHUNK / 8 ? end - p : OUT_CHUNK / 8;
+	if ( n * 6 > OUT_CHUNK - out_n )
+	    out_flush();
+	d = out_chunk + out_n;
+	for ( e = p + n; p < e; ) {
+	    if ( *p >= 0x80 ) {
+		/* May end past e, never past end. */
+		k = out_utf8(p, end - p);
+		if ( k ) {
+		    memcpy( d, p, k );
+		    d += k;
+		    p += k;
+		}
+		else {
+		    memcpy( d, "\\ufffd", 6 );
+		    d += 6;
+		    ++p;
+		}
+		continue;
+	    }
+	    c = out_esc[ *p ];
+	    if ( !c ) {
+		*d++ = *p;
+	    }
+	    else if ( c != 'u' ) {
+		*d++ = '\\';
+		*d++ = c;
+	    }
+	    else {
+		memcpy( d, "\\u00", 4 );
+		d[4] = "0123456789abcdef"[ *p >> 4 ];
+		d[5] = "0123456789abcdef"[ *p & 15 ];
+		d += 6;
+	    }
+	    ++p;
+	}
+	out_n = d - out_chunk;
+    }
+}
+
+// Add a number.
+static void
+out_u64(uint64_t v)
+{
+    char b[ 20 ];
+    unsigned i = sizeof(b);
+
+    do {
+	b[ --i ] = '0' + v % 10;
+	v /= 10;
+    } while ( v );
+    out_add( b + i, sizeof(b) - i );
+}
+
+static void
+out_json(const char* id, unsigned id_len, unsigned sev,
+	 const char* text, size_t len, uint64_t rx_ns)
+{
+    const char* e;
+
+    e = memchr(text, '\0', len);
+    if ( e )
+	len = e - text;
+
+    if ( out_timestamp ) {
+	out_add( "{\"rx_ns\":", 9 );
+	out_u64( rx_ns );
+	out_add( ",\"id\":\"", 7 );
+    }
+    else {
+	out_add( "{\"id\":\"", 7 );
+    }
+    out_json_str( id, id_len );
+    out_add( "\",\"sev\":", 8 );
+    out_u64( sev & 15 );
+    out_add( ",\"severity\":\"", 13 );
+    out_add( mql_sev_name[ sev & 15 ], strlen(mql_sev_name[ sev & 15 ]) );
+    out_add( "\",\"text\":\"", 10 );
+    out_json_str( text, len );
+    out_add( "\"}\n", 3 );
+}
+
+static void
+out_bin(const char* id, unsigned id_len, unsigned sev,
+	const char* text, size_t len, uint64_t rx_ns)
+{
+    mql_out_bin_t r;
+    const char* e;
+
+    e = memchr(text, '\0', len);
+    if ( e )
+	len = e - text;
+
+    memset( &r, 0, sizeof(r) );
+    r.len = sizeof(r) + id_len + len;
+    r.sev = sev & 15;
+    r.id_len = id_len;
+    r.rx_ns = rx_ns;
+    out_add( &r, sizeof(r) );
+    out_add( id, id_len );
+    out_add( text, len );
+}
+
+// A message in the format asked for.
+static void
+out_message(const out_ent_t* e, const char* id, const char* text, size_t len)
+{
+    switch ( out_format ) {
+    case MQL_OUT_NDJSON:
+	out_json(id, e->id_len, e->sev, text, len, e->rx_ns);
+	break;
+    case MQL_OUT_BIN:
+	out_bin(id, e->id_len, e->sev, text, len, e->rx_ns);
+	break;
+    default:
+	out_line(id, e->id_len, e->sev, text, len);
+	break;
+    }
+}
+
+// Any other line, to stderr unless lines are written.
+static void
+out_note(const char* s, size_t n)
+{
+    if ( out_format == MQL_OUT_LINE )
+	out_add( s, n );
+    else
+	fwrite( s, 1, n, stderr );
+}
+
+static void
+out_entry(const out_ent_t* e)
+{
+    const char* id = (const char*)(e + 1);
+    const char* text = id + e->id_len;
+    const char* r;
+    int rlen;
+    int pos = 0;
+    int i;
+    char line[ 128 ];
+
+    switch ( e->kind ) {
+    case MQL_OUT_REC:
+	out_message(e, id, text, e->text_len);
+	break;
+    case MQL_OUT_BATCH:
+	while ( (i = mql_batch_next(text, e->text_len, &pos, &r, &rlen)) > 0 )
+	    out_message(e, id, r, rlen);
+	if ( i < 0 ) {
+	    i = snprintf(line, sizeof(line),
+			 "Error: Malformed batch from \"%.*s\"!\n\n",
+			 (int)e->id_len, id);
+	    out_note( line, i );
+	}
+	break;
+    default:
+	out_note( text, e->text_len );
+	out_note( "\n", 1 );
+	break;
+    }
+    if ( e->t1 )
+	MQL_PROBE3(listen_print, e->sev, e->text_len, mql_probe_ns() - e->t1);
+}
+
+
+/*
+ * The queues, all under out_mtx.
+ */
+
+static out_block_t*
+out_block(size_t need)
+{
+    out_block_t* b;
+
+    if ( need <= OUT_BLOCK && out_pool ) {
+	b = out_pool;
+	out_pool = b->next;
+	--out_n_pool;
+    }
+    else {
+	if ( need < OUT_BLOCK )
+	    need = OUT_BLOCK;
+	b = malloc(sizeof(out_block_t) + need);
+	if ( !b )
+	    return 0;
+	b->size = need;
+    }
+    b->next = 0;
+    b->head = b->tail = 0;
+    return b;
+}
+
+static void
+out_release(out_block_t* b)
+{
+    if ( b->size == OUT_BLOCK && out_n_pool < OUT_POOL ) {
+	b->next = out_pool;
+	out_pool = b;
+	++out_n_pool;
+    }
+    else {
+	free(b);
+    }
+}
+
+// Remove the first entry of queue s.
+static void
+out_pop(unsigned s)
+{
+    out_queue_t* q = &out_q[s];
+    out_block_t* b = q->first;
+    uint32_t len = OUT_HEAD(b)->len;
+
+    b->head += len;
+    out_bytes -= len;
+    if ( b->head == b->tail ) {
+	q->first = b->next;
+	if ( !q->first ) {
+	    q->last = 0;
+	    out_mask &= ~(1U << s);
+	}
+	out_release(b);
+    }
+}
+
+// The queue with the oldest entry.
+static unsigned
+out_oldest(void)
+{
+    unsigned m = out_mask & (out_mask - 1);
+    unsigned s = __builtin_ctz(out_mask);
+    unsigned i;
+
+    for ( ; m; m &= m - 1 ) {
+	i = __builtin_ctz(m);
+	if ( OUT_HEAD(out_q[i].first)->seq < OUT_HEAD(out_q[s].first)->seq )
+	    s = i;
+    }
+    return s;
+}
+
+// Count a dropped message.
+static void
+out_dropped(const char* id, unsigned id_len, unsigned sev)
+{
+    unsigned h = 2166136261U;
+    unsigned i;
+    out_drop_t** d;
+
+    for ( i = 0; i < id_len; ++i )
+	h = (h ^ (unsigned char)id[i]) * 16777619U;
+    for ( i = 0; i < OUT_SOURCES; ++i ) {
+	d = &out_drop[ (h + i) % OUT_SOURCES ];
+	if ( !*d ) {
+	    if ( out_n_drop >= OUT_SOURCES / 2 )
+		break;
+	    *d = calloc(1, sizeof(out_drop_t));
+	    if ( !*d )
+		break;
+	    memcpy( (*d)->id, id, id_len );
+	    ++out_n_drop;
+	}
+	if ( !strncmp((*d)->id, id, id_len) && !(*d)->id[id_len] ) {
+	    ++(*d)->n[sev];
+	    return;
+	}
+    }
+    ++out_drop_other.n[sev];
+}
+
+// Drop the first entry of queue s.
+static void
+out_drop_first(unsigned s)
+{
+    const out_ent_t* e = OUT_HEAD(out_q[s].first);
+
+    out_dropped( (const char*)(e + 1), e->id_len, e->sev );
+    out_pop(s);
+}
+
+
+static void*
+out_thread(void* arg)
+{
+    char* w = 0;			/* Taken entries */
+    size_t w_max = 0, w_len, pos;
+    out_ent_t* e;
+    unsigned s;
+
+    pthread_mutex_lock( &out_mtx );
+    for (;;) {
+	if ( !out_mask ) {
+	    if ( out_n ) {
+		/* Idle, write what we have. */
+		pthread_mutex_unlock( &out_mtx );
+		out_flush();
+		pthread_mutex_lock( &out_mtx );
+		continue;
+	    }
+	    if ( out_stop )
+		break;
+	    out_waiting = 1;
+	    pthread_cond_wait( &out_cv, &out_mtx );
+	    out_waiting = 0;
+	    continue;
+	}
+
+	/* The oldest entries, as many as make a chunk. */
+	for ( w_len = 0; out_mask && w_len < OUT_TAKE; out_pop(s) ) {
+	    s = out_oldest();
+	    e = OUT_HEAD(out_q[s].first);
+	    if ( w_len + e->len > w_max ) {
+		size_t max = w_max ? w_max * 2 : 2 * OUT_TAKE;
+		char* p;
+		while ( w_len + e->len > max )
+		    max *= 2;
+		p = realloc(w, max);
+		if ( !p ) {
+		    ++out_lost;
+		    continue;
+		}
+		w = p;
+		w_max = max;
+	    }
+	    memcpy( w + w_len, e, e->len );
+	    w_len += e->len;
+	}
+	if ( out_full )
+	    pthread_cond_broadcast( &out_room );
+	pthread_mutex_unlock( &out_mtx );
+
+	for ( pos = 0; pos < w_len; pos += ((out_ent_t*)(w + pos))->len )
+	    out_entry( (out_ent_t*)(w + pos) );
+
+	pthread_mutex_lock( &out_mtx );
+    }
+    pthread_mutex_unlock( &out_mtx );
+    free(w);
+    return 0;
+}
+
+
+void
+mql_out_format(unsigned format, int timestamp)
+{
+    out_format = format;
+    out_timestamp = timestamp;
+}
+
+
+int
+mql_out_start(int fd, size_t max, unsigned policy)
+{
+    unsigned i;
+
+    for ( i = 0; i < MQL_S_MAX; ++i )
+	snprintf( out_sev[i], sizeof(out_sev[i]), "%-*s",
+		  OUT_SEV_W, mql_sev_name[i] );
+    out_fd = fd;
+    out_max = max;
+    out_policy = policy;
+    out_chunk = malloc(OUT_CHUNK);
+    if ( !out_chunk )
+	return -1;
+    if ( out_format == MQL_OUT_BIN )
+	out_add( MQL_OUT_BIN_MAGIC, strlen(MQL_OUT_BIN_MAGIC) );
+    errno = pthread_create(&out_tid, 0, out_thread, 0);
+    return errno ? -1 : 0;
+}
+
+
+void
+mql_out_put(unsigned kind, const char* id, unsigned id_len,
+	    unsigned sev, const char* text, unsigned len, uint64_t t1)
+{
+    size_t need;
+    out_queue_t* q = &out_q[ sev & 15 ];
+    out_block_t* b;
+    out_ent_t* e;
+    struct timespec ts;
+    uint64_t rx_ns = 0;
+    unsigned v;
+    int wake;
+
+    if ( id_len > MQL_ID_MAX_LEN )
+	id_len = MQL_ID_MAX_LEN;
+    sev &= 15;
+    need = OUT_ENT_LEN(id_len, len);
+    if ( out_timestamp && kind != MQL_OUT_TEXT ) {
+	clock_gettime( CLOCK_REALTIME, &ts );
+	rx_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    pthread_mutex_lock( &out_mtx );
+    while ( out_max && out_bytes && out_bytes + need > out_max ) {
+	switch ( out_policy ) {
+	case MQL_OUT_WAIT:
+	    ++out_full;
+	    pthread_cond_wait( &out_room, &out_mtx );
+	    --out_full;
+	    break;
+	case MQL_OUT_OLDEST:
+	    out_drop_first( out_oldest() );
+	    break;
+	default:
+	    v = 31 - __builtin_clz(out_mask);	/* Least severe queued */
+	    if ( sev > v ) {
+		out_dropped(id, id_len, sev);
+		pthread_mutex_unlock( &out_mtx );
+		return;
+	    }
+	    out_drop_first( v );
+	    break;
+	}
+    }
+
+    b = q->last;
+    if ( !b || b->size - b->tail < need ) {
+	b = out_block(need);
+	if ( !b ) {
+	    ++out_lost;
+	    pthread_mutex_unlock( &out_mtx );
+	    return;
+	}
+	if ( q->last )
+	    q->last->next = b;
+	else
+	    q->first = b;
+	q->last = b;
+    }
+    e = (out_ent_t*)((char*)(b + 1) + b->tail);
+    e->len = need;
+    e->text_len = len;
+    e->kind = kind;
+    e->sev = sev;
+    e->id_len = id_len;
+    e->t1 = t1;
+    e->rx_ns = rx_ns;
+    e->seq = out_seq++;
+    memcpy( e + 1, id, id_len );
+    memcpy( (char*)(e + 1) + id_len, text, len );
+    b->tail += need;
+    out_bytes += need;
+    out_mask |= 1U << sev;
+    wake = out_waiting;
+    pthread_mutex_unlock( &out_mtx );
+    if ( wake )
+	pthread_cond_signal( &out_cv );
+}
+
+
+void
+mql_out_text(const char* line)
+{
+    mql_out_put(MQL_OUT_TEXT, "", 0, 0, line, strlen(line), 0);
+}
+
+
+void
+mql_out_stop(void)
+{
+    if ( out_fd < 0 )
+	return;
+    pthread_mutex_lock( &out_mtx );
+    out_stop = 1;
+    pthread_cond_signal( &out_cv );
+    pthread_mutex_unlock( &out_mtx );
+    pthread_join( out_tid, 0 );
+    if ( out_lost )
+	fprintf(stderr, "listen: %llu messages lost, out of memory\n",
+		(unsigned long long)out_lost);
+    out_fd = -1;
+}
+
+
+static void
+out_report_one(FILE* f, const out_drop_t* d, int total)
+{
+    unsigned i;
+    uint64_t n;
+
+    for ( i = 0; i < MQL_S_MAX; ++i ) {
+	n = total ? d->n[i] : d->n[i] - d->reported[i];
+	if ( n )
+	    fprintf(f, "  %-16s : %x : %-9s : %llu\n",
+		    d->id[0] ? d->id : "-", i, mql_sev_name[i],
+		    (unsigned long long)n);
+    }
+}
+
+void
+mql_out_report(FILE* f, int total)
+{
+    uint64_t n = 0, all = 0;
+    unsigned i, j;
+    out_drop_t* d;
+
+    pthread_mutex_lock( &out_mtx );
+    for ( i = 0; i <= OUT_SOURCES; ++i ) {
+	d = i < OUT_SOURCES ? out_drop[i] : &out_drop_other;
+	for ( j = 0; d && j < MQL_S_MAX; ++j ) {
+	    n += d->n[j] - d->reported[j];
+	    all += d->n[j];
+	}
+    }
+    if ( total ? all : n ) {
+	if ( total )
+	    fprintf(f, "Dropped %llu messages in all:\n",
+		    (unsigned long long)all);
+	else
+	    fprintf(f, "Dropped %llu messages, %llu in all:\n",
+		    (unsigned long long)n, (unsigned long long)all);
+	for ( i = 0; i <= OUT_SOURCES; ++i ) {
+	    d = i < OUT_SOURCES ? out_drop[i] : &out_drop_other;
+	    if ( !d )
+		continue;
+	    out_report_one(f, d, total);
+	    memcpy( d->reported, d->n, sizeof(d->n) );
+	}
+    }
+    pthread_mutex_unlock( &out_mtx );
+}
@@ -0,0 +1,97 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_out.h
+ * Description     : Mqtt Logging, listener output thread
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:35:10 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:50:12 2026
+ * Update Count    : 3
+ */
+
+#ifndef __MQL_OUT_H__
+#define __MQL_OUT_H__ (1)
+
+/*
+ * "mql listen" hands each message it gets to an output thread and goes
+ * back to the transport.  The output thread formats the lines and writes
+ * them in large chunks, and writes what it has as soon as there is
+ * nothing more queued, so an idle listener is never behind.
+ *
+ * The queued bytes may be bounded.  When full the receiving thread waits,
+ * which holds up the transport, or messages are dropped and counted per
+ * source and severity.  The chunk being written is not counted.
+ *
+ * Messages are written as lines, as JSON objects one per line, or as
+ * binary records:
+ *
+ *	MQL_OUT_BIN_MAGIC, then for each message
+ *	mql_out_bin_t, id_len bytes of id, len - sizeof(mql_out_bin_t) -
+ *	id_len bytes of text
+ *
+ * in the byte order of the host and with no padding.  The records of a
+ * batch are messages of their own.  In all of them the text ends at a
+ * '\0', if any.  Other lines than messages go to stderr with JSON and
+ * binary output.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_OUT_REC	(0)		/* One log message */
+#define MQL_OUT_BATCH	(1)		/* Messages batched by mqlagent */
+#define MQL_OUT_TEXT	(2)		/* A line to write as it is */
+
+#define MQL_OUT_LINE	(0)		/* <id> : <sev> : <name> : "<text>" */
+#define MQL_OUT_NDJSON	(1)
+#define MQL_OUT_BIN	(2)
+
+#define MQL_OUT_BIN_MAGIC "MQLOUT01"
+
+typedef struct {
+    uint32_t	len;			/* Of the record, all of it */
+    uint8_t	sev;
+    uint8_t	id_len;
+    uint16_t	reserved;
+    uint64_t	rx_ns;			/* CLOCK_REALTIME received, or 0 */
+} mql_out_bin_t;
+
+#define MQL_OUT_WAIT	(0)		/* When full, wait for room */
+#define MQL_OUT_OLDEST	(1)		/* Drop the oldest */
+#define MQL_OUT_SEVERITY (2)		/* Drop the least severe, oldest first */
+
+// Write messages as format, MQL_OUT_LINE unless set before the start,
+// with the time they were received if timestamp.
+void mql_out_format(unsigned format, int timestamp);
+
+// Start the output thread, writing to fd, max bytes queued (0 no bound).
+//	RETURNS	0 OK, -1 on error (errno set)
+int mql_out_start(int fd, size_t max, unsigned policy);
+
+// Queue a message of source id, severity sev.  t1 is mql_probe_ns() when
+// it was received, or 0.  From one thread at a time.
+void mql_out_put(unsigned kind, const char* id, unsigned id_len,
+		 unsigned sev, const char* text, unsigned len, uint64_t t1);
+
+// Queue a line, a '\n' is added.
+void mql_out_text(const char* line);
+
+// Write all that is queued and stop the thread.
+void mql_out_stop(void);
+
+// Print the messages dropped since the last report, or all, per source
+// and severity, if any.
+void mql_out_report(FILE* f, int total);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1005 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_query.c
+ * Description     : Query command, log records from the mqld store
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:44:00 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:06:48 2026
+ * Update Count    : 5
+ */
+
+
+/*
+ * With an index (see mql_store.h) only the blocks that may hold a match
+ * are read: the time range, severities and source of a block must fit,
+ * and the bloom filter must have every word and the source with one of
+ * the severities.  Segments without one are read whole, but a segment is
+ * skipped when the next one was created before --since, all its records
+ * are older than that.
+ *
+ * With --scan the arguments are substrings instead of words, searched
+ * for in every record the index lets through, see mql_match.h.
+ *
+ * The blocks to read are cut into tasks of about Q_TASK_BYTES, in record
+ * order, and dealt round robin to one queue per thread.  A thread takes
+ * its oldest task, or steals the oldest of another thread when it has
+ * none.  Each task prints into its own buffer, and the buffers are
+ * written in task order, so the output is in record order as if read by
+ * one thread.  No task is started more than Q_AHEAD per thread after the
+ * one being written, so a slow reader of the output does not make the
+ * buffers of the whole query pile up in memory.
+ *
+ * Compacted segments (see mql_col.h) are read a row group per task, and
+ * only the columns needed: a filter pass over each column marks the
+ * records to keep, and the text is decompressed only when words are
+ * searched for or records printed.  With --count or --by each task counts
+ * into its own table, merged at the end; counting a column is one tight
+ * loop over an array.
+ */
+
+#include "mql.h"
+#include "mql_store.h"
+#include "mql_col.h"
+#include "mql_match.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+extern int opt_d;
+#define DD if(opt_d)printf
+
+extern const char* mql_sev_name[MQL_S_MAX];
+
+#define Q_WORDS_MAX	(32)
+#define Q_TASK_BYTES	(1024 * 1024)
+#define Q_TASK_GROUPS	(4)		/* Of a columnar file */
+#define Q_THREADS_MAX	(256)
+#define Q_AHEAD		(4)		/* Tasks per thread ahead of output */
+
+typedef struct {
+    const char*	id;			/* 0 for all */
+    unsigned	id_len;
+    unsigned	sev;			/* This and lower */
+    uint64_t	since;
+    uint64_t	until;
+    unsigned	n_words;
+    const char*	word[ Q_WORDS_MAX ];
+    unsigned	word_len[ Q_WORDS_MAX ];
+    uint64_t	hash[ Q_WORDS_MAX ];
+    uint64_t	src_hash[ MQL_S_MAX ];	/* Of id and each severity */
+    mql_match_t* match;			/* --scan */
+    uint64_t	want;
+    int		count;			/* --count or --by */
+    unsigned	by;			/* Q_BY_... */
+    long	tz_off;			/* Local time - UTC, s */
+
+    /* Counts for -d. */
+    unsigned long segments;
+    unsigned long columnar;
+    unsigned long seg_skipped;
+    unsigned long seg_indexed;
+    unsigned long blocks;
+    unsigned long blk_skipped;
+    unsigned long records;
+    unsigned long matched;
+} q_t;
+
+#define Q_BY_ALL	(0)		/* Just the count */
+#define Q_BY_SOURCE	(1)
+#define Q_BY_SEVERITY	(2)
+#define Q_BY_MINUTE	(3)
+#define Q_BY_HOUR	(4)
+#define Q_BY_DAY	(5)
+
+static const char* q_by_name[] =
+{ "", "source", "severity", "minute", "hour", "day", 0 };
+static const unsigned q_by_secs[] = { 0, 0, 0, 60, 3600, 86400 };
+
+// Counts by a key: source name, severity byte or bucket start big endian,
+// so that keys sort as they should with memcmp().
+typedef struct {
+    uint64_t	count;
+    uint32_t	key;			/* Offset in keys */
+    uint32_t	len;
+} q_count_t;
+
+typedef struct {
+    q_count_t*	ent;
+    unsigned	n;
+    unsigned	max;
+    uint32_t*	slot;			/* Index + 1, 0 free */
+    unsigned	n_slots;
+    char*	keys;
+    size_t	keys_len;
+    size_t	keys_max;
+} q_map_t;
+
+// A record of a segment or columnar file.
+typedef struct {
+    const char*	id;
+    unsigned	id_len;
+    unsigned	sev;
+    uint64_t	ts_ns;
+    const char*	text;
+    unsigned	text_len;
+} q_rec_t;
+
+typedef struct {
+    const mql_seg_t* seg;
+    const mql_col_t* col;		/* Or this, pos and end are groups */
+    size_t	pos;
+    size_t	end;
+    char*	out;			/* Printed records */
+    size_t	out_len;
+    q_map_t	counts;
+    unsigned long records;
+    unsigned long matched;
+    int		done;
+} q_task_t;
+
+typedef struct {
+    pthread_mutex_t mtx;
+    unsigned*	task;
+    unsigned	head;			/* Oldest, taken by the owner */
+    unsigned	tail;			/* Newest + 1, stolen */
+} q_queue_t;
+
+typedef struct {
+    time_t	last;			/* Formatted in ts */
+    char	ts[ 32 ];
+} q_time_t;
+
+static q_t q;
+
+static mql_seg_t* segs;
+static unsigned n_segs;
+static mql_col_t* cols;
+static unsigned n_cols;
+static q_task_t* tasks;
+static unsigned n_tasks;
+static unsigned max_tasks;
+
+static q_queue_t* queues;
+static unsigned n_queues;
+static unsigned n_written;		/* Tasks written, under done_mtx */
+static pthread_mutex_t done_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+
+
+static int
+q_has_word(const char* text, unsigned len, const char* w, unsigned wl)
+{
+    const char* t;
+    unsigned tl, pos = 0;
+
+    while ( mql_idx_word(text, len, &pos, &t, &tl) )
+	if ( tl == wl && !strncasecmp(t, w, wl) )
+	    return 1;
+    return 0;
+}
+
+static void
+q_print(FILE* f, q_time_t* qt, const q_rec_t* r)
+{
+    time_t t = r->ts_ns / 1000000000;
+    struct tm tm;
+
+    if ( t != qt->last ) {
+	localtime_r( &t, &tm );
+	strftime( qt->ts, sizeof(qt->ts), "%Y-%m-%d %H:%M:%S", &tm );
+	qt->last = t;
+    }
+    fprintf(f, "%s.%03u %-16.*s : %x : %-9s : \"%.*s\"\n",
+	    qt->ts, (unsigned)(r->ts_ns / 1000000 % 1000),
+	    (int)r->id_len, r->id, r->sev, mql_sev_name[r->sev & 15],
+	    (int)r->text_len, r->text);
+}
+
+// The text has the words, or the strings with --scan.
+static int
+q_text(const char* text, unsigned len)
+{
+    unsigned i;
+
+    if ( q.match )
+	return (mql_match_scan(q.match, text, len, q.want) & q.want) == q.want;
+    for ( i = 0; i < q.n_words; ++i )
+	if ( !q_has_word(text, len, q.word[i], q.word_len[i]) )
+	    return 0;
+    return 1;
+}
+
+// The record matches.
+static int
+q_record(const q_rec_t* r)
+{
+    if ( r->sev > q.sev || r->ts_ns < q.since || r->ts_ns >= q.until )
+	return 0;
+    if ( q.id && (r->id_len != q.id_len || memcmp(r->id, q.id, q.id_len)) )
+	return 0;
+    return q_text(r->text, r->text_len);
+}
+
+
+/*
+ * Counting
+ */
+
+static uint32_t
+q_hash(const char* p, unsigned len)
+{
+    uint32_t h = 2166136261U;		/* FNV-1a */
+    while ( len-- )
+	h = (h ^ (uint8_t)*p++) * 16777619U;
+    return h;
+}
+
+static void
+q_oom(void)
+{
+    perror("query: ");
+    exit( EXIT_FAILURE );
+}
+
+// Add n to the count of key.
+static void
+q_map_add(q_map_t* m, const char* key, unsigned len, uint64_t n)
+{
+    unsigned i, k;
+
+    if ( 2 * m->n >= m->n_slots ) {
+	unsigned ns = m->n_slots ? 2 * m->n_slots : 64;
+	uint32_t* s = calloc(ns, sizeof(uint32_t));
+	if ( !s )
+	    q_oom();
+	for ( k = 0; k < m->n; ++k ) {
+	    i = q_hash(m->keys + m->ent[k].key, m->ent[k].len) & (ns - 1);
+	    while ( s[i] )
+		i = (i + 1) & (ns - 1);
+	    s[i] = k + 1;
+	}
+	free(m->slot);
+	m->slot = s;
+	m->n_slots = ns;
+    }
+    i = q_hash(key, len) & (m->n_slots - 1);
+    for ( ; m->slot[i]; i = (i + 1) & (m->n_slots - 1) ) {
+	q_count_t* e = &m->ent[ m->slot[i] - 1 ];
+	if ( e->len == len && !memcmp(m->keys + e->key, key, len) ) {
+	    e->count += n;
+	    return;
+	}
+    }
+    if ( m->n == m->max ) {
+	m->max = m->max ? 2 * m->max : 64;
+	m->ent = realloc(m->ent, m->max * sizeof(q_count_t));
+	if ( !m->ent )
+	    q_oom();
+    }
+    if ( m->keys_len + len > m->keys_max ) {
+	m->keys_max = 2 * (m->keys_len + len) + 256;
+	m->keys = realloc(m->keys, m->keys_max);
+	if ( !m->keys )
+	    q_oom();
+    }
+    memcpy( m->keys + m->keys_len, key, len );
+    m->ent[ m->n ].count = n;
+    m->ent[ m->n ].key = m->keys_len;
+    m->ent[ m->n ].len = len;
+    m->keys_len += len;
+    m->slot[i] = ++m->n;
+}
+
+static void
+q_map_free(q_map_t* m)
+{
+    free(m->ent);
+    free(m->slot);
+    free(m->keys);
+    memset( m, 0, sizeof(q_map_t) );
+}
+
+// Start of the bucket of a time, in s, local midnight for days.
+static uint64_t
+q_bucket(uint64_t ts_ns)
+{
+    int64_t t = ts_ns / 1000000000 + q.tz_off;
+    unsigned u = q_by_secs[ q.by ];
+    return t - t % u - q.tz_off;
+}
+
+// Count n for a bucket start.
+static void
+q_count_bucket(q_map_t* m, uint64_t b, uint64_t n)
+{
+    char key[ 8 ];
+    unsigned i;
+
+    for ( i = 0; i < 8; ++i )
+	key[i] = b >> (56 - 8 * i);
+    q_map_add(m, key, 8, n);
+}
+
+// Count a matching record.
+static void
+q_count(q_map_t* m, const q_rec_t* r)
+{
+    char sev = r->sev;
+
+    switch ( q.by ) {
+    case Q_BY_ALL:	q_map_add(m, "", 0, 1);			break;
+    case Q_BY_SOURCE:	q_map_add(m, r->id, r->id_len, 1);	break;
+    case Q_BY_SEVERITY:	q_map_add(m, &sev, 1, 1);		break;
+    default:		q_count_bucket(m, q_bucket(r->ts_ns), 1);	break;
+    }
+}
+
+static const char* q_sort_keys;
+
+static int
+q_count_cmp(const void* a, const void* b)
+{
+    const q_count_t* x = a;
+    const q_count_t* y = b;
+    int c = memcmp(q_sort_keys + x->key, q_sort_keys + y->key,
+		   x->len < y->len ? x->len : y->len);
+    return c ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+// Print the counts, sorted by key.
+static void
+q_count_print(q_map_t* m)
+{
+    char key[ 64 ];
+    struct tm tm;
+    time_t t;
+    unsigned i, k;
+
+    q_sort_keys = m->keys;
+    qsort( m->ent, m->n, sizeof(q_count_t), q_count_cmp );
+    if ( q.by == Q_BY_ALL ) {
+	printf("%llu\n", (unsigned long long)(m->n ? m->ent[0].count : 0));
+	return;
+    }
+    for ( i = 0; i < m->n; ++i ) {
+	const char* p = m->keys + m->ent[i].key;
+	switch ( q.by ) {
+	case Q_BY_SOURCE:
+	    printf("%-16.*s ", (int)m->ent[i].len, p);
+	    break;
+	case Q_BY_SEVERITY:
+	    printf("%x : %-9s ", *p, mql_sev_name[ *p & 15 ]);
+	    break;
+	default:
+	    for ( t = 0, k = 0; k < 8; ++k )
+		t = t << 8 | (uint8_t)p[k];
+	    localtime_r( &t, &tm );
+	    strftime( key, sizeof(key),
+		      q.by == Q_BY_DAY ? "%Y-%m-%d" : "%Y-%m-%d %H:%M", &tm );
+	    printf("%-16s ", key);
+	    break;
+	}
+	printf("%llu\n", (unsigned long long)m->ent[i].count);
+    }
+}
+
+
+/*
+ * Tasks
+ */
+
+// Read the records of a segment task.
+static void
+q_run_seg(q_task_t* t, FILE* f)
+{
+    q_time_t qt = { -1 };
+    const mql_rec_t* r;
+    q_rec_t v;
+    size_t pos = t->pos;
+
+    while ( pos < t->end && mql_seg_next(t->seg, &pos, &r) > 0 ) {
+	++t->records;
+	v.id = MQL_REC_ID(r);
+	v.id_len = r->id_len;
+	v.sev = r->sev;
+	v.ts_ns = r->ts_ns;
+	v.text = MQL_REC_TEXT(r);
+	v.text_len = r->text_len;
+	if ( !q_record(&v) )
+	    continue;
+	++t->matched;
+	if ( q.count )
+	    q_count(&t->counts, &v);
+	else
+	    q_print(f, &qt, &v);
+    }
+}
+
+// Count the kept records of a group by its columns.
+static void
+q_count_col(q_task_t* t, const mql_col_rows_t* rows, const uint8_t* keep)
+{
+    const mql_col_t* col = t->col;
+    uint64_t n[ MQL_S_MAX ] = { 0 };
+    uint64_t* by_src;
+    uint64_t b, cur = 0, run = 0;
+    unsigned i;
+    char sev;
+
+    switch ( q.by ) {
+    case Q_BY_ALL:
+	for ( i = 0; i < rows->n; ++i )
+	    n[0] += keep[i];
+	if ( n[0] )
+	    q_map_add(&t->counts, "", 0, n[0]);
+	break;
+    case Q_BY_SOURCE:
+	by_src = calloc(col->hdr->n_sources, sizeof(uint64_t));
+	if ( !by_src )
+	    q_oom();
+	for ( i = 0; i < rows->n; ++i )
+	    by_src[ rows->src[i] ] += keep[i];
+	for ( i = 0; i < col->hdr->n_sources; ++i )
+	    if ( by_src[i] )
+		q_map_add(&t->counts, col->src[i], col->src_len[i], by_src[i]);
+	free(by_src);
+	break;
+    case Q_BY_SEVERITY:
+	for ( i = 0; i < rows->n; ++i )
+	    n[ rows->sev[i] ] += keep[i];
+	for ( i = 0; i < MQL_S_MAX; ++i )
+	    if ( n[i] ) {
+		sev = i;
+		q_map_add(&t->counts, &sev, 1, n[i]);
+	    }
+	break;
+    default:
+	/* Runs of the same bucket, records come in time order. */
+	for ( i = 0; i < rows->n; ++i ) {
+	    if ( !keep[i] )
+		continue;
+	    b = q_bucket(rows->ts[i]);
+	    if ( run && b != cur ) {
+		q_count_bucket(&t->counts, cur, run);
+		run = 0;
+	    }
+	    cur = b;
+	    ++run;
+	}
+	if ( run )
+	    q_count_bucket(&t->counts, cur, run);
+	break;
+    }
+}
+
+// Read the groups of a columnar task.
+static void
+q_run_col(q_task_t* t, FILE* f)
+{
+    const mql_col_t* col = t->col;
+    mql_col_rows_t* rows = calloc(1, sizeof(mql_col_rows_t));
+    uint8_t keep[ MQL_COL_GROUP ];
+    unsigned what = MQL_COL_SEV;
+    int src = q.id ? mql_col_source(col, q.id, q.id_len) : -1;
+    int text = q.n_words || q.match || !q.count;
+    q_time_t qt = { -1 };
+    unsigned i, m;
+    size_t g, pos;
+    q_rec_t v;
+
+    if ( !rows )
+	q_oom();
+    if ( q.since || q.until != ~0ULL || q.by >= Q_BY_MINUTE || !q.count )
+	what |= MQL_COL_TS;
+    if ( q.id || q.by == Q_BY_SOURCE || !q.count )
+	what |= MQL_COL_SRC;
+
+    for ( g = t->pos; g < t->end; ++g ) {
+	if ( mql_col_get(col, g, what, rows) ) {
+	    fprintf(stderr, "Error: Damaged group %zu of %016llx.\n", g,
+		    (unsigned long long)col->hdr->first_seq);
+	    continue;
+	}
+	t->records += rows->n;
+
+	/* A column at a time, without branches. */
+	for ( i = 0; i < rows->n; ++i )
+	    keep[i] = rows->sev[i] <= q.sev;
+	if ( what & MQL_COL_TS )
+	    for ( i = 0; i < rows->n; ++i )
+		keep[i] &= (rows->ts[i] >= q.since) & (rows->ts[i] < q.until);
+	if ( q.id )
+	    for ( i = 0; i < rows->n; ++i )
+		keep[i] &= rows->src[i] == src;
+
+	for ( m = 0, i = 0; i < rows->n; ++i )
+	    m += keep[i];
+	if ( !m )
+	    continue;
+
+	if ( text ) {
+	    if ( mql_col_get(col, g, MQL_COL_TEXT, rows) ) {
+		fprintf(stderr, "Error: Damaged text of group %zu of %016llx.\n",
+			g, (unsigned long long)col->hdr->first_seq);
+		continue;
+	    }
+	    for ( pos = 0, i = 0; i < rows->n; ++i ) {
+		if ( mql_col_text(rows, &pos, &v.text, &v.text_len) <= 0 ) {
+		    memset( keep + i, 0, rows->n - i );
+		    break;
+		}
+		if ( !keep[i] )
+		    continue;
+		if ( !q_text(v.text, v.text_len) ) {
+		    keep[i] = 0;
+		    continue;
+		}
+		if ( q.count )
+		    continue;
+		v.id = col->src[ rows->src[i] ];
+		v.id_len = col->src_len[ rows->src[i] ];
+		v.sev = rows->sev[i];
+		v.ts_ns = rows->ts[i];
+		q_print(f, &qt, &v);
+	    }
+	    for ( m = 0, i = 0; i < rows->n; ++i )
+		m += keep[i];
+	}
+	t->matched += m;
+	if ( q.count )
+	    q_count_col(t, rows, keep);
+    }
+    free(rows->text);
+    free(rows);
+}
+
+// Print or count the matching records of a task.
+static void
+q_run(q_task_t* t)
+{
+    FILE* f = open_memstream(&t->out, &t->out_len);
+
+    if ( !f ) {
+	perror("open_memstream: ");
+	exit( EXIT_FAILURE );
+    }
+    if ( t->col )
+	q_run_col(t, f);
+    else
+	q_run_seg(t, f);
+    fclose(f);
+}
+
+// Oldest task of queue w, else the oldest of another one, that is before
+// limit.  *left is set when a queue still has tasks.
+//	RETURNS	task, -1 when none
+static int
+q_take_before(unsigned w, unsigned limit, int* left)
+{
+    unsigned k;
+    int t = -1;
+
+    for ( k = 0; k < n_queues && t < 0; ++k ) {
+	q_queue_t* qu = &queues[ (w + k) % n_queues ];
+	pthread_mutex_lock( &qu->mtx );
+	if ( qu->head < qu->tail ) {
+	    *left = 1;
+	    if ( qu->task[ qu->head ] < limit )
+		t = qu->task[ qu->head++ ];
+	}
+	pthread_mutex_unlock( &qu->mtx );
+    }
+    return t;
+}
+
+// Next task for thread w, waits while all left are too far ahead of the
+// output.  The first task not written is always before the limit, so it
+// is taken by the first thread free.
+//	RETURNS	task, -1 when all are taken
+static int
+q_take(unsigned w)
+{
+    int t, left;
+
+    pthread_mutex_lock( &done_mtx );
+    for (;;) {
+	left = 0;
+	t = q_take_before(w, n_written + Q_AHEAD * n_queues, &left);
+	if ( t >= 0 || !left )
+	    break;
+	pthread_cond_wait( &done_cv, &done_mtx );
+    }
+    pthread_mutex_unlock( &done_mtx );
+    return t;
+}
+
+static void*
+q_worker(void* arg)
+{
+    unsigned w = (uintptr_t)arg;
+    int t;
+
+    while ( (t = q_take(w)) >= 0 ) {
+	q_run(&tasks[t]);
+	pthread_mutex_lock( &done_mtx );
+	tasks[t].done = 1;
+	pthread_cond_broadcast( &done_cv );
+	pthread_mutex_unlock( &done_mtx );
+    }
+    return 0;
+}
+
+// Read [pos, end) of seg, or groups [pos, end) of col, added to the last
+// task when it goes on from it.
+static void
+q_task(const mql_seg_t* seg, const mql_col_t* col, size_t pos, size_t end)
+{
+    q_task_t* t = n_tasks ? &tasks[ n_tasks - 1 ] : 0;
+
+    if ( t && t->seg == seg && t->col == col && t->end == pos
+	 && t->end - t->pos < (col ? Q_TASK_GROUPS : Q_TASK_BYTES) ) {
+	t->end = end;
+	return;
+    }
+    if ( n_tasks == max_tasks ) {
+	max_tasks = max_tasks ? 2 * max_tasks : 256;
+	tasks = realloc(tasks, max_tasks * sizeof(q_task_t));
+	if ( !tasks ) {
+	    perror("query: ");
+	    exit( EXIT_FAILURE );
+	}
+    }
+    t = &tasks[ n_tasks++ ];
+    memset( t, 0, sizeof(q_task_t) );
+    t->seg = seg;
+    t->col = col;
+    t->pos = pos;
+    t->end = end;
+}
+
+// Block b may hold a match.
+static int
+q_block(const mql_idx_t* idx, unsigned b, unsigned src)
+{
+    const mql_idx_block_t* k = &idx->blocks[b];
+    unsigned i;
+
+    if ( k->max_ts < q.since || k->min_ts >= q.until )
+	return 0;
+    if ( !(k->sev_mask & ((2U << q.sev) - 1)) )
+	return 0;
+    if ( q.id && !(k->src[ src / 64 ] & (1ULL << src % 64)) )
+	return 0;
+    if ( q.id && q.sev < MQL_S_MAX-1 ) {
+	for ( i = 0; i <= q.sev; ++i )
+	    if ( mql_idx_bloom(idx, b, q.src_hash[i]) )
+		break;
+	if ( i > q.sev )
+	    return 0;
+    }
+    for ( i = 0; i < q.n_words; ++i )
+	if ( !mql_idx_bloom(idx, b, q.hash[i]) )
+	    return 0;
+    return 1;
+}
+
+// Creation time of a segment, compacted or not, 0 if it can not be read.
+static uint64_t
+q_created(const char* path)
+{
+    mql_col_header_t h;
+    int fd = open(path, O_RDONLY);
+    ssize_t n;
+
+    if ( fd < 0 )
+	return 0;
+    n = pread(fd, &h, sizeof(h), 0);
+    close(fd);
+    if ( n != sizeof(h) || (memcmp(h.magic, MQL_SEG_MAGIC, sizeof(h.magic))
+			    && memcmp(h.magic, MQL_COL_MAGIC, sizeof(h.magic))) )
+	return 0;
+    return h.created_ns;
+}
+
+// Map a segment and add tasks for the parts to read.
+static void
+q_segment(const char* path, uint64_t next_created)
+{
+    mql_seg_t* seg = &segs[ n_segs ];
+    mql_idx_t idx;
+    size_t end = 0;
+    unsigned b, src = 0;
+
+    ++q.segments;
+    if ( !mql_idx_open(&idx, path) ) {
+	/* A checkpoint index tells nothing of the records after it. */
+	if ( !(idx.hdr->flags & MQL_IDX_OPEN)
+	     && (idx.hdr->max_ts < q.since || idx.hdr->min_ts >= q.until) ) {
+	    ++q.seg_skipped;
+	    q.blocks += idx.hdr->n_blocks;
+	    q.blk_skipped += idx.hdr->n_blocks;
+	    mql_idx_close(&idx);
+	    return;
+	}
+	if ( q.id )
+	    src = mql_idx_source(&idx, q.id, q.id_len);
+    }
+    else if ( next_created && next_created < q.since ) {
+	++q.seg_skipped;
+	return;
+    }
+
+    if ( mql_seg_open(seg, path) ) {
+	if ( idx.base )
+	    mql_idx_close(&idx);
+	fprintf(stderr, "%s: ", path);
+	perror("");
+	return;
+    }
+    /* The mapping stays, there may be more segments than descriptors. */
+    close(seg->fd);
+    seg->fd = -1;
+    ++n_segs;
+
+    if ( idx.base && idx.hdr->first_seq == seg->hdr->first_seq
+	 && idx.hdr->seg_size <= seg->size ) {
+	++q.seg_indexed;
+	q.blocks += idx.hdr->n_blocks;
+	for ( b = 0; b < idx.hdr->n_blocks; ++b ) {
+	    if ( !q_block(&idx, b, src) ) {
+		++q.blk_skipped;
+		continue;
+	    }
+	    q_task(seg, 0, idx.blocks[b].off,
+		   idx.blocks[b].off + idx.blocks[b].len);
+	}
+	end = idx.hdr->seg_size;
+    }
+    /* Past the index, or all of it. */
+    if ( end < seg->size )
+	q_task(seg, 0, end, seg->size);
+    if ( idx.base )
+	mql_idx_close(&idx);
+}
+
+// Map a columnar file and add tasks for the groups that may match.
+static void
+q_columnar(const char* path)
+{
+    mql_col_t* col = &cols[ n_cols ];
+    const mql_col_group_t* k;
+    unsigned g;
+
+    ++q.segments;
+    ++q.columnar;
+    if ( mql_col_open(col, path) ) {
+	fprintf(stderr, "%s: ", path);
+	perror("");
+	return;
+    }
+    q.blocks += col->hdr->n_groups;
+    if ( col->hdr->max_ts < q.since || col->hdr->min_ts >= q.until
+	 || (q.id && mql_col_source(col, q.id, q.id_len) < 0) ) {
+	++q.seg_skipped;
+	q.blk_skipped += col->hdr->n_groups;
+	mql_col_close(col);
+	return;
+    }
+    close(col->fd);
+    col->fd = -1;
+    ++n_cols;
+
+    for ( g = 0; g < col->hdr->n_groups; ++g ) {
+	k = &col->groups[g];
+	if ( k->max_ts < q.since || k->min_ts >= q.until
+	     || !(k->sev_mask & ((2U << q.sev) - 1)) ) {
+	    ++q.blk_skipped;
+	    continue;
+	}
+	q_task(0, col, g, g + 1);
+    }
+}
+
+
+void
+mql_command_query(const char* dir, const char* target, unsigned severity,
+		  uint64_t since_ns, uint64_t until_ns, int scan,
+		  const char* by, unsigned threads,
+		  int n_words, const char** words)
+{
+    struct timespec t0, t1;
+    char path[ 4096 ], next[ 4096 ];
+    pthread_t tid[ Q_THREADS_MAX ];
+    char** names;
+    char** col_names;
+    char** name;
+    q_map_t counts = { 0 };
+    struct tm tm;
+    time_t now;
+    const char* w;
+    unsigned wl, pos;
+    unsigned k;
+    int n, n_col, n_name, i, j, c;
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    if ( by ) {
+	for ( k = 0; q_by_name[k] && strcmp(q_by_name[k], by); ++k )
+	    ;
+	if ( !q_by_name[k] ) {
+	    fprintf(stderr, "Error: Count by source, severity, minute, hour"
+		    " or day.\n");
+	    exit( EXIT_FAILURE );
+	}
+	q.count = 1;
+	q.by = k;
+	now = time(0);
+	localtime_r( &now, &tm );
+	q.tz_off = tm.tm_gmtoff;
+    }
+    if ( target && strcmp("ALL",target) && strcmp("*",target) ) {
+	q.id = target;
+	q.id_len = strlen(target);
+	for ( i = 0; i < MQL_S_MAX; ++i )
+	    q.src_hash[i] = mql_idx_hash_source(q.id, q.id_len, i);
+    }
+    q.sev = severity;
+    q.since = since_ns;
+    q.until = until_ns;
+
+    if ( scan && n_words ) {
+	/* Substrings, each must be in the text. */
+	q.match = mql_match_new(0);
+	for ( i = 0; q.match && i < n_words; ++i )
+	    if ( mql_match_add(q.match, words[i], strlen(words[i])) < 0 ) {
+		fprintf(stderr, "Error: Too many or too long strings.\n");
+		exit( EXIT_FAILURE );
+	    }
+	if ( !q.match || mql_match_build(q.match) ) {
+	    perror("query: ");
+	    exit( EXIT_FAILURE );
+	}
+	q.want = mql_match_all(q.match);
+    }
+    /* Words of the arguments, each must be in the text. */
+    for ( i = 0; !scan && i < n_words; ++i ) {
+	pos = 0;
+	while ( mql_idx_word(words[i], strlen(words[i]), &pos, &w, &wl) ) {
+	    if ( q.n_words == Q_WORDS_MAX ) {
+		fprintf(stderr, "Error: Too many words, at most %d.\n",
+			Q_WORDS_MAX);
+		exit( EXIT_FAILURE );
+	    }
+	    q.word[ q.n_words ] = w;
+	    q.word_len[ q.n_words ] = wl;
+	    q.hash[ q.n_words ] = mql_idx_hash(w, wl);
+	    ++q.n_words;
+	}
+    }
+
+    n = mql_seg_list(dir, &names);
+    n_col = n < 0 ? -1 : mql_col_list(dir, &col_names);
+    if ( n < 0 || n_col < 0 ) {
+	fprintf(stderr, "%s: ", dir);
+	perror("");
+	exit( EXIT_FAILURE );
+    }
+    segs = calloc(n + 1, sizeof(mql_seg_t));
+    cols = calloc(n_col + 1, sizeof(mql_col_t));
+    name = calloc(n + n_col + 1, sizeof(char*));
+    if ( !segs || !cols || !name )
+	q_oom();
+
+    /* Both in sequence order, a segment still there is read instead. */
+    for ( i = 0, j = 0, n_name = 0; i < n || j < n_col; ++n_name ) {
+	c = i == n ? 1 : j == n_col ? -1 : strncmp(names[i], col_names[j], 16);
+	name[ n_name ] = c <= 0 ? names[i++] : col_names[j++];
+	if ( !c )
+	    ++j;
+    }
+    for ( i = 0; i < n_name; ++i ) {
+	uint64_t next_created = 0;
+	snprintf( path, sizeof(path), "%s/%s", dir, name[i] );
+	if ( strstr(name[i], MQL_COL_SUFFIX) ) {
+	    q_columnar(path);
+	    continue;
+	}
+	if ( i + 1 < n_name && q.since ) {
+	    snprintf( next, sizeof(next), "%s/%s", dir, name[i+1] );
+	    next_created = q_created(next);
+	}
+	q_segment(path, next_created);
+    }
+    free(name);
+    mql_seg_list_free(names, n);
+    mql_seg_list_free(col_names, n_col);
+
+    /* Deal the tasks and start the threads. */
+    if ( threads < 1 )
+	threads = 1;
+    if ( threads > Q_THREADS_MAX )
+	threads = Q_THREADS_MAX;
+    if ( threads > n_tasks )
+	threads = n_tasks ? n_tasks : 1;
+    n_queues = threads;
+    queues = calloc(n_queues, sizeof(q_queue_t));
+    for ( k = 0; queues && k < n_queues; ++k ) {
+	pthread_mutex_init( &queues[k].mtx, 0 );
+	queues[k].task = calloc(n_tasks / n_queues + 1, sizeof(unsigned));
+	if ( !queues[k].task )
+	    break;
+    }
+    if ( !queues || k < n_queues ) {
+	perror("query: ");
+	exit( EXIT_FAILURE );
+    }
+    for ( k = 0; k < n_tasks; ++k ) {
+	q_queue_t* qu = &queues[ k % n_queues ];
+	qu->task[ qu->tail++ ] = k;
+    }
+    for ( k = 0; k < threads; ++k )
+	if ( pthread_create(&tid[k], 0, q_worker, (void*)(uintptr_t)k) ) {
+	    perror("pthread_create: ");
+	    exit( EXIT_FAILURE );
+	}
+
+    /* Results in task order, as they come in. */
+    for ( k = 0; k < n_tasks; ++k ) {
+	q_task_t* t = &tasks[k];
+	pthread_mutex_lock( &done_mtx );
+	while ( !t->done )
+	    pthread_cond_wait( &done_cv, &done_mtx );
+	pthread_mutex_unlock( &done_mtx );
+	if ( t->out_len && fwrite(t->out, t->out_len, 1, stdout) != 1 )
+	    exit( EXIT_FAILURE );
+	free(t->out);
+	pthread_mutex_lock( &done_mtx );
+	n_written = k + 1;
+	pthread_cond_broadcast( &done_cv );
+	pthread_mutex_unlock( &done_mtx );
+	for ( j = 0; j < (int)t->counts.n; ++j )
+	    q_map_add(&counts, t->counts.keys + t->counts.ent[j].key,
+		      t->counts.ent[j].len, t->counts.ent[j].count);
+	q_map_free(&t->counts);
+	q.records += t->records;
+	q.matched += t->matched;
+    }
+    for ( k = 0; k < threads; ++k )
+	pthread_join( tid[k], 0 );
+    if ( q.count )
+	q_count_print(&counts);
+    fflush(stdout);
+
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+    DD ("segments=%lu columnar=%lu skipped=%lu indexed=%lu blocks=%lu"
+	" skipped=%lu tasks=%u threads=%u records=%lu matched=%lu ms=%.3f\n",
+	q.segments, q.columnar, q.seg_skipped, q.seg_indexed, q.blocks,
+	q.blk_skipped,
+	n_tasks, threads, q.records, q.matched,
+	(t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    for ( k = 0; k < n_segs; ++k )
+	mql_seg_close(&segs[k]);
+    for ( k = 0; k < n_cols; ++k )
+	mql_col_close(&cols[k]);
+    q_map_free(&counts);
+    for ( k = 0; k < n_queues; ++k ) {
+	pthread_mutex_destroy( &queues[k].mtx );
+	free(queues[k].task);
+    }
+    free(queues);
+    free(segs);
+    free(cols);
+    free(tasks);
+    mql_match_free(q.match);
+}
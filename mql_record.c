@@ -0,0 +1,176 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_record.c
+ * Description     : Record command, raw messages to a capture file
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:30:13 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:30:13 2026
+ * Update Count    : 1
+ */
+
+
+/*
+ * Subscribes and writes each message to a capture file (see
+ * mql_capture.h) as it comes, a time, the topic and the payload, nothing
+ * parsed.  Messages come from the one transport thread, which writes
+ * through a large stdio buffer; the main thread only watches the limits
+ * and the signals.
+ */
+
+#include "mql.h"
+#include "mql_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+extern int opt_d;
+#define DD if(opt_d)printf
+
+extern char transport_spec[];
+
+#define R_BUF		(1024 * 1024)
+
+static FILE* r_out;
+static uint64_t r_last_ns;		/* Of the record before */
+static uint64_t r_count;
+static uint64_t r_bytes;
+static uint64_t r_max;			/* Records to get, 0 no limit */
+static volatile int r_error;
+static volatile sig_atomic_t r_stop;
+
+
+static uint64_t
+r_now(void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+r_put(const mql_cap_rec_t* r, const void* topic, const void* payload)
+{
+    if ( fwrite(r, sizeof(*r), 1, r_out) != 1
+	 || fwrite(topic, r->topic_len, 1, r_out) != (r->topic_len != 0)
+	 || fwrite(payload, r->len, 1, r_out) != (r->len != 0) )
+	r_error = 1;
+    r_bytes += MQL_CAP_LEN(r);
+}
+
+static void
+r_message(mql_transport_t* tp, void* obj,
+	  const char* topic, const void* payload, int len)
+{
+    mql_cap_rec_t r;
+    uint64_t now;
+
+    if ( r_error || (r_max && r_count >= r_max) )
+	return;
+    now = r_now();
+    memset( &r, 0, sizeof(r) );
+    if ( now < r_last_ns || now - r_last_ns > UINT32_MAX ) {
+	r.len = sizeof(now);
+	r_put( &r, "", &now );
+    }
+    else {
+	r.dt_ns = now - r_last_ns;
+    }
+    r_last_ns = now;
+    r.topic_len = strlen(topic);
+    r.len = len;
+    r_put( &r, topic, payload );
+    if ( ++r_count == r_max )
+	r_stop = 1;
+}
+
+static void
+r_connect(mql_transport_t* tp, void* obj, int result)
+{
+    DD ("subscribe \"%s\"\n", (const char*)obj);
+    if ( mql_transport_subscribe(tp, obj) ) {
+	perror("mql_transport_subscribe: ");
+	exit( EXIT_FAILURE );
+    }
+}
+
+static void
+r_disconnect(mql_transport_t* tp, void* obj, int result)
+{
+    fprintf(stderr, "record: disconnected: %d\n", result);
+    r_stop = 1;
+}
+
+static void
+r_on_signal(int sig)
+{
+    r_stop = 1;
+}
+
+
+void
+mql_command_record(const char* host, int port, const char* topic,
+		   const char* file, unsigned seconds, uint64_t count)
+{
+    mql_cap_header_t h;
+    mql_transport_t* tp;
+    time_t t0 = time(0);
+
+    r_out = fopen(file, "w");
+    if ( !r_out ) {
+	fprintf(stderr, "record: %s: ", file);
+	perror("");
+	exit( EXIT_FAILURE );
+    }
+    setvbuf( r_out, 0, _IOFBF, R_BUF );
+    r_last_ns = r_now();
+    r_max = count;
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, MQL_CAP_MAGIC, sizeof(h.magic) );
+    h.start_ns = r_last_ns;
+    if ( fwrite(&h, sizeof(h), 1, r_out) != 1 )
+	r_error = 1;
+
+    tp = mql_transport_new(transport_spec);
+    if ( !tp ) {
+	printf("Bad transport: \"%s\"\n", transport_spec);
+	exit( EXIT_FAILURE );
+    }
+    mql_transport_callbacks(tp, r_connect, r_disconnect, r_message,
+			    (void*)topic);
+    signal( SIGINT, r_on_signal );
+    signal( SIGTERM, r_on_signal );
+    if ( mql_transport_connect(tp, host, port) ) {
+	perror("mql_transport_connect: ");
+	exit( EXIT_FAILURE );
+    }
+    if ( mql_transport_loop_start(tp) ) {
+	mql_transport_destroy(tp);
+	fprintf(stderr, "Error: %s\n", "Can not start transport");
+	exit( EXIT_FAILURE );
+    }
+
+    while ( !r_stop && !r_error
+	    && !(seconds && time(0) - t0 >= (time_t)seconds) )
+	usleep( 100000 );
+
+    mql_transport_destroy(tp);		/* No more messages after this */
+    if ( fclose(r_out) )
+	r_error = 1;
+    if ( r_error ) {
+	fprintf(stderr, "record: %s: ", file);
+	perror("");
+	exit( EXIT_FAILURE );
+    }
+    fprintf(stderr, "Recorded %llu messages, %llu bytes in %lu s.\n",
+	    (unsigned long long)r_count,
+	    (unsigned long long)(r_bytes + sizeof(h)),
+	    (unsigned long)(time(0) - t0));
+}
@@ -0,0 +1,322 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_replay.c
+ * Description     : Replay command, publish a capture file again
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:30:13 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:07:20 2026
+ * Update Count    : 3
+ */
+
+
+/*
+ * Publishes the messages of a capture file (see mql_capture.h) with the
+ * times between them as recorded, divided by a speed, or as fast as the
+ * transport takes them.  With more than one connection each has a thread
+ * of its own and the messages of a topic all go on the same one, so the
+ * order per source is kept.  A message is sent when it is due on one
+ * clock for all the threads; one that is late is sent at once, and the
+ * latest is reported.  When the transport is full (the unix transport
+ * does not block) the message is tried again after a wait that grows
+ * from P_WAIT_MIN to P_WAIT_MAX, so none are lost; the waits and the
+ * messages the transport would not take for other reasons are reported.
+ */
+
+#include "mql.h"
+#include "mql_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern int opt_d;
+#define DD if(opt_d)printf
+
+extern char transport_spec[];
+
+#define P_CONNECTIONS_MAX	(256)
+#define P_WAIT_MIN		(10000)		/* ns, when the transport is full */
+#define P_WAIT_MAX		(1000000)
+
+typedef struct {
+    pthread_t		tid;
+    unsigned		i;
+    mql_transport_t*	tp;
+    int			connected;
+    uint64_t		sent;
+    uint64_t		failed;
+    uint64_t		waits;		/* For a full transport */
+    uint64_t		late_max;	/* ns */
+} p_conn_t;
+
+static const unsigned char* p_map;
+static size_t p_size;
+static double p_speed;			/* 0 as fast as possible */
+static unsigned p_n;
+static uint64_t p_t0;			/* CLOCK_MONOTONIC at the start */
+static uint64_t p_first;		/* Time of the first message */
+static pthread_mutex_t p_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t p_cv = PTHREAD_COND_INITIALIZER;
+static volatile sig_atomic_t p_stop;
+
+
+static uint64_t
+p_now(void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+p_sleep_until(uint64_t t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000ULL;
+    ts.tv_nsec = t % 1000000000ULL;
+    while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) )
+	if ( p_stop )
+	    break;
+}
+
+static void
+p_connect(mql_transport_t* tp, void* obj, int result)
+{
+    p_conn_t* c = obj;
+    pthread_mutex_lock( &p_mtx );
+    c->connected = 1;
+    pthread_cond_broadcast( &p_cv );
+    pthread_mutex_unlock( &p_mtx );
+}
+
+static void
+p_on_signal(int sig)
+{
+    p_stop = 1;
+}
+
+// Publish on c, wait and try again while the transport is full.
+//	RETURNS	0 sent, -1 not taken or stopped
+static int
+p_publish(p_conn_t* c, const char* topic, const void* payload, int len)
+{
+    uint64_t wait = P_WAIT_MIN;
+
+    for (;;) {
+	errno = 0;
+	if ( !mql_transport_publish(c->tp, topic, len, payload, 0, 0) )
+	    return 0;
+	if ( (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+	     || p_stop )
+	    return -1;
+	++c->waits;
+	p_sleep_until( p_now() + wait );
+	if ( wait < P_WAIT_MAX )
+	    wait *= 2;
+    }
+}
+
+// The connection of a topic.
+static unsigned
+p_conn_of(const unsigned char* topic, unsigned len)
+{
+    unsigned h = 2166136261U;
+    while ( len-- )
+	h = (h ^ *topic++) * 16777619U;
+    return h % p_n;
+}
+
+
+static void*
+p_worker(void* arg)
+{
+    p_conn_t* c = arg;
+    char topic[ MQL_TOPIC_MAX_LEN + 1 ];
+    mql_cap_rec_t r;
+    const unsigned char* p;
+    size_t pos = sizeof(mql_cap_header_t);
+    uint64_t ts = 0;			/* Since the start */
+    uint64_t due, now;
+
+    pthread_mutex_lock( &p_mtx );
+    while ( !p_t0 && !p_stop )
+	pthread_cond_wait( &p_cv, &p_mtx );
+    pthread_mutex_unlock( &p_mtx );
+
+    for ( ; !p_stop && pos + sizeof(r) <= p_size; pos += MQL_CAP_LEN(&r) ) {
+	memcpy( &r, p_map + pos, sizeof(r) );
+	p = p_map + pos + sizeof(r);
+	if ( !r.topic_len ) {
+	    uint64_t t;
+	    memcpy( &t, p, sizeof(t) );
+	    ts = t - ((const mql_cap_header_t*)p_map)->start_ns;
+	    continue;
+	}
+	ts += r.dt_ns;
+	if ( p_n > 1 && p_conn_of(p, r.topic_len) != c->i )
+	    continue;
+
+	if ( p_speed ) {
+	    due = p_t0 + (uint64_t)((ts - p_first) / p_speed);
+	    now = p_now();
+	    if ( now < due )
+		p_sleep_until( due );
+	    else if ( now - due > c->late_max )
+		c->late_max = now - due;
+	}
+	memcpy( topic, p, r.topic_len );
+	topic[ r.topic_len ] = '\0';
+	if ( p_publish(c, topic, p + r.topic_len, r.len) )
+	    ++c->failed;
+	else
+	    ++c->sent;
+    }
+    return 0;
+}
+
+
+// Check the records of the file, all whole and topics not too long,
+// and find the time of the first message.
+//	RETURNS	messages, -1 if damaged
+static long long
+p_check(void)
+{
+    mql_cap_rec_t r;
+    size_t pos;
+    uint64_t ts = 0;
+    long long n = 0;
+
+    for ( pos = sizeof(mql_cap_header_t); pos < p_size;
+	  pos += MQL_CAP_LEN(&r) ) {
+	if ( p_size - pos < sizeof(r) )
+	    return -1;
+	memcpy( &r, p_map + pos, sizeof(r) );
+	if ( MQL_CAP_LEN(&r) > p_size - pos
+	     || r.topic_len > MQL_TOPIC_MAX_LEN
+	     || (!r.topic_len && r.len != sizeof(uint64_t)) )
+	    return -1;
+	if ( !r.topic_len ) {
+	    memcpy( &ts, p_map + pos + sizeof(r), sizeof(ts) );
+	    ts -= ((const mql_cap_header_t*)p_map)->start_ns;
+	}
+	else if ( !n++ ) {
+	    p_first = ts + r.dt_ns;
+	}
+    }
+    return n;
+}
+
+
+void
+mql_command_replay(const char* host, int port, const char* file,
+		   double speed, unsigned connections)
+{
+    p_conn_t* c;
+    struct stat st;
+    long long n;
+    uint64_t t1, sent = 0, failed = 0, waits = 0, late = 0;
+    double secs;
+    unsigned i;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if ( fd < 0 || fstat(fd, &st) ) {
+	fprintf(stderr, "replay: %s: ", file);
+	perror("");
+	exit( EXIT_FAILURE );
+    }
+    p_size = st.st_size;
+    if ( p_size < sizeof(mql_cap_header_t) )
+	p_map = MAP_FAILED;
+    else
+	p_map = mmap(0, p_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( p_map == MAP_FAILED
+	 || memcmp(p_map, MQL_CAP_MAGIC, strlen(MQL_CAP_MAGIC))
+	 || (n = p_check()) < 0 ) {
+	fprintf(stderr, "Error: %s is not a capture file.\n", file);
+	exit( EXIT_FAILURE );
+    }
+    madvise( (void*)p_map, p_size, MADV_SEQUENTIAL );
+    DD ("%lld messages in \"%s\"\n", n, file);
+
+    p_speed = speed;
+    p_n = connections;
+    if ( !p_n || p_n > P_CONNECTIONS_MAX ) {
+	fprintf(stderr, "Error: 1 to %u connections.\n", P_CONNECTIONS_MAX);
+	exit( EXIT_FAILURE );
+    }
+    c = calloc(p_n, sizeof(p_conn_t));
+    if ( !c ) {
+	perror("replay: ");
+	exit( EXIT_FAILURE );
+    }
+    signal( SIGINT, p_on_signal );
+    signal( SIGTERM, p_on_signal );
+
+    for ( i = 0; i < p_n; ++i ) {
+	c[i].i = i;
+	c[i].tp = mql_transport_new(transport_spec);
+	if ( !c[i].tp ) {
+	    printf("Bad transport: \"%s\"\n", transport_spec);
+	    exit( EXIT_FAILURE );
+	}
+	mql_transport_callbacks(c[i].tp, p_connect, 0, 0, &c[i]);
+	if ( mql_transport_connect(c[i].tp, host, port) ) {
+	    perror("mql_transport_connect: ");
+	    exit( EXIT_FAILURE );
+	}
+	if ( mql_transport_loop_start(c[i].tp) ) {
+	    fprintf(stderr, "Error: %s\n", "Can not start transport");
+	    exit( EXIT_FAILURE );
+	}
+	if ( pthread_create(&c[i].tid, 0, p_worker, &c[i]) ) {
+	    perror("pthread_create: ");
+	    exit( EXIT_FAILURE );
+	}
+    }
+
+    /* Start them all at once, when all are connected. */
+    pthread_mutex_lock( &p_mtx );
+    for ( i = 0; i < p_n && !p_stop; )
+	if ( c[i].connected )
+	    ++i;
+	else
+	    pthread_cond_wait( &p_cv, &p_mtx );
+    p_t0 = p_now();
+    pthread_cond_broadcast( &p_cv );
+    pthread_mutex_unlock( &p_mtx );
+
+    for ( i = 0; i < p_n; ++i ) {
+	pthread_join( c[i].tid, 0 );
+	sent += c[i].sent;
+	failed += c[i].failed;
+	waits += c[i].waits;
+	if ( c[i].late_max > late )
+	    late = c[i].late_max;
+    }
+    t1 = p_now();
+    for ( i = 0; i < p_n; ++i )
+	mql_transport_destroy( c[i].tp );
+
+    secs = (t1 - p_t0) / 1e9;
+    printf("Replayed %llu of %lld messages in %.3f s (%.0f msg/s)"
+	   " on %u connections, failed=%llu waits=%llu late-max=%.3f ms\n",
+	   (unsigned long long)sent, n, secs, sent / (secs > 0 ? secs : 1),
+	   p_n, (unsigned long long)failed, (unsigned long long)waits,
+	   late / 1e6);
+    munmap( (void*)p_map, p_size );
+    free(c);
+}
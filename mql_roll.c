@@ -0,0 +1,413 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_roll.c
+ * Description     : Mqtt Logging, message counts per source and time
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:03:20 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:10:40 2026
+ * Update Count    : 2
+ */
+
+
+/*
+ * A record costs a source lookup, usually the one of the record before,
+ * and three probes of the count table.  The table is kept under half
+ * full.
+ */
+
+#include "mql_roll.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+static uint32_t
+roll_hash_src(const char* p, unsigned len)
+{
+    uint32_t h = 2166136261U;		/* FNV-1a */
+    while ( len-- )
+	h = (h ^ (uint8_t)*p++) * 16777619U;
+    return h;
+}
+
+static unsigned
+roll_slot(uint64_t key, unsigned n_slots)
+{
+    return (key * 0x9e3779b97f4a7c15ULL) >> 32 & (n_slots - 1);
+}
+
+// Slot of key, or the free one where it goes.
+static mql_roll_ent_t*
+roll_find(const mql_roll_ent_t* ent, unsigned n_slots, uint64_t key)
+{
+    unsigned i = roll_slot(key, n_slots);
+
+    while ( ent[i].count && ent[i].key != key )
+	i = (i + 1) & (n_slots - 1);
+    return (mql_roll_ent_t*)&ent[i];
+}
+
+// Move the counts to a table of n slots, those of buckets still kept.
+//	RETURNS	0 OK, -1 out of memory
+static int
+roll_rehash(mql_roll_t* r, unsigned n)
+{
+    mql_roll_ent_t* ent = calloc(n, sizeof(mql_roll_ent_t));
+    mql_roll_ent_t* e;
+    unsigned i, used = 0;
+
+    if ( !ent )
+	return -1;
+    for ( i = 0; i < r->hdr.n_slots; ++i ) {
+	e = &r->ent[i];
+	if ( !e->count || MQL_ROLL_KEY_TIER(e->key) >= MQL_ROLL_TIERS
+	     || MQL_ROLL_KEY_BUCKET(e->key)
+	     < r->hdr.keep[ MQL_ROLL_KEY_TIER(e->key) ] )
+	    continue;
+	*roll_find(ent, n, e->key) = *e;
+	++used;
+    }
+    free(r->ent);
+    r->ent = ent;
+    r->hdr.n_slots = n;
+    r->hdr.n_used = used;
+    return 0;
+}
+
+// Put source i in the source hash, growing it when needed.
+//	RETURNS	0 OK, -1 out of memory
+static int
+roll_src_slot(mql_roll_t* r, unsigned i)
+{
+    unsigned k, n = r->n_src_slots;
+    uint32_t* s;
+
+    if ( 2 * (i + 1) > n ) {
+	n = n ? 2 * n : 256;
+	s = calloc(n, sizeof(uint32_t));
+	if ( !s )
+	    return -1;
+	free(r->src_slot);
+	r->src_slot = s;
+	r->n_src_slots = n;
+	for ( k = 0; k < i; ++k )
+	    roll_src_slot(r, k);
+    }
+    k = roll_hash_src(r->dict + r->src_off[i], r->src_len[i]) & (n - 1);
+    while ( r->src_slot[k] )
+	k = (k + 1) & (n - 1);
+    r->src_slot[k] = i + 1;
+    return 0;
+}
+
+// Add a source to the dictionary.
+//	RETURNS	index, -1 out of memory or too many
+static int
+roll_src_add(mql_roll_t* r, const char* id, unsigned len)
+{
+    unsigned i = r->hdr.n_sources;
+
+    if ( i == MQL_ROLL_SOURCES || len > 255 )
+	return -1;
+    if ( i == r->max_src ) {
+	unsigned m = r->max_src ? 2 * r->max_src : 64;
+	uint32_t* o = realloc(r->src_off, m * sizeof(uint32_t));
+	uint8_t* l = o ? realloc(r->src_len, m) : 0;
+	if ( o )
+	    r->src_off = o;
+	if ( !l )
+	    return -1;
+	r->src_len = l;
+	r->max_src = m;
+    }
+    if ( r->hdr.dict_len + len > r->dict_max ) {
+	size_t m = 2 * (r->hdr.dict_len + len) + 1024;
+	char* d = realloc(r->dict, m);
+	if ( !d )
+	    return -1;
+	r->dict = d;
+	r->dict_max = m;
+    }
+    memcpy( r->dict + r->hdr.dict_len, id, len );
+    r->src_off[i] = r->hdr.dict_len;
+    r->src_len[i] = len;
+    r->hdr.dict_len += len;
+    if ( roll_src_slot(r, i) )
+	return -1;
+    ++r->hdr.n_sources;
+    return i;
+}
+
+void
+mql_roll_init(mql_roll_t* r)
+{
+    memset( r, 0, sizeof(mql_roll_t) );
+    memcpy( r->hdr.magic, MQL_ROLL_MAGIC, sizeof(r->hdr.magic) );
+    r->hdr.min_ts = ~0ULL;
+    r->last_src = -1;
+    r->tiers = MQL_ROLL_TIERS;
+}
+
+void
+mql_roll_free(mql_roll_t* r)
+{
+    free(r->ent);
+    free(r->dict);
+    free(r->src_off);
+    free(r->src_len);
+    free(r->src_slot);
+    mql_roll_init(r);
+}
+
+int
+mql_roll_source(const mql_roll_t* r, const char* id, unsigned len)
+{
+    unsigned k, i;
+
+    if ( !r->n_src_slots )
+	return -1;
+    k = roll_hash_src(id, len) & (r->n_src_slots - 1);
+    for ( ; r->src_slot[k]; k = (k + 1) & (r->n_src_slots - 1) ) {
+	i = r->src_slot[k] - 1;
+	if ( r->src_len[i] == len && !memcmp(r->dict + r->src_off[i], id, len) )
+	    return i;
+    }
+    return -1;
+}
+
+const char*
+mql_roll_name(const mql_roll_t* r, unsigned i, unsigned* len)
+{
+    *len = r->src_len[i];
+    return r->dict + r->src_off[i];
+}
+
+uint64_t
+mql_roll_get(const mql_roll_t* r, uint64_t key)
+{
+    if ( !r->hdr.n_slots )
+	return 0;
+    return roll_find(r->ent, r->hdr.n_slots, key)->count;
+}
+
+void
+mql_roll_count(mql_roll_t* r, const char* id, unsigned len, unsigned sev,
+	       uint64_t ts_ns, uint64_t n)
+{
+    uint64_t t = ts_ns / 1000000000;
+    mql_roll_ent_t* e;
+    unsigned tier;
+    int src = r->last_src;
+
+    if ( src < 0 || r->src_len[src] != len
+	 || memcmp(r->dict + r->src_off[src], id, len) ) {
+	src = mql_roll_source(r, id, len);
+	if ( src < 0 )
+	    src = roll_src_add(r, id, len);
+	if ( src < 0 ) {
+	    r->bad = 1;
+	    return;
+	}
+	r->last_src = src;
+    }
+    if ( 2 * (r->hdr.n_used + r->tiers) > r->hdr.n_slots
+	 && roll_rehash(r, r->hdr.n_slots ? 2 * r->hdr.n_slots : 4096) ) {
+	r->bad = 1;
+	return;
+    }
+    for ( tier = 0; tier < r->tiers; ++tier ) {
+	uint64_t key = MQL_ROLL_KEY(tier, t / MQL_ROLL_SECS(tier), src,
+				    sev & 15);
+	e = roll_find(r->ent, r->hdr.n_slots, key);
+	if ( !e->count ) {
+	    e->key = key;
+	    ++r->hdr.n_used;
+	}
+	e->count += n;
+    }
+}
+
+void
+mql_roll_add(mql_roll_t* r, const char* id, unsigned len, unsigned sev,
+	     uint64_t ts_ns, uint64_t seq)
+{
+    mql_roll_count(r, id, len, sev, ts_ns, 1);
+    if ( ts_ns < r->hdr.min_ts )
+	r->hdr.min_ts = ts_ns;
+    if ( ts_ns > r->hdr.max_ts )
+	r->hdr.max_ts = ts_ns;
+    if ( seq >= r->hdr.end_seq )
+	r->hdr.end_seq = seq + 1;
+}
+
+// Write all of n bytes.
+static int
+roll_write(int fd, const void* p, size_t n)
+{
+    while ( n ) {
+	ssize_t k = write(fd, p, n);
+	if ( k < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    return -1;
+	}
+	p = (const char*)p + k;
+	n -= k;
+    }
+    return 0;
+}
+
+int
+mql_roll_save(mql_roll_t* r, const char* dir)
+{
+    char path[ 4096 ], tmp[ 4096 + 4 ];
+    uint64_t t = r->hdr.max_ts / 1000000000;
+    uint32_t keep[ MQL_ROLL_TIERS ] = { 0 };
+    unsigned i, n, used;
+    int fd, dfd, err;
+
+    /* Old minutes and hours, right sized after. */
+    if ( t / 60 > MQL_ROLL_KEEP_MINUTES )
+	keep[ MQL_ROLL_MINUTE ] = t / 60 - MQL_ROLL_KEEP_MINUTES;
+    if ( t / 3600 > MQL_ROLL_KEEP_HOURS )
+	keep[ MQL_ROLL_HOUR ] = t / 3600 - MQL_ROLL_KEEP_HOURS;
+    if ( keep[ MQL_ROLL_MINUTE ] > r->hdr.keep[ MQL_ROLL_MINUTE ]
+	 || keep[ MQL_ROLL_HOUR ] > r->hdr.keep[ MQL_ROLL_HOUR ] ) {
+	for ( i = 0; i < MQL_ROLL_TIERS; ++i )
+	    if ( keep[i] > r->hdr.keep[i] )
+		r->hdr.keep[i] = keep[i];
+	for ( used = 0, i = 0; i < r->hdr.n_slots; ++i )
+	    if ( r->ent[i].count && MQL_ROLL_KEY_TIER(r->ent[i].key) < MQL_ROLL_TIERS
+		 && MQL_ROLL_KEY_BUCKET(r->ent[i].key)
+		 >= r->hdr.keep[ MQL_ROLL_KEY_TIER(r->ent[i].key) ] )
+		++used;
+	for ( n = 4096; n < 4 * used; n *= 2 )
+	    ;
+	if ( roll_rehash(r, n) )
+	    return -1;
+    }
+
+    snprintf( path, sizeof(path), "%s/" MQL_ROLL_FILE, dir );
+    snprintf( tmp, sizeof(tmp), "%s.tmp", path );
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 )
+	return -1;
+    if ( roll_write(fd, &r->hdr, sizeof(r->hdr)) )
+	goto fail;
+    for ( i = 0; i < r->hdr.n_sources; ++i )
+	if ( roll_write(fd, &r->src_len[i], 1)
+	     || roll_write(fd, r->dict + r->src_off[i], r->src_len[i]) )
+	    goto fail;
+    if ( roll_write(fd, r->ent, (size_t)r->hdr.n_slots * sizeof(*r->ent))
+	 || fdatasync(fd) )
+	goto fail;
+    if ( close(fd) || rename(tmp, path) ) {
+	fd = -1;
+	goto fail;
+    }
+    dfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if ( dfd >= 0 ) {
+	fsync(dfd);
+	close(dfd);
+    }
+    return 0;
+
+ fail:
+    err = errno;
+    if ( fd >= 0 )
+	close(fd);
+    unlink(tmp);
+    errno = err;
+    return -1;
+}
+
+int
+mql_roll_load(mql_roll_t* r, const char* dir)
+{
+    char path[ 4096 ];
+    mql_roll_header_t h;
+    struct stat sb;
+    size_t need, pos;
+    char* buf = 0;
+    unsigned i;
+    ssize_t k;
+    int fd, err = EINVAL;
+
+    snprintf( path, sizeof(path), "%s/" MQL_ROLL_FILE, dir );
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 )
+	return -1;
+    if ( fstat(fd, &sb) ) {
+	err = errno;
+	goto fail;
+    }
+    if ( sb.st_size < (off_t)sizeof(h) )
+	goto fail;
+    buf = malloc(sb.st_size);
+    if ( !buf ) {
+	err = ENOMEM;
+	goto fail;
+    }
+    for ( pos = 0; pos < (size_t)sb.st_size; pos += k ) {
+	k = read(fd, buf + pos, sb.st_size - pos);
+	if ( k <= 0 ) {
+	    err = k ? errno : EINVAL;
+	    goto fail;
+	}
+    }
+    memcpy( &h, buf, sizeof(h) );
+    need = sizeof(h) + h.n_sources + (size_t)h.dict_len
+	+ (size_t)h.n_slots * sizeof(mql_roll_ent_t);
+    if ( memcmp(h.magic, MQL_ROLL_MAGIC, sizeof(h.magic))
+	 || h.n_sources > MQL_ROLL_SOURCES
+	 || (h.n_slots & (h.n_slots - 1))
+	 || 2 * h.n_used > h.n_slots
+	 || need != (size_t)sb.st_size )
+	goto fail;
+
+    /* Sources in the order of their indexes. */
+    mql_roll_free(r);
+    pos = sizeof(h);
+    for ( i = 0; i < h.n_sources; ++i ) {
+	unsigned len = (uint8_t)buf[pos];
+	if ( pos + 1 + len > sizeof(h) + h.n_sources + h.dict_len )
+	    goto fail;
+	if ( roll_src_add(r, buf + pos + 1, len) != (int)i ) {
+	    err = r->hdr.n_sources == i ? ENOMEM : EINVAL;
+	    goto fail;
+	}
+	pos += 1 + len;
+    }
+    if ( pos != sizeof(h) + h.n_sources + h.dict_len )
+	goto fail;
+    r->ent = calloc(h.n_slots + 1, sizeof(mql_roll_ent_t));
+    if ( !r->ent ) {
+	err = ENOMEM;
+	goto fail;
+    }
+    memcpy( r->ent, buf + pos, (size_t)h.n_slots * sizeof(mql_roll_ent_t) );
+    for ( k = 0, i = 0; i < h.n_slots; ++i )
+	k += !!r->ent[i].count;
+    if ( k != h.n_used )
+	goto fail;			/* Lookups need free slots */
+    r->hdr = h;
+    free(buf);
+    close(fd);
+    return 0;
+
+ fail:
+    mql_roll_free(r);
+    free(buf);
+    close(fd);
+    errno = err;
+    return -1;
+}
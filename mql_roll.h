@@ -0,0 +1,134 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_roll.h
+ * Description     : Mqtt Logging, message counts per source and time
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:03:20 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:10:40 2026
+ * Update Count    : 2
+ */
+
+#ifndef __MQL_ROLL_H__
+#define __MQL_ROLL_H__ (1)
+
+/*
+ * The store writer counts records per source, severity and minute, and
+ * the same per hour and per day, as it writes them.  The counts are saved
+ * in MQL_ROLL_FILE in the store directory, a hash table as it is in
+ * memory:
+ *
+ *	mql_roll_header_t
+ *	n_sources sources, a length byte and the name each
+ *	n_slots mql_roll_ent_t, open addressing, count 0 for a free slot
+ *
+ * Minutes are dropped after MQL_ROLL_KEEP_MINUTES and hours after
+ * MQL_ROLL_KEEP_HOURS, days are kept.  Buckets are UTC.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_ROLL_MAGIC		"MQLROL01"
+#define MQL_ROLL_FILE		"rollup.mql"
+
+#define MQL_ROLL_MINUTE		(0)
+#define MQL_ROLL_HOUR		(1)
+#define MQL_ROLL_DAY		(2)
+#define MQL_ROLL_TIERS		(3)
+
+#define MQL_ROLL_SECS(tier) \
+    ((tier) == MQL_ROLL_MINUTE ? 60 : (tier) == MQL_ROLL_HOUR ? 3600 : 86400)
+
+#define MQL_ROLL_KEEP_MINUTES	(2 * 24 * 60)
+#define MQL_ROLL_KEEP_HOURS	(92 * 24)
+
+// Key of a count: bucket is the start / MQL_ROLL_SECS(tier), src the
+// index of the source.
+#define MQL_ROLL_KEY(tier,bucket,src,sev) \
+    ((uint64_t)(bucket) << 32 | (uint64_t)(src) << 16 | (sev) << 8 | (tier))
+#define MQL_ROLL_KEY_TIER(k)	((unsigned)((k) & 0xff))
+#define MQL_ROLL_KEY_SEV(k)	((unsigned)((k) >> 8 & 0xff))
+#define MQL_ROLL_KEY_SRC(k)	((unsigned)((k) >> 16 & 0xffff))
+#define MQL_ROLL_KEY_BUCKET(k)	((uint32_t)((k) >> 32))
+
+#define MQL_ROLL_SOURCES	(65535)
+
+typedef struct {
+    char	magic[ 8 ];		/* MQL_ROLL_MAGIC, no NUL */
+    uint64_t	end_seq;		/* Records before it are counted */
+    uint64_t	min_ts;			/* Of the records counted */
+    uint64_t	max_ts;
+    uint32_t	n_sources;
+    uint32_t	dict_len;		/* Bytes of sources */
+    uint32_t	n_slots;		/* Power of two */
+    uint32_t	n_used;
+    uint32_t	keep[ MQL_ROLL_TIERS ];	/* Older buckets are dropped */
+    uint32_t	reserved;
+    uint64_t	reserved2[ 2 ];
+} mql_roll_header_t;
+
+typedef struct {
+    uint64_t	key;			/* MQL_ROLL_KEY() */
+    uint64_t	count;
+} mql_roll_ent_t;
+
+typedef struct {
+    mql_roll_header_t hdr;
+    mql_roll_ent_t* ent;		/* hdr.n_slots */
+    char*	dict;			/* Names, one after the other */
+    size_t	dict_max;
+    uint32_t*	src_off;		/* In dict, per source */
+    uint8_t*	src_len;
+    unsigned	max_src;
+    uint32_t*	src_slot;		/* Source + 1, 0 free */
+    unsigned	n_src_slots;
+    int		last_src;		/* Of the last record, or -1 */
+    unsigned	tiers;			/* Counted, the first so many */
+    int		bad;			/* Out of memory, counts are off */
+} mql_roll_t;
+
+// An empty table.
+void mql_roll_init(mql_roll_t* r);
+
+void mql_roll_free(mql_roll_t* r);
+
+// Read MQL_ROLL_FILE of dir into an empty table.
+//	RETURNS	0 OK, -1 on error (errno set, ENOENT none, EINVAL damaged)
+int mql_roll_load(mql_roll_t* r, const char* dir);
+
+// Drop old buckets and write MQL_ROLL_FILE of dir, a new file renamed in
+// place.
+//	RETURNS	0 OK, -1 on error (errno set)
+int mql_roll_save(mql_roll_t* r, const char* dir);
+
+// Count a record.
+void mql_roll_add(mql_roll_t* r, const char* id, unsigned len, unsigned sev,
+		  uint64_t ts_ns, uint64_t seq);
+
+// Count n records at ts_ns, leaving the times and end_seq alone.
+void mql_roll_count(mql_roll_t* r, const char* id, unsigned len,
+		    unsigned sev, uint64_t ts_ns, uint64_t n);
+
+// Index of a source.
+//	RETURNS	index, -1 not counted
+int mql_roll_source(const mql_roll_t* r, const char* id, unsigned len);
+
+// Name of source i.
+const char* mql_roll_name(const mql_roll_t* r, unsigned i, unsigned* len);
+
+// Count of a key, 0 for none.
+uint64_t mql_roll_get(const mql_roll_t* r, uint64_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
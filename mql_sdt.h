@@ -0,0 +1,92 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_sdt.h
+ * Description     : USDT static tracepoints
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:05:33 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:35:10 2026
+ * Update Count    : 2
+ */
+
+#ifndef __MQL_SDT_H__
+#define __MQL_SDT_H__ (1)
+
+/*
+ * Static tracepoints for bpftrace/perf, provider "mql".
+ *
+ * Probes are compiled in whenever <sys/sdt.h> (systemtap-sdt-dev) is
+ * available, unless MQL_NO_USDT is defined.  An unattached probe is a
+ * single nop.  Each probe has a semaphore that the tracer increments
+ * when it attaches (use bpftrace -p <pid>), so timing arguments are only
+ * measured while someone is listening; otherwise they are 0.
+ *
+ * Probes:
+ *	mql:log_entry	(severity, level)
+ *	mql:log_filter	(severity, level)
+ *	mql:log_publish	(severity, len, status, publish_ns)
+ *	mql:log_return	(severity, rc, total_ns)
+ *	mql:logf_format	(severity, len, format_ns)
+ *	mql:level_change (command, old_level, new_level, count)
+ *	mql:listen_parse (severity, topic_len, parse_ns)
+ *	mql:listen_print (severity, payload_len, print_ns), from the parse,
+ *			 queued time included
+ */
+
+#include <time.h>
+#include <stdint.h>
+
+#if !defined(MQL_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define MQL_USDT (1)
+#endif
+#endif
+
+
+#ifdef MQL_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// Define the semaphore of a probe, once, in the file using the probe.
+#define MQL_PROBE_DEFINE(name)					\
+    unsigned short mql_##name##_semaphore			\
+	__attribute__((unused)) __attribute__((section(".probes")))
+
+// True while a tracer is attached to the probe.
+#define MQL_PROBE_ENABLED(name)						\
+    __builtin_expect( *(volatile unsigned short*)&mql_##name##_semaphore, 0 )
+
+#define MQL_PROBE2(name,a,b)		STAP_PROBE2(mql,name,a,b)
+#define MQL_PROBE3(name,a,b,c)		STAP_PROBE3(mql,name,a,b,c)
+#define MQL_PROBE4(name,a,b,c,d)	STAP_PROBE4(mql,name,a,b,c,d)
+
+#else
+
+#define MQL_PROBE_DEFINE(name)		\
+    extern unsigned short mql_##name##_semaphore
+#define MQL_PROBE_ENABLED(name)		(0)
+
+#define MQL_PROBE2(name,a,b)		\
+    do { (void)(a); (void)(b); } while(0)
+#define MQL_PROBE3(name,a,b,c)		\
+    do { (void)(a); (void)(b); (void)(c); } while(0)
+#define MQL_PROBE4(name,a,b,c,d)	\
+    do { (void)(a); (void)(b); (void)(c); (void)(d); } while(0)
+
+#endif
+
+
+// Monotonic time in ns, for probe timing arguments.
+static inline uint64_t
+mql_probe_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,615 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_serve.c
+ * Description     : Mqtt Logging, following the store and serving tails
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:27:32 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:03:23 2026
+ * Update Count    : 2
+ */
+
+
+/*
+ * The follower lists the store only to find the next file, the one
+ * holding the sequence number it looks for or the first after it.  A
+ * segment without a footer is being written: at its end the follower
+ * looks at the size again and maps the file anew when it grew.  A record
+ * not all there yet, or the zeros of a write that is not done when a
+ * later one is, reads as damaged and is waited for.  Files are skipped by
+ * their footer or header when all their records are too old or behind
+ * the sequence number.
+ */
+
+#include "mql_serve.h"
+#include "mql_int.h"
+#include "mql_col.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+
+#define FW_NONE		(0)
+#define FW_SEG		(1)
+#define FW_COL		(2)
+
+#define SV_POLL_MS	(50)		/* Looking for more when caught up */
+#define SV_BUF		(64 * 1024)	/* Sent at once */
+
+struct mql_follow {
+    char	dir[ 4096 ];
+    mql_tail_req_t req;
+    uint64_t	next;			/* Sequence number looked for */
+    uint64_t	done;			/* First seq of the last file read */
+    int		have_done;
+    int		kind;			/* FW_... */
+    mql_seg_t	seg;
+    size_t	pos;
+    mql_col_t	col;
+    unsigned	g;			/* Next group of col */
+    mql_col_rows_t* rows;		/* Group g - 1 */
+    unsigned	r;			/* Next row of rows */
+    size_t	tpos;			/* Its text */
+    char*	rec;			/* A record of col */
+    size_t	rec_max;
+};
+
+struct mql_serve {
+    char	dir[ 4096 ];
+    char	path[ sizeof(((struct sockaddr_un*)0)->sun_path) ];
+    int		fd;
+    pthread_t	tid;
+    volatile int stop;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    unsigned	n_clients;
+};
+
+typedef struct {
+    mql_serve_t* srv;
+    int		fd;
+} sv_client_t;
+
+
+/*
+ * Following
+ */
+
+mql_follow_t*
+mql_follow_open(const char* dir, const mql_tail_req_t* req)
+{
+    mql_follow_t* f = calloc(1, sizeof(mql_follow_t));
+
+    if ( !f )
+	return 0;
+    f->rows = calloc(1, sizeof(mql_col_rows_t));
+    if ( !f->rows ) {
+	free(f);
+	return 0;
+    }
+    strncpy( f->dir, dir, sizeof(f->dir) - 1 );
+    f->req = *req;
+    if ( f->req.id_len > sizeof(f->req.id) )
+	f->req.id_len = sizeof(f->req.id);
+    f->next = req->from_seq;
+    f->seg.fd = f->col.fd = -1;
+    return f;
+}
+
+uint64_t
+mql_follow_seq(const mql_follow_t* f)
+{
+    return f->next;
+}
+
+// The file is read, go on after it.
+static void
+fw_close(mql_follow_t* f, uint64_t first, uint64_t end)
+{
+    if ( f->kind == FW_SEG )
+	mql_seg_close(&f->seg);
+    else if ( f->kind == FW_COL )
+	mql_col_close(&f->col);
+    f->kind = FW_NONE;
+    f->done = first;
+    f->have_done = 1;
+    if ( end > f->next )
+	f->next = end;
+}
+
+void
+mql_follow_close(mql_follow_t* f)
+{
+    if ( !f )
+	return;
+    fw_close(f, 0, 0);
+    free(f->rows->text);
+    free(f->rows);
+    free(f->rec);
+    free(f);
+}
+
+// Whether a record is asked for.
+static int
+fw_match(const mql_follow_t* f, const char* id, unsigned id_len, unsigned sev,
+	 uint64_t ts_ns)
+{
+    return sev <= f->req.sev && ts_ns >= f->req.since_ns
+	&& (!f->req.id_len
+	    || (id_len == f->req.id_len && !memcmp(id, f->req.id, id_len)));
+}
+
+// Open the file holding next, or the first after it, skipping those with
+// nothing to follow.
+//	RETURNS	1 opened, 0 none, or one went away under us
+static int
+fw_open(mql_follow_t* f)
+{
+    char path[ 4096 + 32 ];
+    char** segs;
+    char** cols;
+    const char** name;
+    char* is_seg;
+    const mql_seg_footer_t* foot;
+    uint64_t first;
+    int n_seg, n_col, n, i, j, c, s = -1;
+
+    n_seg = mql_seg_list(f->dir, &segs);
+    if ( n_seg < 0 )
+	return 0;
+    n_col = mql_col_list(f->dir, &cols);
+    if ( n_col < 0 ) {
+	mql_seg_list_free(segs, n_seg);
+	return 0;
+    }
+    name = calloc(n_seg + n_col + 1, sizeof(char*));
+    is_seg = calloc(n_seg + n_col + 1, 1);
+
+    /* Both in sequence order, a segment still there is read instead. */
+    for ( i = 0, j = 0, n = 0; name && is_seg && (i < n_seg || j < n_col); ++n ) {
+	c = i == n_seg ? 1 : j == n_col ? -1 : strncmp(segs[i], cols[j], 16);
+	is_seg[n] = c <= 0;
+	name[n] = c <= 0 ? segs[i++] : cols[j++];
+	if ( !c )
+	    ++j;
+    }
+    /* The last holding next, or the first after those read. */
+    for ( i = 0; name && is_seg && i < n; ++i ) {
+	first = strtoull(name[i], 0, 16);
+	if ( f->have_done && first <= f->done )
+	    continue;
+	if ( first > f->next ) {
+	    if ( s < 0 )
+		s = i;
+	    break;
+	}
+	s = i;
+    }
+
+    for ( i = s; s >= 0 && i < n && f->kind == FW_NONE; ++i ) {
+	first = strtoull(name[i], 0, 16);
+	snprintf( path, sizeof(path), "%s/%s", f->dir, name[i] );
+	if ( is_seg[i] ) {
+	    if ( mql_seg_open(&f->seg, path) ) {
+		if ( errno == ENOENT )
+		    break;		/* Compacted, list again */
+		fw_close(f, first, 0);
+		continue;
+	    }
+	    f->kind = FW_SEG;
+	    f->pos = 0;
+	    foot = mql_seg_footer(&f->seg);
+	    if ( foot && (foot->end_seq <= f->next
+			  || foot->max_ts < f->req.since_ns) )
+		fw_close(f, first, foot->end_seq);
+	}
+	else {
+	    if ( mql_col_open(&f->col, path) ) {
+		if ( errno == ENOENT )
+		    break;
+		fw_close(f, first, 0);
+		continue;
+	    }
+	    f->kind = FW_COL;
+	    f->g = f->r = 0;
+	    f->rows->n = 0;
+	    if ( MQL_COL_END(f->col.hdr) <= f->next
+		 || f->col.hdr->max_ts < f->req.since_ns )
+		fw_close(f, first, MQL_COL_END(f->col.hdr));
+	}
+    }
+    free(name);
+    free(is_seg);
+    mql_seg_list_free(segs, n_seg);
+    mql_seg_list_free(cols, n_col);
+    return f->kind != FW_NONE;
+}
+
+// Map more of a segment that grew.
+//	RETURNS	1 it grew, 0 not
+static int
+fw_grow(mql_follow_t* f)
+{
+    struct stat sb;
+    void* p;
+
+    if ( fstat(f->seg.fd, &sb) || (size_t)sb.st_size <= f->seg.size )
+	return 0;
+    p = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, f->seg.fd, 0);
+    if ( p == MAP_FAILED )
+	return 0;
+    munmap( (void*)f->seg.base, f->seg.size );
+    f->seg.base = p;
+    f->seg.hdr = p;
+    f->seg.size = sb.st_size;
+    return 1;
+}
+
+// Next record of a segment.
+//	RETURNS	1 record, 0 at the end, 2 the segment is done
+static int
+fw_seg(mql_follow_t* f, const mql_rec_t** rec)
+{
+    const mql_seg_footer_t* foot;
+    const mql_rec_t* r;
+    int k;
+
+    for (;;) {
+	k = mql_seg_next(&f->seg, &f->pos, &r);
+	if ( k > 0 ) {
+	    if ( r->seq < f->next )
+		continue;
+	    f->next = r->seq + 1;
+	    if ( !fw_match(f, MQL_REC_ID(r), r->id_len, r->sev, r->ts_ns) )
+		continue;
+	    *rec = r;
+	    return 1;
+	}
+	if ( fw_grow(f) )
+	    continue;
+	foot = mql_seg_footer(&f->seg);
+	if ( !foot )
+	    return 0;			/* Being written */
+	fw_close(f, f->seg.hdr->first_seq, foot->end_seq);
+	return 2;
+    }
+}
+
+// Next record of a columnar file.
+//	RETURNS	1 record, 2 the file is done, -1 on error
+static int
+fw_col(mql_follow_t* f, const mql_rec_t** rec)
+{
+    const mql_col_t* col = &f->col;
+    const mql_col_group_t* k;
+    mql_col_rows_t* rows = f->rows;
+    mql_rec_t* r;
+    const char* text;
+    const char* id;
+    unsigned len, id_len;
+    size_t n;
+
+    for (;;) {
+	if ( f->r == rows->n ) {
+	    if ( f->g == col->hdr->n_groups ) {
+		fw_close(f, col->hdr->first_seq, MQL_COL_END(col->hdr));
+		return 2;
+	    }
+	    k = &col->groups[ f->g++ ];
+	    rows->n = f->r = 0;
+	    f->tpos = 0;
+	    if ( k->max_ts < f->req.since_ns
+		 || !(k->sev_mask & ((2U << f->req.sev) - 1))
+		 || (f->g < col->hdr->n_groups
+		     && col->groups[ f->g ].first_seq <= f->next) ) {
+		if ( f->g < col->hdr->n_groups
+		     && col->groups[ f->g ].first_seq > f->next )
+		    f->next = col->groups[ f->g ].first_seq;
+		continue;
+	    }
+	    if ( mql_col_get(col, f->g - 1, MQL_COL_SRC | MQL_COL_SEV
+			     | MQL_COL_TS | MQL_COL_TEXT | MQL_COL_SEQ, rows) ) {
+		rows->n = 0;
+		continue;		/* Damaged, as query does */
+	    }
+	}
+	if ( mql_col_text(rows, &f->tpos, &text, &len) <= 0 ) {
+	    f->r = rows->n;
+	    continue;
+	}
+	if ( rows->seq[ f->r ] < f->next ) {
+	    ++f->r;
+	    continue;
+	}
+	f->next = rows->seq[ f->r ] + 1;
+	id = col->src[ rows->src[ f->r ] ];
+	id_len = col->src_len[ rows->src[ f->r ] ];
+	if ( !fw_match(f, id, id_len, rows->sev[ f->r ], rows->ts[ f->r ]) ) {
+	    ++f->r;
+	    continue;
+	}
+
+	/* As it was in the segment. */
+	n = MQL_REC_LEN(id_len, len);
+	if ( n > f->rec_max ) {
+	    char* p = realloc(f->rec, n);
+	    if ( !p )
+		return -1;
+	    f->rec = p;
+	    f->rec_max = n;
+	}
+	r = (mql_rec_t*)f->rec;
+	memset( r, 0, sizeof(mql_rec_t) );
+	r->len = n;
+	r->text_len = len;
+	r->seq = rows->seq[ f->r ];
+	r->ts_ns = rows->ts[ f->r ];
+	r->sev = rows->sev[ f->r ];
+	r->id_len = id_len;
+	memcpy( f->rec + sizeof(mql_rec_t), id, id_len );
+	memcpy( f->rec + sizeof(mql_rec_t) + id_len, text, len );
+	memset( f->rec + sizeof(mql_rec_t) + id_len + len, 0,
+		n - sizeof(mql_rec_t) - id_len - len );
+	++f->r;
+	*rec = r;
+	return 1;
+    }
+}
+
+int
+mql_follow_next(mql_follow_t* f, const mql_rec_t** rec)
+{
+    int k;
+
+    for (;;) {
+	if ( f->kind == FW_NONE && !fw_open(f) )
+	    return 0;
+	k = f->kind == FW_SEG ? fw_seg(f, rec) : fw_col(f, rec);
+	if ( k != 2 )
+	    return k;
+    }
+}
+
+
+/*
+ * Serving
+ */
+
+// Send all of n bytes, giving up when the server stops.
+//	RETURNS	0 OK, -1 gone
+static int
+sv_send(mql_serve_t* srv, int fd, const char* p, size_t n)
+{
+    ssize_t k;
+
+    while ( n ) {
+	k = send(fd, p, n, MSG_NOSIGNAL);
+	if ( k < 0 ) {
+	    if ( (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		 && !srv->stop )
+		continue;
+	    return -1;
+	}
+	p += k;
+	n -= k;
+    }
+    return 0;
+}
+
+// Whether the client is still there, waiting up to ms for it to go.
+static int
+sv_alive(int fd, int ms)
+{
+    struct pollfd p = { fd, POLLIN, 0 };
+    char c[ 64 ];
+
+    ssize_t k;
+
+    if ( poll(&p, 1, ms) <= 0 )
+	return 1;
+    k = recv(fd, c, sizeof(c), MSG_DONTWAIT);
+    return k > 0 || (k < 0 && errno == EAGAIN);
+}
+
+// Read the request of a client.
+//	RETURNS	0 OK, -1 gone or bad
+static int
+sv_request(mql_serve_t* srv, int fd, mql_tail_req_t* req)
+{
+    size_t got = 0;
+    ssize_t k;
+    struct pollfd p = { fd, POLLIN, 0 };
+
+    while ( got < sizeof(*req) && !srv->stop ) {
+	if ( poll(&p, 1, 200) <= 0 )
+	    continue;
+	k = recv(fd, (char*)req + got, sizeof(*req) - got, 0);
+	if ( k <= 0 )
+	    return -1;
+	got += k;
+    }
+    if ( got < sizeof(*req)
+	 || memcmp(req->magic, MQL_TAIL_MAGIC, sizeof(req->magic)) )
+	return -1;
+    return 0;
+}
+
+static void*
+sv_client(void* arg)
+{
+    sv_client_t* cl = arg;
+    mql_serve_t* srv = cl->srv;
+    mql_follow_t* f = 0;
+    const mql_rec_t* r;
+    mql_tail_req_t req;
+    mql_rec_t mark;
+    struct timeval tv = { 0, 200000 };
+    char* buf = malloc(SV_BUF);
+    size_t n = 0;
+    uint64_t marked = 0;
+    int live = 0, k;
+
+    setsockopt( cl->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv) );
+    if ( buf && !sv_request(srv, cl->fd, &req) )
+	f = mql_follow_open(srv->dir, &req);
+    while ( f && !srv->stop ) {
+	k = mql_follow_next(f, &r);
+	if ( k < 0 )
+	    break;
+	if ( k > 0 && r->len <= MQL_TAIL_REC_MAX ) {
+	    if ( n + r->len > SV_BUF ) {
+		if ( sv_send(srv, cl->fd, buf, n) )
+		    break;
+		n = 0;
+	    }
+	    if ( r->len > SV_BUF ) {
+		if ( sv_send(srv, cl->fd, (const char*)r, r->len) )
+		    break;
+	    }
+	    else {
+		memcpy( buf + n, r, r->len );
+		n += r->len;
+	    }
+	    continue;
+	}
+	if ( k > 0 )
+	    continue;
+
+	/* Caught up, say how far. */
+	if ( !live || mql_follow_seq(f) != marked ) {
+	    memset( &mark, 0, sizeof(mark) );
+	    mark.len = sizeof(mark);
+	    mark.seq = marked = mql_follow_seq(f);
+	    mark.flags = MQL_REC_PAD | MQL_TAIL_MARK | (live ? 0 : MQL_TAIL_LIVE);
+	    memcpy( buf + n, &mark, sizeof(mark) );
+	    n += sizeof(mark);
+	    live = 1;
+	}
+	if ( n && sv_send(srv, cl->fd, buf, n) )
+	    break;
+	n = 0;
+	if ( !sv_alive(cl->fd, SV_POLL_MS) )
+	    break;
+    }
+    mql_follow_close(f);
+    free(buf);
+    close(cl->fd);
+    free(cl);
+
+    pthread_mutex_lock( &srv->mtx );
+    --srv->n_clients;
+    pthread_cond_broadcast( &srv->cv );
+    pthread_mutex_unlock( &srv->mtx );
+    return 0;
+}
+
+static void*
+sv_listen(void* arg)
+{
+    mql_serve_t* srv = arg;
+    struct pollfd p = { srv->fd, POLLIN, 0 };
+    sv_client_t* cl;
+    pthread_t tid;
+    int fd;
+
+    while ( !srv->stop ) {
+	if ( poll(&p, 1, 200) <= 0 )
+	    continue;
+	fd = accept(srv->fd, 0, 0);
+	if ( fd < 0 )
+	    continue;
+	cl = malloc(sizeof(sv_client_t));
+	if ( !cl ) {
+	    close(fd);
+	    continue;
+	}
+	cl->srv = srv;
+	cl->fd = fd;
+	pthread_mutex_lock( &srv->mtx );
+	++srv->n_clients;
+	pthread_mutex_unlock( &srv->mtx );
+	if ( pthread_create(&tid, 0, sv_client, cl) ) {
+	    close(fd);
+	    free(cl);
+	    pthread_mutex_lock( &srv->mtx );
+	    --srv->n_clients;
+	    pthread_mutex_unlock( &srv->mtx );
+	    continue;
+	}
+	pthread_detach( tid );
+    }
+    return 0;
+}
+
+mql_serve_t*
+mql_serve_start(const char* dir)
+{
+    mql_serve_t* srv = calloc(1, sizeof(mql_serve_t));
+    struct sockaddr_un sa;
+    int err;
+
+    if ( !srv )
+	return 0;
+    if ( snprintf(srv->path, sizeof(srv->path), "%s/%s", dir, MQL_TAIL_SOCK)
+	 >= (int)sizeof(srv->path) ) {
+	free(srv);
+	errno = ENAMETOOLONG;
+	return 0;
+    }
+    strncpy( srv->dir, dir, sizeof(srv->dir) - 1 );
+    pthread_mutex_init( &srv->mtx, 0 );
+    pthread_cond_init( &srv->cv, 0 );
+    memset( &sa, 0, sizeof(sa) );
+    sa.sun_family = AF_UNIX;
+    strcpy( sa.sun_path, srv->path );
+    srv->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( srv->fd < 0 )
+	goto fail;
+    if ( mql_unix_unlink_stale(srv->path, SOCK_STREAM) )
+	goto fail;
+    if ( bind(srv->fd, (struct sockaddr*)&sa, sizeof(sa))
+	 || listen(srv->fd, 16) )
+	goto fail;
+    if ( pthread_create(&srv->tid, 0, sv_listen, srv) ) {
+	unlink(srv->path);
+	goto fail;
+    }
+    return srv;
+
+ fail:
+    err = errno;
+    if ( srv->fd >= 0 )
+	close(srv->fd);
+    free(srv);
+    errno = err;
+    return 0;
+}
+
+void
+mql_serve_stop(mql_serve_t* srv)
+{
+    if ( !srv )
+	return;
+    srv->stop = 1;
+    pthread_join( srv->tid, 0 );
+    close(srv->fd);
+    unlink(srv->path);
+    pthread_mutex_lock( &srv->mtx );
+    while ( srv->n_clients )
+	pthread_cond_wait( &srv->cv, &srv->mtx );
+    pthread_mutex_unlock( &srv->mtx );
+    free(srv);
+}
@@ -0,0 +1,98 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_serve.h
+ * Description     : Mqtt Logging, following the store and serving tails
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:27:32 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:27:32 2026
+ * Update Count    : 1
+ */
+
+#ifndef __MQL_SERVE_H__
+#define __MQL_SERVE_H__ (1)
+
+/*
+ * A follower reads the records of a store in sequence order, segments
+ * and columnar files alike, from a sequence number or a time, and goes
+ * on into the segment being written as the writer adds to it.  History
+ * and live records are the one stream, numbered by the store, so there
+ * is nothing to join.
+ *
+ * mqld serves followers on the unix socket MQL_TAIL_SOCK of the store
+ * directory.  A client sends a mql_tail_req_t, and gets the records that
+ * match as they are in segments, a mql_rec_t, the source and the text
+ * padded to 8, and now and then a mark, a mql_rec_t of only the header
+ * with MQL_REC_PAD | MQL_TAIL_MARK: every record before its seq has been
+ * looked at.  The first mark also has MQL_TAIL_LIVE, the history is done.
+ * A client that loses the server asks again from the seq after the last
+ * record or mark it got.
+ */
+
+#include "mql_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_TAIL_SOCK		"tail.sock"
+#define MQL_TAIL_MAGIC		"MQLTAIL1"
+
+#define MQL_TAIL_MARK		(0x100)	/* mql_rec_t flags, with MQL_REC_PAD */
+#define MQL_TAIL_LIVE		(0x200)
+
+#define MQL_TAIL_REC_MAX	(1024 * 1024)	/* Longest record sent */
+
+typedef struct {
+    char	magic[ 8 ];		/* MQL_TAIL_MAGIC, no NUL */
+    uint64_t	from_seq;		/* 0 for all since since_ns */
+    uint64_t	since_ns;
+    uint32_t	sev;			/* This and more severe */
+    uint32_t	id_len;			/* 0 for all sources */
+    char	id[ 256 ];
+} mql_tail_req_t;
+
+
+/*
+ * Following
+ */
+
+typedef struct mql_follow mql_follow_t;
+
+// A follower of the store in dir, for the records of req.
+//	RETURNS	follower, 0 out of memory
+mql_follow_t* mql_follow_open(const char* dir, const mql_tail_req_t* req);
+
+// The next record, valid until the next call.  0 when caught up with the
+// writer, ask again later.
+//	RETURNS	1 record in *rec, 0 none yet, -1 on error (errno set)
+int mql_follow_next(mql_follow_t* f, const mql_rec_t** rec);
+
+// Sequence number of the next record to look at.
+uint64_t mql_follow_seq(const mql_follow_t* f);
+
+void mql_follow_close(mql_follow_t* f);
+
+
+/*
+ * Serving
+ */
+
+typedef struct mql_serve mql_serve_t;
+
+// Serve followers of the store in dir on its MQL_TAIL_SOCK, from a
+// thread of its own and a thread per client.
+//	RETURNS	server, 0 on error (errno set)
+mql_serve_t* mql_serve_start(const char* dir);
+
+// Close the socket and the clients, and free.
+void mql_serve_stop(mql_serve_t* srv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,252 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_stats.c
+ * Description     : Stats command, message counts from the store rollups
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:03:20 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:03:20 2026
+ * Update Count    : 1
+ */
+
+
+/*
+ * Answered from the rollup counts of mqld (see mql_roll.h), no records
+ * are read.  The range is cut into whole days, hours and minutes, the
+ * largest that fit, so a day back is at most some 160 lookups per source
+ * and severity.  It is rounded out to whole minutes, and in to whole
+ * hours or days where the minutes or hours are dropped already.  The
+ * counts are those of the last save, at most a minute behind mqld.
+ */
+
+#include "mql.h"
+#include "mql_roll.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+extern int opt_d;
+#define DD if(opt_d)printf
+
+extern const char* mql_sev_name[MQL_S_MAX];
+
+#define S_BY_ALL	(0)		/* Source and severity */
+#define S_BY_SOURCE	(1)
+#define S_BY_SEVERITY	(2)
+#define S_BY_MINUTE	(3)
+#define S_BY_HOUR	(4)
+#define S_BY_DAY	(5)
+
+static const char* s_by_name[] =
+{ "", "source", "severity", "minute", "hour", "day", 0 };
+
+static mql_roll_t roll;
+
+// Start of the time bucket of t of a tier, rounded down or up.
+static uint64_t
+s_floor(uint64_t t, unsigned tier)
+{
+    return t - t % MQL_ROLL_SECS(tier);
+}
+
+static uint64_t
+s_ceil(uint64_t t, unsigned tier)
+{
+    return s_floor(t + MQL_ROLL_SECS(tier) - 1, tier);
+}
+
+// Whether the bucket of tier starting at t is kept.
+static int
+s_kept(uint64_t t, unsigned tier)
+{
+    return t / MQL_ROLL_SECS(tier) >= roll.hdr.keep[tier];
+}
+
+// Count of a source, severities sev_lo to sev_hi, in [s,e), with the
+// tiers up to top.
+static uint64_t
+s_count(unsigned src, unsigned sev_lo, unsigned sev_hi, uint64_t s, uint64_t e,
+	unsigned top)
+{
+    uint64_t n = 0;
+    unsigned tier, v;
+
+    while ( s < e ) {
+	for ( tier = top; tier; --tier )
+	    if ( !(s % MQL_ROLL_SECS(tier)) && s + MQL_ROLL_SECS(tier) <= e )
+		break;
+	for ( v = sev_lo; v <= sev_hi; ++v )
+	    n += mql_roll_get(&roll, MQL_ROLL_KEY(tier, s / MQL_ROLL_SECS(tier),
+						  src, v));
+	s += MQL_ROLL_SECS(tier);
+    }
+    return n;
+}
+
+static const char* s_sort_dict;
+
+static int
+s_name_cmp(const void* a, const void* b)
+{
+    unsigned x = *(const unsigned*)a;
+    unsigned y = *(const unsigned*)b;
+    unsigned xl = roll.src_len[x], yl = roll.src_len[y];
+    int c = memcmp(s_sort_dict + roll.src_off[x], s_sort_dict + roll.src_off[y],
+		   xl < yl ? xl : yl);
+    return c ? c : (xl > yl) - (xl < yl);
+}
+
+// Print a time, local, days as UTC dates as they are counted.
+static void
+s_time(uint64_t t, unsigned tier)
+{
+    char buf[ 64 ];
+    struct tm tm;
+    time_t tt = t;
+
+    if ( tier == MQL_ROLL_DAY ) {
+	gmtime_r( &tt, &tm );
+	strftime( buf, sizeof(buf), "%Y-%m-%d", &tm );
+    }
+    else {
+	localtime_r( &tt, &tm );
+	strftime( buf, sizeof(buf), "%Y-%m-%d %H:%M", &tm );
+    }
+    printf("%-16s ", buf);
+}
+
+
+void
+mql_command_stats(const char* dir, const char* target, unsigned severity,
+		  uint64_t since_ns, uint64_t until_ns, const char* by)
+{
+    unsigned* src;
+    unsigned n_src, i, v, k, tier;
+    uint64_t s, e, t, n, mins;
+    uint64_t total[ MQL_S_MAX ];
+    time_t from;
+    int rounded = 0;
+
+    for ( k = 0; by && s_by_name[k] && strcmp(s_by_name[k], by); ++k )
+	;
+    if ( by && !s_by_name[k] ) {
+	fprintf(stderr, "Error: Stats by source, severity, minute, hour"
+		" or day.\n");
+	exit( EXIT_FAILURE );
+    }
+    if ( !by )
+	k = S_BY_ALL;
+
+    mql_roll_init(&roll);
+    if ( mql_roll_load(&roll, dir) ) {
+	perror("stats: " MQL_ROLL_FILE);
+	exit( EXIT_FAILURE );
+    }
+    if ( !roll.hdr.n_used )
+	return;
+
+    /* Whole buckets overlapping the range. */
+    tier = k == S_BY_HOUR ? MQL_ROLL_HOUR : k == S_BY_DAY ? MQL_ROLL_DAY
+	: MQL_ROLL_MINUTE;
+    s = since_ns / 1000000000;
+    e = until_ns == ~0ULL ? roll.hdr.max_ts / 1000000000 + 1
+	: (until_ns + 999999999) / 1000000000;
+    if ( s < roll.hdr.min_ts / 1000000000 )
+	s = roll.hdr.min_ts / 1000000000;
+    s = s_floor(s, tier);
+    e = s_ceil(e, tier);
+
+    /* In to what is kept. */
+    if ( k >= S_BY_MINUTE ) {
+	t = (uint64_t)roll.hdr.keep[tier] * MQL_ROLL_SECS(tier);
+	if ( s < t ) {
+	    s = t;
+	    rounded = 1;
+	}
+    }
+    else {
+	for ( tier = MQL_ROLL_MINUTE; tier < MQL_ROLL_DAY; ++tier ) {
+	    if ( !s_kept(s, tier) ) {
+		s = s_ceil(s, tier + 1);
+		rounded = 1;
+	    }
+	    if ( !s_kept(s_floor(e, tier + 1), tier) ) {
+		e = s_floor(e, tier + 1);
+		rounded = 1;
+	    }
+	}
+	tier = MQL_ROLL_DAY;
+    }
+    if ( e < s )
+	e = s;
+    if ( rounded ) {
+	from = s;
+	fprintf(stderr, "stats: Older counts are dropped, from %s",
+		ctime(&from));
+    }
+    DD ("since=%llu until=%llu sources=%u slots=%u used=%u\n",
+	(unsigned long long)s, (unsigned long long)e, roll.hdr.n_sources,
+	roll.hdr.n_slots, roll.hdr.n_used);
+
+    /* The sources, by name. */
+    src = calloc(roll.hdr.n_sources + 1, sizeof(unsigned));
+    if ( !src ) {
+	perror("stats: ");
+	exit( EXIT_FAILURE );
+    }
+    n_src = 0;
+    if ( target && strcmp("ALL",target) && strcmp("*",target) ) {
+	int j = mql_roll_source(&roll, target, strlen(target));
+	if ( j >= 0 )
+	    src[ n_src++ ] = j;
+    }
+    else {
+	for ( i = 0; i < roll.hdr.n_sources; ++i )
+	    src[ n_src++ ] = i;
+	s_sort_dict = roll.dict;
+	qsort( src, n_src, sizeof(unsigned), s_name_cmp );
+    }
+
+    mins = (e - s) / 60;
+    memset( total, 0, sizeof(total) );
+    for ( i = 0; i < n_src && k <= S_BY_SEVERITY; ++i ) {
+	unsigned len;
+	const char* name = mql_roll_name(&roll, src[i], &len);
+	for ( n = 0, v = 0; v <= severity; ++v ) {
+	    t = s_count(src[i], v, v, s, e, tier);
+	    if ( t && k == S_BY_ALL )
+		printf("%-16.*s %x : %-9s %llu %.2f/min\n", (int)len, name,
+		       v, mql_sev_name[v], (unsigned long long)t,
+		       mins ? (double)t / mins : 0.0);
+	    total[v] += t;
+	    n += t;
+	}
+	if ( n && k == S_BY_SOURCE )
+	    printf("%-16.*s %llu %.2f/min\n", (int)len, name,
+		   (unsigned long long)n, mins ? (double)n / mins : 0.0);
+    }
+    for ( v = 0; v <= severity && k == S_BY_SEVERITY; ++v )
+	if ( total[v] )
+	    printf("%x : %-9s %llu %.2f/min\n", v, mql_sev_name[v],
+		   (unsigned long long)total[v],
+		   mins ? (double)total[v] / mins : 0.0);
+
+    /* Per bucket, of the one tier. */
+    for ( t = s; k >= S_BY_MINUTE && t < e; t += MQL_ROLL_SECS(tier) ) {
+	for ( n = 0, i = 0; i < n_src; ++i )
+	    n += s_count(src[i], 0, severity, t, t + MQL_ROLL_SECS(tier), tier);
+	if ( n ) {
+	    s_time(t, tier);
+	    printf("%llu\n", (unsigned long long)n);
+	}
+    }
+
+    free(src);
+    mql_roll_free(&roll);
+}
@@ -0,0 +1,2134 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_store.c
+ * Description     : Mqtt Logging, on-disk log store
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:32:23 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:10:40 2026
+ * Update Count    : 6
+ */
+
+
+/*
+ * Appending threads copy records into large buffers; a writer thread
+ * writes full buffers to the current segment with one write() each.
+ * A buffer is also written when its oldest record has waited commit_ms.
+ *
+ * Group commit: the writer calls fdatasync() at most once per commit_ms,
+ * covering everything written since the last one, and again when it has
+ * caught up.  With commit_ms 0 every record is written and synced alone.
+ *
+ * When all buffers wait for the disk, appends block; the transport then
+ * leaves messages with the broker, nothing is dropped here.
+ *
+ * With io_uring the buffers are registered and written with several
+ * writes in flight.  The group commit fdatasync() is linked behind the
+ * writes of its round, and writes go on while it runs, so a slow sync
+ * only holds back the records it covers.
+ *
+ * With O_DIRECT every write is padded to MQL_STORE_ALIGN by a padding
+ * record, and the segment header fills the first block.
+ *
+ * The writer indexes each buffer as it writes it, and writes the index
+ * when the segment is closed and synced.  It counts the records in the
+ * rollup table (mql_roll.h) too, saved when a segment is closed and once
+ * every ST_ROLL_SAVE_MS after a sync, so it never counts records that
+ * could be lost.
+ *
+ * Restart: a closed segment ends with a checksummed footer holding its
+ * index and counts (see mql_store.h), and is then added to the manifest,
+ * ST_MAN_FILE, a list of the complete segments.  With each rollup save
+ * the writer also writes the index of the open segment so far, a
+ * checkpoint.  Recovery skips the segments of the manifest, takes a
+ * segment with a footer as it is, and reads the open one only past its
+ * checkpoint, to cut a broken end and give it its footer; the rollups
+ * go on from the block of that index with their end_seq.  So a restart
+ * reads about what was written in the last ST_ROLL_SAVE_MS.
+ */
+
+#define _GNU_SOURCE			/* O_DIRECT */
+
+#include "mql.h"
+#include "mql_store.h"
+#include "mql_col.h"
+#include "mql_roll.h"
+#include "mql_uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define ST_SYNC_TAG	(~0ULL)		/* user_data of a uring fdatasync */
+#define ST_SRC_SLOTS	(512)		/* Source hash, over twice the table */
+#define ST_ROLL_SAVE_MS	(60 * 1000)
+
+#define ST_MAN_FILE	"manifest.mql"
+#define ST_MAN_MAGIC	"MQLMAN01"
+
+// The manifest: a header and an entry per closed segment, oldest first.
+typedef struct {
+    char	magic[ 8 ];		/* ST_MAN_MAGIC, no NUL */
+    uint64_t	sum;			/* FNV-1a of the entries */
+    uint32_t	n;
+    uint32_t	reserved;
+} st_man_header_t;
+
+typedef struct {
+    uint64_t	first_seq;
+    uint64_t	end_seq;		/* Last + 1 */
+    uint64_t	size;			/* Of the file, with the footer */
+    uint64_t	min_ts;
+    uint64_t	max_ts;
+    uint32_t	flags;			/* Of the footer */
+    uint32_t	reserved;
+} st_man_ent_t;
+
+// Index of the segment being written.
+typedef struct {
+    mql_idx_block_t* blk;		/* Last one being filled */
+    uint8_t*	bloom;
+    unsigned	n_blk;
+    unsigned	max_blk;
+    char	(*src)[ MQL_IDX_SRC_LEN ];
+    unsigned	n_src;
+    uint8_t	slot[ ST_SRC_SLOTS ];	/* Source + 1, 0 free */
+    uint64_t	first_seq;
+    uint64_t	end_seq;		/* Last record + 1 */
+    uint64_t	end;			/* Segment bytes covered */
+    uint64_t	min_ts;
+    uint64_t	max_ts;
+    int		bad;			/* Out of memory, no index */
+} st_idx_t;
+
+typedef struct {
+    char*	data;
+    size_t	len;
+    size_t	wlen;			/* With padding */
+    uint64_t	first_seq;
+    uint64_t	end_seq;		/* Last + 1 */
+    uint64_t	due_ms;			/* Write by then */
+} st_buf_t;
+
+struct mql_store {
+    mql_store_conf_t conf;
+    char*	dir;
+    size_t	room;			/* Record bytes per buffer */
+    int		efd;			/* Wakes the uring writer, or -1 */
+
+    pthread_t	tid;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv_work;		/* To the writer */
+    pthread_cond_t cv_free;		/* A buffer came back */
+    pthread_cond_t cv_done;		/* Records synced */
+
+    /* Under mtx. */
+    st_buf_t*	buf;
+    unsigned*	free_list;
+    unsigned	n_free;
+    unsigned*	queue;			/* Full buffers, oldest first */
+    unsigned	q_head;
+    unsigned	q_len;
+    st_buf_t*	cur;			/* Being filled */
+    uint64_t	next_seq;
+    uint64_t	written_seq;		/* Records before it are written */
+    uint64_t	synced_seq;		/* ... and synced */
+    unsigned	flushing;
+    int		stop;
+    int		dirty;			/* Written, not synced */
+    uint64_t	last_sync_ms;
+    mql_store_stats_t st;
+
+    /* Writer thread only. */
+    int		fd;
+    int		dfd;
+    int		direct;			/* Segments opened with O_DIRECT */
+    char*	blk;			/* Aligned header block */
+    uint64_t	seg_bytes;
+    uint64_t	seg_start_ms;
+    mql_store_stats_t w;
+
+    /* Writer thread only, io_uring. */
+    mql_uring_t* ring;
+    unsigned*	fifo;			/* Writes in flight, oldest first */
+    unsigned	f_head;
+    unsigned	f_len;
+    char*	done;			/* Per buffer, write completed */
+    unsigned	n_ops;			/* In flight, writes and syncs */
+    int		sync_inflight;
+    uint64_t	sub_seq;		/* Records before it are submitted */
+    uint64_t	sync_seq;		/* ... and covered by a sync */
+    int		werr;			/* A write failed, new segment */
+
+    st_idx_t	ix;			/* Writer thread only */
+    mql_roll_t	roll;			/* Writer thread only */
+    mql_roll_t	seg_roll;		/* Of the segment, minutes only */
+    uint64_t	roll_saved_ms;
+    uint64_t	roll_saved_seq;		/* end_seq of the saved table */
+    st_man_ent_t* man;			/* Writer thread only */
+    unsigned	n_man;
+    unsigned	max_man;
+};
+
+
+static uint64_t
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static uint64_t
+now_real_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * Reading
+ */
+
+int
+mql_seg_open(mql_seg_t* seg, const char* path)
+{
+    struct stat sb;
+    void* p;
+
+    memset( seg, 0, sizeof(mql_seg_t) );
+    seg->fd = open(path, O_RDONLY);
+    if ( seg->fd < 0 )
+	return -1;
+    if ( fstat(seg->fd, &sb) )
+	goto fail;
+    if ( sb.st_size < (off_t)sizeof(mql_seg_header_t) ) {
+	errno = EINVAL;
+	goto fail;
+    }
+    p = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, seg->fd, 0);
+    if ( p == MAP_FAILED )
+	goto fail;
+    seg->base = p;
+    seg->size = sb.st_size;
+    seg->hdr = p;
+    if ( memcmp(seg->hdr->magic, MQL_SEG_MAGIC, sizeof(seg->hdr->magic)) ) {
+	mql_seg_close(seg);
+	errno = EINVAL;
+	return -1;
+    }
+    return 0;
+
+ fail:
+    close(seg->fd);
+    seg->fd = -1;
+    return -1;
+}
+
+void
+mql_seg_close(mql_seg_t* seg)
+{
+    if ( seg->base )
+	munmap( (void*)seg->base, seg->size );
+    if ( seg->fd >= 0 )
+	close( seg->fd );
+    seg->base = 0;
+    seg->fd = -1;
+}
+
+// FNV-1a of n bytes.
+static uint64_t
+st_sum(const void* p, size_t n)
+{
+    const uint8_t* q = p;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while ( n-- )
+	h = (h ^ *q++) * 0x100000001b3ULL;
+    return h;
+}
+
+const mql_seg_footer_t*
+mql_seg_footer(const mql_seg_t* seg)
+{
+    const mql_seg_trailer_t* t;
+    const mql_seg_footer_t* f;
+    const mql_rec_t* r;
+    size_t min = sizeof(mql_rec_t) + sizeof(*f) + sizeof(*t);
+    size_t len;
+
+    if ( seg->size < sizeof(mql_seg_header_t) + min )
+	return 0;
+    t = (const mql_seg_trailer_t*)(seg->base + seg->size - sizeof(*t));
+    if ( memcmp(t->magic, MQL_FOOT_END, sizeof(t->magic)) || t->len % 8
+	 || t->len < min || t->len > seg->size - sizeof(mql_seg_header_t) )
+	return 0;
+    r = (const mql_rec_t*)(seg->base + seg->size - t->len);
+    f = (const mql_seg_footer_t*)(r + 1);
+    if ( r->len != t->len || !(r->flags & MQL_REC_PAD)
+	 || !(r->flags & MQL_REC_FOOTER)
+	 || memcmp(f->magic, MQL_FOOT_MAGIC, sizeof(f->magic))
+	 || f->data_end != seg->size - t->len )
+	return 0;
+    len = sizeof(*f) + (size_t)f->idx_len + f->dict_len
+	+ (size_t)f->n_counts * sizeof(mql_roll_ent_t);
+    if ( len > t->len - sizeof(mql_rec_t) - sizeof(*t)
+	 || st_sum(&f->first_seq, len - offsetof(mql_seg_footer_t, first_seq))
+	 != f->sum )
+	return 0;
+    return f;
+}
+
+int
+mql_seg_next(const mql_seg_t* seg, size_t* pos, const mql_rec_t** rec)
+{
+    const mql_rec_t* r;
+    size_t left;
+
+    if ( *pos < sizeof(mql_seg_header_t) )
+	*pos = sizeof(mql_seg_header_t);
+    for (;;) {
+	left = seg->size - *pos;
+	if ( !left )
+	    return 0;
+	if ( left < sizeof(mql_rec_t) )
+	    return -1;
+	r = (const mql_rec_t*)(seg->base + *pos);
+	if ( r->len % 8 || r->len > left
+	     || r->len < MQL_REC_LEN(r->id_len, r->text_len) )
+	    return -1;
+	*pos += r->len;
+	if ( !(r->flags & MQL_REC_PAD) ) {
+	    *rec = r;
+	    return 1;
+	}
+    }
+}
+
+// Name of 16 hex digits and suffix.
+static int
+st_name_is(const char* p, const char* suffix)
+{
+    int i;
+    if ( strlen(p) != 16 + strlen(suffix) || strcmp(p + 16, suffix) )
+	return 0;
+    for ( i = 0; i < 16; ++i )
+	if ( !strchr("0123456789abcdef", p[i]) )
+	    return 0;
+    return 1;
+}
+
+int
+mql_store_list(const char* dir, const char* suffix, char*** names)
+{
+    struct dirent** ent;
+    int i, k = 0, n;
+
+    n = scandir(dir, &ent, 0, alphasort);
+    if ( n < 0 )
+	return -1;
+    *names = calloc(n + 1, sizeof(char*));
+    for ( i = 0; i < n; ++i ) {
+	if ( *names && st_name_is(ent[i]->d_name, suffix)
+	     && !((*names)[ k++ ] = strdup(ent[i]->d_name)) ) {
+	    mql_seg_list_free(*names, k);
+	    *names = 0;
+	}
+	free(ent[i]);
+    }
+    free(ent);
+    if ( !*names ) {
+	errno = ENOMEM;
+	return -1;
+    }
+    return k;
+}
+
+int
+mql_seg_list(const char* dir, char*** names)
+{
+    return mql_store_list(dir, MQL_SEG_SUFFIX, names);
+}
+
+void
+mql_seg_list_free(char** names, int n)
+{
+    int i;
+    for ( i = 0; i < n; ++i )
+	free(names[i]);
+    free(names);
+}
+
+
+static int
+idx_is_word(char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')
+	|| ('0' <= c && c <= '9');
+}
+
+int
+mql_idx_word(const char* text, unsigned len, unsigned* pos,
+	     const char** word, unsigned* word_len)
+{
+    unsigned i = *pos;
+
+    while ( i < len && !idx_is_word(text[i]) )
+	++i;
+    if ( i == len ) {
+	*pos = i;
+	return 0;
+    }
+    *word = text + i;
+    while ( i < len && idx_is_word(text[i]) )
+	++i;
+    *word_len = text + i - *word;
+    *pos = i;
+    return 1;
+}
+
+uint64_t
+mql_idx_hash(const char* word, unsigned len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+    unsigned i;
+
+    for ( i = 0; i < len; ++i ) {
+	char c = word[i];
+	if ( 'A' <= c && c <= 'Z' )
+	    c += 'a' - 'A';
+	h = (h ^ (uint8_t)c) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+uint64_t
+mql_idx_hash_source(const char* id, unsigned len, unsigned sev)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;	/* Not a word, '/' is no letter */
+    unsigned i;
+
+    for ( i = 0; i < len; ++i )
+	h = (h ^ (uint8_t)id[i]) * 0x100000001b3ULL;
+    h = (h ^ '/') * 0x100000001b3ULL;
+    return (h ^ ("0123456789abcdef"[sev & 15])) * 0x100000001b3ULL;
+}
+
+// Bit k of hash h in a filter of bits bits, double hashing.
+static unsigned
+idx_bloom_bit(uint64_t h, unsigned k, unsigned bits)
+{
+    uint32_t h1 = h;
+    uint32_t h2 = (h >> 32) | 1;
+    return (h1 + k * h2) & (bits - 1);
+}
+
+int
+mql_idx_bloom(const mql_idx_t* idx, unsigned b, uint64_t h)
+{
+    unsigned bits = idx->hdr->bloom_bits;
+    const uint8_t* f = idx->blooms + (size_t)b * (bits / 8);
+    unsigned k, i;
+
+    for ( k = 0; k < idx->hdr->bloom_k; ++k ) {
+	i = idx_bloom_bit(h, k, bits);
+	if ( !(f[i / 8] & (1 << i % 8)) )
+	    return 0;
+    }
+    return 1;
+}
+
+unsigned
+mql_idx_source(const mql_idx_t* idx, const char* id, unsigned len)
+{
+    unsigned i;
+
+    if ( len >= MQL_IDX_SRC_LEN )
+	return MQL_IDX_SRC_OTHER;
+    for ( i = 0; i < idx->hdr->n_sources; ++i ) {
+	const char* s = idx->sources + i * MQL_IDX_SRC_LEN;
+	if ( !memcmp(s, id, len) && !s[len] )
+	    return i;
+    }
+    return MQL_IDX_SRC_OTHER;
+}
+
+int
+mql_idx_open(mql_idx_t* idx, const char* path)
+{
+    size_t n = strlen(path);
+    const mql_idx_header_t* h;
+    char ipath[ 4096 ];
+    struct stat sb;
+    size_t need;
+    void* p;
+
+    memset( idx, 0, sizeof(mql_idx_t) );
+    idx->fd = -1;
+    if ( n >= sizeof(MQL_SEG_SUFFIX) - 1
+	 && !strcmp(path + n - (sizeof(MQL_SEG_SUFFIX) - 1), MQL_SEG_SUFFIX) )
+	n -= sizeof(MQL_SEG_SUFFIX) - 1;
+    else if ( n >= sizeof(MQL_IDX_SUFFIX) - 1
+	      && !strcmp(path + n - (sizeof(MQL_IDX_SUFFIX) - 1),
+			 MQL_IDX_SUFFIX) )
+	n -= sizeof(MQL_IDX_SUFFIX) - 1;
+    if ( n + sizeof(MQL_IDX_SUFFIX) > sizeof(ipath) ) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    memcpy( ipath, path, n );
+    strcpy( ipath + n, MQL_IDX_SUFFIX );
+
+    idx->fd = open(ipath, O_RDONLY);
+    if ( idx->fd < 0 )
+	return -1;
+    if ( fstat(idx->fd, &sb) )
+	goto fail;
+    if ( sb.st_size < (off_t)sizeof(mql_idx_header_t) ) {
+	errno = EINVAL;
+	goto fail;
+    }
+    p = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, idx->fd, 0);
+    if ( p == MAP_FAILED )
+	goto fail;
+    idx->base = p;
+    idx->size = sb.st_size;
+    idx->hdr = h = p;
+    need = sizeof(mql_idx_header_t) + (size_t)h->n_sources * MQL_IDX_SRC_LEN
+	+ (size_t)h->n_blocks * (sizeof(mql_idx_block_t) + h->bloom_bits / 8);
+    if ( memcmp(h->magic, MQL_IDX_MAGIC, sizeof(h->magic))
+	 || h->n_sources > MQL_IDX_SRC_OTHER
+	 || h->bloom_bits < 8 || (h->bloom_bits & (h->bloom_bits - 1))
+	 || need != idx->size ) {
+	mql_idx_close(idx);
+	errno = EINVAL;
+	return -1;
+    }
+    idx->sources = idx->base + sizeof(mql_idx_header_t);
+    idx->blocks = (const mql_idx_block_t*)
+	(idx->sources + h->n_sources * MQL_IDX_SRC_LEN);
+    idx->blooms = (const uint8_t*)(idx->blocks + h->n_blocks);
+    return 0;
+
+ fail:
+    close(idx->fd);
+    idx->fd = -1;
+    return -1;
+}
+
+void
+mql_idx_close(mql_idx_t* idx)
+{
+    if ( idx->base )
+	munmap( (void*)idx->base, idx->size );
+    if ( idx->fd >= 0 )
+	close( idx->fd );
+    idx->base = 0;
+    idx->fd = -1;
+}
+
+
+/*
+ * Index building, writer thread
+ */
+
+static int
+write_all(int fd, const char* p, size_t n)
+{
+    while ( n ) {
+	ssize_t k = write(fd, p, n);
+	if ( k < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    return -1;
+	}
+	p += k;
+	n -= k;
+    }
+    return 0;
+}
+
+static void
+st_idx_reset(st_idx_t* ix, uint64_t first_seq)
+{
+    ix->n_blk = 0;
+    ix->n_src = 0;
+    memset( ix->slot, 0, sizeof(ix->slot) );
+    ix->first_seq = first_seq;
+    ix->end_seq = first_seq;
+    ix->end = 0;
+    ix->min_ts = ~0ULL;
+    ix->max_ts = 0;
+    ix->bad = 0;
+}
+
+static void
+st_idx_free(st_idx_t* ix)
+{
+    free(ix->blk);
+    free(ix->bloom);
+    free(ix->src);
+}
+
+// Source bit of id, added to the table if there is room.
+static unsigned
+st_idx_src(st_idx_t* ix, const char* id, unsigned len)
+{
+    unsigned i = mql_idx_hash(id, len) % ST_SRC_SLOTS;
+    char* s;
+
+    if ( len >= MQL_IDX_SRC_LEN )
+	return MQL_IDX_SRC_OTHER;
+    for ( ;; i = (i + 1) % ST_SRC_SLOTS ) {
+	if ( !ix->slot[i] )
+	    break;
+	s = ix->src[ ix->slot[i] - 1 ];
+	if ( !memcmp(s, id, len) && !s[len] )
+	    return ix->slot[i] - 1;
+    }
+    if ( ix->n_src == MQL_IDX_SRC_OTHER )
+	return MQL_IDX_SRC_OTHER;
+    if ( !ix->src ) {
+	ix->src = calloc(MQL_IDX_SRC_OTHER, MQL_IDX_SRC_LEN);
+	if ( !ix->src ) {
+	    ix->bad = 1;
+	    return MQL_IDX_SRC_OTHER;
+	}
+    }
+    s = ix->src[ ix->n_src ];
+    memset( s, 0, MQL_IDX_SRC_LEN );
+    memcpy( s, id, len );
+    ix->slot[i] = ++ix->n_src;
+    return ix->n_src - 1;
+}
+
+// Add the record at off in the segment.
+static void
+st_idx_rec(st_idx_t* ix, uint64_t off, const mql_rec_t* r)
+{
+    const char* text = MQL_REC_TEXT(r);
+    mql_idx_block_t* b;
+    uint8_t* f;
+    const char* w;
+    unsigned wl, pos = 0;
+    unsigned src, k, i;
+    uint64_t h;
+
+    if ( r->ts_ns < ix->min_ts )
+	ix->min_ts = r->ts_ns;
+    if ( r->ts_ns > ix->max_ts )
+	ix->max_ts = r->ts_ns;
+    ix->end_seq = r->seq + 1;
+    ix->end = off + r->len;
+    if ( ix->bad )
+	return;
+    b = ix->n_blk ? &ix->blk[ ix->n_blk - 1 ] : 0;
+    if ( !b || b->len >= MQL_IDX_BLOCK ) {
+	if ( ix->n_blk == ix->max_blk ) {
+	    unsigned m = ix->max_blk ? 2 * ix->max_blk : 64;
+	    void* p = realloc(ix->blk, m * sizeof(mql_idx_block_t));
+	    void* q = p ? realloc(ix->bloom, (size_t)m * MQL_IDX_BLOOM_BITS / 8)
+		: 0;
+	    if ( p )
+		ix->blk = p;
+	    if ( q )
+		ix->bloom = q;
+	    if ( !p || !q ) {
+		ix->bad = 1;
+		return;
+	    }
+	    ix->max_blk = m;
+	}
+	b = &ix->blk[ ix->n_blk ];
+	memset( b, 0, sizeof(mql_idx_block_t) );
+	memset( ix->bloom + (size_t)ix->n_blk * MQL_IDX_BLOOM_BITS / 8, 0,
+		MQL_IDX_BLOOM_BITS / 8 );
+	b->off = off;
+	b->first_seq = r->seq;
+	b->min_ts = ~0ULL;
+	++ix->n_blk;
+    }
+
+    b->len = off + r->len - b->off;
+    ++b->n_records;
+    if ( r->ts_ns < b->min_ts )
+	b->min_ts = r->ts_ns;
+    if ( r->ts_ns > b->max_ts )
+	b->max_ts = r->ts_ns;
+    b->sev_mask |= 1 << (r->sev & 15);
+    src = st_idx_src(ix, MQL_REC_ID(r), r->id_len);
+    b->src[ src / 64 ] |= 1ULL << src % 64;
+
+    f = ix->bloom + (size_t)(ix->n_blk - 1) * MQL_IDX_BLOOM_BITS / 8;
+    h = mql_idx_hash_source(MQL_REC_ID(r), r->id_len, r->sev);
+    do {
+	for ( k = 0; k < MQL_IDX_BLOOM_K; ++k ) {
+	    i = idx_bloom_bit(h, k, MQL_IDX_BLOOM_BITS);
+	    f[i / 8] |= 1 << i % 8;
+	}
+	if ( !mql_idx_word(text, r->text_len, &pos, &w, &wl) )
+	    break;
+	h = mql_idx_hash(w, wl);
+    } while ( 1 );
+}
+
+// Take over a checkpoint index, to go on after its seg_size.
+//	RETURNS	0 OK, -1 out of memory or not of this writer
+static int
+st_idx_load(st_idx_t* ix, const mql_idx_t* idx)
+{
+    const mql_idx_header_t* h = idx->hdr;
+    const mql_idx_block_t* last;
+    const char* s;
+    unsigned i, m;
+    void* p;
+
+    if ( h->bloom_bits != MQL_IDX_BLOOM_BITS || h->bloom_k != MQL_IDX_BLOOM_K
+	 || !h->n_blocks )
+	return -1;
+    st_idx_reset(ix, h->first_seq);
+    for ( m = ix->max_blk; m < h->n_blocks; m = m ? 2 * m : 64 )
+	;
+    if ( m > ix->max_blk ) {
+	p = realloc(ix->blk, m * sizeof(mql_idx_block_t));
+	if ( p )
+	    ix->blk = p;
+	p = p ? realloc(ix->bloom, (size_t)m * MQL_IDX_BLOOM_BITS / 8) : 0;
+	if ( !p )
+	    return -1;
+	ix->bloom = p;
+	ix->max_blk = m;
+    }
+    for ( i = 0; i < h->n_sources; ++i ) {
+	s = idx->sources + (size_t)i * MQL_IDX_SRC_LEN;
+	if ( st_idx_src(ix, s, strnlen(s, MQL_IDX_SRC_LEN)) != i )
+	    return -1;
+    }
+    memcpy( ix->blk, idx->blocks, h->n_blocks * sizeof(mql_idx_block_t) );
+    memcpy( ix->bloom, idx->blooms, (size_t)h->n_blocks * MQL_IDX_BLOOM_BITS / 8 );
+    last = &idx->blocks[ h->n_blocks - 1 ];
+    ix->n_blk = h->n_blocks;
+    ix->end_seq = last->first_seq + last->n_records;
+    ix->end = h->seg_size;
+    ix->min_ts = h->min_ts;
+    ix->max_ts = h->max_ts;
+    return 0;
+}
+
+// Index and count the records of b, written at off.
+static void
+st_idx_buf(mql_store_t* st, const st_buf_t* b, uint64_t off)
+{
+    size_t pos = 0;
+
+    while ( pos < b->len ) {
+	const mql_rec_t* r = (const mql_rec_t*)(b->data + pos);
+	if ( !(r->flags & MQL_REC_PAD) ) {
+	    st_idx_rec(&st->ix, off + pos, r);
+	    mql_roll_add(&st->roll, MQL_REC_ID(r), r->id_len, r->sev,
+			 r->ts_ns, r->seq);
+	    mql_roll_count(&st->seg_roll, MQL_REC_ID(r), r->id_len, r->sev,
+			   r->ts_ns, 1);
+	}
+	pos += r->len;
+    }
+}
+
+// Save the rollup table, all it counts is synced.
+static void
+st_roll_save(mql_store_t* st)
+{
+    st->roll_saved_ms = now_ms();
+    if ( st->roll.bad || st->roll.hdr.end_seq == st->roll_saved_seq )
+	return;
+    if ( mql_roll_save(&st->roll, st->dir) )
+	perror("mql_store: rollup: ");
+    else
+	st->roll_saved_seq = st->roll.hdr.end_seq;
+}
+
+// Write n bytes to a file of dir, a new file renamed in place.
+//	RETURNS	0 OK, -1 on error (errno set)
+static int
+st_put(mql_store_t* st, const char* path, const void* p, size_t n)
+{
+    char tmp[ 4096 + 4 ];
+    int fd, err;
+
+    snprintf( tmp, sizeof(tmp), "%s.tmp", path );
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 )
+	return -1;
+    if ( write_all(fd, p, n) || fdatasync(fd) ) {
+	err = errno;
+	close(fd);
+	unlink(tmp);
+	errno = err;
+	return -1;
+    }
+    if ( close(fd) || rename(tmp, path) ) {
+	err = errno;
+	unlink(tmp);
+	errno = err;
+	return -1;
+    }
+    fsync(st->dfd);
+    return 0;
+}
+
+// Bytes of the index as a file, 0 for none.
+static size_t
+st_idx_len(const st_idx_t* ix)
+{
+    if ( ix->bad || !ix->n_blk )
+	return 0;
+    return sizeof(mql_idx_header_t) + (size_t)ix->n_src * MQL_IDX_SRC_LEN
+	+ (size_t)ix->n_blk * (sizeof(mql_idx_block_t) + MQL_IDX_BLOOM_BITS / 8);
+}
+
+// The index as a file at p, st_idx_len() bytes.
+static void
+st_idx_put(const st_idx_t* ix, unsigned flags, char* p)
+{
+    mql_idx_header_t* h = (mql_idx_header_t*)p;
+
+    memset( h, 0, sizeof(*h) );
+    memcpy( h->magic, MQL_IDX_MAGIC, sizeof(h->magic) );
+    h->first_seq = ix->first_seq;
+    h->seg_size = ix->end;
+    h->min_ts = ix->min_ts;
+    h->max_ts = ix->max_ts;
+    h->n_blocks = ix->n_blk;
+    h->n_sources = ix->n_src;
+    h->bloom_bits = MQL_IDX_BLOOM_BITS;
+    h->bloom_k = MQL_IDX_BLOOM_K;
+    h->flags = flags;
+    p += sizeof(*h);
+    memcpy( p, ix->src, (size_t)ix->n_src * MQL_IDX_SRC_LEN );
+    p += (size_t)ix->n_src * MQL_IDX_SRC_LEN;
+    memcpy( p, ix->blk, (size_t)ix->n_blk * sizeof(mql_idx_block_t) );
+    p += (size_t)ix->n_blk * sizeof(mql_idx_block_t);
+    memcpy( p, ix->bloom, (size_t)ix->n_blk * MQL_IDX_BLOOM_BITS / 8 );
+}
+
+// Write the index of the segment, MQL_IDX_OPEN for a checkpoint.
+static void
+st_idx_write(mql_store_t* st, unsigned flags)
+{
+    st_idx_t* ix = &st->ix;
+    char path[ 4096 ];
+    size_t n = st_idx_len(ix);
+    char* p;
+
+    if ( !n )
+	return;
+    snprintf( path, sizeof(path), "%s/%016llx" MQL_IDX_SUFFIX, st->dir,
+	      (unsigned long long)ix->first_seq );
+    p = malloc(n);
+    if ( p )
+	st_idx_put(ix, flags, p);
+    if ( !p || st_put(st, path, p, n) )
+	/* Queries read the segment instead. */
+	perror("mql_store: index: ");
+    free(p);
+}
+
+// Save the rollup table and the index of the open segment, all they
+// cover is synced.
+static void
+st_checkpoint(mql_store_t* st)
+{
+    if ( st->roll.hdr.end_seq == st->roll_saved_seq ) {
+	st->roll_saved_ms = now_ms();
+	return;
+    }
+    if ( st->fd >= 0 )
+	st_idx_write(st, MQL_IDX_OPEN);
+    st_roll_save(st);
+}
+
+// The footer of the index, but for its magic and sum.
+static void
+st_foot_of(const st_idx_t* ix, uint64_t off, unsigned flags,
+	   mql_seg_footer_t* f)
+{
+    memset( f, 0, sizeof(*f) );
+    f->first_seq = ix->first_seq;
+    f->end_seq = ix->end_seq;
+    f->min_ts = ix->min_ts;
+    f->max_ts = ix->max_ts;
+    f->data_end = off;
+    f->flags = flags;
+}
+
+// Write the footer of a segment at off, after its last record, with the
+// counts of seg_roll or without them.
+//	RETURNS	bytes written, 0 on error (errno set)
+static size_t
+st_foot_write(mql_store_t* st, int fd, uint64_t off, int counts)
+{
+    st_idx_t* ix = &st->ix;
+    mql_roll_t* r = &st->seg_roll;
+    mql_seg_footer_t* f;
+    mql_seg_trailer_t* t;
+    mql_rec_t* rec;
+    size_t len, n, k;
+    unsigned i, m;
+    char* buf;
+    char* p;
+    ssize_t w;
+
+    counts = counts && !r->bad;
+    len = sizeof(mql_rec_t) + sizeof(*f) + st_idx_len(ix);
+    if ( counts )
+	len += (r->hdr.n_sources + r->hdr.dict_len + 7) / 8 * 8
+	    + (size_t)r->hdr.n_used * sizeof(mql_roll_ent_t);
+    len = (len + sizeof(*t) + 7) / 8 * 8;
+    if ( st->conf.direct )
+	len = (len + MQL_STORE_ALIGN - 1) / MQL_STORE_ALIGN * MQL_STORE_ALIGN;
+    if ( posix_memalign((void**)&buf, MQL_STORE_ALIGN, len) )
+	return 0;
+    memset( buf, 0, len );
+    rec = (mql_rec_t*)buf;
+    rec->len = len;
+    rec->text_len = len - sizeof(mql_rec_t);
+    rec->flags = MQL_REC_PAD | MQL_REC_FOOTER;
+    f = (mql_seg_footer_t*)(rec + 1);
+    st_foot_of(ix, off, counts ? MQL_FOOT_COUNTS : 0, f);
+    memcpy( f->magic, MQL_FOOT_MAGIC, sizeof(f->magic) );
+    f->idx_len = st_idx_len(ix);
+    if ( f->idx_len )
+	st_idx_put(ix, 0, (char*)(f + 1));
+    if ( counts ) {
+	f->n_sources = r->hdr.n_sources;
+	p = (char*)MQL_FOOT_DICT(f);
+	for ( i = 0; i < r->hdr.n_sources; ++i ) {
+	    const char* id = mql_roll_name(r, i, &m);
+	    *p++ = m;
+	    memcpy( p, id, m );
+	    p += m;
+	}
+	f->dict_len = (p - MQL_FOOT_DICT(f) + 7) / 8 * 8;
+	p = (char*)MQL_FOOT_COUNT(f);
+	for ( i = 0; i < r->hdr.n_slots; ++i )
+	    if ( r->ent[i].count ) {
+		memcpy( p, &r->ent[i], sizeof(mql_roll_ent_t) );
+		p += sizeof(mql_roll_ent_t);
+		++f->n_counts;
+	    }
+    }
+    n = sizeof(*f) + (size_t)f->idx_len + f->dict_len
+	+ (size_t)f->n_counts * sizeof(mql_roll_ent_t);
+    f->sum = st_sum(&f->first_seq, n - offsetof(mql_seg_footer_t, first_seq));
+    t = (mql_seg_trailer_t*)(buf + len - sizeof(*t));
+    t->len = len;
+    memcpy( t->magic, MQL_FOOT_END, sizeof(t->magic) );
+
+    for ( k = 0; k < len; k += w ) {
+	w = pwrite(fd, buf + k, len - k, off + k);
+	if ( w < 0 && errno == EINTR )
+	    w = 0;
+	else if ( w <= 0 ) {
+	    free(buf);
+	    return 0;
+	}
+    }
+    free(buf);
+    return len;
+}
+
+static int
+st_man_cmp(const void* a, const void* b)
+{
+    const st_man_ent_t* x = a;
+    const st_man_ent_t* y = b;
+    return (x->first_seq > y->first_seq) - (x->first_seq < y->first_seq);
+}
+
+// Add a closed segment to the manifest, with the size of the file.
+static void
+st_man_add(mql_store_t* st, const mql_seg_footer_t* f, uint64_t size)
+{
+    st_man_ent_t* e;
+
+    if ( st->n_man == st->max_man ) {
+	unsigned m = st->max_man ? 2 * st->max_man : 64;
+	e = realloc(st->man, m * sizeof(st_man_ent_t));
+	if ( !e )
+	    return;			/* Recovery looks at its footer */
+	st->man = e;
+	st->max_man = m;
+    }
+    e = &st->man[ st->n_man++ ];
+    memset( e, 0, sizeof(*e) );
+    e->first_seq = f->first_seq;
+    e->end_seq = f->end_seq;
+    e->size = size;
+    e->min_ts = f->min_ts;
+    e->max_ts = f->max_ts;
+    e->flags = f->flags;
+}
+
+// Write the manifest.
+static void
+st_man_write(mql_store_t* st)
+{
+    char path[ 4096 ];
+    size_t n = (size_t)st->n_man * sizeof(st_man_ent_t);
+    st_man_header_t* h = malloc(sizeof(*h) + n);
+
+    if ( !h )
+	return;
+    memset( h, 0, sizeof(*h) );
+    memcpy( h->magic, ST_MAN_MAGIC, sizeof(h->magic) );
+    h->n = st->n_man;
+    memcpy( h + 1, st->man, n );
+    h->sum = st_sum(h + 1, n);
+    snprintf( path, sizeof(path), "%s/" ST_MAN_FILE, st->dir );
+    if ( st_put(st, path, h, sizeof(*h) + n) )
+	perror("mql_store: manifest: ");
+    free(h);
+}
+
+// Read the manifest, or start with none.
+static void
+st_man_load(mql_store_t* st)
+{
+    char path[ 4096 ];
+    st_man_header_t h;
+    struct stat sb;
+    size_t n = 0;
+    int fd;
+
+    snprintf( path, sizeof(path), "%s/" ST_MAN_FILE, st->dir );
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 )
+	return;
+    if ( fstat(fd, &sb) || read(fd, &h, sizeof(h)) != sizeof(h)
+	 || memcmp(h.magic, ST_MAN_MAGIC, sizeof(h.magic))
+	 || (n = (size_t)h.n * sizeof(st_man_ent_t),
+	     sb.st_size != (off_t)(sizeof(h) + n))
+	 || !(st->man = malloc(n + 1))
+	 || read(fd, st->man, n) != (ssize_t)n || st_sum(st->man, n) != h.sum )
+	fprintf(stderr, "mql_store: %s: damaged, not used\n", path);
+    else
+	st->n_man = st->max_man = h.n;
+    close(fd);
+}
+
+/*
+ * Writer thread
+ */
+
+static void
+st_seg_close(mql_store_t* st)
+{
+    mql_seg_footer_t f;
+    size_t n;
+
+    if ( st->fd < 0 )
+	return;
+    /* In the manifest only when it is all on disk. */
+    n = st_foot_write(st, st->fd, st->seg_bytes, 1);
+    if ( !n )
+	perror("mql_store: footer: ");
+    if ( !fdatasync(st->fd) )
+	++st->w.syncs;
+    else
+	n = 0;
+    close(st->fd);
+    st->fd = -1;
+    st_idx_write(st, 0);
+    st_roll_save(st);
+    if ( n ) {
+	st_foot_of(&st->ix, st->seg_bytes,
+		   st->seg_roll.bad ? 0 : MQL_FOOT_COUNTS, &f);
+	st_man_add(st, &f, st->seg_bytes + n);
+	st_man_write(st);
+    }
+}
+
+// Padding record of len bytes at p.
+static void
+st_pad_rec(char* p, size_t len)
+{
+    mql_rec_t* r = (mql_rec_t*)p;
+    memset( p, 0, len );
+    r->len = len;
+    r->text_len = len - sizeof(mql_rec_t);
+    r->flags = MQL_REC_PAD;
+}
+
+// Pad a buffer to whole blocks for O_DIRECT.
+static void
+st_pad(mql_store_t* st, st_buf_t* b)
+{
+    size_t pad = 0;
+    b->wlen = b->len;
+    if ( !st->conf.direct || !(b->len % MQL_STORE_ALIGN) )
+	return;
+    pad = MQL_STORE_ALIGN - b->len % MQL_STORE_ALIGN;
+    if ( pad < sizeof(mql_rec_t) )
+	pad += MQL_STORE_ALIGN;
+    st_pad_rec(b->data + b->len, pad);
+    b->wlen += pad;
+}
+
+static int
+st_seg_new(mql_store_t* st, uint64_t first_seq)
+{
+    mql_seg_header_t* h = (mql_seg_header_t*)st->blk;
+    size_t hlen = sizeof(mql_seg_header_t);
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    char path[ 4096 ];
+
+    if ( snprintf(path, sizeof(path), "%s/%016llx" MQL_SEG_SUFFIX, st->dir,
+		  (unsigned long long)first_seq) >= (int)sizeof(path) ) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    if ( st->conf.direct ) {
+	/* The header fills a block, so records start aligned. */
+	hlen = MQL_STORE_ALIGN;
+	st_pad_rec(st->blk + sizeof(mql_seg_header_t),
+		   hlen - sizeof(mql_seg_header_t));
+	if ( st->direct )
+	    flags |= O_DIRECT;
+    }
+    st->fd = open(path, flags, 0644);
+    if ( st->fd < 0 && st->direct && errno == EINVAL ) {
+	fprintf(stderr, "mql_store: %s: no O_DIRECT, buffered\n", st->dir);
+	st->direct = 0;
+	st->fd = open(path, flags & ~O_DIRECT, 0644);
+    }
+    if ( st->fd < 0 )
+	return -1;
+    memset( h, 0, sizeof(mql_seg_header_t) );
+    memcpy( h->magic, MQL_SEG_MAGIC, sizeof(h->magic) );
+    h->first_seq = first_seq;
+    h->created_ns = now_real_ns();
+    if ( write_all(st->fd, st->blk, hlen) ) {
+	close(st->fd);
+	st->fd = -1;
+	return -1;
+    }
+    fsync(st->dfd);			/* The new name */
+    st_idx_reset(&st->ix, first_seq);
+    mql_roll_free(&st->seg_roll);
+    st->seg_roll.tiers = 1;
+    st->seg_bytes = hlen;
+    st->seg_start_ms = now_ms();
+    ++st->w.segments;
+    return 0;
+}
+
+// Time for a new segment before writing b.
+static int
+st_rotate_due(mql_store_t* st, const st_buf_t* b)
+{
+    return st->fd >= 0
+	&& (st->seg_bytes + b->wlen > st->conf.seg_max
+	    || now_ms() - st->seg_start_ms >= st->conf.seg_secs * 1000ULL);
+}
+
+// Write a buffer, rotating first if it would not fit.  No lock held.
+static void
+st_write(mql_store_t* st, st_buf_t* b)
+{
+    st_pad(st, b);
+    if ( st_rotate_due(st, b) )
+	st_seg_close(st);
+    if ( (st->fd < 0 && st_seg_new(st, b->first_seq))
+	 || write_all(st->fd, b->data, b->wlen) ) {
+	if ( !st->w.errors )
+	    perror("mql_store: write: ");
+	st->w.errors += b->end_seq - b->first_seq;
+	/* Start over in a new segment, the old one ends with a part. */
+	if ( st->fd >= 0 ) {
+	    close(st->fd);
+	    st->fd = -1;
+	}
+	return;
+    }
+    st_idx_buf(st, b, st->seg_bytes);
+    st->seg_bytes += b->wlen;
+    st->w.bytes += b->wlen;
+    ++st->w.writes;
+    st->w.inflight_max = 1;
+}
+
+static void
+st_publish_w(mql_store_t* st)
+{
+    st->st.bytes = st->w.bytes;
+    st->st.writes = st->w.writes;
+    st->st.syncs = st->w.syncs;
+    st->st.segments = st->w.segments;
+    st->st.errors = st->w.errors;
+    st->st.inflight_max = st->w.inflight_max;
+}
+
+// Wake the writer.  Under mtx.
+static void
+st_wake(mql_store_t* st)
+{
+    uint64_t one = 1;
+    if ( st->efd < 0 )
+	pthread_cond_signal( &st->cv_work );
+    else if ( write(st->efd, &one, sizeof(one)) < 0 )
+	;				/* Counter full, it is awake */
+}
+
+static void*
+st_writer(void* arg)
+{
+    mql_store_t* st = arg;
+
+    pthread_mutex_lock( &st->mtx );
+    for (;;) {
+	uint64_t now = now_ms();
+	uint64_t sync_due = st->last_sync_ms + st->conf.commit_ms;
+	int urgent = st->stop || st->flushing;
+	st_buf_t* b = 0;
+
+	if ( st->q_len ) {
+	    b = &st->buf[ st->queue[ st->q_head ] ];
+	    st->q_head = (st->q_head + 1) % st->conf.n_bufs;
+	    --st->q_len;
+	}
+	else if ( st->cur && (urgent || now >= st->cur->due_ms) ) {
+	    b = st->cur;
+	    st->cur = 0;
+	}
+
+	if ( b ) {
+	    pthread_mutex_unlock( &st->mtx );
+	    st_write(st, b);
+	    pthread_mutex_lock( &st->mtx );
+	    st->written_seq = b->end_seq;
+	    st->dirty = 1;
+	    st->free_list[ st->n_free++ ] = b - st->buf;
+	    st_publish_w(st);
+	    pthread_cond_signal( &st->cv_free );
+	    continue;
+	}
+
+	if ( st->dirty && (urgent || now >= sync_due) ) {
+	    uint64_t seq = st->written_seq;
+	    int fd = st->fd;
+	    st->dirty = 0;
+	    pthread_mutex_unlock( &st->mtx );
+	    if ( fd >= 0 && !fdatasync(fd) )
+		++st->w.syncs;
+	    if ( now_ms() - st->roll_saved_ms >= ST_ROLL_SAVE_MS )
+		st_checkpoint(st);
+	    pthread_mutex_lock( &st->mtx );
+	    st->last_sync_ms = now_ms();
+	    st->synced_seq = seq;
+	    st_publish_w(st);
+	    pthread_cond_broadcast( &st->cv_done );
+	    continue;
+	}
+
+	if ( st->stop )
+	    break;
+
+	/* Sleep until the current buffer or a sync is due. */
+	if ( st->cur || st->dirty ) {
+	    uint64_t due = st->dirty ? sync_due : ~0ULL;
+	    struct timespec ts;
+	    if ( st->cur && st->cur->due_ms < due )
+		due = st->cur->due_ms;
+	    clock_gettime( CLOCK_REALTIME, &ts );
+	    due -= now;
+	    ts.tv_sec += due / 1000;
+	    ts.tv_nsec += (due % 1000) * 1000000;
+	    if ( ts.tv_nsec >= 1000000000 ) {
+		ts.tv_nsec -= 1000000000;
+		++ts.tv_sec;
+	    }
+	    pthread_cond_timedwait( &st->cv_work, &st->mtx, &ts );
+	}
+	else {
+	    pthread_cond_wait( &st->cv_work, &st->mtx );
+	}
+    }
+    pthread_mutex_unlock( &st->mtx );
+
+    st_seg_close(st);
+    pthread_mutex_lock( &st->mtx );
+    st_publish_w(st);
+    pthread_mutex_unlock( &st->mtx );
+    return 0;
+}
+
+
+/*
+ * Writer thread, io_uring
+ */
+
+// Take completions, give back buffers written in order.
+//	RETURNS	number taken
+static int
+st_uring_reap(mql_store_t* st)
+{
+    uint64_t ud;
+    int res, n = 0;
+    int synced = 0;
+
+    while ( mql_uring_complete(st->ring, &ud, &res) ) {
+	++n;
+	--st->n_ops;
+	if ( ud == ST_SYNC_TAG ) {
+	    st->sync_inflight = 0;
+	    if ( res >= 0 )
+		++st->w.syncs;
+	    synced = 1;
+	    continue;
+	}
+	if ( res != (int)st->buf[ud].wlen ) {
+	    if ( !st->w.errors ) {
+		errno = res < 0 ? -res : EIO;
+		perror("mql_store: write: ");
+	    }
+	    st->w.errors += st->buf[ud].end_seq - st->buf[ud].first_seq;
+	    st->werr = 1;
+	}
+	st->done[ud] = 1;
+    }
+    if ( !n )
+	return 0;
+
+    pthread_mutex_lock( &st->mtx );
+    while ( st->f_len && st->done[ st->fifo[ st->f_head ] ] ) {
+	unsigned i = st->fifo[ st->f_head ];
+	st->done[i] = 0;
+	st->f_head = (st->f_head + 1) % st->conf.n_bufs;
+	--st->f_len;
+	st->written_seq = st->buf[i].end_seq;
+	st->free_list[ st->n_free++ ] = i;
+	pthread_cond_signal( &st->cv_free );
+    }
+    if ( synced && !st->sync_inflight ) {
+	st->synced_seq = st->sync_seq;
+	pthread_cond_broadcast( &st->cv_done );
+    }
+    st_publish_w(st);
+    pthread_mutex_unlock( &st->mtx );
+    return n;
+}
+
+// Wait for everything in flight.
+static void
+st_uring_drain(mql_store_t* st)
+{
+    while ( st->n_ops ) {
+	if ( mql_uring_submit(st->ring, 1) && errno != EBUSY ) {
+	    perror("mql_store: io_uring_enter: ");
+	    exit( EXIT_FAILURE );
+	}
+	st_uring_reap(st);
+    }
+}
+
+// Queue the write of b, rotating first.  RETURNS 0 queued.
+static int
+st_uring_write(mql_store_t* st, st_buf_t* b, unsigned flags)
+{
+    unsigned i = b - st->buf;
+
+    st_pad(st, b);
+    if ( st->werr || st_rotate_due(st, b) ) {
+	/* The old segment has to be complete before it is closed. */
+	st_uring_drain(st);
+	if ( st->werr ) {
+	    close(st->fd);
+	    st->fd = -1;
+	    st->werr = 0;
+	}
+	st_seg_close(st);
+	pthread_mutex_lock( &st->mtx );
+	st->synced_seq = st->written_seq;
+	pthread_cond_broadcast( &st->cv_done );
+	pthread_mutex_unlock( &st->mtx );
+	st->sync_seq = st->sub_seq;
+    }
+    if ( st->fd < 0 && st_seg_new(st, b->first_seq) ) {
+	if ( !st->w.errors )
+	    perror("mql_store: open: ");
+	st->w.errors += b->end_seq - b->first_seq;
+	return -1;
+    }
+    if ( mql_uring_write_fixed(st->ring, st->fd, b->data, b->wlen,
+			       st->seg_bytes, i, flags, i) ) {
+	/* Never, there is room for every buffer and a sync. */
+	st_uring_drain(st);
+	mql_uring_write_fixed(st->ring, st->fd, b->data, b->wlen,
+			      st->seg_bytes, i, flags, i);
+    }
+    st_idx_buf(st, b, st->seg_bytes);
+    st->seg_bytes += b->wlen;
+    st->w.bytes += b->wlen;
+    ++st->w.writes;
+    st->fifo[ (st->f_head + st->f_len) % st->conf.n_bufs ] = i;
+    ++st->f_len;
+    ++st->n_ops;
+    st->sub_seq = b->end_seq;
+    return 0;
+}
+
+static void*
+st_writer_uring(void* arg)
+{
+    mql_store_t* st = arg;
+    unsigned* todo = calloc(st->conf.n_bufs, sizeof(unsigned));
+
+    if ( !todo ) {
+	perror("mql_store: ");
+	exit( EXIT_FAILURE );
+    }
+    for (;;) {
+	uint64_t now = now_ms();
+	uint64_t due = ~0ULL;
+	unsigned n_todo = 0, k;
+	int urgent, sync_now, idle, stop, held;
+	struct pollfd pfd[2];
+
+	pthread_mutex_lock( &st->mtx );
+	urgent = st->stop || st->flushing;
+	stop = st->stop;
+	sync_now = st->sub_seq > st->sync_seq && !st->sync_inflight
+	    && (urgent || !st->conf.commit_ms
+		|| now >= st->last_sync_ms + st->conf.commit_ms);
+	/* A linked sync covers its round only, so the rounds before it
+	   must be done; hold new writes until then. */
+	held = sync_now && st->f_len;
+	if ( !held ) {
+	    while ( st->q_len ) {
+		todo[ n_todo++ ] = st->queue[ st->q_head ];
+		st->q_head = (st->q_head + 1) % st->conf.n_bufs;
+		--st->q_len;
+	    }
+	    if ( st->cur && (urgent || now >= st->cur->due_ms) ) {
+		todo[ n_todo++ ] = st->cur - st->buf;
+		st->cur = 0;
+	    }
+	}
+	if ( st->cur && !held )
+	    due = st->cur->due_ms;
+	idle = !st->q_len && !st->cur;
+	pthread_mutex_unlock( &st->mtx );
+
+	/* Writes of this round that count for a sync must be in it. */
+	if ( n_todo && !st->f_len && !st->sync_inflight
+	     && (urgent || !st->conf.commit_ms
+		 || now >= st->last_sync_ms + st->conf.commit_ms) )
+	    sync_now = 1;
+	if ( sync_now && st->f_len )
+	    sync_now = 0;
+
+	for ( k = 0; k < n_todo; ++k ) {
+	    st_buf_t* b = &st->buf[ todo[k] ];
+	    if ( st_uring_write(st, b, sync_now ? MQL_URING_LINK : 0) ) {
+		pthread_mutex_lock( &st->mtx );
+		st->written_seq = b->end_seq;
+		st->free_list[ st->n_free++ ] = todo[k];
+		pthread_cond_signal( &st->cv_free );
+		pthread_mutex_unlock( &st->mtx );
+		if ( st->sub_seq < b->end_seq )
+		    st->sub_seq = b->end_seq;
+	    }
+	}
+	if ( sync_now && st->sub_seq > st->sync_seq ) {
+	    if ( st->fd >= 0
+		 && !mql_uring_fdatasync(st->ring, st->fd, 0, ST_SYNC_TAG) ) {
+		st->sync_inflight = 1;
+		++st->n_ops;
+	    }
+	    else {
+		/* Nothing open to sync, all went to closed segments. */
+		pthread_mutex_lock( &st->mtx );
+		st->synced_seq = st->sub_seq;
+		pthread_cond_broadcast( &st->cv_done );
+		pthread_mutex_unlock( &st->mtx );
+	    }
+	    st->sync_seq = st->sub_seq;
+	    st->last_sync_ms = now;
+	}
+	if ( st->n_ops > st->w.inflight_max )
+	    st->w.inflight_max = st->n_ops;
+	if ( mql_uring_submit(st->ring, 0) && errno != EBUSY ) {
+	    perror("mql_store: io_uring_enter: ");
+	    exit( EXIT_FAILURE );
+	}
+	if ( st_uring_reap(st) || n_todo )
+	    continue;
+
+	/* All written and synced, a good time for a checkpoint. */
+	if ( !st->n_ops && st->sub_seq == st->sync_seq
+	     && now_ms() - st->roll_saved_ms >= ST_ROLL_SAVE_MS )
+	    st_checkpoint(st);
+
+	if ( stop && idle && !st->n_ops && st->sub_seq == st->sync_seq )
+	    break;
+
+	/* Sleep until a completion, new work, or a buffer or sync is due. */
+	if ( st->sub_seq > st->sync_seq && !st->sync_inflight && !st->f_len ) {
+	    uint64_t sd = st->last_sync_ms + st->conf.commit_ms;
+	    if ( sd < due )
+		due = sd;
+	}
+	pfd[0].fd = mql_uring_fd(st->ring);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = st->efd;
+	pfd[1].events = POLLIN;
+	now = now_ms();
+	if ( poll(pfd, 2, due == ~0ULL ? -1 : due > now ? (int)(due - now) : 0)
+	     > 0 && pfd[1].revents ) {
+	    uint64_t v;
+	    if ( read(st->efd, &v, sizeof(v)) < 0 )
+		;			/* Nothing to read, fine */
+	}
+    }
+    free(todo);
+
+    st_seg_close(st);
+    pthread_mutex_lock( &st->mtx );
+    st_publish_w(st);
+    pthread_mutex_unlock( &st->mtx );
+    return 0;
+}
+
+
+/*
+ * Appending
+ */
+
+// Hand the current buffer to the writer.  Under mtx.
+static void
+st_queue_cur(mql_store_t* st)
+{
+    st->queue[ (st->q_head + st->q_len) % st->conf.n_bufs ] = st->cur - st->buf;
+    ++st->q_len;
+    st->cur = 0;
+    st_wake(st);
+}
+
+int
+mql_store_append(mql_store_t* st, const char* id, unsigned id_len,
+		 unsigned sev, const void* text, unsigned text_len)
+{
+    size_t n = MQL_REC_LEN(id_len, text_len);
+    uint64_t ts = now_real_ns();
+    mql_rec_t* r;
+    st_buf_t* b;
+    int stalled = 0;
+
+    pthread_mutex_lock( &st->mtx );
+    if ( id_len > 255 || n > st->room ) {
+	++st->st.rejected;
+	pthread_mutex_unlock( &st->mtx );
+	return -1;
+    }
+    if ( st->cur && st->cur->len + n > st->room )
+	st_queue_cur(st);
+    while ( !st->cur ) {
+	if ( st->n_free ) {
+	    st->cur = &st->buf[ st->free_list[ --st->n_free ] ];
+	    st->cur->len = 0;
+	    break;
+	}
+	if ( !stalled++ )
+	    ++st->st.stalls;
+	pthread_cond_wait( &st->cv_free, &st->mtx );
+    }
+
+    b = st->cur;
+    if ( !b->len ) {
+	b->first_seq = st->next_seq;
+	b->due_ms = now_ms() + st->conf.commit_ms;
+	st_wake(st);
+    }
+    r = (mql_rec_t*)(b->data + b->len);
+    memset( r, 0, sizeof(mql_rec_t) );
+    r->len = n;
+    r->text_len = text_len;
+    r->seq = st->next_seq++;
+    r->ts_ns = ts;
+    r->sev = sev;
+    r->id_len = id_len;
+    memcpy( (char*)MQL_REC_ID(r), id, id_len );
+    memcpy( (char*)MQL_REC_TEXT(r), text, text_len );
+    memset( (char*)MQL_REC_TEXT(r) + text_len, 0,
+	    n - sizeof(mql_rec_t) - id_len - text_len );
+    b->len += n;
+    b->end_seq = st->next_seq;
+    ++st->st.records;
+    if ( !st->conf.commit_ms )
+	st_queue_cur(st);
+    pthread_mutex_unlock( &st->mtx );
+    return 0;
+}
+
+int
+mql_store_message(mql_store_t* st, const char* topic,
+		  const void* payload, int len)
+{
+    mql_fragment_t frag[6];
+    const char* rec;
+    int rec_len;
+    int pos = 0;
+    int n = 0;
+    int k = mql_split(topic, frag, 6);
+    unsigned sev;
+    char c;
+
+    if ( k < 4 || k > 5
+	 || frag[1].len != strlen(MQL_LOG_TAG)
+	 || strncmp(frag[1].ptr, MQL_LOG_TAG, frag[1].len)
+	 || frag[3].len != 1 )
+	return -1;
+    c = frag[3].ptr[0];
+    if ( '0' <= c && c <= '9' )
+	sev = c - '0';
+    else if ( 'a' <= c && c <= 'f' )
+	sev = c - 'a' + 10;
+    else
+	return -1;
+
+    if ( k == 4 )
+	return mql_store_append(st, frag[2].ptr, frag[2].len, sev,
+				payload, len) ? 0 : 1;
+
+    if ( frag[4].len != strlen(MQL_BATCH_TAG)
+	 || strncmp(frag[4].ptr, MQL_BATCH_TAG, frag[4].len) )
+	return -1;
+    while ( mql_batch_next(payload, len, &pos, &rec, &rec_len) > 0 )
+	if ( !mql_store_append(st, frag[2].ptr, frag[2].len, sev,
+			       rec, rec_len) )
+	    ++n;
+    return n;
+}
+
+
+/*
+ * Open and close
+ */
+
+void
+mql_store_defaults(mql_store_conf_t* conf)
+{
+    memset( conf, 0, sizeof(mql_store_conf_t) );
+    conf->commit_ms = MQL_STORE_COMMIT_MS;
+    conf->buf_size = MQL_STORE_BUF_SIZE;
+    conf->n_bufs = MQL_STORE_N_BUFS;
+    conf->seg_max = MQL_STORE_SEG_MAX;
+    conf->seg_secs = MQL_STORE_SEG_SECS;
+    conf->io = MQL_STORE_IO_URING;
+}
+
+// Ring, registered buffers and eventfd, else the plain writer is used.
+static int
+st_uring_setup(mql_store_t* st)
+{
+    struct iovec* iov;
+    unsigned i;
+
+    st->ring = mql_uring_new(2 * st->conf.n_bufs);
+    if ( !st->ring )
+	return -1;
+    iov = calloc(st->conf.n_bufs, sizeof(struct iovec));
+    st->fifo = calloc(st->conf.n_bufs, sizeof(unsigned));
+    st->done = calloc(st->conf.n_bufs, 1);
+    if ( iov ) {
+	for ( i = 0; i < st->conf.n_bufs; ++i ) {
+	    iov[i].iov_base = st->buf[i].data;
+	    iov[i].iov_len = st->conf.buf_size;
+	}
+    }
+    if ( iov && st->fifo && st->done
+	 && !mql_uring_register(st->ring, iov, st->conf.n_bufs) )
+	st->efd = eventfd(0, EFD_NONBLOCK);
+    free(iov);
+    if ( st->efd < 0 ) {
+	mql_uring_free(st->ring);
+	st->ring = 0;
+	free(st->fifo);
+	free(st->done);
+	st->fifo = 0;
+	st->done = 0;
+	return -1;
+    }
+    return 0;
+}
+
+const char*
+mql_store_io(const mql_store_t* st)
+{
+    if ( st->ring )
+	return st->direct ? "uring+direct" : "uring";
+    return st->direct ? "write+direct" : "write";
+}
+
+// Sequence number after the last compacted record, 1 for none.
+static uint64_t
+st_col_next(mql_store_t* st)
+{
+    char** names;
+    char path[ 4096 ];
+    mql_col_t col;
+    uint64_t seq = 1;
+    int n;
+
+    n = mql_col_list(st->dir, &names);
+    if ( n > 0 ) {
+	snprintf( path, sizeof(path), "%s/%s", st->dir, names[n-1] );
+	if ( !mql_col_open(&col, path) ) {
+	    seq = col.hdr->first_seq + col.hdr->n_records;
+	    mql_col_close(&col);
+	}
+    }
+    if ( n >= 0 )
+	mql_seg_list_free(names, n);
+    return seq;
+}
+
+// Complete a segment that is not in the manifest: the last one, or one
+// closed just before a crash.  A segment with a footer only needs its
+// index; else its records after the checkpoint index are read, those
+// after a damaged one cut, and it gets its index and a footer.
+//	RETURNS	0 OK, -1 on error
+static int
+st_seg_finish(mql_store_t* st, const char* path)
+{
+    const mql_seg_footer_t* f;
+    mql_seg_footer_t foot;
+    mql_seg_t seg;
+    mql_idx_t idx;
+    const mql_rec_t* r;
+    char ipath[ 4096 ];
+    size_t pos = 0, good = 0;
+    size_t n;
+    int fd, i;
+
+    /* A new segment with this number replaces a broken or empty one. */
+    if ( mql_seg_open(&seg, path) )
+	return errno == EINVAL ? 0 : -1;
+
+    f = mql_seg_footer(&seg);
+    if ( f ) {
+	if ( f->end_seq > st->next_seq )
+	    st->next_seq = f->end_seq;
+	snprintf( ipath, sizeof(ipath), "%s/%016llx" MQL_IDX_SUFFIX, st->dir,
+		  (unsigned long long)f->first_seq );
+	if ( !mql_idx_open(&idx, ipath) ) {
+	    if ( !(idx.hdr->flags & MQL_IDX_OPEN) )
+		ipath[0] = 0;		/* Written, all there */
+	    mql_idx_close(&idx);
+	}
+	if ( ipath[0] && f->idx_len
+	     && st_put(st, ipath, MQL_FOOT_IDX(f), f->idx_len) )
+	    perror("mql_store: index: ");
+	st_man_add(st, f, seg.size);
+	mql_seg_close(&seg);
+	return 0;
+    }
+
+    /* Trust what the checkpoint covers, it was synced. */
+    st_idx_reset(&st->ix, seg.hdr->first_seq);
+    if ( !mql_idx_open(&idx, path) ) {
+	if ( idx.hdr->first_seq == seg.hdr->first_seq
+	     && idx.hdr->seg_size <= seg.size && !st_idx_load(&st->ix, &idx) )
+	    good = pos = idx.hdr->seg_size;
+	else
+	    st_idx_reset(&st->ix, seg.hdr->first_seq);
+	mql_idx_close(&idx);
+    }
+    while ( (i = mql_seg_next(&seg, &pos, &r)) > 0 ) {
+	if ( r->seq < st->ix.end_seq )
+	    break;			/* Not written by us */
+	st_idx_rec(&st->ix, pos - r->len, r);
+	good = pos;
+    }
+    if ( !good ) {
+	mql_seg_close(&seg);
+	return 0;
+    }
+    if ( st->ix.end_seq > st->next_seq )
+	st->next_seq = st->ix.end_seq;
+    if ( i || good < seg.size ) {
+	if ( i )
+	    fprintf(stderr, "mql_store: %s: cut at %zu of %zu bytes\n",
+		    path, good, seg.size);
+	if ( truncate(path, good) ) {
+	    mql_seg_close(&seg);
+	    return -1;
+	}
+    }
+    mql_seg_close(&seg);
+
+    /* Closed now, no counts: rollups read it if they need to. */
+    fd = open(path, O_WRONLY);
+    n = fd < 0 ? 0 : st_foot_write(st, fd, good, 0);
+    if ( !n || fdatasync(fd) ) {
+	perror("mql_store: footer: ");
+	n = 0;
+    }
+    if ( fd >= 0 )
+	close(fd);
+    st_idx_write(st, 0);
+    if ( n ) {
+	st_foot_of(&st->ix, good, 0, &foot);
+	st_man_add(st, &foot, good + n);
+    }
+    return 0;
+}
+
+// Continue after the last good record of the last segment.  Segments in
+// the manifest are complete and not looked at.
+static int
+st_recover(mql_store_t* st)
+{
+    char path[ 4096 ];
+    char** names;
+    uint64_t seq;
+    unsigned k, m, old;
+    int n, i;
+
+    n = mql_seg_list(st->dir, &names);
+    if ( n < 0 )
+	return -1;
+    /* Compacted segments may be all there is. */
+    st->next_seq = st_col_next(st);
+    st_man_load(st);
+    old = st->n_man;
+
+    /* Keep the entries of segments still there, both are in order. */
+    for ( i = 0, k = 0, m = 0; k < st->n_man; ++k ) {
+	seq = st->man[k].first_seq;
+	while ( i < n && strtoull(names[i], 0, 16) < seq )
+	    ++i;
+	if ( i < n && strtoull(names[i], 0, 16) == seq )
+	    st->man[ m++ ] = st->man[k];
+    }
+    st->n_man = m;
+    if ( m && st->man[m-1].end_seq > st->next_seq )
+	st->next_seq = st->man[m-1].end_seq;
+
+    for ( i = 0, k = 0; i < n; ++i ) {
+	seq = strtoull(names[i], 0, 16);
+	while ( k < m && st->man[k].first_seq < seq )
+	    ++k;
+	if ( k < m && st->man[k].first_seq == seq )
+	    continue;
+	if ( seq > st->next_seq )
+	    st->next_seq = seq;
+	snprintf( path, sizeof(path), "%s/%s", st->dir, names[i] );
+	if ( st_seg_finish(st, path) ) {
+	    mql_seg_list_free(names, n);
+	    return -1;
+	}
+    }
+    mql_seg_list_free(names, n);
+
+    if ( st->n_man != old || m != old ) {
+	/* Recovered ones were added in name order after the others. */
+	qsort( st->man, st->n_man, sizeof(st_man_ent_t), st_man_cmp );
+	st_man_write(st);
+    }
+    return 0;
+}
+
+// Count in a column file the records from seq from.
+static void
+st_roll_col(mql_store_t* st, const char* path, uint64_t from)
+{
+    mql_col_rows_t* rows;
+    mql_col_t col;
+    unsigned g, i;
+
+    if ( mql_col_open(&col, path) )
+	return;
+    rows = calloc(1, sizeof(mql_col_rows_t));
+    for ( g = 0; rows && g < col.hdr->n_groups; ++g ) {
+	const mql_col_group_t* k = &col.groups[g];
+	if ( k->first_seq + k->n_records <= from
+	     || mql_col_get(&col, g, MQL_COL_SRC|MQL_COL_SEV|MQL_COL_TS, rows) )
+	    continue;
+	for ( i = 0; i < rows->n; ++i )
+	    if ( k->first_seq + i >= from )
+		mql_roll_add(&st->roll, col.src[ rows->src[i] ],
+			     col.src_len[ rows->src[i] ], rows->sev[i],
+			     rows->ts[i], k->first_seq + i);
+    }
+    free(rows);
+    mql_col_close(&col);
+}
+
+// Add the counts of a footer.
+static void
+st_roll_foot(mql_store_t* st, const mql_seg_footer_t* f)
+{
+    const uint8_t* d = (const uint8_t*)MQL_FOOT_DICT(f);
+    const mql_roll_ent_t* e = (const mql_roll_ent_t*)MQL_FOOT_COUNT(f);
+    const uint8_t** name = calloc(f->n_sources + 1, sizeof(uint8_t*));
+    unsigned i, src;
+
+    if ( !name ) {
+	st->roll.bad = 1;
+	return;
+    }
+    for ( i = 0; i < f->n_sources; ++i ) {
+	name[i] = d;
+	d += 1 + *d;
+    }
+    for ( i = 0; i < f->n_counts; ++i ) {
+	src = MQL_ROLL_KEY_SRC(e[i].key);
+	if ( src < f->n_sources )
+	    mql_roll_count(&st->roll, (const char*)name[src] + 1, *name[src],
+			   MQL_ROLL_KEY_SEV(e[i].key),
+			   MQL_ROLL_KEY_BUCKET(e[i].key) * 60000000000ULL,
+			   e[i].count);
+    }
+    free(name);
+    if ( f->min_ts < st->roll.hdr.min_ts )
+	st->roll.hdr.min_ts = f->min_ts;
+    if ( f->max_ts > st->roll.hdr.max_ts )
+	st->roll.hdr.max_ts = f->max_ts;
+    if ( f->end_seq > st->roll.hdr.end_seq )
+	st->roll.hdr.end_seq = f->end_seq;
+}
+
+// Offset of the index block of a segment with record seq, 0 for none.
+static size_t
+st_idx_find(const char* path, uint64_t seq)
+{
+    mql_idx_t idx;
+    size_t pos = 0;
+    unsigned b;
+
+    if ( mql_idx_open(&idx, path) )
+	return 0;
+    for ( b = 0; b < idx.hdr->n_blocks && idx.blocks[b].first_seq <= seq; ++b )
+	pos = idx.blocks[b].off;
+    mql_idx_close(&idx);
+    return pos;
+}
+
+// Load the rollup table and count the records it is missing, those
+// since it was saved, in the last segment after a crash.  Without one
+// it is counted again, from the footers where it can.
+static void
+st_roll_recover(mql_store_t* st)
+{
+    char path[ 4096 ];
+    char** names;
+    mql_seg_t seg;
+    const mql_seg_footer_t* f;
+    const mql_rec_t* r;
+    uint64_t from;
+    size_t pos;
+    int n, i;
+
+    if ( mql_roll_load(&st->roll, st->dir) && errno != ENOENT )
+	perror("mql_store: " MQL_ROLL_FILE ": ");
+    if ( st->roll.hdr.end_seq > st->next_seq ) {
+	/* It counted records cut from the segment. */
+	fprintf(stderr, "mql_store: rollup ahead of the store, counting"
+		" again\n");
+	mql_roll_free(&st->roll);
+    }
+    from = st->roll.hdr.end_seq;
+    st->roll_saved_seq = from;
+    if ( from >= st->next_seq )
+	return;
+
+    n = mql_col_list(st->dir, &names);
+    for ( i = 0; i < n; ++i ) {
+	snprintf( path, sizeof(path), "%s/%s", st->dir, names[i] );
+	if ( i + 1 == n || strtoull(names[i+1], 0, 16) > from )
+	    st_roll_col(st, path, from);
+    }
+    if ( n >= 0 )
+	mql_seg_list_free(names, n);
+
+    n = mql_seg_list(st->dir, &names);
+    for ( i = 0; i < n; ++i ) {
+	if ( i + 1 < n && strtoull(names[i+1], 0, 16) <= from )
+	    continue;
+	snprintf( path, sizeof(path), "%s/%s", st->dir, names[i] );
+	if ( mql_seg_open(&seg, path) )
+	    continue;
+	f = mql_seg_footer(&seg);
+	if ( f && (f->flags & MQL_FOOT_COUNTS) && f->first_seq >= from ) {
+	    st_roll_foot(st, f);
+	    mql_seg_close(&seg);
+	    continue;
+	}
+	pos = st_idx_find(path, from);
+	if ( pos >= seg.size )
+	    pos = 0;
+	for ( ; mql_seg_next(&seg, &pos, &r) > 0; )
+	    if ( r->seq >= from )
+		mql_roll_add(&st->roll, MQL_REC_ID(r), r->id_len, r->sev,
+			     r->ts_ns, r->seq);
+	mql_seg_close(&seg);
+    }
+    if ( n >= 0 )
+	mql_seg_list_free(names, n);
+    st_roll_save(st);
+}
+
+mql_store_t*
+mql_store_open(const mql_store_conf_t* conf)
+{
+    mql_store_t* st;
+    unsigned i;
+    int err;
+
+    if ( !conf->dir || conf->n_bufs < 2 || conf->buf_size < 4096
+	 || conf->seg_max < conf->buf_size + MQL_STORE_ALIGN
+	 || !conf->seg_secs
+	 || (conf->direct && conf->buf_size % MQL_STORE_ALIGN) ) {
+	errno = EINVAL;
+	return 0;
+    }
+    st = calloc(1,sizeof(mql_store_t));
+    if ( !st )
+	return 0;
+    st->conf = *conf;
+    st->fd = -1;
+    st->dfd = -1;
+    st->efd = -1;
+    st->direct = conf->direct;
+    /* Room for the padding record of O_DIRECT. */
+    st->room = conf->buf_size - (conf->direct ? 2 * MQL_STORE_ALIGN : 0);
+    st->dir = strdup(conf->dir);
+    st->buf = calloc(conf->n_bufs, sizeof(st_buf_t));
+    st->free_list = calloc(conf->n_bufs, sizeof(unsigned));
+    st->queue = calloc(conf->n_bufs, sizeof(unsigned));
+    if ( !st->dir || !st->buf || !st->free_list || !st->queue
+	 || posix_memalign((void**)&st->blk, MQL_STORE_ALIGN, MQL_STORE_ALIGN) )
+	goto fail;
+    for ( i = 0; i < conf->n_bufs; ++i ) {
+	if ( posix_memalign((void**)&st->buf[i].data, MQL_STORE_ALIGN,
+			    conf->buf_size) )
+	    goto fail;
+	st->free_list[ st->n_free++ ] = i;
+    }
+    st->dfd = open(st->dir, O_RDONLY | O_DIRECTORY);
+    mql_roll_init(&st->roll);
+    if ( st->dfd < 0 || st_recover(st) )
+	goto fail;
+    st_roll_recover(st);
+    st->written_seq = st->synced_seq = st->next_seq;
+    st->last_sync_ms = now_ms();
+
+    pthread_mutex_init( &st->mtx, 0 );
+    pthread_cond_init( &st->cv_work, 0 );
+    pthread_cond_init( &st->cv_free, 0 );
+    pthread_cond_init( &st->cv_done, 0 );
+    if ( conf->io == MQL_STORE_IO_URING )
+	st_uring_setup(st);
+    if ( pthread_create(&st->tid, 0, st->ring ? st_writer_uring : st_writer,
+			st) )
+	goto fail;
+    return st;
+
+ fail:
+    err = errno;
+    if ( st->ring )
+	mql_uring_free(st->ring);
+    if ( st->efd >= 0 )
+	close(st->efd);
+    free(st->fifo);
+    free(st->done);
+    free(st->blk);
+    st_idx_free(&st->ix);
+    mql_roll_free(&st->roll);
+    free(st->man);
+    if ( st->dfd >= 0 )
+	close(st->dfd);
+    for ( i = 0; st->buf && i < conf->n_bufs; ++i )
+	free(st->buf[i].data);
+    free(st->buf);
+    free(st->free_list);
+    free(st->queue);
+    free(st->dir);
+    free(st);
+    errno = err;
+    return 0;
+}
+
+void
+mql_store_flush(mql_store_t* st)
+{
+    uint64_t seq;
+    pthread_mutex_lock( &st->mtx );
+    seq = st->next_seq;
+    ++st->flushing;
+    st_wake(st);
+    while ( st->synced_seq < seq )
+	pthread_cond_wait( &st->cv_done, &st->mtx );
+    --st->flushing;
+    pthread_mutex_unlock( &st->mtx );
+}
+
+void
+mql_store_stats(mql_store_t* st, mql_store_stats_t* stats)
+{
+    pthread_mutex_lock( &st->mtx );
+    *stats = st->st;
+    pthread_mutex_unlock( &st->mtx );
+}
+
+void
+mql_store_close(mql_store_t* st)
+{
+    unsigned i;
+
+    pthread_mutex_lock( &st->mtx );
+    st->stop = 1;
+    st_wake(st);
+    pthread_mutex_unlock( &st->mtx );
+    pthread_join( st->tid, 0 );
+
+    if ( st->ring ) {
+	mql_uring_free(st->ring);
+	close(st->efd);
+    }
+    free(st->fifo);
+    free(st->done);
+    free(st->blk);
+    st_idx_free(&st->ix);
+    mql_roll_free(&st->roll);
+    mql_roll_free(&st->seg_roll);
+    free(st->man);
+    close(st->dfd);
+    for ( i = 0; i < st->conf.n_bufs; ++i )
+	free(st->buf[i].data);
+    free(st->buf);
+    free(st->free_list);
+    free(st->queue);
+    free(st->dir);
+    pthread_mutex_destroy( &st->mtx );
+    pthread_cond_destroy( &st->cv_work );
+    pthread_cond_destroy( &st->cv_free );
+    pthread_cond_destroy( &st->cv_done );
+    free(st);
+}
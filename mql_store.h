@@ -0,0 +1,323 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_store.h
+ * Description     : Mqtt Logging, on-disk log store
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:32:23 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:10:40 2026
+ * Update Count    : 5
+ */
+
+#ifndef __MQL_STORE_H__
+#define __MQL_STORE_H__ (1)
+
+/*
+ * Log records kept in a directory of segment files, written by mqld and
+ * read by the mql tools.
+ *
+ * A segment is named after the sequence number of its first record,
+ * "<seq as 16 hex digits>.seg", so names sort in record order.  It holds
+ * a header followed by records:
+ *
+ *	mql_seg_header_t
+ *	mql_rec_t, <id>, <text>, padding to 8 bytes
+ *	...
+ *
+ * Every record gets the next sequence number of the store, they are
+ * never reused.  Padding records (MQL_REC_PAD) fill writes up to the
+ * block size with O_DIRECT, mql_seg_next() skips them.  Numbers are host
+ * byte order, segments are not meant to move between machines.
+ *
+ * A closed segment ends with a footer, a padding record that is also
+ * MQL_REC_FOOTER:
+ *
+ *	mql_rec_t
+ *	mql_seg_footer_t
+ *	the index of the segment, as the .idx file
+ *	n_sources sources, a length byte and the name each, padded to 8
+ *	n_counts mql_roll_ent_t, counts per source, severity and minute
+ *	padding
+ *	mql_seg_trailer_t, the last bytes of the file
+ *
+ * The counts are left out (no MQL_FOOT_COUNTS) when the footer was
+ * written at recovery, not by the writer.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_SEG_MAGIC		"MQLSEG01"
+#define MQL_SEG_SUFFIX		".seg"
+#define MQL_SEG_NAME_LEN	(16 + sizeof(MQL_SEG_SUFFIX) - 1)
+
+typedef struct {
+    char	magic[ 8 ];		/* MQL_SEG_MAGIC, no NUL */
+    uint64_t	first_seq;
+    uint64_t	created_ns;		/* CLOCK_REALTIME */
+    uint64_t	reserved[ 5 ];
+} mql_seg_header_t;
+
+typedef struct {
+    uint32_t	len;			/* All of it, multiple of 8 */
+    uint32_t	text_len;
+    uint64_t	seq;
+    uint64_t	ts_ns;			/* Received, CLOCK_REALTIME */
+    uint8_t	sev;
+    uint8_t	id_len;
+    uint16_t	flags;			/* MQL_REC_... */
+    uint32_t	reserved;
+} mql_rec_t;
+
+#define MQL_REC_PAD	(1)		/* Padding, no record */
+#define MQL_REC_FOOTER	(2)		/* With MQL_REC_PAD, the footer */
+
+#define MQL_REC_ID(r)	((const char*)(r) + sizeof(mql_rec_t))
+#define MQL_REC_TEXT(r)	(MQL_REC_ID(r) + (r)->id_len)
+#define MQL_REC_LEN(id_len,text_len) \
+    ((sizeof(mql_rec_t) + (id_len) + (text_len) + 7) & ~(size_t)7)
+
+#define MQL_FOOT_MAGIC		"MQLFOOT1"
+#define MQL_FOOT_END		"MQLFEND1"
+#define MQL_FOOT_COUNTS		(1)	/* flags: has the counts */
+
+typedef struct {
+    char	magic[ 8 ];		/* MQL_FOOT_MAGIC, no NUL */
+    uint64_t	sum;			/* FNV-1a of the rest, to the counts */
+    uint64_t	first_seq;
+    uint64_t	end_seq;		/* Last + 1 */
+    uint64_t	min_ts;
+    uint64_t	max_ts;
+    uint64_t	data_end;		/* Offset of the footer record */
+    uint32_t	idx_len;		/* Bytes of the index, 0 none */
+    uint32_t	n_sources;
+    uint32_t	dict_len;		/* Bytes of sources, padded */
+    uint32_t	n_counts;
+    uint32_t	flags;			/* MQL_FOOT_... */
+    uint32_t	reserved;
+} mql_seg_footer_t;
+
+typedef struct {
+    uint64_t	len;			/* Of the footer record */
+    char	magic[ 8 ];		/* MQL_FOOT_END */
+} mql_seg_trailer_t;
+
+#define MQL_FOOT_IDX(f)		((const char*)(f) + sizeof(mql_seg_footer_t))
+#define MQL_FOOT_DICT(f)	(MQL_FOOT_IDX(f) + (f)->idx_len)
+#define MQL_FOOT_COUNT(f)	(MQL_FOOT_DICT(f) + (f)->dict_len)
+
+
+/*
+ * Reading
+ */
+
+typedef struct {
+    int		fd;
+    const char*	base;			/* Mapped file */
+    size_t	size;
+    const mql_seg_header_t* hdr;
+} mql_seg_t;
+
+// Map a segment read-only.
+//	RETURNS	0 OK, -1 on error (errno set, EINVAL for no segment)
+int mql_seg_open(mql_seg_t* seg, const char* path);
+
+void mql_seg_close(mql_seg_t* seg);
+
+// The footer of a closed segment, checked.
+//	RETURNS	footer, 0 for none or damaged
+const mql_seg_footer_t* mql_seg_footer(const mql_seg_t* seg);
+
+// Next record, start with *pos = 0.
+//	RETURNS	1	OK, record in *rec, *pos advanced
+//		0	End of segment
+//		-1	Damaged record at *pos
+int mql_seg_next(const mql_seg_t* seg, size_t* pos, const mql_rec_t** rec);
+
+// Segment file names in dir, sorted, free with mql_seg_list_free().
+//	RETURNS	number of names, -1 on error
+int mql_seg_list(const char* dir, char*** names);
+
+void mql_seg_list_free(char** names, int n);
+
+// Names in dir of 16 hex digits and suffix, as mql_seg_list().
+int mql_store_list(const char* dir, const char* suffix, char*** names);
+
+
+/*
+ * Indexes
+ *
+ * When the writer closes a segment it writes "<seq>.idx" next to it, a
+ * sparse index over blocks of about MQL_IDX_BLOCK bytes of records:
+ *
+ *	mql_idx_header_t
+ *	n_sources names, MQL_IDX_SRC_LEN bytes each, NUL padded
+ *	n_blocks mql_idx_block_t
+ *	n_blocks bloom filters, bloom_bits / 8 bytes each
+ *
+ * A block has the time range, severities and sources of its records, and
+ * a bloom filter of the words of their texts and of their source and
+ * severity pairs.  Words are runs of ASCII letters and digits, in any
+ * case.  A segment without an index has to be read from end to end.
+ *
+ * The writer also writes the index of the segment it is writing now and
+ * then, MQL_IDX_OPEN, up to seg_size; the records after that have to be
+ * read, and its time range says nothing about them.
+ */
+
+#define MQL_IDX_MAGIC		"MQLIDX01"
+#define MQL_IDX_SUFFIX		".idx"
+#define MQL_IDX_BLOCK		(64 * 1024)
+#define MQL_IDX_BLOOM_BITS	(8192)	/* Power of two */
+#define MQL_IDX_BLOOM_K		(3)
+#define MQL_IDX_SRC_LEN		(64)
+#define MQL_IDX_SRC_OTHER	(255)	/* Sources not in the table */
+
+typedef struct {
+    char	magic[ 8 ];		/* MQL_IDX_MAGIC, no NUL */
+    uint64_t	first_seq;		/* Of the segment */
+    uint64_t	seg_size;		/* Segment bytes covered */
+    uint64_t	min_ts;
+    uint64_t	max_ts;
+    uint32_t	n_blocks;
+    uint32_t	n_sources;
+    uint32_t	bloom_bits;
+    uint32_t	bloom_k;
+    uint32_t	flags;			/* MQL_IDX_... */
+    uint32_t	reserved;
+    uint64_t	reserved2;
+} mql_idx_header_t;
+
+#define MQL_IDX_OPEN		(1)	/* Of a segment being written */
+
+typedef struct {
+    uint64_t	off;			/* Of the first record */
+    uint64_t	len;			/* To the end of the last */
+    uint64_t	first_seq;
+    uint64_t	min_ts;
+    uint64_t	max_ts;
+    uint32_t	n_records;
+    uint16_t	sev_mask;		/* Bit per severity */
+    uint16_t	reserved;
+    uint64_t	src[ 4 ];		/* Bit per source */
+} mql_idx_block_t;
+
+typedef struct {
+    int		fd;
+    const char*	base;			/* Mapped file */
+    size_t	size;
+    const mql_idx_header_t* hdr;
+    const char*	sources;
+    const mql_idx_block_t* blocks;
+    const uint8_t* blooms;
+} mql_idx_t;
+
+// Map the index of a segment, path of the segment or of the index.
+//	RETURNS	0 OK, -1 on error (errno set, EINVAL for no index)
+int mql_idx_open(mql_idx_t* idx, const char* path);
+
+void mql_idx_close(mql_idx_t* idx);
+
+// Source bit of id, MQL_IDX_SRC_OTHER when it is not in the table.
+unsigned mql_idx_source(const mql_idx_t* idx, const char* id, unsigned len);
+
+// Next word of text, start with *pos = 0.
+//	RETURNS	1 word in *word/*word_len, 0 no more
+int mql_idx_word(const char* text, unsigned len, unsigned* pos,
+		 const char** word, unsigned* word_len);
+
+// Hash of a word, the same in any case.
+uint64_t mql_idx_hash(const char* word, unsigned len);
+
+// Hash of a source and severity pair.
+uint64_t mql_idx_hash_source(const char* id, unsigned len, unsigned sev);
+
+// Word with hash h may be in block b.
+int mql_idx_bloom(const mql_idx_t* idx, unsigned b, uint64_t h);
+
+
+/*
+ * Writing
+ */
+
+typedef struct mql_store mql_store_t;
+
+typedef struct {
+    const char*	dir;
+    unsigned	commit_ms;		/* Longest wait for write and fsync */
+    size_t	buf_size;		/* Bytes per write */
+    unsigned	n_bufs;			/* Buffers filled ahead of the disk */
+    size_t	seg_max;		/* Rotate at this size, bytes */
+    unsigned	seg_secs;		/* Rotate at this age */
+    unsigned	io;			/* MQL_STORE_IO_... */
+    int		direct;			/* O_DIRECT, if the file system can */
+} mql_store_conf_t;
+
+#define MQL_STORE_IO_WRITE	(0)	/* write() and fdatasync() */
+#define MQL_STORE_IO_URING	(1)	/* io_uring, else as above */
+
+#define MQL_STORE_ALIGN		(4096)	/* O_DIRECT block, buf_size in these */
+
+#define MQL_STORE_COMMIT_MS	(100)
+#define MQL_STORE_BUF_SIZE	(1024 * 1024)
+#define MQL_STORE_N_BUFS	(8)
+#define MQL_STORE_SEG_MAX	(64 * 1024 * 1024)
+#define MQL_STORE_SEG_SECS	(3600)
+
+typedef struct {
+    uint64_t	records;
+    uint64_t	bytes;			/* Written to segments */
+    uint64_t	writes;
+    uint64_t	syncs;
+    uint64_t	segments;		/* Opened by this store */
+    uint64_t	stalls;			/* Appends that waited for a buffer */
+    uint64_t	rejected;		/* Malformed or too large */
+    uint64_t	errors;			/* Failed writes, records lost */
+    uint64_t	inflight_max;		/* Most I/Os in flight at once */
+} mql_store_stats_t;
+
+// Defaults for all but dir, io_uring if it is there.
+void mql_store_defaults(mql_store_conf_t* conf);
+
+// Open dir for appending and start the writer thread.  Records after a
+// damaged or partly written one at the end of the last segment are cut,
+// and numbering continues from the last good record.  Only the records
+// of the last segment after the last checkpoint of the writer are read.
+//	RETURNS	store, or 0 on error (errno set)
+mql_store_t* mql_store_open(const mql_store_conf_t* conf);
+
+// Add a record.  Copies, blocks only while all buffers wait for the disk.
+// May be called from any thread.
+//	RETURNS	0 OK, -1 rejected (too large)
+int mql_store_append(mql_store_t* st, const char* id, unsigned id_len,
+		     unsigned sev, const void* text, unsigned text_len);
+
+// Add a received log message, <prefix>/log/<id>/<sev> or a batch of them
+// on <prefix>/log/<id>/<sev>/batch.
+//	RETURNS	records added, -1 for not a log message
+int mql_store_message(mql_store_t* st, const char* topic,
+		      const void* payload, int len);
+
+// Wait until all appended records are written and synced.
+void mql_store_flush(mql_store_t* st);
+
+void mql_store_stats(mql_store_t* st, mql_store_stats_t* stats);
+
+// How the writer does I/O, "uring" or "write", with "+direct".
+const char* mql_store_io(const mql_store_t* st);
+
+// Flush, stop the writer, close and free.
+void mql_store_close(mql_store_t* st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_stub.c
+ * Description     : Stand-in for libmosquitto, for benchmarks and tests
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:06:42 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:17:28 2026
+ * Update Count    : 4
+ */
+
+/*
+ * Link this instead of -lmosquitto to run the library and the listener
+ * without a broker.  Nothing is sent anywhere: publish only counts, or
+ * hands the message to mql_stub_publish_hook when one is set.
+ * Publish may be called from any number of threads.
+ */
+
+#include "mql_stub.h"
+
+#include <mosquitto.h>
+#include <stdlib.h>
+
+
+struct mosquitto {
+    void*	obj;
+    void	(*on_connect)(struct mosquitto*, void*, int);
+};
+
+unsigned long mql_stub_published = 0;
+unsigned long mql_stub_subscribed = 0;
+
+mql_stub_publish_hook_t mql_stub_publish_hook = 0;
+
+
+int
+mosquitto_lib_init()
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+int
+mosquitto_lib_cleanup()
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+struct mosquitto*
+mosquitto_new(const char* id, bool clean_session, void* obj)
+{
+    struct mosquitto* mqc = calloc(1,sizeof(struct mosquitto));
+    if ( mqc )
+	mqc->obj = obj;
+    return mqc;
+}
+
+void
+mosquitto_destroy(struct mosquitto* mqc)
+{
+    free(mqc);
+}
+
+int
+mosquitto_connect(struct mosquitto* mqc, const char* host, int port,
+		  int keepalive)
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+int
+mosquitto_disconnect(struct mosquitto* mqc)
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+int
+mosquitto_loop_stop(struct mosquitto* mqc, bool force)
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+// Reports the connection as made right away.
+int
+mosquitto_loop_start(struct mosquitto* mqc)
+{
+    if ( mqc->on_connect )
+	mqc->on_connect(mqc, mqc->obj, 0);
+    return MOSQ_ERR_SUCCESS;
+}
+
+void
+mosquitto_connect_callback_set(struct mosquitto* mqc,
+			       void (*cb)(struct mosquitto*, void*, int))
+{
+    mqc->on_connect = cb;
+}
+
+void
+mosquitto_disconnect_callback_set(struct mosquitto* mqc,
+				  void (*cb)(struct mosquitto*, void*, int))
+{
+}
+
+void
+mosquitto_message_callback_set(struct mosquitto* mqc,
+			       void (*cb)(struct mosquitto*, void*,
+					  const struct mosquitto_message*))
+{
+}
+
+const char*
+mosquitto_strerror(int err)
+{
+    return err ? "stub error" : "success";
+}
+
+int
+mosquitto_subscribe(struct mosquitto* mqc, int* mid, const char* sub, int qos)
+{
+    __atomic_add_fetch( &mql_stub_subscribed, 1, __ATOMIC_RELAXED );
+    return MOSQ_ERR_SUCCESS;
+}
+
+int
+mosquitto_publish(struct mosquitto* mqc, int* mid, const char* topic,
+		  int payloadlen, const void* payload, int qos, bool retain)
+{
+    __atomic_add_fetch( &mql_stub_published, 1, __ATOMIC_RELAXED );
+    if ( mql_stub_publish_hook )
+	return mql_stub_publish_hook(topic,payloadlen,payload);
+    return MOSQ_ERR_SUCCESS;
+}
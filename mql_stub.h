@@ -0,0 +1,36 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_stub.h
+ * Description     : Stand-in for libmosquitto, for benchmarks and tests
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:06:42 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:06:42 2026
+ * Update Count    : 1
+ */
+
+#ifndef __MQL_STUB_H__
+#define __MQL_STUB_H__ (1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of mosquitto_publish() and mosquitto_subscribe() calls.
+extern unsigned long mql_stub_published;
+extern unsigned long mql_stub_subscribed;
+
+// Called by mosquitto_publish() when set.  Return value is returned
+// from mosquitto_publish().
+typedef int (*mql_stub_publish_hook_t)(const char* topic,
+				       int len, const void* payload);
+extern mql_stub_publish_hook_t mql_stub_publish_hook;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_tail.c
+ * Description     : Tail command, stored records and then live ones
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:27:32 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:27:32 2026
+ * Update Count    : 1
+ */
+
+
+/*
+ * Asks mqld for the records since a time on the tail socket of its store
+ * (see mql_serve.h) and prints them as query does, the stored ones first
+ * and then the new ones as they are written, all numbered by the store.
+ * When mqld goes away it asks again from the sequence number after the
+ * last record or mark, so a restart of mqld neither loses nor repeats
+ * records.
+ */
+
+#include "mql.h"
+#include "mql_serve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern int opt_d;
+#define DD if(opt_d)printf
+
+extern const char* mql_sev_name[MQL_S_MAX];
+
+#define T_RETRY_S	(1)		/* Between tries to connect */
+#define T_BUF		(MQL_TAIL_REC_MAX + 64 * 1024)
+
+
+static int
+t_connect(const char* path)
+{
+    struct sockaddr_un sa;
+    int fd;
+
+    memset( &sa, 0, sizeof(sa) );
+    sa.sun_family = AF_UNIX;
+    if ( strlen(path) >= sizeof(sa.sun_path) ) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    strcpy( sa.sun_path, path );
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( fd < 0 )
+	return -1;
+    if ( connect(fd, (struct sockaddr*)&sa, sizeof(sa)) ) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+static void
+t_print(const mql_rec_t* r, time_t* last, char* ts, size_t ts_len)
+{
+    time_t t = r->ts_ns / 1000000000;
+    struct tm tm;
+
+    if ( t != *last ) {
+	localtime_r( &t, &tm );
+	strftime( ts, ts_len, "%Y-%m-%d %H:%M:%S", &tm );
+	*last = t;
+    }
+    printf("%s.%03u %-16.*s : %x : %-9s : \"%.*s\"\n",
+	   ts, (unsigned)(r->ts_ns / 1000000 % 1000),
+	   (int)r->id_len, MQL_REC_ID(r), r->sev, mql_sev_name[r->sev & 15],
+	   (int)r->text_len, MQL_REC_TEXT(r));
+}
+
+
+void
+mql_command_tail(const char* dir, const char* sock, const char* target,
+		 unsigned severity, uint64_t since_ns)
+{
+    char path[ 4096 ];
+    char ts[ 32 ];
+    mql_tail_req_t req;
+    const mql_rec_t* r;
+    char* buf = malloc(T_BUF);
+    size_t n = 0, pos;
+    uint64_t next = 0;			/* After the last record or mark */
+    time_t last = -1;
+    ssize_t k;
+    int fd, warned = 0;
+
+    if ( !buf ) {
+	perror("tail: ");
+	exit( EXIT_FAILURE );
+    }
+    setvbuf( stdout, 0, _IOFBF, 64 * 1024 );	/* Flushed per read */
+    if ( sock )
+	snprintf( path, sizeof(path), "%s", sock );
+    else
+	snprintf( path, sizeof(path), "%s/%s", dir, MQL_TAIL_SOCK );
+    memset( &req, 0, sizeof(req) );
+    memcpy( req.magic, MQL_TAIL_MAGIC, sizeof(req.magic) );
+    req.since_ns = since_ns;
+    req.sev = severity;
+    if ( target && strcmp("ALL",target) && strcmp("*",target) ) {
+	if ( strlen(target) >= sizeof(req.id) ) {
+	    fprintf(stderr, "Error: Target too long.\n");
+	    exit( EXIT_FAILURE );
+	}
+	req.id_len = strlen(target);
+	memcpy( req.id, target, req.id_len );
+    }
+
+    for (;;) {
+	fd = t_connect(path);
+	if ( fd < 0 ) {
+	    if ( !warned++ ) {
+		fprintf(stderr, "tail: %s: ", path);
+		perror("");
+	    }
+	    if ( errno == ENAMETOOLONG )
+		exit( EXIT_FAILURE );
+	    sleep( T_RETRY_S );
+	    continue;
+	}
+	DD ("connected \"%s\" from %llu\n", path, (unsigned long long)next);
+	warned = 0;
+	req.from_seq = next;
+	if ( write(fd, &req, sizeof(req)) != sizeof(req) ) {
+	    close(fd);
+	    sleep( T_RETRY_S );
+	    continue;
+	}
+
+	/* Whole records of what came, the rest kept for the next read. */
+	n = 0;
+	while ( (k = read(fd, buf + n, T_BUF - n)) > 0 ) {
+	    n += k;
+	    for ( pos = 0; n - pos >= sizeof(mql_rec_t); pos += r->len ) {
+		r = (const mql_rec_t*)(buf + pos);
+		if ( r->len % 8 || r->len < sizeof(mql_rec_t)
+		     || r->len > MQL_TAIL_REC_MAX ) {
+		    fprintf(stderr, "Error: Bad record from %s.\n", path);
+		    exit( EXIT_FAILURE );
+		}
+		if ( r->len > n - pos )
+		    break;
+		if ( r->flags & MQL_REC_PAD ) {
+		    if ( (r->flags & MQL_TAIL_MARK) && r->seq > next )
+			next = r->seq;
+		    if ( r->flags & MQL_TAIL_LIVE )
+			DD ("live at %llu\n", (unsigned long long)r->seq);
+		    continue;
+		}
+		if ( r->len < MQL_REC_LEN(r->id_len, r->text_len) ) {
+		    fprintf(stderr, "Error: Bad record from %s.\n", path);
+		    exit( EXIT_FAILURE );
+		}
+		if ( r->seq < next )
+		    continue;		/* Had it before */
+		next = r->seq + 1;
+		t_print(r, &last, ts, sizeof(ts));
+	    }
+	    memmove( buf, buf + pos, n - pos );
+	    n -= pos;
+	    fflush(stdout);
+	}
+	close(fd);
+	DD ("lost \"%s\" at %llu\n", path, (unsigned long long)next);
+	sleep( T_RETRY_S );
+    }
+}
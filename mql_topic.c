@@ -0,0 +1,173 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_topic.c
+ * Description     : Topic parser for receivers
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:42:48 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:42:48 2026
+ * Update Count    : 2
+ */
+
+
+#include "mql_topic.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+void
+mql_topic_init(mql_topic_parser_t* p, const char* prefix)
+{
+    memset( p, 0, sizeof(*p) );
+    if ( prefix && strlen(prefix) < sizeof(p->prefix) ) {
+	strcpy( p->prefix, prefix );
+	p->prefix_len = strlen(prefix);
+    }
+}
+
+
+void
+mql_topic_free(mql_topic_parser_t* p)
+{
+    free( p->ids );
+    p->ids = 0;
+    p->n_ids = 0;
+}
+
+
+// Slot of an id, added if new.
+//	RETURNS	slot, -1 table full or out of memory
+static int
+topic_slot(mql_topic_parser_t* p, const char* id, unsigned len, uint32_t h)
+{
+    const unsigned mask = MQL_TOPIC_IDS - 1;
+    mql_topic_id_t* e;
+    unsigned i;
+
+    if ( !p->ids ) {
+	p->ids = calloc(MQL_TOPIC_IDS, sizeof(mql_topic_id_t));
+	if ( !p->ids )
+	    return -1;
+    }
+    for ( i = h & mask; ; i = (i + 1) & mask ) {
+	e = &p->ids[i];
+	if ( !e->len )
+	    break;
+	if ( e->hash == h && e->len == len + 1 && !memcmp(e->id, id, len) )
+	    return i;
+    }
+    if ( p->n_ids >= MQL_TOPIC_IDS * 3 / 4 )
+	return -1;
+    e->hash = h;
+    e->len = len + 1;
+    memcpy( e->id, id, len );
+    e->id[ len ] = '\0';
+    ++p->n_ids;
+    return i;
+}
+
+
+void
+mql_topic_intern(mql_topic_parser_t* p, mql_topic_t* t)
+{
+    t->src = topic_slot(p, t->id, t->id_len, t->hash);
+    if ( t->src >= 0 ) {
+	t->id = p->ids[ t->src ].id;
+    }
+    else {
+	memcpy( p->copy, t->id, t->id_len );
+	p->copy[ t->id_len ] = '\0';
+	t->id = p->copy;
+    }
+}
+
+
+// s starts with the string tag, inline for short ones.
+static inline int
+topic_is(const char* s, const char* tag, unsigned len)
+{
+    while ( len-- )
+	if ( *s++ != *tag++ )
+	    return 0;
+    return 1;
+}
+
+
+int
+mql_topic_parse(mql_topic_parser_t* p, const char* topic, mql_topic_t* t)
+{
+    const char* s = topic;
+    const char* id;
+    uint32_t h = 0;
+    unsigned len;
+    unsigned c;
+    int kind;
+
+    /* <prefix>/ */
+    if ( p->prefix_len ) {
+	if ( !topic_is(s, p->prefix, p->prefix_len) || s[ p->prefix_len ] != '/' )
+	    return -1;
+	s += p->prefix_len + 1;
+    }
+    else {
+	while ( *s && *s != '/' )
+	    ++s;
+	if ( !*s++ )
+	    return -1;
+    }
+
+    /* log/ or cmd */
+    if ( topic_is(s, MQL_LOG_TAG "/", sizeof(MQL_LOG_TAG)) )
+	s += sizeof(MQL_LOG_TAG);
+    else if ( topic_is(s, MQL_CMD_TAG, sizeof(MQL_CMD_TAG) - 1)
+	      && (s[ sizeof(MQL_CMD_TAG) - 1 ] == '/'
+		  || !s[ sizeof(MQL_CMD_TAG) - 1 ]) )
+	return MQL_TOPIC_CMD;
+    else
+	return -1;
+
+    /* <id>/, hashed as far as it is kept: a rotate and xor per byte,
+       short of a multiply, and one multiply at the end. */
+    for ( id = s; *s && *s != '/'; ++s )
+	if ( s - id < MQL_ID_MAX_LEN )
+	    h = (h << 5 | h >> 27) ^ (unsigned char)*s;
+    if ( !*s )
+	return -1;
+    len = s - id;
+    if ( len > MQL_ID_MAX_LEN )
+	len = MQL_ID_MAX_LEN;
+    h = (h ^ len) * 2654435761U;
+    h ^= h >> 15;
+    ++s;
+
+    /* <severity>[/batch] */
+    c = (unsigned char)*s;
+    if ( c - '0' < 10 )
+	t->sev = c - '0';
+    else if ( (c | 0x20) - 'a' < 6 )
+	t->sev = (c | 0x20) - 'a' + 10;
+    else
+	return -1;
+    if ( !s[1] ) {
+	kind = MQL_TOPIC_LOG;
+	s += 1;
+    }
+    else if ( s[1] == '/' && !strcmp(s + 2, MQL_BATCH_TAG) ) {
+	kind = MQL_TOPIC_BATCH;
+	s += 2 + sizeof(MQL_BATCH_TAG) - 1;
+    }
+    else {
+	return -1;
+    }
+
+    t->id = id;
+    t->id_len = len;
+    t->hash = h;
+    t->src = -1;
+    t->len = s - topic;
+    return kind;
+}
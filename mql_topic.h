@@ -0,0 +1,87 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_topic.h
+ * Description     : Mqtt Logging, topic parser for receivers
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 15:42:48 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 15:42:48 2026
+ * Update Count    : 2
+ */
+
+#ifndef __MQL_TOPIC_H__
+#define __MQL_TOPIC_H__ (1)
+
+/*
+ * Parses <prefix>/log/<id>/<severity>[/batch] and <prefix>/cmd/... in one
+ * pass over the topic, without copying it.  A known prefix is compared
+ * and skipped whole, so it may hold '/'; otherwise the prefix is the
+ * first level.  The id is hashed while it is scanned, and interned only
+ * when asked for, so a message that is not wanted costs the parse alone:
+ * the same source then gets the same '\0' terminated name and index
+ * every time, for as long as the parser lives.
+ *
+ * A parser is for one thread.
+ */
+
+#include <stdint.h>
+
+#include "mql.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_TOPIC_IDS		(1024)	/* Interned, the rest copied */
+
+#define MQL_TOPIC_CMD		(0)	/* Control message */
+#define MQL_TOPIC_LOG		(1)
+#define MQL_TOPIC_BATCH		(2)	/* Log messages batched by mqlagent */
+
+typedef struct {
+    uint32_t	hash;
+    uint32_t	len;			/* Of the id plus one, 0 free */
+    char	id[ MQL_ID_MAX_LEN + 1 ];
+} mql_topic_id_t;
+
+typedef struct {
+    char	prefix[ MQL_TOPIC_MAX_LEN ];
+    unsigned	prefix_len;		/* 0 for any first level */
+    unsigned	n_ids;
+    mql_topic_id_t* ids;		/* MQL_TOPIC_IDS, 0 until the first */
+    char	copy[ MQL_ID_MAX_LEN + 1 ];	/* Of an id not interned */
+} mql_topic_parser_t;
+
+typedef struct {
+    const char*	id;			/* In the topic until interned */
+    unsigned	id_len;			/* At most MQL_ID_MAX_LEN */
+    uint32_t	hash;			/* Of the id */
+    int		src;			/* Index of the id, -1 not interned */
+    unsigned	sev;
+    unsigned	len;			/* Of the topic */
+} mql_topic_t;
+
+// A parser for topics under prefix, 0 for any.
+void mql_topic_init(mql_topic_parser_t* p, const char* prefix);
+
+void mql_topic_free(mql_topic_parser_t* p);
+
+// Parse a topic.  Ids longer than MQL_ID_MAX_LEN are cut.  t->id points
+// into the topic and is not '\0' terminated.
+//	RETURNS	MQL_TOPIC_LOG or MQL_TOPIC_BATCH with t filled in,
+//		MQL_TOPIC_CMD, or -1 malformed
+int mql_topic_parse(mql_topic_parser_t* p, const char* topic, mql_topic_t* t);
+
+// Intern the id of a parsed topic: t->id is made '\0' terminated, valid
+// as long as the parser, and t->src its index.  When the table is full
+// the id is copied, valid until the next call, and t->src is -1.
+void mql_topic_intern(mql_topic_parser_t* p, mql_topic_t* t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_tp_loop.c
+ * Description     : Mqtt Logging, in-process loopback transport
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:17:28 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:17:28 2026
+ * Update Count    : 1
+ */
+
+/*
+ * Spec: loop
+ *
+ * All loop transports of a process share one bus.  Publish delivers to
+ * every transport with a matching subscription, synchronously on the
+ * publishing thread.  Meant for tests and benchmarks: no broker, no
+ * threads, no copies beyond a terminating '\0'.
+ */
+
+#include "mql.h"
+#include "mql_int.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define LOOP_FILTERS_MAX	(16)
+
+typedef struct mql_tp_loop {
+    mql_transport_t	tp;
+    struct mql_tp_loop*	next;
+    int			started;
+    unsigned		n_filters;
+    char		filter[ LOOP_FILTERS_MAX ][ MQL_TOPIC_MAX_LEN ];
+} mql_tp_loop_t;
+
+static mql_tp_loop_t* loop_bus = 0;
+static pthread_rwlock_t loop_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+static int
+mql_tp_loop_connect(mql_transport_t* tp, const char* host, int port)
+{
+    return 0;
+}
+
+static int
+mql_tp_loop_loop_start(mql_transport_t* tp)
+{
+    mql_tp_loop_t* l = (mql_tp_loop_t*)tp;
+    pthread_rwlock_wrlock( &loop_lock );
+    l->started = 1;
+    pthread_rwlock_unlock( &loop_lock );
+    if ( tp->on_connect )
+	tp->on_connect(tp,tp->obj,0);
+    return 0;
+}
+
+static int
+mql_tp_loop_matches(const mql_tp_loop_t* l, const char* topic)
+{
+    unsigned i;
+    for ( i = 0; i < l->n_filters; ++i )
+	if ( mql_topic_match(l->filter[i],topic) )
+	    return 1;
+    return 0;
+}
+
+static int
+mql_tp_loop_publish(mql_transport_t* tp, const char* topic,
+		    int len, const void* payload, int qos, int retain)
+{
+    mql_tp_loop_t* l;
+    char buf[ 1024 ];
+    char* copy = 0;
+
+    if ( len < 0 )
+	return -1;
+
+    pthread_rwlock_rdlock( &loop_lock );
+    for ( l = loop_bus; l; l = l->next ) {
+	if ( !l->started || !l->tp.on_message || !mql_tp_loop_matches(l,topic) )
+	    continue;
+	if ( !copy ) {
+	    /* Receivers get a '\0' terminated payload. */
+	    copy = ((size_t)len < sizeof(buf)) ? buf : malloc(len+1);
+	    if ( !copy ) {
+		pthread_rwlock_unlock( &loop_lock );
+		return -1;
+	    }
+	    memcpy( copy, payload, len );
+	    copy[len] = '\0';
+	}
+	l->tp.on_message(&l->tp,l->tp.obj,topic,copy,len);
+    }
+    pthread_rwlock_unlock( &loop_lock );
+
+    if ( copy && copy != buf )
+	free(copy);
+    return 0;
+}
+
+static int
+mql_tp_loop_subscribe(mql_transport_t* tp, const char* filter)
+{
+    mql_tp_loop_t* l = (mql_tp_loop_t*)tp;
+    int i = -1;
+    pthread_rwlock_wrlock( &loop_lock );
+    if ( l->n_filters < LOOP_FILTERS_MAX
+	 && strlen(filter) < MQL_TOPIC_MAX_LEN ) {
+	strcpy( l->filter[ l->n_filters++ ], filter );
+	i = 0;
+    }
+    pthread_rwlock_unlock( &loop_lock );
+    return i;
+}
+
+static void
+mql_tp_loop_destroy(mql_transport_t* tp)
+{
+    mql_tp_loop_t* l = (mql_tp_loop_t*)tp;
+    mql_tp_loop_t** pp;
+    pthread_rwlock_wrlock( &loop_lock );
+    for ( pp = &loop_bus; *pp; pp = &(*pp)->next ) {
+	if ( *pp == l ) {
+	    *pp = l->next;
+	    break;
+	}
+    }
+    pthread_rwlock_unlock( &loop_lock );
+    free(l);
+}
+
+
+static const mql_tp_ops_t mql_tp_loop_ops = {
+    "loop",
+    mql_tp_loop_connect,
+    mql_tp_loop_loop_start,
+    mql_tp_loop_publish,
+    mql_tp_loop_subscribe,
+    mql_tp_loop_destroy
+};
+
+
+mql_transport_t*
+mql_tp_loop_new(const char* arg)
+{
+    mql_tp_loop_t* l = calloc(1,sizeof(mql_tp_loop_t));
+    if ( !l )
+	return 0;
+    l->tp.ops = &mql_tp_loop_ops;
+    pthread_rwlock_wrlock( &loop_lock );
+    l->next = loop_bus;
+    loop_bus = l;
+    pthread_rwlock_unlock( &loop_lock );
+    return &l->tp;
+}
@@ -0,0 +1,184 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_tp_mosquitto.c
+ * Description     : Mqtt Logging, libmosquitto transport
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:17:28 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:04:43 2026
+ * Update Count    : 2
+ */
+
+/*
+ * Spec: mqtt[://<host>[:<port>]], default $MQTT_HOST or 127.0.0.1, port
+ * 1883.  A host or port given to connect overrides the spec.
+ */
+
+#include "mql.h"
+#include "mql_int.h"
+
+#include <mosquitto.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MQTT_PORT	(1883)
+#define MQTT_KEEPALIVE	(60)
+
+typedef struct {
+    mql_transport_t	tp;
+    struct mosquitto*	mqc;
+    int			owned;		/* Created here, not mql_init() */
+    char		host[ 80 ];
+    int			port;
+} mql_tp_mosquitto_t;
+
+
+static void
+mql_tp_mosquitto_connect_cb(struct mosquitto* mqc, void* obj, int result)
+{
+    mql_transport_t* tp = obj;
+    if ( tp->on_connect )
+	tp->on_connect(tp,tp->obj,result);
+}
+
+static void
+mql_tp_mosquitto_disconnect_cb(struct mosquitto* mqc, void* obj, int result)
+{
+    mql_transport_t* tp = obj;
+    if ( tp->on_disconnect )
+	tp->on_disconnect(tp,tp->obj,result ? result : -1);
+}
+
+static void
+mql_tp_mosquitto_message_cb(struct mosquitto* mqc, void* obj,
+			    const struct mosquitto_message* msg)
+{
+    mql_transport_t* tp = obj;
+    if ( tp->on_message )
+	tp->on_message(tp,tp->obj,msg->topic,msg->payload,msg->payloadlen);
+}
+
+
+static int
+mql_tp_mosquitto_connect(mql_transport_t* tp, const char* host, int port)
+{
+    mql_tp_mosquitto_t* m = (mql_tp_mosquitto_t*)tp;
+    int i;
+    if ( !m->owned )
+	return -1;
+    if ( host && *host )
+	strncpy( m->host, host, sizeof(m->host)-1 );
+    if ( port )
+	m->port = port;
+    i = mosquitto_connect(m->mqc, m->host, m->port, MQTT_KEEPALIVE);
+    return (i == MOSQ_ERR_SUCCESS) ? 0 : -1;
+}
+
+static int
+mql_tp_mosquitto_loop_start(mql_transport_t* tp)
+{
+    mql_tp_mosquitto_t* m = (mql_tp_mosquitto_t*)tp;
+    int i = mosquitto_loop_start(m->mqc);
+    return (i == MOSQ_ERR_SUCCESS) ? 0 : -1;
+}
+
+static int
+mql_tp_mosquitto_publish(mql_transport_t* tp, const char* topic,
+			 int len, const void* payload, int qos, int retain)
+{
+    mql_tp_mosquitto_t* m = (mql_tp_mosquitto_t*)tp;
+    int i = mosquitto_publish(m->mqc, 0, topic, len, payload, qos, retain);
+    return (i == MOSQ_ERR_SUCCESS) ? 0 : -1;
+}
+
+static int
+mql_tp_mosquitto_subscribe(mql_transport_t* tp, const char* filter)
+{
+    mql_tp_mosquitto_t* m = (mql_tp_mosquitto_t*)tp;
+    int i = mosquitto_subscribe(m->mqc, 0, filter, 0);
+    return (i == MOSQ_ERR_SUCCESS) ? 0 : -1;
+}
+
+static void
+mql_tp_mosquitto_destroy(mql_transport_t* tp)
+{
+    mql_tp_mosquitto_t* m = (mql_tp_mosquitto_t*)tp;
+    if ( m->owned ) {
+	mosquitto_disconnect(m->mqc);
+	mosquitto_loop_stop(m->mqc,false);
+	mosquitto_destroy(m->mqc);
+    }
+    free(m);
+}
+
+
+static const mql_tp_ops_t mql_tp_mosquitto_ops = {
+    "mqtt",
+    mql_tp_mosquitto_connect,
+    mql_tp_mosquitto_loop_start,
+    mql_tp_mosquitto_publish,
+    mql_tp_mosquitto_subscribe,
+    mql_tp_mosquitto_destroy
+};
+
+
+mql_transport_t*
+mql_tp_mosquitto_new(const char* arg)
+{
+    mql_tp_mosquitto_t* m;
+
+    if ( mosquitto_lib_init() != MOSQ_ERR_SUCCESS )
+	return 0;
+
+    m = calloc(1,sizeof(mql_tp_mosquitto_t));
+    if ( !m )
+	return 0;
+    m->tp.ops = &mql_tp_mosquitto_ops;
+    m->owned = 1;
+    strncpy( m->host, getenv("MQTT_HOST") ? getenv("MQTT_HOST")
+	     : "127.0.0.1", sizeof(m->host)-1 );
+    m->port = MQTT_PORT;
+
+    // arg: //<host>[:<port>]
+    if ( arg && !strncmp(arg,"//",2) ) {
+	size_t n;
+	arg += 2;
+	n = strcspn(arg,":");
+	if ( n ) {
+	    if ( n >= sizeof(m->host) )
+		n = sizeof(m->host) - 1;
+	    memcpy( m->host, arg, n );
+	    m->host[n] = '\0';
+	}
+	if ( arg[n] == ':' )
+	    m->port = atoi(arg+n+1);
+    }
+
+    m->mqc = mosquitto_new(0, true, m);
+    if ( !m->mqc ) {
+	free(m);
+	return 0;
+    }
+    mosquitto_connect_callback_set(m->mqc, mql_tp_mosquitto_connect_cb);
+    mosquitto_disconnect_callback_set(m->mqc, mql_tp_mosquitto_disconnect_cb);
+    mosquitto_message_callback_set(m->mqc, mql_tp_mosquitto_message_cb);
+    return &m->tp;
+}
+
+
+// Wrap a handle owned by the application, for mql_init().  Only publish
+// and subscribe are used, the callbacks stay with the application.
+mql_transport_t*
+mql_tp_mosquitto_wrap(struct mosquitto* mqc)
+{
+    mql_tp_mosquitto_t* m = calloc(1,sizeof(mql_tp_mosquitto_t));
+    if ( !m )
+	return 0;
+    m->tp.ops = &mql_tp_mosquitto_ops;
+    m->mqc = mqc;
+    m->owned = 0;
+    return &m->tp;
+}
@@ -0,0 +1,693 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_tp_shm.c
+ * Description     : Mqtt Logging, shared-memory ring transport
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:21:41 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:24:55 2026
+ * Update Count    : 3
+ */
+
+/*
+ * Spec: shm[:<name>], default MQL_SHM_NAME.
+ *
+ * For producers and receivers on the same host, no broker involved.
+ *
+ * Each transport that publishes log topics (<prefix>/log/...) creates
+ * its own ring, /dev/shm/<name>.<pid>.<n>, on first use.  Any number of
+ * producer threads claim positions with one atomic add; a slot carries a
+ * sequence word that is odd while written and even when complete, so
+ * receivers read the rings like a seqlock and never write to them.
+ * A producer takes its slot with a compare-and-swap from the sequence
+ * the record a lap before left.  A producer never waits: if that record
+ * is still being written, or a producer a lap ahead has the slot, the
+ * record is dropped and counted.  A receiver that falls behind by more
+ * than a ring loses the oldest records and counts them.
+ *
+ * The segments are created with mode 0600: only processes of the same
+ * user see each other.
+ *
+ * All other topics (commands, responses) go through one small ring of
+ * the same kind in the common segment /dev/shm/<name>, which also holds
+ * the futex words receivers sleep on.  Receivers spin briefly on their
+ * rings, then futex-wait; a producer only makes the wake system call
+ * when a receiver is asleep.
+ *
+ * A receiver reads log rings only when it has subscribed to a filter
+ * that can match a log topic, and finds new rings by scanning /dev/shm
+ * while idle.  Rings of processes that are gone are read to the end,
+ * then removed.
+ */
+
+#include "mql.h"
+#include "mql_int.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHM_MAGIC		(0x6d716c72)	/* "mqlr" */
+#define SHM_SLOT_SIZE		(512)
+#define SHM_LOG_SLOTS		(4096)		/* Per producer, 2 MiB */
+#define SHM_BOARD_SLOTS		(64)
+#define SHM_FILTERS_MAX		(16)
+#define SHM_RINGS_MAX		(256)
+#define SHM_NAME_MAX		(64)
+#define SHM_SPIN		(2000)		/* Empty polls before sleeping */
+#define SHM_WAIT_MS		(100)		/* Sleep, then rescan /dev/shm */
+
+typedef struct {
+    _Atomic uint64_t	seq;		/* 2*pos+1 writing, 2*pos+2 done */
+    uint16_t		tlen;		/* Topic length with '\0' */
+    uint16_t		len;		/* Payload length */
+    char		data[ SHM_SLOT_SIZE - 12 ];
+} shm_slot_t;
+
+typedef struct {
+    uint32_t		magic;
+    uint32_t		n_slots;	/* Power of two */
+    int32_t		pid;		/* Owner, 0 for the board */
+    uint32_t		pad0;
+    _Atomic uint64_t	head;		/* Next position to claim */
+    _Atomic uint64_t	dropped;	/* Records producers dropped */
+    _Atomic uint64_t	skip;		/* Last position dropped, plus 1 */
+    char		pad1[ 64 - 40 ];
+    shm_slot_t		slot[];
+} shm_ring_t;
+
+// The common segment.
+typedef struct {
+    uint32_t		magic;
+    uint32_t		pad0;
+    _Atomic uint32_t	log_bell;	/* Futex, bumped for log records */
+    _Atomic uint32_t	log_sleepers;
+    _Atomic uint32_t	cmd_bell;	/* Futex, bumped for board records */
+    _Atomic uint32_t	cmd_sleepers;
+    char		pad1[ 64 - 24 ];
+} shm_bus_t;				/* Followed by the board ring */
+
+#define SHM_RING_BYTES(n)	(sizeof(shm_ring_t) + (n)*sizeof(shm_slot_t))
+#define SHM_BUS_BYTES		(sizeof(shm_bus_t) + SHM_RING_BYTES(SHM_BOARD_SLOTS))
+#define SHM_BOARD(bus)		((shm_ring_t*)((char*)(bus) + sizeof(shm_bus_t)))
+
+// A ring as seen by a receiver.
+typedef struct {
+    shm_ring_t*		r;
+    size_t		bytes;
+    uint64_t		pos;		/* Next position to read */
+    int			gone;		/* Owner process has exited */
+    char		name[ SHM_NAME_MAX ];
+} shm_reader_t;
+
+typedef struct {
+    mql_transport_t	tp;
+    char		name[ SHM_NAME_MAX ];
+    shm_bus_t*		bus;
+
+    // Producer side.
+    _Atomic(shm_ring_t*) ring;
+    char		ring_name[ SHM_NAME_MAX ];
+    pthread_mutex_t	mtx;		/* Ring creation, subscribe */
+
+    // Receiver side.  Filters are only appended, the transport thread
+    // reads n_filters and want_log without the lock.
+    atomic_uint		n_filters;
+    char		filter[ SHM_FILTERS_MAX ][ MQL_TOPIC_MAX_LEN ];
+    atomic_int		want_log;
+    shm_reader_t	board;
+    shm_reader_t	rd[ SHM_RINGS_MAX ];
+    unsigned		n_rd;
+    unsigned long	lost;
+
+    int			running;
+    volatile int	closing;
+    pthread_t		tid;
+} mql_tp_shm_t;
+
+static atomic_uint shm_ring_count = 0;
+
+
+static void
+shm_futex_wait(_Atomic uint32_t* w, uint32_t val, int ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    syscall(SYS_futex, w, FUTEX_WAIT, val, &ts, 0, 0);
+}
+
+static void
+shm_futex_wake(_Atomic uint32_t* w)
+{
+    syscall(SYS_futex, w, FUTEX_WAKE, INT32_MAX, 0, 0, 0);
+}
+
+static void
+shm_ring_init(shm_ring_t* r, unsigned n_slots, int pid)
+{
+    unsigned i;
+    r->n_slots = n_slots;
+    r->pid = pid;
+    atomic_init( &r->head, 0 );
+    atomic_init( &r->dropped, 0 );
+    atomic_init( &r->skip, 0 );
+    for ( i = 0; i < n_slots; ++i )
+	atomic_init( &r->slot[i].seq, 0 );
+    atomic_thread_fence( memory_order_release );
+    r->magic = SHM_MAGIC;
+}
+
+
+// Count the record at pos as dropped.
+static int
+shm_ring_drop(shm_ring_t* r, uint64_t pos)
+{
+    atomic_fetch_add_explicit( &r->dropped, 1, memory_order_relaxed );
+    atomic_store_explicit( &r->skip, pos + 1, memory_order_release );
+    errno = EAGAIN;
+    return -1;
+}
+
+// Claim a slot and write one record.  Never waits.
+//	RETURNS	0 written, -1 too long, or dropped with errno EAGAIN
+static int
+shm_ring_put(shm_ring_t* r, const char* topic, size_t tlen,
+	     const void* payload, size_t len)
+{
+    uint64_t pos, seq;
+    shm_slot_t* s;
+
+    if ( tlen + len > sizeof(s->data) )
+	return -1;
+    pos = atomic_fetch_add_explicit( &r->head, 1, memory_order_relaxed );
+    s = &r->slot[ pos & (r->n_slots - 1) ];
+
+    /* Only from the record a lap before, complete. */
+    seq = (pos < r->n_slots) ? 0 : 2*(pos - r->n_slots) + 2;
+    if ( !atomic_compare_exchange_strong_explicit( &s->seq, &seq, 2*pos + 1,
+						   memory_order_relaxed,
+						   memory_order_relaxed ) )
+	return shm_ring_drop(r, pos);
+    atomic_thread_fence( memory_order_release );
+    s->tlen = tlen;
+    s->len = len;
+    memcpy( s->data, topic, tlen );
+    memcpy( s->data + tlen, payload, len );
+
+    /* Never over a lap that is newer. */
+    seq = 2*pos + 1;
+    if ( !atomic_compare_exchange_strong_explicit( &s->seq, &seq, 2*pos + 2,
+						   memory_order_release,
+						   memory_order_relaxed ) )
+	return shm_ring_drop(r, pos);
+    return 0;
+}
+
+
+// Read the record at rd->pos into buf (at least SHM_SLOT_SIZE+1).
+//	RETURNS	1	Record read, rd->pos advanced
+//		0	Nothing new
+//		-1	Overrun, rd->pos moved to the oldest record left
+static int
+shm_ring_get(mql_tp_shm_t* t, shm_reader_t* rd, char* buf,
+	     const char** topic, const char** payload, int* len)
+{
+    shm_ring_t* r = rd->r;
+    shm_slot_t* s = &r->slot[ rd->pos & (r->n_slots - 1) ];
+    uint64_t want = 2*rd->pos + 2;
+    uint64_t s1, s2;
+    unsigned tlen, plen;
+
+    s1 = atomic_load_explicit( &s->seq, memory_order_acquire );
+    if ( s1 < want ) {
+	uint64_t head = atomic_load_explicit( &r->head, memory_order_relaxed );
+	if ( s1 == want - 1 )
+	    return 0;			/* Being written */
+	if ( head <= rd->pos + r->n_slots ) {
+	    if ( atomic_load_explicit( &r->skip, memory_order_acquire )
+		 != rd->pos + 1 )
+		return 0;		/* Not yet */
+	    ++t->lost;			/* Dropped by its producer */
+	    ++rd->pos;
+	    return -1;
+	}
+    }
+    if ( s1 == want ) {
+	tlen = s->tlen;
+	plen = s->len;
+	if ( tlen + plen <= sizeof(s->data) )
+	    memcpy( buf, s->data, tlen + plen );
+	atomic_thread_fence( memory_order_acquire );
+	s2 = atomic_load_explicit( &s->seq, memory_order_relaxed );
+	if ( s2 == s1 && tlen && tlen + plen <= sizeof(s->data) ) {
+	    buf[ tlen - 1 ] = '\0';
+	    buf[ tlen + plen ] = '\0';
+	    *topic = buf;
+	    *payload = buf + tlen;
+	    *len = plen;
+	    ++rd->pos;
+	    return 1;
+	}
+    }
+
+    /* Overwritten by a producer a lap ahead. */
+    s1 = atomic_load_explicit( &r->head, memory_order_relaxed );
+    if ( s1 > r->n_slots && rd->pos < s1 - r->n_slots ) {
+	t->lost += s1 - r->n_slots - rd->pos;
+	rd->pos = s1 - r->n_slots;
+    }
+    else {
+	++t->lost;			/* Torn record */
+	++rd->pos;
+    }
+    return -1;
+}
+
+
+// Create the common segment, or map the existing one.
+static shm_bus_t*
+shm_bus_open(const char* name)
+{
+    shm_bus_t* bus;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if ( fd < 0 )
+	return 0;
+    flock(fd, LOCK_EX);			/* Serialise initialisation */
+    if ( ftruncate(fd, SHM_BUS_BYTES) ) {
+	close(fd);
+	return 0;
+    }
+    bus = mmap(0, SHM_BUS_BYTES, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if ( bus != MAP_FAILED && bus->magic != SHM_MAGIC ) {
+	shm_ring_init( SHM_BOARD(bus), SHM_BOARD_SLOTS, 0 );
+	bus->magic = SHM_MAGIC;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return (bus == MAP_FAILED) ? 0 : bus;
+}
+
+
+static int
+shm_is_log_topic(const char* topic)
+{
+    const char* p = strchr(topic,'/');
+    return p && !strncmp(p+1, MQL_LOG_TAG "/", sizeof(MQL_LOG_TAG));
+}
+
+// Can the filter match <prefix>/log/...?
+static int
+shm_is_log_filter(const char* f)
+{
+    const char* p;
+    if ( !strcmp(f,"#") )
+	return 1;
+    p = strchr(f,'/');
+    if ( !p )
+	return 0;
+    ++p;
+    return *p == '#' || (*p == '+' && (!p[1] || p[1] == '/'))
+	|| !strncmp(p, MQL_LOG_TAG, sizeof(MQL_LOG_TAG)-1);
+}
+
+
+static int
+mql_tp_shm_connect(mql_transport_t* tp, const char* host, int port)
+{
+    mql_tp_shm_t* t = (mql_tp_shm_t*)tp;
+    if ( t->bus )
+	return -1;
+    t->bus = shm_bus_open(t->name);
+    if ( !t->bus )
+	return -1;
+    t->board.r = SHM_BOARD(t->bus);
+    t->board.pos = atomic_load( &t->board.r->head );
+    return 0;
+}
+
+
+// The producer ring of t, created on first use.
+//	RETURNS	ring, or 0 if it could not be created
+static shm_ring_t*
+shm_ring_create(mql_tp_shm_t* t)
+{
+    size_t bytes = SHM_RING_BYTES(SHM_LOG_SLOTS);
+    shm_ring_t* r;
+    int fd;
+
+    pthread_mutex_lock( &t->mtx );
+    r = atomic_load_explicit( &t->ring, memory_order_relaxed );
+    if ( !r ) {
+	fd = -1;
+	if ( snprintf( t->ring_name, SHM_NAME_MAX, "%s.%d.%u", t->name,
+		       (int)getpid(), atomic_fetch_add(&shm_ring_count,1) )
+	     < SHM_NAME_MAX )
+	    fd = shm_open(t->ring_name, O_RDWR | O_CREAT, 0600);
+	if ( fd >= 0 ) {
+	    if ( !ftruncate(fd, bytes) ) {
+		r = mmap(0, bytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if ( r != MAP_FAILED ) {
+		    r->magic = 0;	/* Left by an earlier owner of pid */
+		    shm_ring_init( r, SHM_LOG_SLOTS, getpid() );
+		    atomic_store_explicit( &t->ring, r, memory_order_release );
+		}
+		else
+		    r = 0;
+	    }
+	    close(fd);
+	}
+    }
+    pthread_mutex_unlock( &t->mtx );
+    return r;
+}
+
+
+static int
+mql_tp_shm_publish(mql_transport_t* tp, const char* topic,
+		   int len, const void* payload, int qos, int retain)
+{
+    mql_tp_shm_t* t = (mql_tp_shm_t*)tp;
+    shm_bus_t* bus = t->bus;
+    size_t tlen = strlen(topic) + 1;
+    shm_ring_t* r;
+
+    if ( !bus || len < 0 )
+	return -1;
+
+    if ( shm_is_log_topic(topic) ) {
+	r = atomic_load_explicit( &t->ring, memory_order_acquire );
+	if ( !r && !(r = shm_ring_create(t)) )
+	    return -1;
+	if ( shm_ring_put(r, topic, tlen, payload, len) )
+	    return -1;
+	/* The record before the sleepers, as the reader does the reverse. */
+	atomic_thread_fence( memory_order_seq_cst );
+	if ( atomic_load_explicit(&bus->log_sleepers, memory_order_relaxed) ) {
+	    atomic_fetch_add( &bus->log_bell, 1 );
+	    shm_futex_wake( &bus->log_bell );
+	}
+	return 0;
+    }
+
+    if ( shm_ring_put(SHM_BOARD(bus), topic, tlen, payload, len) )
+	return -1;
+    /* Rare, always ring both bells. */
+    atomic_fetch_add( &bus->cmd_bell, 1 );
+    atomic_fetch_add( &bus->log_bell, 1 );
+    shm_futex_wake( &bus->cmd_bell );
+    shm_futex_wake( &bus->log_bell );
+    return 0;
+}
+
+
+static int
+mql_tp_shm_subscribe(mql_transport_t* tp, const char* filter)
+{
+    mql_tp_shm_t* t = (mql_tp_shm_t*)tp;
+    unsigned n;
+    int i = -1;
+
+    pthread_mutex_lock( &t->mtx );
+    n = atomic_load( &t->n_filters );
+    if ( n < SHM_FILTERS_MAX && strlen(filter) < MQL_TOPIC_MAX_LEN ) {
+	strcpy( t->filter[n], filter );
+	atomic_store( &t->n_filters, n + 1 );
+	if ( shm_is_log_filter(filter) )
+	    atomic_store( &t->want_log, 1 );
+	i = 0;
+    }
+    pthread_mutex_unlock( &t->mtx );
+    return i;
+}
+
+
+// Map rings of producers not seen yet.  Rings found by the first scan
+// are read from their head, later ones from their oldest record.
+static void
+shm_scan(mql_tp_shm_t* t, int first)
+{
+    size_t nlen = strlen(t->name + 1);
+    struct dirent* de;
+    DIR* d = opendir("/dev/shm");
+    unsigned i;
+
+    if ( !d )
+	return;
+    while ( (de = readdir(d)) && t->n_rd < SHM_RINGS_MAX ) {
+	shm_reader_t* rd;
+	struct stat st;
+	char name[ SHM_NAME_MAX ];
+	uint64_t head;
+	int fd;
+
+	/* <name>.<pid>.<n>, name without its leading '/' */
+	if ( strncmp(de->d_name, t->name + 1, nlen) || de->d_name[nlen] != '.'
+	     || strlen(de->d_name) + 2 > SHM_NAME_MAX )
+	    continue;
+	name[0] = '/';
+	strcpy( name + 1, de->d_name );
+	for ( i = 0; i < t->n_rd; ++i )
+	    if ( !strcmp(t->rd[i].name, name) )
+		break;
+	if ( i < t->n_rd )
+	    continue;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if ( fd < 0 )
+	    continue;
+	if ( fstat(fd, &st) || (size_t)st.st_size < sizeof(shm_ring_t) ) {
+	    close(fd);
+	    continue;
+	}
+	rd = &t->rd[ t->n_rd ];
+	rd->bytes = st.st_size;
+	rd->r = mmap(0, rd->bytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if ( rd->r == MAP_FAILED )
+	    continue;
+	if ( rd->r->magic != SHM_MAGIC
+	     || SHM_RING_BYTES(rd->r->n_slots) > rd->bytes ) {
+	    munmap(rd->r, rd->bytes);
+	    continue;
+	}
+	head = atomic_load( &rd->r->head );
+	rd->pos = first ? head
+	    : (head > rd->r->n_slots ? head - rd->r->n_slots : 0);
+	rd->gone = 0;
+	strcpy( rd->name, name );
+	++t->n_rd;
+    }
+    closedir(d);
+
+    /* Owners that have exited: drained last round, remove. */
+    for ( i = t->n_rd; i > 0; --i ) {
+	shm_reader_t* rd = &t->rd[i-1];
+	if ( rd->gone && rd->pos >= atomic_load(&rd->r->head) ) {
+	    munmap(rd->r, rd->bytes);
+	    shm_unlink(rd->name);
+	    t->rd[i-1] = t->rd[ --t->n_rd ];
+	}
+	else if ( kill(rd->r->pid, 0) && errno == ESRCH )
+	    rd->gone = 1;
+    }
+}
+
+
+static unsigned
+shm_drain(mql_tp_shm_t* t, shm_reader_t* rd, char* buf)
+{
+    const char* topic;
+    const char* payload;
+    unsigned n = 0;
+    unsigned i, nf;
+    int len;
+    int k;
+
+    while ( (k = shm_ring_get(t, rd, buf, &topic, &payload, &len)) ) {
+	if ( k < 0 )
+	    continue;
+	++n;
+	nf = atomic_load( &t->n_filters );
+	for ( i = 0; i < nf; ++i ) {
+	    if ( mql_topic_match(t->filter[i],topic) ) {
+		if ( t->tp.on_message )
+		    t->tp.on_message(&t->tp,t->tp.obj,topic,payload,len);
+		break;
+	    }
+	}
+    }
+    return n;
+}
+
+
+// Look for new rings if ms have passed since the last look.
+static void
+shm_rescan(mql_tp_shm_t* t, uint64_t* last, unsigned ms)
+{
+    struct timespec ts;
+    uint64_t now;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+    if ( now - *last >= ms ) {
+	shm_scan(t, 0);
+	*last = now;
+    }
+}
+
+
+static unsigned
+shm_drain_all(mql_tp_shm_t* t, char* buf)
+{
+    unsigned i;
+    unsigned n = shm_drain(t, &t->board, buf);
+    for ( i = 0; i < t->n_rd; ++i )
+	n += shm_drain(t, &t->rd[i], buf);
+    return n;
+}
+
+
+static void*
+mql_tp_shm_reader(void* arg)
+{
+    mql_tp_shm_t* t = arg;
+    shm_bus_t* bus = t->bus;
+    _Atomic uint32_t* bell = &bus->cmd_bell;
+    _Atomic uint32_t* sleepers = &bus->cmd_sleepers;
+    char buf[ SHM_SLOT_SIZE + 1 ];
+    uint64_t last_scan = 0;
+    unsigned idle = 0;
+    unsigned busy = 0;
+    int scanned = 0;
+    int woke = 0;
+
+    if ( t->tp.on_connect )
+	t->tp.on_connect(&t->tp,t->tp.obj,0);
+
+    while ( !t->closing ) {
+	uint32_t v;
+
+	if ( !scanned && atomic_load(&t->want_log) ) {
+	    /* Log subscriber: read the rings, wake for log records. */
+	    shm_scan(t, 1);
+	    scanned = 1;
+	    bell = &bus->log_bell;
+	    sleepers = &bus->log_sleepers;
+	}
+
+	if ( shm_drain_all(t, buf) ) {
+	    idle = 0;
+	    woke = 0;
+	    if ( scanned && !(++busy & 1023) )
+		shm_rescan(t, &last_scan, SHM_WAIT_MS);
+	    continue;
+	}
+	if ( woke && scanned )
+	    shm_rescan(t, &last_scan, 1);	/* Rung by a new ring? */
+	woke = 0;
+	if ( ++idle < SHM_SPIN )
+	    continue;
+
+	/* Announce the sleep, then look once more before sleeping. */
+	atomic_fetch_add( sleepers, 1 );
+	atomic_thread_fence( memory_order_seq_cst );
+	v = atomic_load( bell );
+	if ( !shm_drain_all(t, buf) && !t->closing )
+	    shm_futex_wait(bell, v, SHM_WAIT_MS);
+	atomic_fetch_sub( sleepers, 1 );
+	if ( scanned )
+	    shm_rescan(t, &last_scan, SHM_WAIT_MS);
+	woke = 1;
+	idle = 0;
+    }
+    return 0;
+}
+
+
+static int
+mql_tp_shm_loop_start(mql_transport_t* tp)
+{
+    mql_tp_shm_t* t = (mql_tp_shm_t*)tp;
+    if ( !t->bus || t->running )
+	return -1;
+    if ( pthread_create(&t->tid, 0, mql_tp_shm_reader, t) )
+	return -1;
+    t->running = 1;
+    return 0;
+}
+
+
+static void
+mql_tp_shm_destroy(mql_transport_t* tp)
+{
+    mql_tp_shm_t* t = (mql_tp_shm_t*)tp;
+    shm_ring_t* r = atomic_load( &t->ring );
+    unsigned i;
+
+    t->closing = 1;
+    if ( t->running ) {
+	atomic_fetch_add( &t->bus->log_bell, 1 );
+	atomic_fetch_add( &t->bus->cmd_bell, 1 );
+	shm_futex_wake( &t->bus->log_bell );
+	shm_futex_wake( &t->bus->cmd_bell );
+	pthread_join(t->tid, 0);
+    }
+    for ( i = 0; i < t->n_rd; ++i )
+	munmap(t->rd[i].r, t->rd[i].bytes);
+    if ( r ) {
+	munmap(r, SHM_RING_BYTES(SHM_LOG_SLOTS));
+	shm_unlink(t->ring_name);	/* Receivers keep their mapping */
+    }
+    if ( t->bus )
+	munmap(t->bus, SHM_BUS_BYTES);
+    pthread_mutex_destroy( &t->mtx );
+    free(t);
+}
+
+
+static const mql_tp_ops_t mql_tp_shm_ops = {
+    "shm",
+    mql_tp_shm_connect,
+    mql_tp_shm_loop_start,
+    mql_tp_shm_publish,
+    mql_tp_shm_subscribe,
+    mql_tp_shm_destroy
+};
+
+
+mql_transport_t*
+mql_tp_shm_new(const char* arg)
+{
+    mql_tp_shm_t* t;
+    const char* name = arg ? arg : MQL_SHM_NAME;
+
+    /* Room for ".<pid>.<n>" */
+    if ( strlen(name) + 24 > SHM_NAME_MAX || strchr(name,'/') )
+	return 0;
+    t = calloc(1,sizeof(mql_tp_shm_t));
+    if ( !t )
+	return 0;
+    t->tp.ops = &mql_tp_shm_ops;
+    snprintf( t->name, SHM_NAME_MAX, "/%s", name );
+    pthread_mutex_init( &t->mtx, 0 );
+    return &t->tp;
+}
@@ -0,0 +1,237 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_tp_unix.c
+ * Description     : Mqtt Logging, Unix-domain socket transport
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:17:28 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:02:58 2026
+ * Update Count    : 2
+ */
+
+/*
+ * Spec: unix[:<path>], default MQL_UNIX_PATH.
+ *
+ * Connects to "mql hub" (or mqlagent) on the same host, which routes
+ * messages between its clients like a broker.  One SOCK_SEQPACKET
+ * frame per message, see mql_int.h.  Publish never blocks: when the
+ * socket buffer is full the message is dropped and -1 returned.
+ */
+
+#include "mql.h"
+#include "mql_int.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+typedef struct {
+    mql_transport_t	tp;
+    int			fd;
+    int			running;
+    volatile int	closing;
+    pthread_t		tid;
+    struct sockaddr_un	addr;
+} mql_tp_unix_t;
+
+
+static int
+mql_tp_unix_connect(mql_transport_t* tp, const char* host, int port)
+{
+    mql_tp_unix_t* u = (mql_tp_unix_t*)tp;
+
+    if ( u->fd >= 0 )
+	return -1;
+    u->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ( u->fd < 0 )
+	return -1;
+    if ( connect(u->fd, (struct sockaddr*)&u->addr, sizeof(u->addr)) ) {
+	close(u->fd);
+	u->fd = -1;
+	return -1;
+    }
+    return 0;
+}
+
+
+static void*
+mql_tp_unix_reader(void* arg)
+{
+    mql_tp_unix_t* u = arg;
+    char* buf = malloc(MQL_UNIX_FRAME_MAX + 1);
+    ssize_t n;
+
+    if ( u->tp.on_connect )
+	u->tp.on_connect(&u->tp,u->tp.obj,buf ? 0 : -1);
+
+    while ( buf ) {
+	const char* topic;
+	size_t tlen;
+
+	n = recv(u->fd, buf, MQL_UNIX_FRAME_MAX, 0);
+	if ( n < 0 && errno == EINTR )
+	    continue;
+	if ( n <= 0 )
+	    break;
+	if ( buf[0] != MQL_UNIX_PUBLISH )
+	    continue;
+
+	buf[n] = '\0';
+	topic = buf + 1;
+	tlen = strnlen(topic, n - 1);
+	if ( tlen == (size_t)(n - 1) )
+	    continue;			/* No end of topic */
+	if ( u->tp.on_message )
+	    u->tp.on_message(&u->tp,u->tp.obj,topic,
+			     topic + tlen + 1, n - 2 - tlen);
+    }
+
+    free(buf);
+    if ( !u->closing && u->tp.on_disconnect )
+	u->tp.on_disconnect(&u->tp,u->tp.obj,-1);
+    return 0;
+}
+
+
+static int
+mql_tp_unix_loop_start(mql_transport_t* tp)
+{
+    mql_tp_unix_t* u = (mql_tp_unix_t*)tp;
+    if ( u->fd < 0 || u->running )
+	return -1;
+    if ( pthread_create(&u->tid, 0, mql_tp_unix_reader, u) )
+	return -1;
+    u->running = 1;
+    return 0;
+}
+
+
+static int
+mql_tp_unix_send(mql_tp_unix_t* u, char type, const char* topic,
+		 int len, const void* payload, int flags)
+{
+    struct iovec iov[3];
+    struct msghdr mh;
+    size_t tlen = strlen(topic) + 1;
+
+    if ( u->fd < 0 || len < 0 || tlen > MQL_TOPIC_MAX_LEN
+	 || 1 + tlen + len > MQL_UNIX_FRAME_MAX )
+	return -1;
+
+    iov[0].iov_base = &type;
+    iov[0].iov_len = 1;
+    iov[1].iov_base = (void*)topic;
+    iov[1].iov_len = tlen;
+    iov[2].iov_base = (void*)payload;
+    iov[2].iov_len = len;
+    memset( &mh, 0, sizeof(mh) );
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 3;
+
+    while ( sendmsg(u->fd, &mh, flags | MSG_NOSIGNAL) < 0 ) {
+	if ( errno != EINTR )
+	    return -1;
+    }
+    return 0;
+}
+
+static int
+mql_tp_unix_publish(mql_transport_t* tp, const char* topic,
+		    int len, const void* payload, int qos, int retain)
+{
+    return mql_tp_unix_send((mql_tp_unix_t*)tp, MQL_UNIX_PUBLISH,
+			    topic, len, payload, MSG_DONTWAIT);
+}
+
+static int
+mql_tp_unix_subscribe(mql_transport_t* tp, const char* filter)
+{
+    return mql_tp_unix_send((mql_tp_unix_t*)tp, MQL_UNIX_SUBSCRIBE,
+			    filter, 0, "", 0);
+}
+
+static void
+mql_tp_unix_destroy(mql_transport_t* tp)
+{
+    mql_tp_unix_t* u = (mql_tp_unix_t*)tp;
+    u->closing = 1;
+    if ( u->fd >= 0 )
+	shutdown(u->fd, SHUT_RDWR);
+    if ( u->running )
+	pthread_join(u->tid, 0);
+    if ( u->fd >= 0 )
+	close(u->fd);
+    free(u);
+}
+
+
+static const mql_tp_ops_t mql_tp_unix_ops = {
+    "unix",
+    mql_tp_unix_connect,
+    mql_tp_unix_loop_start,
+    mql_tp_unix_publish,
+    mql_tp_unix_subscribe,
+    mql_tp_unix_destroy
+};
+
+
+mql_transport_t*
+mql_tp_unix_new(const char* arg)
+{
+    mql_tp_unix_t* u;
+    const char* path = arg ? arg : MQL_UNIX_PATH;
+
+    if ( strlen(path) >= sizeof(u->addr.sun_path) )
+	return 0;
+    u = calloc(1,sizeof(mql_tp_unix_t));
+    if ( !u )
+	return 0;
+    u->tp.ops = &mql_tp_unix_ops;
+    u->fd = -1;
+    u->addr.sun_family = AF_UNIX;
+    strcpy( u->addr.sun_path, path );
+    return &u->tp;
+}
+
+
+int
+mql_unix_unlink_stale(const char* path, int type)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd, err;
+
+    if ( lstat(path, &st) )
+	return errno == ENOENT ? 0 : -1;
+    if ( !S_ISSOCK(st.st_mode) ) {
+	errno = EEXIST;
+	return -1;
+    }
+    if ( strlen(path) >= sizeof(addr.sun_path) ) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+
+    /* Only one that nobody answers on is left over. */
+    fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if ( fd < 0 )
+	return -1;
+    err = connect(fd, (struct sockaddr*)&addr, sizeof(addr)) ? errno : 0;
+    close(fd);
+    if ( err == ECONNREFUSED )
+	return unlink(path);
+    errno = err ? err : EADDRINUSE;
+    return -1;
+}
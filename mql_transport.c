@@ -0,0 +1,139 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_transport.c
+ * Description     : Mqtt Logging, pluggable transport
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:17:28 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:21:41 2026
+ * Update Count    : 2
+ */
+
+#include "mql.h"
+#include "mql_int.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+mql_transport_t*
+mql_transport_new(const char* spec)
+{
+    const char* arg = 0;
+    size_t n;
+
+    if ( !spec || !*spec )
+	spec = getenv("MQL_TRANSPORT");
+    if ( !spec || !*spec )
+	spec = "mqtt";
+
+    n = strcspn(spec,":");
+    if ( spec[n] == ':' ) {
+	arg = spec + n + 1;
+	if ( !*arg )
+	    arg = 0;
+    }
+
+    if ( n == 4 && !strncmp(spec,"mqtt",4) )
+	return mql_tp_mosquitto_new(arg);
+    if ( n == 4 && !strncmp(spec,"loop",4) )
+	return mql_tp_loop_new(arg);
+    if ( n == 4 && !strncmp(spec,"unix",4) )
+	return mql_tp_unix_new(arg);
+    if ( n == 3 && !strncmp(spec,"shm",3) )
+	return mql_tp_shm_new(arg);
+    return 0;
+}
+
+
+const char*
+mql_transport_name(const mql_transport_t* tp)
+{
+    return tp->ops->name;
+}
+
+
+void
+mql_transport_callbacks(mql_transport_t* tp,
+			mql_tp_connect_cb_t on_connect,
+			mql_tp_connect_cb_t on_disconnect,
+			mql_tp_message_cb_t on_message,
+			void* obj)
+{
+    tp->on_connect = on_connect;
+    tp->on_disconnect = on_disconnect;
+    tp->on_message = on_message;
+    tp->obj = obj;
+}
+
+
+int
+mql_transport_connect(mql_transport_t* tp, const char* host, int port)
+{
+    return tp->ops->connect(tp,host,port);
+}
+
+
+int
+mql_transport_loop_start(mql_transport_t* tp)
+{
+    return tp->ops->loop_start(tp);
+}
+
+
+int
+mql_transport_publish(mql_transport_t* tp, const char* topic,
+		      int len, const void* payload, int qos, int retain)
+{
+    return tp->ops->publish(tp,topic,len,payload,qos,retain);
+}
+
+
+int
+mql_transport_subscribe(mql_transport_t* tp, const char* filter)
+{
+    return tp->ops->subscribe(tp,filter);
+}
+
+
+void
+mql_transport_destroy(mql_transport_t* tp)
+{
+    if ( tp )
+	tp->ops->destroy(tp);
+}
+
+
+int
+mql_topic_match(const char* f, const char* t)
+{
+    for (;;) {
+	if ( *f == '#' )
+	    return 1;			/* Matches rest, also parent level */
+	if ( *f == '+' ) {
+	    ++f;
+	    while ( *t && *t != '/' )
+		++t;
+	}
+	else {
+	    while ( *f && *f != '/' ) {
+		if ( *f != *t )
+		    return 0;
+		++f;
+		++t;
+	    }
+	    if ( *t && *t != '/' )
+		return 0;
+	}
+	/* Both at end of a level. */
+	if ( !*f )
+	    return !*t;
+	if ( !*t )
+	    return !strcmp(f,"/#");	/* "a/#" matches "a" */
+	++f;
+	++t;
+    }
+}
@@ -0,0 +1,98 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_transport.h
+ * Description     : Mqtt Logging, pluggable transport
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:17:28 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:21:41 2026
+ * Update Count    : 2
+ */
+
+#ifndef __MQL_TRANSPORT_H__
+#define __MQL_TRANSPORT_H__ (1)
+
+/*
+ * Publish/subscribe transport used by the library and the mql tools.
+ *
+ * Selected at runtime by a spec string:
+ *	mqtt[://<host>[:<port>]]	libmosquitto (default)
+ *	loop				In-process loopback, all "loop"
+ *					transports of a process see each other
+ *	unix[:<path>]			Unix-domain socket to "mql hub" on
+ *					the same host (default MQL_UNIX_PATH)
+ *	shm[:<name>]			Shared-memory rings in /dev/shm on
+ *					the same host (default MQL_SHM_NAME)
+ * A NULL or empty spec means $MQL_TRANSPORT, or "mqtt" if unset.
+ *
+ * Topic filters use the MQTT wildcards '+' and '#' on all transports.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQL_UNIX_PATH	"/tmp/mql.sock"
+#define MQL_SHM_NAME	"mql"
+
+typedef struct mql_transport mql_transport_t;
+
+// Called when connected (result 0) or disconnected (result != 0).
+typedef void (*mql_tp_connect_cb_t)(mql_transport_t* tp, void* obj,
+				    int result);
+
+// Called for each received message.  The payload is always '\0'
+// terminated at len.  Both are only valid during the call.
+typedef void (*mql_tp_message_cb_t)(mql_transport_t* tp, void* obj,
+				    const char* topic,
+				    const void* payload, int len);
+
+// Create a transport from a spec, see above.
+//	RETURNS	transport, or 0 on error (bad spec, no memory)
+mql_transport_t* mql_transport_new(const char* spec);
+
+// Name of the backend, "mqtt", "loop", "unix" or "shm".
+const char* mql_transport_name(const mql_transport_t* tp);
+
+// Set callbacks, any may be 0.  Call before mql_transport_connect().
+void mql_transport_callbacks(mql_transport_t* tp,
+			     mql_tp_connect_cb_t on_connect,
+			     mql_tp_connect_cb_t on_disconnect,
+			     mql_tp_message_cb_t on_message,
+			     void* obj);
+
+// Connect.  host and port override the spec when set (mqtt only).
+//	RETURNS	0	OK
+//		-1	Error
+int mql_transport_connect(mql_transport_t* tp, const char* host, int port);
+
+// Start delivering messages and callbacks from a transport thread.
+//	RETURNS	0	OK
+//		-1	Error
+int mql_transport_loop_start(mql_transport_t* tp);
+
+// Publish, may be called from any thread.
+//	RETURNS	0	OK
+//		-1	Error
+int mql_transport_publish(mql_transport_t* tp, const char* topic,
+			  int len, const void* payload, int qos, int retain);
+
+// Subscribe to a topic filter.
+//	RETURNS	0	OK
+//		-1	Error
+int mql_transport_subscribe(mql_transport_t* tp, const char* filter);
+
+// Disconnect, stop the transport thread and free.
+void mql_transport_destroy(mql_transport_t* tp);
+
+// Returns 1 if topic matches the MQTT topic filter, else 0.
+int mql_topic_match(const char* filter, const char* topic);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
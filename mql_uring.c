@@ -0,0 +1,262 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_uring.c
+ * Description     : Mqtt Logging, minimal io_uring wrapper
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:37:52 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:37:52 2026
+ * Update Count    : 1
+ */
+
+#include "mql_uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef MQL_NO_URING
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+struct mql_uring {
+    int		fd;
+    void*	sq_map;
+    size_t	sq_map_len;
+    void*	cq_map;
+    size_t	cq_map_len;
+    struct io_uring_sqe* sqes;
+    size_t	sqes_len;
+
+    unsigned*	sq_head;
+    unsigned*	sq_tail;
+    unsigned	sq_mask;
+    unsigned*	sq_array;
+    unsigned*	cq_head;
+    unsigned*	cq_tail;
+    unsigned	cq_mask;
+    struct io_uring_cqe* cqes;
+
+    unsigned	sq_entries;
+    unsigned	queued;			/* Not yet submitted */
+};
+
+
+mql_uring_t*
+mql_uring_new(unsigned entries)
+{
+    struct io_uring_params p;
+    mql_uring_t* r;
+    int err;
+
+    r = calloc(1,sizeof(mql_uring_t));
+    if ( !r )
+	return 0;
+    memset( &p, 0, sizeof(p) );
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if ( r->fd < 0 ) {
+	free(r);
+	return 0;
+    }
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_map = mmap(0, r->sq_map_len, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_map = mmap(0, r->cq_map_len, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(0, r->sqes_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if ( r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED
+	 || r->sqes == MAP_FAILED ) {
+	err = errno;
+	if ( r->sq_map != MAP_FAILED )
+	    munmap( r->sq_map, r->sq_map_len );
+	if ( r->cq_map != MAP_FAILED )
+	    munmap( r->cq_map, r->cq_map_len );
+	if ( r->sqes != MAP_FAILED )
+	    munmap( r->sqes, r->sqes_len );
+	close(r->fd);
+	free(r);
+	errno = err;
+	return 0;
+    }
+
+    r->sq_head = (unsigned*)((char*)r->sq_map + p.sq_off.head);
+    r->sq_tail = (unsigned*)((char*)r->sq_map + p.sq_off.tail);
+    r->sq_mask = *(unsigned*)((char*)r->sq_map + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)((char*)r->sq_map + p.sq_off.array);
+    r->cq_head = (unsigned*)((char*)r->cq_map + p.cq_off.head);
+    r->cq_tail = (unsigned*)((char*)r->cq_map + p.cq_off.tail);
+    r->cq_mask = *(unsigned*)((char*)r->cq_map + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)((char*)r->cq_map + p.cq_off.cqes);
+    r->sq_entries = p.sq_entries;
+    return r;
+}
+
+void
+mql_uring_free(mql_uring_t* r)
+{
+    munmap( r->sqes, r->sqes_len );
+    munmap( r->cq_map, r->cq_map_len );
+    munmap( r->sq_map, r->sq_map_len );
+    close(r->fd);
+    free(r);
+}
+
+int
+mql_uring_fd(const mql_uring_t* r)
+{
+    return r->fd;
+}
+
+int
+mql_uring_register(mql_uring_t* r, const struct iovec* iov, unsigned n)
+{
+    return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS,
+		   iov, n) < 0 ? -1 : 0;
+}
+
+// Next free entry, cleared, or 0.
+static struct io_uring_sqe*
+uring_sqe(mql_uring_t* r, unsigned flags, uint64_t user_data)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail + r->queued;
+    struct io_uring_sqe* sqe;
+
+    if ( tail - head >= r->sq_entries )
+	return 0;
+    sqe = &r->sqes[ tail & r->sq_mask ];
+    memset( sqe, 0, sizeof(*sqe) );
+    sqe->flags = (flags & MQL_URING_LINK) ? IOSQE_IO_LINK : 0;
+    sqe->user_data = user_data;
+    r->sq_array[ tail & r->sq_mask ] = tail & r->sq_mask;
+    ++r->queued;
+    return sqe;
+}
+
+int
+mql_uring_write_fixed(mql_uring_t* r, int fd, const void* p,
+		      unsigned len, uint64_t off, unsigned buf,
+		      unsigned flags, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = uring_sqe(r, flags, user_data);
+    if ( !sqe )
+	return -1;
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)p;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->buf_index = buf;
+    return 0;
+}
+
+int
+mql_uring_fdatasync(mql_uring_t* r, int fd, unsigned flags,
+		    uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = uring_sqe(r, flags, user_data);
+    if ( !sqe )
+	return -1;
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    return 0;
+}
+
+int
+mql_uring_submit(mql_uring_t* r, unsigned wait_nr)
+{
+    unsigned n = r->queued;
+    int k;
+
+    if ( n )
+	__atomic_store_n(r->sq_tail, *r->sq_tail + n, __ATOMIC_RELEASE);
+    r->queued = 0;
+    while ( n || wait_nr ) {
+	k = syscall(__NR_io_uring_enter, r->fd, n, wait_nr,
+		    wait_nr ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+	if ( k < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    return -1;
+	}
+	n -= (unsigned)k < n ? (unsigned)k : n;
+	wait_nr = 0;
+    }
+    return 0;
+}
+
+int
+mql_uring_complete(mql_uring_t* r, uint64_t* user_data, int* res)
+{
+    unsigned head = *r->cq_head;
+    struct io_uring_cqe* cqe;
+
+    if ( head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) )
+	return 0;
+    cqe = &r->cqes[ head & r->cq_mask ];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#else /* MQL_NO_URING */
+
+mql_uring_t*
+mql_uring_new(unsigned entries)
+{
+    errno = ENOSYS;
+    return 0;
+}
+
+void mql_uring_free(mql_uring_t* r) {}
+int mql_uring_fd(const mql_uring_t* r) { return -1; }
+
+int
+mql_uring_register(mql_uring_t* r, const struct iovec* iov, unsigned n)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+mql_uring_write_fixed(mql_uring_t* r, int fd, const void* p,
+		      unsigned len, uint64_t off, unsigned buf,
+		      unsigned flags, uint64_t user_data)
+{
+    return -1;
+}
+
+int
+mql_uring_fdatasync(mql_uring_t* r, int fd, unsigned flags,
+		    uint64_t user_data)
+{
+    return -1;
+}
+
+int
+mql_uring_submit(mql_uring_t* r, unsigned wait_nr)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+mql_uring_complete(mql_uring_t* r, uint64_t* user_data, int* res)
+{
+    return 0;
+}
+
+#endif /* MQL_NO_URING */
@@ -0,0 +1,71 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mql_uring.h
+ * Description     : Mqtt Logging, minimal io_uring wrapper
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:37:52 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:37:52 2026
+ * Update Count    : 1
+ */
+
+#ifndef __MQL_URING_H__
+#define __MQL_URING_H__ (1)
+
+/*
+ * Just what the store writer needs from io_uring, on the raw system
+ * calls so there is no liburing to depend on.  One thread per ring.
+ *
+ * Built without io_uring when MQL_NO_URING is defined, then
+ * mql_uring_new() fails with ENOSYS.
+ */
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mql_uring mql_uring_t;
+
+#define MQL_URING_LINK	(1)		/* Next op starts when this is done */
+
+// Set up a ring for entries ops in flight.
+//	RETURNS	ring, or 0 if io_uring is not there (errno set)
+mql_uring_t* mql_uring_new(unsigned entries);
+
+void mql_uring_free(mql_uring_t* r);
+
+// File descriptor of the ring, readable when there are completions.
+int mql_uring_fd(const mql_uring_t* r);
+
+// Register buffers for mql_uring_write_fixed(), index in iov[].
+int mql_uring_register(mql_uring_t* r, const struct iovec* iov, unsigned n);
+
+// Queue a write of registered buffer buf.
+//	RETURNS	0 OK, -1 ring full
+int mql_uring_write_fixed(mql_uring_t* r, int fd, const void* p,
+			  unsigned len, uint64_t off, unsigned buf,
+			  unsigned flags, uint64_t user_data);
+
+// Queue an fdatasync().
+int mql_uring_fdatasync(mql_uring_t* r, int fd, unsigned flags,
+			uint64_t user_data);
+
+// Submit what is queued, then wait for at least wait_nr completions.
+//	RETURNS	0 OK, -1 on error (errno set)
+int mql_uring_submit(mql_uring_t* r, unsigned wait_nr);
+
+// Take a completion.
+//	RETURNS	1 and user_data and res set, 0 if there is none
+int mql_uring_complete(mql_uring_t* r, uint64_t* user_data, int* res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,645 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mqlagent.c
+ * Description     : Mqtt Logging, host-local aggregation agent
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:24:08 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:04:54 2026
+ * Update Count    : 3
+ */
+
+
+/*
+ * mqlagent accepts the processes of a host on a Unix-domain socket, with
+ * the framing of the unix transport (see mql_int.h), and forwards their
+ * messages to the broker over a few connections instead of one per
+ * process.
+ *
+ * Log messages are collected per topic, that is per source and severity,
+ * and published as one batch message on <topic>/batch (see mql.h) when
+ * the batch is full or has waited long enough.  A batch with a single
+ * message is published as the message itself.  All messages of a source
+ * use the same upstream connection, so they stay in order.
+ *
+ * Other messages, e.g. commands from "mql level", go upstream at once.
+ * Subscriptions of local processes are made upstream on their behalf
+ * and incoming messages are relayed to the processes that match, which
+ * is how level and count commands reach them.
+ *
+ * Processes connect with MQL_TRANSPORT=unix[:<path>].
+ */
+
+#include "mql.h"
+#include "mql_int.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+
+int opt_d = 0;
+#define DD if(opt_d)printf
+
+#define STR_MAX (80)
+char mqtt_host[ STR_MAX ];		/* Empty: from the transport spec */
+
+int mqtt_port;				/* 0: from the transport spec */
+
+char transport_spec[ STR_MAX ];		/* Upstream, empty: $MQL_TRANSPORT */
+char socket_path[ STR_MAX ] = MQL_UNIX_PATH;
+
+#define AGENT_CLIENTS_MAX	(1024)
+#define AGENT_FILTERS_MAX	(16)
+#define AGENT_UP_MAX		(16)
+#define AGENT_UP_FILTERS_MAX	(256)
+#define AGENT_BATCHES_MAX	(4096)		/* Sources x severities */
+#define AGENT_BATCH_HASH	(2 * AGENT_BATCHES_MAX)
+
+unsigned opt_c = 1;				/* Upstream connections */
+unsigned opt_b = 16384;				/* Batch bytes */
+unsigned opt_w = 20;				/* Batch wait, ms */
+
+
+typedef struct {
+    int		fd;
+    unsigned	n_filters;
+    char	filter[ AGENT_FILTERS_MAX ][ MQL_TOPIC_MAX_LEN ];
+    unsigned long dropped;
+} agent_client_t;
+
+typedef struct {
+    char	topic[ MQL_TOPIC_MAX_LEN ];	/* <prefix>/log/<id>/<sev> */
+    unsigned	up;
+    char*	buf;				/* Records, opt_b bytes */
+    int		len;
+    unsigned	n;
+    uint64_t	first_ms;			/* Oldest record */
+    int		queued;				/* In pending[] */
+} agent_batch_t;
+
+
+/* Clients: changed by the main thread, read by upstream threads. */
+static pthread_mutex_t agent_mtx = PTHREAD_MUTEX_INITIALIZER;
+static agent_client_t* client[ AGENT_CLIENTS_MAX ];
+static struct pollfd client_pfd[ AGENT_CLIENTS_MAX + 1 ];
+static unsigned n_clients = 0;
+
+/* Upstream subscriptions, union of all clients'. */
+static char up_filter[ AGENT_UP_FILTERS_MAX ][ MQL_TOPIC_MAX_LEN ];
+static unsigned n_up_filters = 0;
+
+static mql_transport_t* up[ AGENT_UP_MAX ];
+
+/* Batches, main thread only. */
+static agent_batch_t* batch_hash[ AGENT_BATCH_HASH ];
+static unsigned n_batches = 0;
+static agent_batch_t* pending[ AGENT_BATCHES_MAX ];
+static unsigned n_pending = 0;
+
+static unsigned long st_records = 0;	/* Log messages in */
+static unsigned long st_other = 0;	/* Other messages in */
+static unsigned long st_batches = 0;	/* Batch messages out */
+static unsigned long st_single = 0;	/* Single messages out */
+static unsigned long st_up_failed = 0;
+static unsigned long st_relayed = 0;	/* Upstream to clients */
+static unsigned long st_dropped = 0;
+
+static volatile sig_atomic_t agent_stop = 0;
+
+
+void
+do_help(const char* msg)
+{
+    if ( msg )
+	printf("Error: %s\n", msg);
+    printf(
+"mqlagent [-h host] [-p port] [-t transport] [-s path] [<options>]\n"
+"	-t <transport>	Upstream, mqtt[://host[:port]] or unix[:path] (mqtt).\n"
+"	-s <path>	Socket for local processes (" MQL_UNIX_PATH ").\n"
+"	-c <n>		Upstream connections (1).\n"
+"	-b <bytes>	Max batch size (16384).\n"
+"	-w <ms>		Max time a message waits in a batch (20).\n"
+	   );
+    exit(0);
+}
+
+
+static uint64_t
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+
+static int
+send_frame(int fd, char type, const char* topic,
+	   int len, const void* payload, int flags)
+{
+    struct iovec iov[3];
+    struct msghdr mh;
+
+    iov[0].iov_base = &type;
+    iov[0].iov_len = 1;
+    iov[1].iov_base = (void*)topic;
+    iov[1].iov_len = strlen(topic) + 1;
+    iov[2].iov_base = (void*)payload;
+    iov[2].iov_len = len;
+    memset( &mh, 0, sizeof(mh) );
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 3;
+    return sendmsg(fd, &mh, flags | MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+
+/*
+ * Upstream
+ */
+
+static void
+up_publish(unsigned i, const char* topic, int len, const void* payload)
+{
+    if ( mql_transport_publish(up[i], topic, len, payload, 0, 0) )
+	++st_up_failed;
+}
+
+
+// Message from the broker, relay to matching clients.  Upstream thread.
+static void
+up_message_cb(mql_transport_t* tp, void* obj,
+	      const char* topic, const void* payload, int len)
+{
+    unsigned i, j;
+
+    if ( 1 + strlen(topic) + 1 + len > MQL_UNIX_FRAME_MAX )
+	return;
+    pthread_mutex_lock( &agent_mtx );
+    for ( i = 0; i < n_clients; ++i ) {
+	agent_client_t* c = client[i];
+	for ( j = 0; j < c->n_filters; ++j ) {
+	    if ( mql_topic_match(c->filter[j],topic) ) {
+		if ( send_frame(c->fd, MQL_UNIX_PUBLISH, topic, len, payload,
+				MSG_DONTWAIT) ) {
+		    ++c->dropped;
+		    ++st_dropped;
+		}
+		else
+		    ++st_relayed;
+		break;
+	    }
+	}
+    }
+    pthread_mutex_unlock( &agent_mtx );
+}
+
+
+// (Re)connected: make the subscriptions again.
+static void
+up_connect_cb(mql_transport_t* tp, void* obj, int result)
+{
+    unsigned i;
+    DD ("upstream %ld: connected %d\n", (long)(intptr_t)obj, result);
+    if ( result )
+	return;
+    pthread_mutex_lock( &agent_mtx );
+    for ( i = 0; i < n_up_filters; ++i )
+	mql_transport_subscribe(tp, up_filter[i]);
+    pthread_mutex_unlock( &agent_mtx );
+}
+
+
+static void
+up_disconnect_cb(mql_transport_t* tp, void* obj, int result)
+{
+    printf("Upstream %ld disconnected: %d\n", (long)(intptr_t)obj, result);
+}
+
+
+static void
+up_init()
+{
+    unsigned i;
+    for ( i = 0; i < opt_c; ++i ) {
+	up[i] = mql_transport_new(transport_spec);
+	if ( !up[i] ) {
+	    printf("Bad transport: \"%s\"\n", transport_spec);
+	    exit( EXIT_FAILURE );
+	}
+	/* Only the first connection subscribes and relays. */
+	mql_transport_callbacks(up[i], i ? 0 : up_connect_cb,
+				up_disconnect_cb,
+				i ? 0 : up_message_cb, (void*)(intptr_t)i);
+	if ( mql_transport_connect(up[i], mqtt_host, mqtt_port) ) {
+	    perror("mql_transport_connect: ");
+	    exit( EXIT_FAILURE );
+	}
+	if ( mql_transport_loop_start(up[i]) ) {
+	    fprintf(stderr, "Error: %s\n", "Can not start transport");
+	    exit( EXIT_FAILURE );
+	}
+    }
+}
+
+
+/*
+ * Batches
+ */
+
+static void
+batch_flush(agent_batch_t* b)
+{
+    char topic[ MQL_TOPIC_MAX_LEN + 8 ];
+    const char* rec;
+    int rlen;
+    int pos = 0;
+
+    if ( !b->n )
+	return;
+    if ( b->n == 1 ) {
+	/* Alone, publish as it came. */
+	if ( mql_batch_next(b->buf, b->len, &pos, &rec, &rlen) > 0 )
+	    up_publish(b->up, b->topic, rlen, rec);
+	++st_single;
+    }
+    else {
+	snprintf( topic, sizeof(topic), "%s/%s", b->topic, MQL_BATCH_TAG );
+	up_publish(b->up, topic, b->len, b->buf);
+	++st_batches;
+    }
+    DD ("flush \"%s\": %u messages, %d bytes\n", b->topic, b->n, b->len);
+    b->n = 0;
+    b->len = 0;
+}
+
+
+// Flush batches that have waited opt_w ms, or all.
+//	RETURNS	ms until the next batch is due, -1 for none.
+static int
+batch_flush_due(int all)
+{
+    uint64_t now = now_ms();
+    int next = -1;
+    unsigned i = 0;
+
+    while ( i < n_pending ) {
+	agent_batch_t* b = pending[i];
+	uint64_t due = b->first_ms + opt_w;
+	if ( all || due <= now ) {
+	    batch_flush(b);
+	    b->queued = 0;
+	    pending[i] = pending[ --n_pending ];
+	    continue;
+	}
+	if ( next < 0 || (int)(due - now) < next )
+	    next = due - now;
+	++i;
+    }
+    return next;
+}
+
+
+static agent_batch_t*
+batch_lookup(const char* topic, const mql_fragment_t* id)
+{
+    unsigned h = 2166136261U;
+    unsigned i;
+    const char* p;
+
+    for ( p = topic; *p; ++p )
+	h = (h ^ (unsigned char)*p) * 16777619U;
+
+    for ( i = 0; i < AGENT_BATCH_HASH; ++i ) {
+	agent_batch_t** e = &batch_hash[ (h + i) % AGENT_BATCH_HASH ];
+	if ( !*e ) {
+	    unsigned k, hid = 2166136261U;
+	    if ( n_batches >= AGENT_BATCHES_MAX )
+		return 0;
+	    *e = calloc(1, sizeof(agent_batch_t));
+	    if ( !*e )
+		return 0;
+	    (*e)->buf = malloc(opt_b);
+	    if ( !(*e)->buf ) {
+		free(*e);
+		*e = 0;
+		return 0;
+	    }
+	    strcpy( (*e)->topic, topic );
+	    /* Connection by source, keeps its messages in order. */
+	    for ( k = 0; k < id->len; ++k )
+		hid = (hid ^ (unsigned char)id->ptr[k]) * 16777619U;
+	    (*e)->up = hid % opt_c;
+	    ++n_batches;
+	    return *e;
+	}
+	if ( !strcmp((*e)->topic, topic) )
+	    return *e;
+    }
+    return 0;
+}
+
+
+static void
+batch_add(const char* topic, const mql_fragment_t* id,
+	  const char* payload, int len)
+{
+    agent_batch_t* b = batch_lookup(topic, id);
+    char head[ 16 ];
+    int hlen;
+
+    ++st_records;
+    hlen = snprintf( head, sizeof(head), "%d:", len );
+    if ( !b || hlen + len + 1 > (int)opt_b ) {
+	/* No batch for it, send as is. */
+	up_publish(b ? b->up : 0, topic, len, payload);
+	++st_single;
+	return;
+    }
+
+    if ( b->len + hlen + len + 1 > (int)opt_b )
+	batch_flush(b);
+    if ( !b->n )
+	b->first_ms = now_ms();
+    if ( !b->queued ) {
+	b->queued = 1;
+	pending[ n_pending++ ] = b;
+    }
+    memcpy( b->buf + b->len, head, hlen );
+    memcpy( b->buf + b->len + hlen, payload, len );
+    b->buf[ b->len + hlen + len ] = ',';
+    b->len += hlen + len + 1;
+    ++b->n;
+}
+
+
+/*
+ * Local clients
+ */
+
+static void
+client_accept(int lfd)
+{
+    agent_client_t* c;
+    int fd = accept(lfd, 0, 0);
+    if ( fd < 0 )
+	return;
+    c = (n_clients < AGENT_CLIENTS_MAX) ? calloc(1,sizeof(agent_client_t)) : 0;
+    if ( !c ) {
+	close(fd);
+	return;
+    }
+    c->fd = fd;
+    pthread_mutex_lock( &agent_mtx );
+    client[ n_clients ] = c;
+    client_pfd[ n_clients + 1 ].fd = fd;
+    client_pfd[ n_clients + 1 ].events = POLLIN;
+    ++n_clients;
+    pthread_mutex_unlock( &agent_mtx );
+    DD ("client %d connected, %u clients\n", fd, n_clients);
+}
+
+
+static void
+client_close(unsigned i)
+{
+    agent_client_t* c = client[i];
+    DD ("client %d closed, %lu dropped\n", c->fd, c->dropped);
+    pthread_mutex_lock( &agent_mtx );
+    --n_clients;
+    client[i] = client[ n_clients ];
+    client_pfd[ i + 1 ] = client_pfd[ n_clients + 1 ];
+    pthread_mutex_unlock( &agent_mtx );
+    close(c->fd);
+    free(c);
+}
+
+
+static void
+client_subscribe(agent_client_t* c, const char* filter)
+{
+    unsigned i;
+
+    DD ("client %d subscribe \"%s\"\n", c->fd, filter);
+    pthread_mutex_lock( &agent_mtx );
+    if ( c->n_filters < AGENT_FILTERS_MAX )
+	strcpy( c->filter[ c->n_filters++ ], filter );
+    for ( i = 0; i < n_up_filters; ++i )
+	if ( !strcmp(up_filter[i], filter) )
+	    break;
+    if ( i == n_up_filters && n_up_filters < AGENT_UP_FILTERS_MAX ) {
+	strcpy( up_filter[ n_up_filters++ ], filter );
+	mql_transport_subscribe(up[0], filter);
+    }
+    pthread_mutex_unlock( &agent_mtx );
+}
+
+
+static void
+client_frame(agent_client_t* c, const char* frame, size_t n)
+{
+    mql_fragment_t frag[5];
+    const char* topic = frame + 1;
+    const char* payload;
+    size_t tlen;
+    int k;
+
+    if ( n < 2 )
+	return;
+    tlen = strnlen(topic, n - 1);
+    if ( tlen == n - 1 || tlen >= MQL_TOPIC_MAX_LEN )
+	return;				/* No end of topic, or too long */
+    payload = topic + tlen + 1;
+
+    switch ( frame[0] ) {
+    case MQL_UNIX_SUBSCRIBE:
+	client_subscribe(c, topic);
+	break;
+    case MQL_UNIX_PUBLISH:
+	// Log messages, <prefix>/log/<id>/<severity>, are batched.
+	k = mql_split(topic, frag, 5);
+	if ( k == 4 && frag[1].len == strlen(MQL_LOG_TAG)
+	     && !strncmp(frag[1].ptr, MQL_LOG_TAG, frag[1].len) ) {
+	    batch_add(topic, &frag[2], payload, n - 2 - tlen);
+	}
+	else {
+	    ++st_other;
+	    up_publish(0, topic, n - 2 - tlen, payload);
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+
+static void
+agent_signal(int sig)
+{
+    agent_stop = 1;
+}
+
+
+static void
+agent_run()
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    char* frame;
+    int lfd;
+
+    if ( strlen(socket_path) >= sizeof(addr.sun_path) )
+	do_help("Socket path too long.");
+
+    frame = malloc(MQL_UNIX_FRAME_MAX);
+    if ( !frame ) {
+	perror("malloc: ");
+	exit( EXIT_FAILURE );
+    }
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, socket_path );
+
+    lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if ( lfd < 0 ) {
+	perror("socket: ");
+	exit( EXIT_FAILURE );
+    }
+    if ( mql_unix_unlink_stale(socket_path, SOCK_SEQPACKET) ) {
+	fprintf(stderr, "mqlagent: %s: ", socket_path);
+	perror("");
+	exit( EXIT_FAILURE );
+    }
+    if ( bind(lfd, (struct sockaddr*)&addr, sizeof(addr))
+	 || listen(lfd, 64) ) {
+	perror("bind: ");
+	exit( EXIT_FAILURE );
+    }
+    DD ("listening on \"%s\"\n", socket_path);
+
+    /* No SA_RESTART, poll() returns on a signal. */
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_handler = agent_signal;
+    sigaction( SIGINT, &sa, 0 );
+    sigaction( SIGTERM, &sa, 0 );
+    signal( SIGPIPE, SIG_IGN );
+
+    client_pfd[0].fd = lfd;
+    client_pfd[0].events = POLLIN;
+
+    while ( !agent_stop ) {
+	unsigned i;
+	int timeout = batch_flush_due(0);
+	int n = poll(client_pfd, n_clients + 1, timeout);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("poll: ");
+	    exit( EXIT_FAILURE );
+	}
+
+	/* Backwards, client_close() moves the last client into the hole. */
+	for ( i = n_clients; i > 0; --i ) {
+	    agent_client_t* c = client[i-1];
+	    ssize_t len;
+	    if ( !client_pfd[i].revents )
+		continue;
+	    len = recv(c->fd, frame, MQL_UNIX_FRAME_MAX, MSG_DONTWAIT);
+	    if ( len > 0 )
+		client_frame(c, frame, len);
+	    else if ( len == 0 || (errno != EAGAIN && errno != EINTR) )
+		client_close(i-1);
+	}
+
+	if ( client_pfd[0].revents )
+	    client_accept(lfd);
+    }
+
+    batch_flush_due(1);
+    unlink( socket_path );
+    printf("records=%lu other=%lu batches=%lu single=%lu upstream-failed=%lu"
+	   " relayed=%lu dropped=%lu\n",
+	   st_records, st_other, st_batches, st_single, st_up_failed,
+	   st_relayed, st_dropped);
+}
+
+
+int
+main(int argc, const char** argv)
+{
+    unsigned i;
+
+    setbuf(stdout,0);
+
+    /* Decode arguments. */
+    --argc;
+    ++argv;
+
+    while ( argc ) {
+	const char* opt = *argv;
+	const char* arg;
+
+	if ( !strcmp(opt,"-d") )  {
+	    --argc;
+	    ++argv;
+	    ++opt_d;
+	    continue;
+	}
+	if ( !strcmp(opt,"-?") || !strcmp(opt,"--help") )
+	    do_help(0);
+
+	if ( *opt != '-' || strlen(opt) != 2 || !strchr("hptscbw",opt[1]) ) {
+	    printf("Bad option: %s\n",opt);
+	    do_help(0);
+	}
+	--argc;
+	++argv;
+	if ( !argc || !*argv ) {
+	    printf("Missing argument to %s option\n",opt);
+	    do_help(0);
+	}
+	arg = *argv;
+	--argc;
+	++argv;
+
+	switch ( opt[1] ) {
+	case 'h': strncpy( mqtt_host, arg, STR_MAX-1 );		break;
+	case 'p': mqtt_port = atoi( arg );			break;
+	case 't': strncpy( transport_spec, arg, STR_MAX-1 );	break;
+	case 's':
+	    if ( *arg == '-' )
+		do_help("Bad socket path.");
+	    strncpy( socket_path, arg, STR_MAX-1 );
+	    break;
+	case 'c': opt_c = strtoul( arg, 0, 0 );			break;
+	case 'b': opt_b = strtoul( arg, 0, 0 );			break;
+	case 'w': opt_w = strtoul( arg, 0, 0 );			break;
+	}
+    }
+
+    if ( !opt_c || opt_c > AGENT_UP_MAX )
+	do_help("Bad number of connections.");
+    if ( opt_b < 64 || opt_b > 65536 )
+	do_help("Batch size must be 64..65536.");
+
+    up_init();
+    agent_run();
+
+    for ( i = 0; i < opt_c; ++i )
+	mql_transport_destroy( up[i] );
+    return 0;
+}
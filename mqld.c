@@ -0,0 +1,713 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : mqld.c
+ * Description     : Mqtt Logging, receiver daemon writing logs to disk
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:32:23 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:04:54 2026
+ * Update Count    : 6
+ */
+
+
+/*
+ * mqld subscribes to <prefix>/log/# and appends every log message, or
+ * every record of a batch, to the segment files of a store directory
+ * (see mql_store.h).  The transport thread only copies the message into
+ * a buffer; a writer thread does the disk I/O and the group commit.
+ *
+ * mql tail is served on the tail socket of the store (see mql_serve.h),
+ * a thread per client following the store files.
+ *
+ * With -a a compactor thread turns segments into columnar files (see
+ * mql_col.h) once they have been closed for a while.  It also rewrites
+ * the columnar files without the records past their time to live (-k,
+ * -K), and those older than -P merged into larger files and compressed
+ * harder, and with -m removes the oldest files while the store is too
+ * large.  All its reading and writing is kept to -w KiB/s so that it
+ * leaves the disk to the writer.
+ */
+
+#include "mql.h"
+#include "mql_store.h"
+#include "mql_col.h"
+#include "mql_serve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+
+int opt_d = 0;
+#define DD if(opt_d)printf
+
+#define STR_MAX (80)
+char mqtt_host[ STR_MAX ];		/* Empty: from the transport spec */
+
+int mqtt_port;				/* 0: from the transport spec */
+
+char transport_spec[ STR_MAX ];		/* Empty: $MQL_TRANSPORT */
+char my_prefix[ MQL_PREFIX_MAX_LEN ];
+char store_dir[ STR_MAX ] = ".";
+
+static mql_store_conf_t conf;
+static mql_store_t* store;
+static char log_filter[ MQL_TOPIC_MAX_LEN ];
+
+static unsigned long st_messages = 0;	/* Transport thread only */
+static unsigned long st_other = 0;
+static unsigned long st_compacted = 0;	/* Compactor thread only */
+static unsigned long st_packed = 0;	/* Files rewritten */
+static unsigned long st_dropped = 0;	/* Records past their ttl */
+static unsigned long st_removed = 0;	/* Files over -m */
+
+static unsigned compact_min = 0;	/* -a, 0 no compaction */
+static uint64_t pack_ns = 86400000000000ULL;	/* -P, 0 never */
+static uint64_t disk_max = 0;		/* -m, bytes, 0 no limit */
+static mql_col_opt_t col_opt = { 0, 16384 * 1024 };	/* -w */
+
+/* Time to live of the records of a severity, -k, 0 for ever. */
+static uint64_t ttl_sev[ MQL_S_MAX ];
+static int ttl_sev_set[ MQL_S_MAX ];
+
+/* And of a source, -K, the shorter applies. */
+#define TTL_SOURCES	(64)
+typedef struct {
+    char	id[ MQL_ID_MAX_LEN ];
+    unsigned	len;
+    uint64_t	ns;
+} mqld_ttl_t;
+static mqld_ttl_t ttl_src[ TTL_SOURCES ];
+static unsigned n_ttl_src = 0;
+
+/* Files left as they were, not looked at again for a while. */
+#define IDLE_FILES	(256)
+#define IDLE_NS		(3600000000000ULL)
+static struct {
+    uint64_t	seq;
+    uint64_t	until;
+} idle[ IDLE_FILES ];
+static unsigned n_idle = 0;
+
+static volatile sig_atomic_t mqld_stop = 0;
+
+
+void
+do_help(const char* msg)
+{
+    if ( msg )
+	printf("Error: %s\n", msg);
+    printf(
+"mqld [-h host] [-p port] [-x prefix] [-t transport] [-o dir] [<options>]\n"
+"	-t <transport>	mqtt[://host[:port]], loop, unix[:path], shm[:name].\n"
+"	-o <dir>	Store directory (.).\n"
+"	-c <ms>		Group commit interval, 0 = sync every message (100).\n"
+"	-b <KiB>	Write size (1024).\n"
+"	-s <MiB>	Rotate segments at this size (64).\n"
+"	-r <seconds>	Rotate segments at this age (3600).\n"
+"	-i <io>		uring or write, uring falls back to write (uring).\n"
+"	-D		O_DIRECT, -b a multiple of 4 KiB.\n"
+"	-a <minutes>	Compact segments closed this long, 0 = never (0).\n"
+"	-k <sev>=<age>	Drop records of severity <sev> (0-f) and up this old.\n"
+"	-K <src>=<age>	Drop records of source <src> this old.\n"
+"	-P <age>	Merge and pack columnar files this old, 0 = never (1d).\n"
+"		<age>	<n>[mhd], days without a unit.\n"
+"	-m <MiB>	Remove the oldest files above this store size (0 = no limit).\n"
+"	-w <KiB/s>	Compaction I/O rate, 0 = no limit (16384).\n"
+	   );
+    exit(0);
+}
+
+
+void
+set_prefix(const char* p)
+{
+    if ( p && *p ) {
+	strncpy( my_prefix, p, MQL_PREFIX_MAX_LEN-1 );
+    }
+    else {
+	char* s = getenv("MQL_PREFIX");
+	if ( s ) {
+	    strncpy( my_prefix, s, MQL_PREFIX_MAX_LEN-1 );
+	}
+	else {
+	    strncpy( my_prefix, "mql", MQL_PREFIX_MAX_LEN-1 );
+	}
+    }
+    DD ("prefix=\"%s\"\n",my_prefix);
+}
+
+
+static void
+mqld_message_cb(mql_transport_t* tp, void* obj,
+		const char* topic, const void* payload, int len)
+{
+    ++st_messages;
+    if ( mql_store_message(store, topic, payload, len) < 0 ) {
+	++st_other;
+	DD ("not a log message: \"%s\"\n", topic);
+    }
+}
+
+static void
+mqld_connect_cb(mql_transport_t* tp, void* obj, int result)
+{
+    DD ("connected %d, subscribe \"%s\"\n", result, log_filter);
+    if ( !result )
+	mql_transport_subscribe(tp, log_filter);
+}
+
+static void
+mqld_disconnect_cb(mql_transport_t* tp, void* obj, int result)
+{
+    printf("Disconnected: %d\n", result);
+}
+
+// An age of an option, <n>[mhd], as ns.
+static uint64_t
+mqld_age(const char* s)
+{
+    unsigned long long n;
+    char unit = 'd', c;
+    int k = sscanf(s, "%llu%c%c", &n, &unit, &c);
+
+    if ( (k != 1 && k != 2) || !strchr("mhd",unit) )
+	do_help("Bad age.");
+    n *= unit == 'm' ? 60 : unit == 'h' ? 3600 : 86400;
+    return n * 1000000000ULL;
+}
+
+// A -k or -K option, <what>=<age>.
+static void
+mqld_ttl(const char* opt, const char* arg)
+{
+    const char* eq = strrchr(arg, '=');
+    unsigned len = eq ? eq - arg : 0;
+
+    if ( !len )
+	do_help("Time to live is <what>=<age>.");
+    if ( opt[1] == 'k' ) {
+	unsigned v;
+	if ( len != 1 || !strchr("0123456789abcdef", *arg) )
+	    do_help("Severity is 0-f.");
+	v = *arg <= '9' ? *arg - '0' : *arg - 'a' + 10;
+	ttl_sev[v] = mqld_age(eq + 1);
+	ttl_sev_set[v] = 1;
+    }
+    else {
+	if ( n_ttl_src == TTL_SOURCES || len >= MQL_ID_MAX_LEN )
+	    do_help("Too many or too long -K sources.");
+	memcpy( ttl_src[ n_ttl_src ].id, arg, len );
+	ttl_src[ n_ttl_src ].len = len;
+	ttl_src[ n_ttl_src++ ].ns = mqld_age(eq + 1);
+    }
+}
+
+// Time to live of a source, 0 for ever.
+static uint64_t
+mqld_ttl_source(const char* id, unsigned len)
+{
+    unsigned i;
+
+    for ( i = 0; i < n_ttl_src; ++i )
+	if ( ttl_src[i].len == len && !memcmp(ttl_src[i].id, id, len) )
+	    return ttl_src[i].ns;
+    return 0;
+}
+
+typedef struct {
+    uint64_t	now;
+    const char*	id;			/* Of the last record, in the file */
+    uint64_t	id_ttl;
+} mqld_keep_t;
+
+// Whether a rewrite keeps a record, mql_col_keep_t.
+static int
+mqld_keep(void* arg, const char* id, unsigned len, unsigned sev, uint64_t ts)
+{
+    mqld_keep_t* k = arg;
+    uint64_t ttl = ttl_sev[ sev & 15 ];
+
+    if ( id != k->id ) {
+	k->id = id;
+	k->id_ttl = mqld_ttl_source(id, len);
+    }
+    if ( k->id_ttl && (!ttl || k->id_ttl < ttl) )
+	ttl = k->id_ttl;
+    return !ttl || ts + ttl > k->now;
+}
+
+static uint64_t
+mqld_now(void)
+{
+    struct timespec now;
+    clock_gettime( CLOCK_REALTIME, &now );
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Compact the segments closed over compact_min ago, oldest first.  The
+// last one is still written.
+static void
+mqld_compact(void)
+{
+    char path[ 4096 ];
+    char** names;
+    mql_seg_t seg;
+    uint64_t closed, now;
+    int n, i;
+
+    n = mql_seg_list(store_dir, &names);
+    if ( n < 0 )
+	return;
+    now = mqld_now();
+    for ( i = 0; i + 1 < n && !mqld_stop; ++i ) {
+	/* Closed when the next one was created. */
+	snprintf( path, sizeof(path), "%s/%s", store_dir, names[i+1] );
+	if ( mql_seg_open(&seg, path) )
+	    continue;
+	closed = seg.hdr->created_ns;
+	mql_seg_close(&seg);
+	if ( closed + compact_min * 60000000000ULL > now )
+	    break;
+
+	snprintf( path, sizeof(path), "%s/%s", store_dir, names[i] );
+	if ( mql_col_compact(path, &col_opt) ) {
+	    fprintf(stderr, "%s: ", path);
+	    perror("compact");
+	    continue;
+	}
+	unlink(path);
+	strcpy( path + strlen(path) - strlen(MQL_SEG_SUFFIX), MQL_IDX_SUFFIX );
+	unlink(path);
+	++st_compacted;
+	DD ("compacted %s\n", names[i]);
+    }
+    mql_seg_list_free(names, n);
+}
+
+static int
+mqld_idle(uint64_t seq, uint64_t now)
+{
+    unsigned i;
+
+    for ( i = 0; i < n_idle; ++i )
+	if ( idle[i].seq == seq )
+	    return idle[i].until > now;
+    return 0;
+}
+
+// Leave a file alone for a while, the oldest note making room.
+static void
+mqld_set_idle(uint64_t seq, uint64_t now)
+{
+    unsigned i, old = 0;
+
+    for ( i = 0; i < n_idle && idle[i].seq != seq; ++i )
+	if ( idle[i].until < idle[old].until )
+	    old = i;
+    if ( i == n_idle && n_idle < IDLE_FILES )
+	++n_idle;
+    else if ( i == n_idle )
+	i = old;
+    idle[i].seq = seq;
+    idle[i].until = now + IDLE_NS;
+}
+
+// Whether a columnar file may have records past their time to live.
+static int
+mqld_expiring(const mql_col_t* col, uint64_t now)
+{
+    const mql_col_group_t* k;
+    unsigned g, v;
+    uint64_t ttl;
+
+    for ( g = 0; g < col->hdr->n_groups; ++g ) {
+	k = &col->groups[g];
+	for ( v = 0; v < MQL_S_MAX; ++v )
+	    if ( (k->sev_mask >> v & 1) && ttl_sev[v]
+		 && k->min_ts + ttl_sev[v] <= now )
+		return 1;
+    }
+    for ( v = 0; v < col->hdr->n_sources; ++v ) {
+	ttl = mqld_ttl_source(col->src[v], col->src_len[v]);
+	if ( ttl && col->hdr->min_ts + ttl <= now )
+	    return 1;
+    }
+    return 0;
+}
+
+// Rewrite the n columnar files of paths into the first.
+static void
+mqld_rewrite(char** paths, unsigned n, uint64_t first_seq, uint64_t now)
+{
+    mqld_keep_t keep = { now };
+    uint64_t kept, dropped;
+    unsigned i;
+    int r;
+
+    col_opt.pack = 1;
+    col_opt.keep = mqld_keep;
+    col_opt.arg = &keep;
+    r = mql_col_rewrite(paths, n, &col_opt, &kept, &dropped);
+    col_opt.pack = 0;
+    col_opt.keep = 0;
+    if ( r ) {
+	if ( r < 0 && errno != ECANCELED ) {
+	    fprintf(stderr, "%s: ", paths[0]);
+	    perror("rewrite");
+	}
+	if ( n == 1 || errno != ECANCELED )
+	    mqld_set_idle(first_seq, now);
+	return;
+    }
+    for ( i = kept ? 1 : 0; i < n; ++i )
+	unlink(paths[i]);
+    st_packed += n;
+    st_dropped += dropped;
+    DD ("rewrote %u files from %s, kept %llu dropped %llu\n", n, paths[0],
+	(unsigned long long)kept, (unsigned long long)dropped);
+}
+
+// Rewrite the columnar files with records past their time to live, and
+// merge and pack those older than pack_ns, runs of consecutive ones up to
+// a segment in size.  Packed files are left alone unless they expire or
+// are small.
+static void
+mqld_retain(void)
+{
+    char path[ 4096 ];
+    char** names;
+    char** run;
+    mql_col_t col;
+    uint64_t now = mqld_now();
+    uint64_t end = 0, run_end = 0, run_seq = 0, run_size = 0;
+    unsigned n_run = 0;
+    int n, i, due, run_due = 0;
+
+    n = mql_col_list(store_dir, &names);
+    if ( n < 0 )
+	return;
+    run = calloc(n + 1, sizeof(char*));
+    for ( i = 0; run && i <= n && !mqld_stop; ++i ) {
+	due = 0;
+	if ( i < n ) {
+	    snprintf( path, sizeof(path), "%s/%s", store_dir, names[i] );
+	    if ( mql_col_open(&col, path) )
+		continue;
+	    if ( col.hdr->first_seq < end ) {
+		/* Left over from a merge that was cut short. */
+		mql_col_close(&col);
+		unlink(path);
+		continue;
+	    }
+	    end = MQL_COL_END(col.hdr);
+	    if ( !mqld_idle(col.hdr->first_seq, now) ) {
+		int packed = col.hdr->flags & MQL_COL_PACKED;
+		int old = pack_ns && col.hdr->max_ts + pack_ns <= now;
+		/* 2 to be rewritten, 1 small enough to merge. */
+		due = mqld_expiring(&col, now) || (old && !packed) ? 2
+		    : old && col.size < conf.seg_max / 4;
+	    }
+	    if ( due && n_run && col.hdr->first_seq == run_end
+		 && run_size + col.size <= conf.seg_max ) {
+		/* Goes on the run. */
+		run[ n_run++ ] = strdup(path);
+		run_size += col.size;
+		run_end = end;
+		if ( due > run_due )
+		    run_due = due;
+		mql_col_close(&col);
+		continue;
+	    }
+	}
+
+	/* The run so far, unless one packed file with nothing to drop. */
+	if ( n_run > 1 || run_due == 2 )
+	    mqld_rewrite(run, n_run, run_seq, now);
+	while ( n_run )
+	    free(run[ --n_run ]);
+	if ( i == n )
+	    break;
+	if ( due ) {
+	    run[ n_run++ ] = strdup(path);
+	    run_seq = col.hdr->first_seq;
+	    run_size = col.size;
+	    run_end = end;
+	}
+	run_due = due;
+	mql_col_close(&col);
+    }
+    while ( run && n_run )
+	free(run[ --n_run ]);
+    free(run);
+    mql_seg_list_free(names, n);
+}
+
+// Size of a file of the store and, for a segment, of its index.
+static uint64_t
+mqld_size(const char* name)
+{
+    char path[ 4096 ];
+    struct stat sb;
+    uint64_t n = 0;
+    size_t l;
+
+    snprintf( path, sizeof(path), "%s/%s", store_dir, name );
+    if ( !stat(path, &sb) )
+	n += sb.st_size;
+    l = strlen(path);
+    if ( l > strlen(MQL_SEG_SUFFIX)
+	 && !strcmp(path + l - strlen(MQL_SEG_SUFFIX), MQL_SEG_SUFFIX) ) {
+	strcpy( path + l - strlen(MQL_SEG_SUFFIX), MQL_IDX_SUFFIX );
+	if ( !stat(path, &sb) )
+	    n += sb.st_size;
+    }
+    return n;
+}
+
+// Remove the oldest files, columnar or closed segments, while the store
+// is over disk_max.  The segment being written is kept however large.
+static void
+mqld_bound(void)
+{
+    char path[ 4096 ];
+    char** segs;
+    char** cols;
+    const char* name;
+    uint64_t total = 0, n;
+    int n_seg, n_col, i, j, c;
+
+    n_seg = mql_seg_list(store_dir, &segs);
+    if ( n_seg < 0 )
+	return;
+    n_col = mql_col_list(store_dir, &cols);
+    if ( n_col < 0 ) {
+	mql_seg_list_free(segs, n_seg);
+	return;
+    }
+    for ( i = 0; i < n_seg; ++i )
+	total += mqld_size(segs[i]);
+    for ( j = 0; j < n_col; ++j )
+	total += mqld_size(cols[j]);
+
+    /* Both in sequence order, never the last segment. */
+    for ( i = 0, j = 0; total > disk_max && !mqld_stop
+	      && (i + 1 < n_seg || j < n_col); ) {
+	c = i + 1 >= n_seg ? 1 : j == n_col ? -1 : strncmp(segs[i], cols[j], 16);
+	name = c <= 0 ? segs[i++] : cols[j++];
+	n = mqld_size(name);
+	snprintf( path, sizeof(path), "%s/%s", store_dir, name );
+	if ( unlink(path) ) {
+	    fprintf(stderr, "%s: ", path);
+	    perror("unlink");
+	    continue;
+	}
+	if ( c <= 0 ) {
+	    strcpy( path + strlen(path) - strlen(MQL_SEG_SUFFIX), MQL_IDX_SUFFIX );
+	    unlink(path);
+	}
+	total -= n < total ? n : total;
+	++st_removed;
+	printf("Removed %s, store over %llu MiB\n", name,
+	       (unsigned long long)(disk_max >> 20));
+    }
+    mql_seg_list_free(segs, n_seg);
+    mql_seg_list_free(cols, n_col);
+}
+
+static void*
+mqld_compactor(void* arg)
+{
+    unsigned s;
+
+    while ( !mqld_stop ) {
+	if ( compact_min ) {
+	    mqld_compact();
+	    mqld_retain();
+	}
+	if ( disk_max )
+	    mqld_bound();
+	for ( s = 0; s < 60 && !mqld_stop; ++s )
+	    sleep(1);
+    }
+    return 0;
+}
+
+static void
+mqld_signal(int sig)
+{
+    mqld_stop = 1;
+}
+
+
+int
+main(int argc, const char** argv)
+{
+    mql_transport_t* tp;
+    mql_store_stats_t st;
+    mql_serve_t* srv;
+    pthread_t compact_tid;
+    uint64_t ttl = 0;
+    int retain = 0;
+    unsigned i;
+
+    setbuf(stdout,0);
+    set_prefix(0);
+    mql_store_defaults(&conf);
+
+    /* Decode arguments. */
+    --argc;
+    ++argv;
+
+    while ( argc ) {
+	const char* opt = *argv;
+	const char* arg;
+
+	if ( !strcmp(opt,"-d") )  {
+	    --argc;
+	    ++argv;
+	    ++opt_d;
+	    continue;
+	}
+	if ( !strcmp(opt,"-D") )  {
+	    --argc;
+	    ++argv;
+	    conf.direct = 1;
+	    continue;
+	}
+	if ( !strcmp(opt,"-?") || !strcmp(opt,"--help") )
+	    do_help(0);
+
+	if ( *opt != '-' || strlen(opt) != 2 || !strchr("hpxtocbsriakKPmw",opt[1]) ) {
+	    printf("Bad option: %s\n",opt);
+	    do_help(0);
+	}
+	--argc;
+	++argv;
+	if ( !argc || !*argv ) {
+	    printf("Missing argument to %s option\n",opt);
+	    do_help(0);
+	}
+	arg = *argv;
+	--argc;
+	++argv;
+
+	switch ( opt[1] ) {
+	case 'h': strncpy( mqtt_host, arg, STR_MAX-1 );		break;
+	case 'p': mqtt_port = atoi( arg );			break;
+	case 'x': set_prefix( arg );				break;
+	case 't': strncpy( transport_spec, arg, STR_MAX-1 );	break;
+	case 'o': strncpy( store_dir, arg, STR_MAX-1 );		break;
+	case 'c': conf.commit_ms = strtoul( arg, 0, 0 );	break;
+	case 'b': conf.buf_size = strtoul( arg, 0, 0 ) * 1024;	break;
+	case 's': conf.seg_max = strtoul( arg, 0, 0 ) * 1024 * 1024; break;
+	case 'r': conf.seg_secs = strtoul( arg, 0, 0 );		break;
+	case 'a': compact_min = strtoul( arg, 0, 0 );		break;
+	case 'k':
+	case 'K': mqld_ttl( opt, arg );				break;
+	case 'P': pack_ns = mqld_age( arg );			break;
+	case 'm': disk_max = strtoull( arg, 0, 0 ) << 20;	break;
+	case 'w': col_opt.rate = strtoull( arg, 0, 0 ) * 1024;	break;
+	case 'i':
+	    if ( !strcmp(arg,"uring") )
+		conf.io = MQL_STORE_IO_URING;
+	    else if ( !strcmp(arg,"write") )
+		conf.io = MQL_STORE_IO_WRITE;
+	    else
+		do_help("Bad io, uring or write.");
+	    break;
+	}
+    }
+
+    if ( conf.buf_size < 4096 || conf.buf_size > 64 * 1024 * 1024 )
+	do_help("Write size must be 4..65536 KiB.");
+    if ( conf.seg_max < 2 * conf.buf_size )
+	do_help("Segments must hold at least two writes.");
+    if ( !conf.seg_secs )
+	do_help("Bad segment age.");
+    if ( conf.direct && conf.buf_size % MQL_STORE_ALIGN )
+	do_help("Write size must be a multiple of 4 KiB with -D.");
+    for ( i = 0; i < MQL_S_MAX; ++i ) {
+	if ( ttl_sev_set[i] )
+	    ttl = ttl_sev[i];
+	ttl_sev[i] = ttl;
+	if ( ttl )
+	    retain = 1;
+    }
+    if ( (retain || n_ttl_src) && !compact_min )
+	do_help("Times to live need -a.");
+    col_opt.stop = &mqld_stop;
+
+    conf.dir = store_dir;
+    store = mql_store_open(&conf);
+    if ( !store ) {
+	perror("mql_store_open: ");
+	exit( EXIT_FAILURE );
+    }
+
+    srv = mql_serve_start(store_dir);
+    if ( !srv ) {
+	fprintf(stderr, "%s/%s: ", store_dir, MQL_TAIL_SOCK);
+	perror("no tails");
+    }
+
+    snprintf( log_filter, sizeof(log_filter), "%s/%s/#",
+	      my_prefix, MQL_LOG_TAG );
+    tp = mql_transport_new(transport_spec);
+    if ( !tp ) {
+	printf("Bad transport: \"%s\"\n", transport_spec);
+	exit( EXIT_FAILURE );
+    }
+    mql_transport_callbacks(tp, mqld_connect_cb, mqld_disconnect_cb,
+			    mqld_message_cb, 0);
+    if ( mql_transport_connect(tp, mqtt_host, mqtt_port) ) {
+	perror("mql_transport_connect: ");
+	exit( EXIT_FAILURE );
+    }
+
+    signal( SIGINT, mqld_signal );
+    signal( SIGTERM, mqld_signal );
+    if ( mql_transport_loop_start(tp) ) {
+	fprintf(stderr, "Error: %s\n", "Can not start transport");
+	exit( EXIT_FAILURE );
+    }
+    DD ("storing \"%s\" in \"%s\", io %s\n", log_filter, store_dir,
+	mql_store_io(store));
+    if ( (compact_min || disk_max)
+	 && pthread_create(&compact_tid, 0, mqld_compactor, 0) ) {
+	perror("pthread_create: ");
+	exit( EXIT_FAILURE );
+    }
+
+    while ( !mqld_stop )
+	pause();
+
+    if ( compact_min || disk_max )
+	pthread_join( compact_tid, 0 );
+    mql_transport_destroy(tp);
+    mql_serve_stop(srv);
+    mql_store_flush(store);
+    mql_store_stats(store, &st);
+    printf("io=%s messages=%lu other=%lu records=%llu bytes=%llu"
+	   " writes=%llu syncs=%llu segments=%llu stalls=%llu rejected=%llu"
+	   " errors=%llu inflight-max=%llu compacted=%lu packed=%lu"
+	   " dropped=%lu removed=%lu\n",
+	   mql_store_io(store), st_messages, st_other,
+	   (unsigned long long)st.records, (unsigned long long)st.bytes,
+	   (unsigned long long)st.writes, (unsigned long long)st.syncs,
+	   (unsigned long long)st.segments, (unsigned long long)st.stalls,
+	   (unsigned long long)st.rejected, (unsigned long long)st.errors,
+	   (unsigned long long)st.inflight_max, st_compacted, st_packed,
+	   st_dropped, st_removed);
+    mql_store_close(store);
+    return 0;
+}
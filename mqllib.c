@@ -8,20 +8,23 @@
  * Created On      : Thu Jul  3 21:27:06 2025
  * 
  * Last Modified By: Mats Bergstrom
- * Last Modified On: Sun Nov 23 17:36:45 2025
- * Update Count    : 59
+ * Last Modified On: Mon Oct 19 16:26:21 2026
+ * Update Count    : 66
  */
 
 
-/* NOTE: Currently only using mosquitto */
+/* NOTE: Sends through an mql_transport_t, see mql_transport.h */
 
 #include "mql.h"
+#include "mql_int.h"
+#include "mql_sdt.h"
 
 #include <mosquitto.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 
 static const int opt_dd = 0;
 
@@ -45,22 +48,46 @@ static char mql_cmd_topic[ MQL_TOPIC_MAX_LEN ];
 static char mql_cmd_topic_all[ MQL_TOPIC_MAX_LEN ];
 //static char mql_rsp_topic[ MQL_TOPIC_MAX_LEN ];
 
-static char mql_buffer[ MQL_BUFFER_LEN ];
+// Levels are shared by the logging threads and the transport thread.
+// The counted level and the remaining count are kept in one word,
+// <clevel> << 32 | <count>, so that a counted budget is spent exactly.
+static atomic_uint mql_level = MQL_S_INFO;
+static _Atomic uint64_t mql_counted = 0;
 
-static unsigned mql_level = MQL_S_INFO;
-static unsigned mql_clevel = MQL_S_INFO;
-static unsigned mql_count = 0;
+#define MQL_COUNTED(lvl,count)	(((uint64_t)(lvl) << 32) | (count))
+#define MQL_CLEVEL(c)		((unsigned)((c) >> 32))
+#define MQL_COUNT(c)		((unsigned)((c) & 0xffffffffU))
 
-static struct mosquitto* mql_mqc = 0;
+static mql_transport_t* mql_tp = 0;
+
+MQL_PROBE_DEFINE(log_entry);
+MQL_PROBE_DEFINE(log_filter);
+MQL_PROBE_DEFINE(log_publish);
+MQL_PROBE_DEFINE(log_return);
+MQL_PROBE_DEFINE(logf_format);
+MQL_PROBE_DEFINE(level_change);
 
 int
 mql_init(struct mosquitto* mqc,
 	 const char* prefix, const char* id, unsigned lvl)
+{
+    mql_transport_t* tp;
+
+    if ( !mqc ) abort();
+    tp = mql_tp_mosquitto_wrap(mqc);
+    if ( !tp ) abort();
+    return mql_init_transport(tp, prefix, id, lvl);
+}
+
+
+int
+mql_init_transport(mql_transport_t* tp,
+		   const char* prefix, const char* id, unsigned lvl)
 {
     unsigned l;
     int i;
 
-    if ( !mqc ) abort();
+    if ( !tp ) abort();
     if ( !prefix ) abort();
     if ( !*prefix ) abort();
     if ( !id ) abort();
@@ -69,7 +96,7 @@ mql_init(struct mosquitto* mqc,
 
     DD("prefix=\"%s\" id=\"%s\" lvl=%d\n", prefix,id,lvl);
     
-    mql_mqc = mqc;
+    mql_tp = tp;
     
     strncpy( mql_prefix, prefix, MQL_PREFIX_MAX_LEN-1);
     strncpy( mql_id, id, MQL_ID_MAX_LEN-1 );
@@ -95,9 +122,8 @@ mql_init(struct mosquitto* mqc,
     if ( !(i<MQL_TOPIC_MAX_LEN) ) abort();
     DD(".. cmd_topic_all=\"%s\"\n",mql_cmd_topic_all);
 
-    mql_level = lvl;
-    mql_clevel = lvl;
-    mql_count = 0;
+    atomic_store( &mql_level, lvl );
+    atomic_store( &mql_counted, MQL_COUNTED(lvl,0) );
     
     return 0;
 }
@@ -113,12 +139,26 @@ mql_connect_cb(struct mosquitto* mqc)
 }
 
 
+// Use in transport connect callback.
+int
+mql_subscribe_commands()
+{
+    int i = 0;
+    if ( !mql_tp ) abort();
+    if ( mql_transport_subscribe(mql_tp, mql_cmd_topic) )
+	i = -1;
+    if ( mql_transport_subscribe(mql_tp, mql_cmd_topic_all) )
+	i = -1;
+    return i;
+}
+
+
 #define MQL_LEVEL_COMMAND	'L'
 #define MQL_COUNT_COMMAND	'C'
 
 // Decode a single hex digit to a number.
 // Returns: 1 on success, 0 on failure. 
-static unsigned
+unsigned
 mql_decode_lvl(const char* s, unsigned* lvl_ptr )
 {
     unsigned lvl = 0;
@@ -154,7 +194,7 @@ mql_decode_lvl(const char* s, unsigned* lvl_ptr )
 
 // Decodes a decimal string to a number.
 // Return 0 on failure, >0 number of characters used.
-static unsigned
+unsigned
 mql_decode_count(const char* s, unsigned* count_ptr )
 {
     unsigned count = 0;
@@ -190,7 +230,7 @@ mql_decode_count(const char* s, unsigned* count_ptr )
 
 
 static int
-mql_do_command(struct mosquitto* mqc, const char* cmd)
+mql_do_command(const char* cmd)
 {
     unsigned l = 0;
     DD ("Command \"%s\"\n",cmd);
@@ -200,7 +240,8 @@ mql_do_command(struct mosquitto* mqc, const char* cmd)
 	l = mql_decode_lvl(cmd,&lvl);
 	DD ("New level = %d was %d, l = %d\n",lvl, mql_level,l);
 	if ( l > 0 ) {
-	    mql_level = lvl;
+	    MQL_PROBE4(level_change, MQL_LEVEL_COMMAND, mql_level, lvl, 0);
+	    atomic_store( &mql_level, lvl );
 	    l = 1;
 	}
 	else {
@@ -218,8 +259,9 @@ mql_do_command(struct mosquitto* mqc, const char* cmd)
 	    DD ("New clevel = %d / %d, count=%d, l = %d\n\n",
 		lvl, mql_level,count,l);
 	    if ( l > 0 ) {
-		mql_clevel = lvl;
-		mql_count = count;
+		MQL_PROBE4(level_change, MQL_COUNT_COMMAND, mql_get_level(),
+			   lvl, count);
+		atomic_store( &mql_counted, MQL_COUNTED(lvl,count) );
 		l = 1;
 	    }
 	    else {
@@ -237,14 +279,21 @@ mql_do_command(struct mosquitto* mqc, const char* cmd)
 // Use in MQTT message callback.
 int
 mql_message_cb(struct mosquitto* mqc,const struct mosquitto_message *msg)
+{
+    return mql_message(msg->topic, msg->payload, msg->payloadlen);
+}
+
+
+// Use in transport message callback.
+int
+mql_message(const char* topic, const void* payload, int len)
 {
     int i = 0;
-    const char*    topic = msg->topic;
-    const char*    pload = msg->payload;
-    if ( !mql_mqc ) abort();
+    const char*    pload = payload;
+    if ( !mql_tp ) abort();
     if ( !strncmp(topic,mql_cmd_topic,MQL_TOPIC_MAX_LEN) ||
 	 !strncmp(topic,mql_cmd_topic_all,MQL_TOPIC_MAX_LEN) ) {
-	i = mql_do_command(mqc,pload);
+	i = mql_do_command(pload);
     }
     return i;
 }
@@ -257,7 +306,7 @@ mql_set_level(unsigned severity)
 {
     if ( severity >= MQL_S_MAX )
 	return -1;
-    mql_level = severity;
+    atomic_store( &mql_level, severity );
     return 0;
 }
 
@@ -269,8 +318,7 @@ mql_set_level_counted(unsigned severity, unsigned count)
 	return -1;
     if ( !count )
 	return -1;
-    mql_clevel = severity;
-    mql_count = count;
+    atomic_store( &mql_counted, MQL_COUNTED(severity,count) );
     return 0;
 }
 
@@ -283,21 +331,51 @@ mql_log(unsigned severity, const char* string)
     int n = 0;
     int status;
     const char* topic;
+    uint64_t t0 = 0;			/* Entry */
+    uint64_t tp = 0;			/* Publish start */
+    uint64_t t1 = 0;
+
+    if ( MQL_PROBE_ENABLED(log_return) || MQL_PROBE_ENABLED(log_publish) )
+	t0 = mql_probe_ns();
+    if ( MQL_PROBE_ENABLED(log_entry) )
+	MQL_PROBE2(log_entry, severity, mql_get_level());	/* Counted too */
+
+    DD("mql_log(%x/%x,\"%s\")\n", severity,mql_get_level(),string);
+    if ( !mql_tp ) abort();
+
+    for (;;) {
+	uint64_t c = atomic_load_explicit( &mql_counted, memory_order_relaxed );
+	unsigned lvl;
+
+	if ( MQL_COUNT(c) ) {
+	    if ( severity > MQL_CLEVEL(c) ) {
+		MQL_PROBE2(log_filter, severity, MQL_CLEVEL(c));
+		MQL_PROBE3(log_return, severity, 0,
+			   (t0 ? mql_probe_ns() - t0 : 0));
+		return 0;
+	    }
+	    if ( !string )
+		break;
+	    // Spend one from the budget, unless someone else got there first.
+	    if ( atomic_compare_exchange_weak( &mql_counted, &c, c - 1 ) )
+		break;
+	    continue;
+	}
 
-    DD("mql_log(%x/%x/%d(%u),\"%s\")\n",
-       severity,mql_level,mql_clevel,mql_count,string);
-    if ( !mql_mqc ) abort();
-
-    if ( mql_count ) {
-	if  (severity > mql_clevel)
+	lvl = atomic_load_explicit( &mql_level, memory_order_relaxed );
+	if ( severity > lvl ) {
+	    MQL_PROBE2(log_filter, severity, lvl);
+	    MQL_PROBE3(log_return, severity, 0,
+		       (t0 ? mql_probe_ns() - t0 : 0));
 	    return 0;
-    }
-    else if ( severity > mql_level ) {
-	return 0;
+	}
+	break;
     }
 
-    if ( !string )
+    if ( !string ) {
+	MQL_PROBE3(log_return, severity, -1, 0);
 	return -1;
+    }
 
     n = strlen( string);
 
@@ -305,19 +383,25 @@ mql_log(unsigned severity, const char* string)
 
     DD ("Topic: %u \"%s\"\nMessage: %d \"%s\"\n", severity, topic , n, string);
     
-    status = mosquitto_publish(mql_mqc, 0,
-			       topic,
-			       n,
-			       string,
-			       0,
-			       false );			/* retain is OFF */
-
-    if ( mql_count )
-	--mql_count;
-    
-    if ( status != MOSQ_ERR_SUCCESS )
+    if ( t0 )
+	tp = mql_probe_ns();
+    status = mql_transport_publish(mql_tp,
+				   topic,
+				   n,
+				   string,
+				   0,
+				   0 );			/* retain is OFF */
+
+    if ( t0 )
+	t1 = mql_probe_ns();
+    MQL_PROBE4(log_publish, severity, n, status, (t0 ? t1 - tp : 0));
+
+    if ( status ) {
+	MQL_PROBE3(log_return, severity, -1, (t0 ? t1 - t0 : 0));
 	return -1;
+    }
 
+    MQL_PROBE3(log_return, severity, 0, (t0 ? t1 - t0 : 0));
     return 0;
 }
 
@@ -325,7 +409,8 @@ mql_log(unsigned severity, const char* string)
 unsigned
 mql_get_level()
 {
-    unsigned l = (mql_count ? mql_clevel : mql_level );
+    uint64_t c = atomic_load( &mql_counted );
+    unsigned l = (MQL_COUNT(c) ? MQL_CLEVEL(c) : atomic_load( &mql_level ));
     return l;	
 }
 
@@ -333,20 +418,89 @@ mql_get_level()
 int
 mql_logf(unsigned severity, const char* format, ... )
 {
+    char buffer[ MQL_BUFFER_LEN ];
     va_list ap;
     int i;
-    
+    uint64_t t0 = 0;
+
+    if ( MQL_PROBE_ENABLED(logf_format) )
+	t0 = mql_probe_ns();
+
     va_start( ap, format );
-    i = vsnprintf(mql_buffer, MQL_BUFFER_LEN-1,format,ap);
+    i = vsnprintf(buffer, MQL_BUFFER_LEN-1,format,ap);
     va_end(ap);
 
+    MQL_PROBE3(logf_format, severity, i, (t0 ? mql_probe_ns() - t0 : 0));
+
     if ( i > 0 )
-	mql_log(severity,mql_buffer);
+	mql_log(severity,buffer);
 
     return 0;
 }
 
 
+static void
+mql_open_connect_cb(mql_transport_t* tp, void* obj, int result)
+{
+    if ( !result )
+	mql_subscribe_commands();
+}
+
+static void
+mql_open_message_cb(mql_transport_t* tp, void* obj,
+		    const char* topic, const void* payload, int len)
+{
+    mql_message(topic, payload, len);
+}
+
+
+mql_transport_t*
+mql_open(const char* spec, const char* host, int port,
+	 const char* prefix, const char* id, unsigned lvl)
+{
+    mql_transport_t* tp = mql_transport_new(spec);
+    if ( !tp )
+	return 0;
+    mql_init_transport(tp, prefix, id, lvl);
+    mql_transport_callbacks(tp, mql_open_connect_cb, 0,
+			    mql_open_message_cb, 0);
+    if ( mql_transport_connect(tp, host, port)
+	 || mql_transport_loop_start(tp) ) {
+	mql_transport_destroy(tp);
+	mql_tp = 0;
+	return 0;
+    }
+    return tp;
+}
+
+
+int
+mql_batch_next(const char* payload, int len, int* pos,
+	       const char** rec, int* rec_len)
+{
+    int i = *pos;
+    int n = 0;
+
+    if ( i >= len )
+	return 0;
+    while ( i < len && '0' <= payload[i] && payload[i] <= '9' ) {
+	n = n * 10 + (payload[i] - '0');
+	if ( n > len )
+	    return -1;
+	++i;
+    }
+    if ( i == *pos || i >= len || payload[i] != ':' )
+	return -1;
+    ++i;
+    if ( n > len - i - 1 || payload[i+n] != ',' )
+	return -1;
+    *rec = payload + i;
+    *rec_len = n;
+    *pos = i + n + 1;
+    return 1;
+}
+
+
 int
 mql_split(const char* topic, mql_fragment_t* frag_array, unsigned frag_array_len )
 {
@@ -0,0 +1,418 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : s-mql.c
+ * Description     : Concurrency stress test of mql library
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:11:41 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 14:11:41 2026
+ * Update Count    : 1
+ */
+
+/*
+ * Many threads call mql_log()/mql_logf() while another thread, playing
+ * the mosquitto thread, injects level and count commands through
+ * mql_message_cb() and calls mql_set_level()/mql_set_level_counted().
+ * Runs against mql_stub.c, no broker needed.  Build as s-mql-tsan to run
+ * under ThreadSanitizer.
+ *
+ * Checks:
+ *  - Every published message arrives intact, on the topic of its severity.
+ *  - A counted budget is spent exactly: "C 8 <count>" lets exactly <count>
+ *    DEBUG messages through however many threads are logging.
+ *
+ * s-mql [-d] [-n threads] [-T chaos-seconds] [-R rounds] [-c count]
+ * Exit status is 0 when all checks pass.
+ */
+
+#include "mql.h"
+#include "mql_stub.h"
+
+#include <mosquitto.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+
+int opt_d = 0;
+#define DD if(opt_d)printf
+
+static unsigned opt_threads = 16;
+static double opt_chaos = 2.0;
+static unsigned opt_rounds = 20;
+static unsigned opt_count = 10000;
+
+#define PREFIX	"stress"
+#define ID	"stress"
+#define LOG_TOPIC	PREFIX "/" MQL_LOG_TAG "/" ID "/"
+#define LOG_TOPIC_LEN	(sizeof(LOG_TOPIC) - 1)
+
+static atomic_int stop;
+static atomic_int phase;		/* 0: chaos, 1: budget */
+
+static atomic_ulong published[ MQL_S_MAX ];
+static atomic_ulong corrupt;
+
+
+/* Payload: "S <thread> <seq> <sev> <len> <filler>" */
+static char
+filler(unsigned t, unsigned seq, unsigned i)
+{
+    return 'a' + (t * 7 + seq + i) % 26;
+}
+
+
+static void
+fail(const char* what, const char* topic, int len, const void* payload)
+{
+    atomic_fetch_add( &corrupt, 1 );
+    if ( atomic_load(&corrupt) < 10 )
+	printf("CORRUPT (%s): \"%s\" %d \"%.*s\"\n",
+	       what, topic, len, len, (const char*)payload);
+}
+
+
+static int
+check_publish(const char* topic, int len, const void* payload)
+{
+    const char* p = payload;
+    unsigned t, seq, sev, flen, tsev;
+    int n = 0;
+    unsigned i;
+
+    if ( strncmp(topic, LOG_TOPIC, LOG_TOPIC_LEN)
+	 || !topic[LOG_TOPIC_LEN] || topic[LOG_TOPIC_LEN+1] ) {
+	fail("topic", topic, len, payload);
+	return MOSQ_ERR_SUCCESS;
+    }
+    tsev = strtoul(topic+LOG_TOPIC_LEN, 0, 16);
+    if ( tsev >= MQL_S_MAX ) {
+	fail("topic severity", topic, len, payload);
+	return MOSQ_ERR_SUCCESS;
+    }
+
+    if ( len <= 0 || p[len] != '\0'
+	 || sscanf(p, "S %u %u %x %u %n", &t, &seq, &sev, &flen, &n) != 4
+	 || !n ) {
+	fail("header", topic, len, payload);
+	return MOSQ_ERR_SUCCESS;
+    }
+    if ( sev != tsev ) {
+	fail("severity", topic, len, payload);
+	return MOSQ_ERR_SUCCESS;
+    }
+    if ( (unsigned)len != n + flen ) {
+	fail("length", topic, len, payload);
+	return MOSQ_ERR_SUCCESS;
+    }
+    for ( i = 0; i < flen; ++i ) {
+	if ( p[n+i] != filler(t,seq,i) ) {
+	    fail("filler", topic, len, payload);
+	    return MOSQ_ERR_SUCCESS;
+	}
+    }
+
+    atomic_fetch_add( &published[tsev], 1 );
+    return MOSQ_ERR_SUCCESS;
+}
+
+
+static void*
+logger(void* arg)
+{
+    unsigned t = (unsigned)(size_t)arg;
+    unsigned seq = 0;
+    char fill[ 200 ];
+    char buf[ MQL_BUFFER_LEN ];
+
+    while ( !atomic_load(&stop) ) {
+	unsigned sev;
+	unsigned flen = (t + seq) % 150;
+	unsigned i;
+
+	if ( atomic_load(&phase) )
+	    sev = MQL_S_DEBUG + seq % 8;	/* Only DEBUG_0 fits budget */
+	else
+	    sev = seq % MQL_S_MAX;
+
+	for ( i = 0; i < flen; ++i )
+	    fill[i] = filler(t,seq,i);
+	fill[flen] = '\0';
+
+	if ( seq & 1 ) {
+	    mql_logf( sev, "S %u %u %x %u %s", t, seq, sev, flen, fill );
+	}
+	else {
+	    snprintf( buf, sizeof(buf), "S %u %u %x %u %s",
+		      t, seq, sev, flen, fill );
+	    mql_log( sev, buf );
+	}
+	++seq;
+    }
+    return 0;
+}
+
+
+static void
+command(const char* topic, const char* payload)
+{
+    struct mosquitto_message msg;
+    char t[ MQL_TOPIC_MAX_LEN ];
+    char p[ MQL_BUFFER_LEN ];
+
+    /* The message is owned by "mosquitto", copy like it does. */
+    strncpy( t, topic, sizeof(t)-1 );
+    t[ sizeof(t)-1 ] = '\0';
+    strncpy( p, payload, sizeof(p)-1 );
+    p[ sizeof(p)-1 ] = '\0';
+    memset( &msg, 0, sizeof(msg) );
+    msg.topic = t;
+    msg.payload = p;
+    msg.payloadlen = strlen(p);
+    mql_message_cb( 0, &msg );
+}
+
+
+/* Chaos: random commands and API calls while the loggers run. */
+static void*
+injector(void* arg)
+{
+    unsigned n = 0;
+    char cmd[ 32 ];
+    while ( !atomic_load(&stop) ) {
+	unsigned lvl = (n * 5) % MQL_S_MAX;
+	const char* topic = (n & 4) ? PREFIX "/cmd/ALL" : PREFIX "/cmd/" ID;
+	switch ( n % 6 ) {
+	case 0:
+	    snprintf( cmd, sizeof(cmd), "L %x", lvl );
+	    command( topic, cmd );
+	    break;
+	case 1:
+	    snprintf( cmd, sizeof(cmd), "C %x %u", lvl, n % 50 );
+	    command( topic, cmd );
+	    break;
+	case 2:
+	    mql_set_level( lvl );
+	    break;
+	case 3:
+	    mql_set_level_counted( lvl, 1 + n % 20 );
+	    break;
+	case 4:
+	    command( topic, "C x 12" );		/* Malformed */
+	    break;
+	default:
+	    DD ("level=%x\n", mql_get_level());
+	    break;
+	}
+	++n;
+	if ( n % 64 == 0 )
+	    usleep( 100 );
+    }
+    return 0;
+}
+
+
+/* Budget: keep re-setting the base level while a count runs down. */
+static void*
+level_noise(void* arg)
+{
+    while ( !atomic_load(&stop) ) {
+	command( PREFIX "/cmd/ALL", "L 0" );
+	mql_set_level( MQL_S_FATAL );
+    }
+    return 0;
+}
+
+
+static pthread_t*
+start(void* (*fn)(void*), unsigned n)
+{
+    pthread_t* tid = calloc( n, sizeof(pthread_t) );
+    unsigned i;
+    if ( !tid ) {
+	perror("calloc: ");
+	exit( EXIT_FAILURE );
+    }
+    for ( i = 0; i < n; ++i ) {
+	if ( pthread_create( &tid[i], 0, fn, (void*)(size_t)i ) ) {
+	    perror("pthread_create: ");
+	    exit( EXIT_FAILURE );
+	}
+    }
+    return tid;
+}
+
+static void
+join(pthread_t* tid, unsigned n)
+{
+    unsigned i;
+    for ( i = 0; i < n; ++i )
+	pthread_join( tid[i], 0 );
+    free( tid );
+}
+
+static unsigned long
+total_published()
+{
+    unsigned long n = 0;
+    unsigned i;
+    for ( i = 0; i < MQL_S_MAX; ++i )
+	n += atomic_load( &published[i] );
+    return n;
+}
+
+static void
+reset_published()
+{
+    unsigned i;
+    for ( i = 0; i < MQL_S_MAX; ++i )
+	atomic_store( &published[i], 0 );
+}
+
+
+static int
+chaos()
+{
+    pthread_t* loggers;
+    pthread_t* inj;
+    unsigned long before = __atomic_load_n(&mql_stub_published,
+					    __ATOMIC_RELAXED);
+    unsigned long n;
+
+    atomic_store( &phase, 0 );
+    atomic_store( &stop, 0 );
+    loggers = start( logger, opt_threads );
+    inj = start( injector, 1 );
+    usleep( (useconds_t)(opt_chaos * 1e6) );
+    atomic_store( &stop, 1 );
+    join( inj, 1 );
+    join( loggers, opt_threads );
+
+    n = __atomic_load_n(&mql_stub_published, __ATOMIC_RELAXED) - before;
+    printf("chaos: %u threads, %lu published, %lu checked, %lu corrupt\n",
+	   opt_threads, n, total_published(), atomic_load(&corrupt));
+    return (n == total_published() + atomic_load(&corrupt))
+	&& !atomic_load(&corrupt);
+}
+
+
+static int
+budget(unsigned round)
+{
+    pthread_t* loggers;
+    pthread_t* noise;
+    char cmd[ 32 ];
+    unsigned spins = 0;
+    unsigned long n;
+    unsigned i;
+
+    mql_set_level( MQL_S_FATAL );
+    command( PREFIX "/cmd/" ID, "C 0 0" );	/* No count left from before */
+    atomic_store( &phase, 1 );
+    atomic_store( &stop, 0 );
+    reset_published();
+
+    loggers = start( logger, opt_threads );
+    noise = start( level_noise, 1 );
+
+    /* Alternate between the command and the API. */
+    if ( round & 1 ) {
+	mql_set_level_counted( MQL_S_DEBUG, opt_count );
+    }
+    else {
+	snprintf( cmd, sizeof(cmd), "C %x %u", MQL_S_DEBUG, opt_count );
+	command( PREFIX "/cmd/" ID, cmd );
+    }
+
+    /* Wait for the budget to run out, then give stragglers a chance. */
+    while ( mql_get_level() != MQL_S_FATAL && spins < 100000 ) {
+	usleep( 100 );
+	++spins;
+    }
+    usleep( 10000 );
+
+    atomic_store( &stop, 1 );
+    join( noise, 1 );
+    join( loggers, opt_threads );
+
+    n = atomic_load( &published[MQL_S_DEBUG] );
+    for ( i = 0; i < MQL_S_MAX; ++i )
+	if ( i != MQL_S_DEBUG && atomic_load(&published[i]) )
+	    n = ~0UL;
+    DD ("budget %u: %lu of %u\n", round, n, opt_count);
+    if ( n != opt_count ) {
+	printf("budget %u: published %lu, expected %u\n",
+	       round, n, opt_count);
+	return 0;
+    }
+    return 1;
+}
+
+
+int
+main(int argc, const char** argv)
+{
+    struct mosquitto* mqc;
+    int ok = 1;
+    unsigned r;
+
+    setbuf(stdout,0);
+
+    --argc;
+    ++argv;
+    while ( argc ) {
+	if ( !strcmp(*argv,"-d") ) {
+	    ++opt_d;
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+	if ( argc < 2 ) {
+	    printf("Bad option: %s\n", *argv);
+	    exit( EXIT_FAILURE );
+	}
+	if ( !strcmp(*argv,"-n") )
+	    opt_threads = strtoul(argv[1],0,0);
+	else if ( !strcmp(*argv,"-T") )
+	    opt_chaos = atof(argv[1]);
+	else if ( !strcmp(*argv,"-R") )
+	    opt_rounds = strtoul(argv[1],0,0);
+	else if ( !strcmp(*argv,"-c") )
+	    opt_count = strtoul(argv[1],0,0);
+	else {
+	    printf("Bad option: %s\n", *argv);
+	    exit( EXIT_FAILURE );
+	}
+	argc -= 2;
+	argv += 2;
+    }
+    if ( !opt_threads || !opt_count ) {
+	printf("Bad option value\n");
+	exit( EXIT_FAILURE );
+    }
+
+    mql_stub_publish_hook = check_publish;
+    mqc = mosquitto_new( 0, true, 0 );
+    mql_init( mqc, PREFIX, ID, MQL_S_INFO );
+
+    if ( !chaos() )
+	ok = 0;
+
+    for ( r = 0; r < opt_rounds; ++r )
+	if ( !budget(r) )
+	    ok = 0;
+    printf("budget: %u rounds of %u with %u threads\n",
+	   opt_rounds, opt_count, opt_threads);
+
+    mosquitto_destroy( mqc );
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,359 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : t-broker.c
+ * Description     : Minimal MQTT broker, helper binary and self test
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 14:28:12 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:07:58 2026
+ * Update Count    : 2
+ */
+
+
+/*
+ * "t-broker [-p port]" runs mql_broker.c on 127.0.0.1, prints "port <n>"
+ * and serves until SIGINT/SIGTERM, then prints its counters.  Used by
+ * e2e.sh to run the mql tools without mosquitto.
+ *
+ * "t-broker -t" tests the broker with raw MQTT packets: QoS 0, 1 and 2,
+ * wildcards, retained messages.
+ */
+
+#include "mql_broker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+
+static volatile sig_atomic_t stop = 0;
+static int port = 0;
+static int failures = 0;
+
+#define CHECK(c,msg)	do { if ( !(c) ) fail(__LINE__,msg); } while (0)
+
+
+static void
+fail(int line, const char* msg)
+{
+    printf("FAIL line %d: %s\n", line, msg);
+    ++failures;
+}
+
+
+/*
+ * A blocking MQTT client, just enough for the tests.
+ */
+
+typedef struct {
+    unsigned char	type;		/* First byte */
+    unsigned char	data[ 1024 ];
+    size_t		len;
+} pkt_t;
+
+static int
+c_send(int fd, unsigned char type, const void* data, size_t len)
+{
+    unsigned char buf[ 1100 ];
+    size_t n = 0;
+    size_t rlen = len;
+    buf[n++] = type;
+    do {
+	buf[n] = rlen % 128;
+	rlen /= 128;
+	if ( rlen )
+	    buf[n] |= 0x80;
+	++n;
+    } while ( rlen );
+    memcpy( buf + n, data, len );
+    return send(fd, buf, n + len, 0) == (ssize_t)(n + len) ? 0 : -1;
+}
+
+static int
+c_read_n(int fd, void* buf, size_t n, int ms)
+{
+    struct pollfd pfd;
+    size_t got = 0;
+    while ( got < n ) {
+	ssize_t k;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if ( poll(&pfd, 1, ms) != 1 )
+	    return -1;
+	k = recv(fd, (char*)buf + got, n - got, 0);
+	if ( k <= 0 )
+	    return -1;
+	got += k;
+    }
+    return 0;
+}
+
+// Next packet, -1 on timeout (ms) or error.
+static int
+c_recv(int fd, pkt_t* p, int ms)
+{
+    unsigned char b;
+    unsigned shift = 0;
+    p->len = 0;
+    if ( c_read_n(fd, &p->type, 1, ms) )
+	return -1;
+    do {
+	if ( c_read_n(fd, &b, 1, ms) )
+	    return -1;
+	p->len |= (size_t)(b & 0x7f) << shift;
+	shift += 7;
+    } while ( b & 0x80 );
+    if ( p->len > sizeof(p->data) )
+	return -1;
+    return c_read_n(fd, p->data, p->len, ms);
+}
+
+static size_t
+c_str(unsigned char* p, const char* s)
+{
+    size_t n = strlen(s);
+    p[0] = n >> 8;
+    p[1] = n;
+    memcpy( p + 2, s, n );
+    return 2 + n;
+}
+
+static int
+c_connect(const char* id)
+{
+    struct sockaddr_in addr;
+    unsigned char d[ 128 ];
+    size_t n = 0;
+    pkt_t p;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if ( fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) ) {
+	perror("connect: ");
+	exit( EXIT_FAILURE );
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    n += c_str(d + n, "MQTT");
+    d[n++] = 4;				/* 3.1.1 */
+    d[n++] = 0x02;			/* Clean session */
+    d[n++] = 0;
+    d[n++] = 60;			/* Keepalive */
+    n += c_str(d + n, id);
+    c_send(fd, 0x10, d, n);
+    CHECK( !c_recv(fd, &p, 1000) && p.type == 0x20 && p.len == 2
+	   && p.data[1] == 0, "CONNACK" );
+    return fd;
+}
+
+static void
+c_subscribe(int fd, const char* filter, int qos, int granted)
+{
+    unsigned char d[ 256 ];
+    size_t n = 0;
+    pkt_t p;
+    d[n++] = 0;
+    d[n++] = 1;				/* Packet id */
+    n += c_str(d + n, filter);
+    d[n++] = qos;
+    c_send(fd, 0x82, d, n);
+    CHECK( !c_recv(fd, &p, 1000) && p.type == 0x90 && p.len == 3
+	   && p.data[2] == granted, "SUBACK" );
+}
+
+static void
+c_publish(int fd, const char* topic, const char* msg, int qos, int retain)
+{
+    unsigned char d[ 512 ];
+    size_t n = c_str(d, topic);
+    pkt_t p;
+    if ( qos ) {
+	d[n++] = 0;
+	d[n++] = 7;			/* Packet id */
+    }
+    memcpy( d + n, msg, strlen(msg) );
+    n += strlen(msg);
+    c_send(fd, 0x30 | (qos << 1) | retain, d, n);
+    if ( qos == 1 )
+	CHECK( !c_recv(fd, &p, 1000) && p.type == 0x40 && p.len == 2
+	       && p.data[1] == 7, "PUBACK" );
+    if ( qos == 2 )
+	CHECK( !c_recv(fd, &p, 1000) && p.type == 0x50 && p.len == 2
+	       && p.data[1] == 7, "PUBREC" );
+}
+
+// Release QoS 2 packet id 7.
+static void
+c_release(int fd)
+{
+    unsigned char d[2] = { 0, 7 };
+    pkt_t p;
+    c_send(fd, 0x62, d, 2);
+    CHECK( !c_recv(fd, &p, 1000) && p.type == 0x70 && p.len == 2
+	   && p.data[1] == 7, "PUBCOMP" );
+}
+
+// Expect a PUBLISH of topic/msg with qos and retain.
+static void
+c_expect(int fd, const char* topic, const char* msg, int qos, int retain)
+{
+    size_t tlen = strlen(topic);
+    size_t off = 2 + tlen + (qos ? 2 : 0);
+    pkt_t p;
+    char what[ 256 ];
+
+    snprintf( what, sizeof(what), "PUBLISH %s \"%s\" qos %d retain %d",
+	      topic, msg, qos, retain );
+    CHECK( !c_recv(fd, &p, 1000)
+	   && p.type == (0x30 | (qos << 1) | retain)
+	   && p.len == off + strlen(msg)
+	   && p.data[0] == 0 && p.data[1] == tlen
+	   && !memcmp(p.data + 2, topic, tlen)
+	   && !memcmp(p.data + off, msg, strlen(msg)), what );
+}
+
+// Expect nothing before the answer to a ping.
+static void
+c_expect_none(int fd, const char* what)
+{
+    pkt_t p;
+    c_send(fd, 0xc0, 0, 0);
+    CHECK( !c_recv(fd, &p, 1000) && p.type == 0xd0, what );
+}
+
+
+static int
+self_test()
+{
+    mql_broker_t* b = mql_broker_start(0);
+    mql_broker_stats_t st;
+    int a, pub, c;
+
+    if ( !b ) {
+	perror("mql_broker_start: ");
+	return EXIT_FAILURE;
+    }
+    port = mql_broker_port(b);
+
+    a = c_connect("a");
+    pub = c_connect("pub");
+
+    /* Wildcards, QoS is the lower of publish and best subscription. */
+    c_subscribe(a, "t/+/x", 1, 1);
+    c_subscribe(a, "t/#", 0, 0);
+    c_subscribe(a, "q/2", 2, 1);
+    c_publish(pub, "t/a/x", "m1", 0, 0);
+    c_expect(a, "t/a/x", "m1", 0, 0);
+    c_publish(pub, "t/a/x", "m2", 1, 0);
+    c_expect(a, "t/a/x", "m2", 1, 0);
+    c_publish(pub, "t/b", "m3", 1, 0);
+    c_expect(a, "t/b", "m3", 0, 0);
+    c_publish(pub, "t", "m4", 0, 0);	/* "t/#" matches "t" */
+    c_expect(a, "t", "m4", 0, 0);
+    c_publish(pub, "q/2", "m5", 1, 0);
+    c_expect(a, "q/2", "m5", 1, 0);
+    c_publish(pub, "u/a/x", "m6", 0, 0);
+    c_expect_none(a, "no message for u/a/x");
+
+    /* QoS 2 in, forwarded once as QoS 1 however often sent. */
+    c_publish(pub, "q/2", "m7", 2, 0);
+    c_publish(pub, "q/2", "m7", 2, 0);
+    c_release(pub);
+    c_expect(a, "q/2", "m7", 1, 0);
+    c_expect_none(a, "QoS 2 forwarded once");
+
+    /* Retained, delivered on subscribe, removed by an empty message. */
+    c_publish(pub, "r/1", "keep", 1, 1);
+    c_publish(pub, "r/2", "old", 0, 1);
+    c_publish(pub, "r/2", "new", 0, 1);
+    c_expect_none(pub, "sync");		/* All above handled */
+    c = c_connect("c");
+    c_subscribe(c, "r/1", 1, 1);
+    c_expect(c, "r/1", "keep", 1, 1);
+    c_subscribe(c, "r/2", 0, 0);
+    c_expect(c, "r/2", "new", 0, 1);
+    c_subscribe(c, "r/1", 0, 0);	/* Again, retained of r/1 only */
+    c_expect(c, "r/1", "keep", 0, 1);
+    c_expect_none(c, "nothing for r/2 on resubscribe");
+    c_publish(pub, "r/1", "", 0, 1);
+    c_expect_none(pub, "sync");
+    close(c);
+    c = c_connect("d");
+    c_subscribe(c, "r/#", 0, 0);
+    c_expect(c, "r/2", "new", 0, 1);
+    c_expect_none(c, "r/1 removed");
+
+    close(a);
+    close(pub);
+    close(c);
+    mql_broker_stats(b, &st);
+    mql_broker_stop(b);
+    CHECK( st.retained == 1, "retained count" );
+    printf("connects=%lu published=%lu delivered=%lu\n",
+	   st.connects, st.published, st.delivered);
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+static void
+on_signal(int sig)
+{
+    stop = 1;
+}
+
+
+int
+main(int argc, const char** argv)
+{
+    mql_broker_t* b;
+    mql_broker_stats_t st;
+
+    setbuf(stdout,0);
+    --argc;
+    ++argv;
+    while ( argc ) {
+	if ( !strcmp(*argv,"-t") )
+	    return self_test();
+	if ( !strcmp(*argv,"-p") && argc > 1 ) {
+	    port = atoi( argv[1] );
+	    argc -= 2;
+	    argv += 2;
+	    continue;
+	}
+	printf("t-broker [-p port] | -t\n");
+	return EXIT_FAILURE;
+    }
+
+    b = mql_broker_start(port);
+    if ( !b ) {
+	perror("mql_broker_start: ");
+	return EXIT_FAILURE;
+    }
+    printf("port %d\n", mql_broker_port(b));
+
+    signal( SIGINT, on_signal );
+    signal( SIGTERM, on_signal );
+    while ( !stop )
+	pause();
+
+    mql_broker_stats(b, &st);
+    mql_broker_stop(b);
+    printf("connects=%lu published=%lu delivered=%lu retained=%lu"
+	   " dropped=%lu\n", st.connects, st.published, st.delivered,
+	   st.retained, st.dropped);
+    return 0;
+}
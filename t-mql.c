@@ -2,27 +2,44 @@
  * Copyright (C) 2025, Mats Bergstrom
  * 
  * File name       : t-mql.c
- * Description     : Test of mql library
+ * Description     : Test of mql library, load generator
  * 
  * Author          : Mats Bergstrom
  * Created On      : Mon Nov 17 21:36:21 2025
  * 
  * Last Modified By: Mats Bergstrom
- * Last Modified On: Thu Nov 20 20:48:02 2025
- * Update Count    : 20
+ * Last Modified On: Mon Oct 19 16:12:19 2026
+ * Update Count    : 25
  * Status          : $State$
  * 
  */
 
 
-#include "mql.h"
+/*
+ * Load generator: a number of threads call mql_log() at a target rate (or
+ * as fast as they can) with a severity mix and payload size distribution,
+ * then report achieved rate, publish failures and mql_log() latency.
+ *
+ * Payload: "M <thread> <seq> <send-ns> <filler>", where <send-ns> is
+ * CLOCK_REALTIME just before mql_log().  Decoded by "mql listen --measure".
+ *
+ * Published messages are counted as the transport takes them, so the
+ * count of those filtered by the level is exact whatever the level does
+ * during the run.
+ */
 
-#include <mosquitto.h>
+#include "mql.h"
+#include "mql_int.h"
+#include "mql_hist.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -34,18 +51,55 @@ static char my_id[ MQL_ID_MAX_LEN ];
 
 
 #define STR_MAX (80)
-char mqtt_host[ STR_MAX ];
+char mqtt_host[ STR_MAX ];		/* Empty: from the transport spec */
 
-#define MQTT_PORT	(1883)
-int mqtt_port = MQTT_PORT;
+int mqtt_port;				/* 0: from the transport spec */
 
-struct mosquitto* mqc = 0;
+char transport_spec[ STR_MAX ];		/* Empty: $MQL_TRANSPORT or mqtt */
+
+mql_transport_t* tp = 0;
+
+static mql_tp_ops_t count_ops;		/* Of tp, publish counted */
+static const mql_tp_ops_t* tp_ops;
+static char log_topic[ MQL_PREFIX_MAX_LEN + 8 ];	/* <prefix>/log/ */
+static atomic_ulong n_published;
 
 pthread_mutex_t	mtx;
 pthread_cond_t	cv;
 bool mq_connected = false;
 
 
+unsigned opt_threads = 1;		/* -n Number of threads */
+double opt_rate = 1;			/* -r Total msg/s, 0 = no limit */
+int opt_open = 0;			/* -o Open loop */
+double opt_duration = 0;		/* -T Seconds, 0 = until SIGINT */
+unsigned opt_level = MQL_S_MAX-1;	/* -l Library level */
+
+volatile sig_atomic_t stop = 0;
+
+
+/* Weighted choice, for severity mix and payload sizes. */
+#define WEIGHT_MAX (32)
+typedef struct {
+    unsigned	n;
+    unsigned	lo[ WEIGHT_MAX ];	/* Value, or range lo..hi */
+    unsigned	hi[ WEIGHT_MAX ];
+    unsigned	cum[ WEIGHT_MAX ];	/* Cumulative weight */
+} weights_t;
+
+weights_t sev_mix;			/* -m */
+weights_t size_mix;			/* -s */
+
+
+typedef struct {
+    pthread_t	tid;
+    unsigned	idx;
+    uint64_t	sent;
+    uint64_t	failed;
+    mql_hist_t	lat;
+} worker_t;
+
+
 
 void
 set_prefix(const char* p)
@@ -89,18 +143,8 @@ set_id(const char* p)
 void
 set_host(const char* h)
 {
-    if ( h && *h ) {
+    if ( h )
 	strncpy( mqtt_host, h, STR_MAX-1 );
-    }
-    else {
-	char* s = getenv("MQTT_HOST");
-	if ( s ) {
-	    strncpy( mqtt_host, s, STR_MAX-1 );
-	}
-	else {
-	    strncpy( mqtt_host, "127.0.0.1", STR_MAX-1 );
-	}
-    }
     DD ("host=\"%s\"\n",mqtt_host);
 }
 
@@ -119,9 +163,15 @@ do_help(const char* msg)
     if ( msg )
 	printf("Error: %s\n", msg);
     printf(
-"mql [-h host] [-p port] [-x prefix] [<command> [<args>]]\n"
-"	Command	Description\n"
-"	help	This text.\n"
+"t-mql [-h host] [-p port] [-x prefix] [-i id] [-t transport] [<options>]\n"
+"	-t <transport>	mqtt[://host[:port]], loop, unix[:path], shm[:name].\n"
+"	-n <threads>	Number of logging threads (1).\n"
+"	-r <rate>	Total messages/s, 0 = as fast as possible (1).\n"
+"	-o		Open loop, latency counted from scheduled time.\n"
+"	-T <seconds>	Duration, 0 = until interrupted (0).\n"
+"	-m <mix>	Severity mix, <hex>[-<hex>][:<weight>],... (0-f).\n"
+"	-s <sizes>	Payload sizes, <n>[-<n>][:<weight>],... (32).\n"
+"	-l <level>	Library log level, hex digit (f).\n"
 	   );
     exit(0);
 }
@@ -158,16 +208,15 @@ mq_wait_connected()
 
 
 void
-mq_message_callback(struct mosquitto *pmqc, void *obj,
-		    const struct mosquitto_message *msg)
+mq_message_callback(mql_transport_t* ptp, void *obj,
+		    const char* topic, const void* payload, int len)
 {
-    const char*	topic = msg->topic;
-    const char*	pload = msg->payload;
+    const char*	pload = payload;
     int i;
 
     DD ("%s: \"%s\" \"%s\"\n",__func__, topic, pload );
 
-    i = mql_message_cb(pmqc,msg);
+    i = mql_message(topic,payload,len);
     if ( !i ) {
 	DD(".. Not MQL message\n");
     }
@@ -190,9 +239,9 @@ mq_sub(const char* topic)
     int i;
     if ( topic ) {
 	DD ("%s: topic=%s\n",__func__,topic);
-	i = mosquitto_subscribe(mqc, NULL, topic, 0);
-	if ( i != MOSQ_ERR_SUCCESS ) {
-	    perror("mosquitto_subscribe: ");
+	i = mql_transport_subscribe(tp, topic);
+	if ( i ) {
+	    perror("mql_transport_subscribe: ");
 	    exit( EXIT_FAILURE );
 	}
     }
@@ -200,19 +249,19 @@ mq_sub(const char* topic)
 #endif
 
 void
-mq_connect_callback(struct mosquitto *mqc, void *obj, int result)
+mq_connect_callback(mql_transport_t* ptp, void *obj, int result)
 {
     DD ("%s: \n",__func__);
     /*     mql_sub("some/topic"); */
 
-    mql_connect_cb(mqc);
+    mql_subscribe_commands();
     
     /* Release main thread. */
     mq_set_connected( true );
 }
 
 void
-mq_disconnect_callback(struct mosquitto *mqc, void *obj, int result)
+mq_disconnect_callback(mql_transport_t* ptp, void *obj, int result)
 {
     printf("MQTT Disonnected: %d\n", result);
     mq_set_connected( false );
@@ -220,33 +269,44 @@ mq_disconnect_callback(struct mosquitto *mqc, void *obj, int result)
 
 
 
+// Publish on tp and count the log messages taken.
+static int
+mq_count_publish(mql_transport_t* ptp, const char* topic,
+		 int len, const void* payload, int qos, int retain)
+{
+    int i = tp_ops->publish(ptp, topic, len, payload, qos, retain);
+    if ( !i && !strncmp(topic, log_topic, strlen(log_topic)) )
+	atomic_fetch_add_explicit( &n_published, 1, memory_order_relaxed );
+    return i;
+}
+
+
 void
 mq_init(const char* host, int port )
-/* Initialise the mosquitto lib */
+/* Initialise the transport */
 {
     int i;
-    i = mosquitto_lib_init();
-    if ( i != MOSQ_ERR_SUCCESS) {
-	perror("mosquitto_lib_init: ");
-	exit( EXIT_FAILURE );
-    }
-    
-    mqc = mosquitto_new(0, true, 0);
-    if ( !mqc ) {
-	perror("mosquitto_new: ");
+    tp = mql_transport_new(transport_spec);
+    if ( !tp ) {
+	printf("Bad transport: \"%s\"\n", transport_spec);
 	exit( EXIT_FAILURE );
     }
+    snprintf( log_topic, sizeof(log_topic), "%s/log/", my_prefix );
+    tp_ops = tp->ops;
+    count_ops = *tp_ops;
+    count_ops.publish = mq_count_publish;
+    tp->ops = &count_ops;
 
-    mosquitto_connect_callback_set(mqc, mq_connect_callback);
-    mosquitto_disconnect_callback_set(mqc, mq_disconnect_callback);
-    mosquitto_message_callback_set(mqc, mq_message_callback);
+    mql_transport_callbacks(tp, mq_connect_callback,
+			    mq_disconnect_callback,
+			    mq_message_callback, 0);
 
     /* Init the mql library. */
-    mql_init(mqc,my_prefix, my_id, MQL_S_INFO );
+    mql_init_transport(tp,my_prefix, my_id, MQL_S_INFO );
     
-    i = mosquitto_connect(mqc, host, port, 60);
-    if ( i != MOSQ_ERR_SUCCESS) {
-	perror("mosquitto_connect: ");
+    i = mql_transport_connect(tp, host, port);
+    if ( i ) {
+	perror("mql_transport_connect: ");
 	exit( EXIT_FAILURE );
     }
 
@@ -255,28 +315,247 @@ mq_init(const char* host, int port )
 
 
 
+static uint64_t
+now_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime( clk, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void
+sleep_until(uint64_t t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000ULL;
+    ts.tv_nsec = t % 1000000000ULL;
+    while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) )
+	if ( stop )
+	    break;
+}
+
+
+static unsigned
+rnd(uint64_t* st)
+/* xorshift64* */
+{
+    *st ^= *st >> 12;
+    *st ^= *st << 25;
+    *st ^= *st >> 27;
+    return (*st * 2685821657736338717ULL) >> 32;
+}
+
+
+static unsigned
+weights_pick(const weights_t* w, uint64_t* st)
+{
+    unsigned r;
+    unsigned i;
+    if ( w->n == 1 && w->lo[0] == w->hi[0] )
+	return w->lo[0];
+    r = rnd(st) % w->cum[ w->n - 1 ];
+    for ( i = 0; r >= w->cum[i]; ++i )
+	;
+    if ( w->lo[i] == w->hi[i] )
+	return w->lo[i];
+    return w->lo[i] + rnd(st) % (w->hi[i] - w->lo[i] + 1);
+}
+
+
+static void
+weights_parse(weights_t* w, const char* spec, int base, unsigned max)
+/* <v>[-<v>][:<weight>],... */
+{
+    const char* p = spec;
+    unsigned total = 0;
+    w->n = 0;
+    while ( *p ) {
+	char* e;
+	unsigned lo, hi, wt = 1;
+	if ( w->n >= WEIGHT_MAX )
+	    do_help("Too many elements in distribution.");
+	lo = hi = strtoul(p,&e,base);
+	if ( e == p )
+	    do_help("Bad distribution.");
+	p = e;
+	if ( *p == '-' ) {
+	    ++p;
+	    hi = strtoul(p,&e,base);
+	    if ( e == p || hi < lo )
+		do_help("Bad range in distribution.");
+	    p = e;
+	}
+	if ( *p == ':' ) {
+	    ++p;
+	    wt = strtoul(p,&e,10);
+	    if ( e == p || !wt )
+		do_help("Bad weight in distribution.");
+	    p = e;
+	}
+	if ( hi > max )
+	    do_help("Value out of range in distribution.");
+	total += wt;
+	w->lo[w->n] = lo;
+	w->hi[w->n] = hi;
+	w->cum[w->n] = total;
+	++w->n;
+	if ( *p == ',' )
+	    ++p;
+	else if ( *p )
+	    do_help("Bad distribution.");
+    }
+    if ( !w->n )
+	do_help("Empty distribution.");
+}
+
+
+void*
+worker(void* arg)
+{
+    worker_t* w = arg;
+    uint64_t st = 0x9e3779b97f4a7c15ULL * (w->idx + 1) ^ getpid();
+    uint64_t seq = 0;
+    uint64_t period = 0;
+    uint64_t next;
+    char pload[ MQL_STRING_MAX ];
+
+    if ( opt_rate > 0 )
+	period = (uint64_t)(1e9 * opt_threads / opt_rate);
+
+    /* Spread the threads over the first period. */
+    next = now_ns(CLOCK_MONOTONIC) + period * w->idx / opt_threads;
+
+    while ( !stop ) {
+	unsigned sev = weights_pick(&sev_mix,&st);
+	unsigned size = weights_pick(&size_mix,&st);
+	uint64_t t0, t1;
+	int n;
+	int i;
+
+	if ( period ) {
+	    sleep_until( next );
+	    if ( stop )
+		break;
+	}
+
+	n = snprintf(pload, MQL_STRING_MAX, "M %u %llu %llu ",
+		     w->idx, (unsigned long long)seq,
+		     (unsigned long long)now_ns(CLOCK_REALTIME));
+	if ( size > n ) {
+	    memset(pload+n, 'x', size-n);
+	    pload[size] = '\0';
+	}
+
+	t0 = now_ns(CLOCK_MONOTONIC);
+	i = mql_log( sev, pload );
+	t1 = now_ns(CLOCK_MONOTONIC);
+
+	if ( i )
+	    ++w->failed;
+	else
+	    ++w->sent;
+	++seq;
+
+	if ( opt_open && period ) {
+	    /* Latency from when the call should have been made. */
+	    mql_hist_add(&w->lat, t1 - next);
+	    next += period;
+	}
+	else {
+	    mql_hist_add(&w->lat, t1 - t0);
+	    if ( period ) {
+		next += period;
+		if ( next < t1 )
+		    next = t1;		/* Closed loop: do not catch up */
+	    }
+	}
+
+	DD ("t=%u seq=%llu s=%x size=%u i=%d\n", w->idx,
+	    (unsigned long long)seq, sev, size, i);
+    }
+    return 0;
+}
+
+
+void
+on_signal(int sig)
+{
+    stop = 1;
+}
+
+
 void
 main_loop()
 {
-    unsigned n = 0;
-    unsigned s = 0;
+    worker_t* w;
+    mql_hist_t lat;
+    uint64_t sent = 0;
+    uint64_t failed = 0;
+    uint64_t published, filtered;
+    uint64_t t0, t1;
+    unsigned i;
+    double secs;
+
     /* Wait for us to be connected before we do stuff */
     mq_wait_connected();
 
-    for(;;) {
-	int i;
-	
-	i = mql_log( s, "abc" );
-	if (i) {
-	    printf("mql_log() failed!\n");
+    signal( SIGINT, on_signal );
+    signal( SIGTERM, on_signal );
+
+    mql_set_level( opt_level );
+
+    w = calloc( opt_threads, sizeof(worker_t) );
+    if ( !w ) {
+	perror("calloc: ");
+	exit( EXIT_FAILURE );
+    }
+
+    t0 = now_ns(CLOCK_MONOTONIC);
+    for ( i = 0; i < opt_threads; ++i ) {
+	w[i].idx = i;
+	mql_hist_init( &w[i].lat );
+	if ( pthread_create( &w[i].tid, 0, worker, &w[i] ) ) {
+	    perror("pthread_create: ");
+	    exit( EXIT_FAILURE );
 	}
-	
-	printf("n=%d s=%d\n",n,s);
-	++n;
-	++s; if ( s >= MQL_S_MAX ) s = 0;
-	    
-	sleep(1);
     }
+
+    if ( opt_duration > 0 ) {
+	sleep_until( t0 + (uint64_t)(opt_duration * 1e9) );
+	stop = 1;
+    }
+    else {
+	while ( !stop )
+	    pause();
+    }
+
+    mql_hist_init( &lat );
+    for ( i = 0; i < opt_threads; ++i ) {
+	pthread_join( w[i].tid, 0 );
+	sent += w[i].sent;
+	failed += w[i].failed;
+	mql_hist_merge( &lat, &w[i].lat );
+    }
+    t1 = now_ns(CLOCK_MONOTONIC);
+    secs = (t1 - t0) / 1e9;
+    published = atomic_load( &n_published );
+    filtered = sent > published ? sent - published : 0;
+
+    printf("threads=%u rate=%.0f mode=%s duration=%.3f s\n",
+	   opt_threads, opt_rate,
+	   (opt_open && opt_rate > 0) ? "open" : "closed", secs);
+    printf("calls=%llu published=%llu filtered=%llu failed=%llu\n",
+	   (unsigned long long)(sent + failed),
+	   (unsigned long long)published,
+	   (unsigned long long)filtered, (unsigned long long)failed);
+    printf("throughput=%.0f calls/s %.0f published/s\n",
+	   (sent + failed) / secs, published / secs);
+    printf("mql_log latency: ");
+    mql_hist_print( &lat, stdout );
+    printf("\n");
+
+    free( w );
 }
 
 
@@ -289,7 +568,6 @@ main(int argc, const char** argv)
     
     setbuf(stdout,0);
 
-    set_host(0);			/* Set default host */
     set_prefix(0);			/* Set default prefix */
 
     set_id(0);
@@ -353,19 +631,130 @@ main(int argc, const char** argv)
 	    continue;
 	}
 
+	if ( !strcmp(*argv,"-i") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -i option");
+
+	    set_id( *argv );
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
+	if ( !strcmp(*argv,"-t") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -t option");
+	    strncpy( transport_spec, *argv, STR_MAX-1 );
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
+	if ( !strcmp(*argv,"-o") )  {
+	    --argc;
+	    ++argv;
+	    ++opt_open;
+	    continue;
+	}
+
+	if ( !strcmp(*argv,"-n") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -n option");
+
+	    opt_threads = strtoul(*argv,0,0);
+	    if ( !opt_threads )
+		do_help("Bad number of threads");
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
+	if ( !strcmp(*argv,"-r") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -r option");
+
+	    opt_rate = atof(*argv);
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
+	if ( !strcmp(*argv,"-T") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -T option");
+
+	    opt_duration = atof(*argv);
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
+	if ( !strcmp(*argv,"-m") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -m option");
+
+	    weights_parse(&sev_mix, *argv, 16, MQL_S_MAX-1);
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
+	if ( !strcmp(*argv,"-s") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -s option");
+
+	    weights_parse(&size_mix, *argv, 10, MQL_STRING_MAX-1);
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
+	if ( !strcmp(*argv,"-l") )  {
+	    --argc;
+	    ++argv;
+	    if ( !argc || !*argv )
+		do_help("Missing argument to -l option");
+
+	    opt_level = strtoul(*argv,0,16);
+	    if ( opt_level >= MQL_S_MAX )
+		do_help("Bad level");
+	    --argc;
+	    ++argv;
+	    continue;
+	}
+
 	printf("Bad option: %s\n",*argv);
 	do_help(0);
 	break;
     }
 
+    if ( !sev_mix.n )
+	weights_parse(&sev_mix, "0-f", 16, MQL_S_MAX-1);
+    if ( !size_mix.n )
+	weights_parse(&size_mix, "32", 10, MQL_STRING_MAX-1);
+
 
 
     mq_init(mqtt_host,mqtt_port);
 
-    i = mosquitto_loop_start(mqc);
-    if(i != MOSQ_ERR_SUCCESS){
-	mosquitto_destroy(mqc);
-	fprintf(stderr, "Error: %s\n", mosquitto_strerror(i));
+    i = mql_transport_loop_start(tp);
+    if ( i ) {
+	mql_transport_destroy(tp);
+	fprintf(stderr, "Error: %s\n", "Can not start transport");
 	exit( EXIT_FAILURE );
     }
 
@@ -0,0 +1,529 @@
+/*                               -*- Mode: C -*-
+ * Copyright (C) 2025, Mats Bergstrom
+ *
+ * File name       : t-store.c
+ * Description     : Self test of the mqld store
+ *
+ * Author          : Mats Bergstrom
+ * Created On      : Mon Oct 19 16:11:04 2026
+ *
+ * Last Modified By: Mats Bergstrom
+ * Last Modified On: Mon Oct 19 16:11:04 2026
+ * Update Count    : 1
+ */
+
+/*
+ * "t-store" tests the store (mql_store.h) in a new directory in /tmp,
+ * removed when it passes:
+ *	crash		a writer killed with records in its buffers; on
+ *			reopen no flushed record is lost, the records are
+ *			in sequence without gaps and as written
+ *	torn record	half a record at the end of the last segment is cut
+ *	restart		numbering goes on, the rollup totals match
+ *	lz		round trips, damaged blocks rejected within bounds
+ *	compaction	mql query prints the same before and after
+ * Prints OK or FAILED.  "t-store -k" keeps the directory.  Runs ./mql,
+ * or $MQL.
+ */
+
+#include "mql.h"
+#include "mql_store.h"
+#include "mql_col.h"
+#include "mql_lz.h"
+#include "mql_roll.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define T_FLUSHED	(50000)		/* Records synced before the kill */
+#define T_MORE		(20000)		/* Appended after the restart */
+#define T_SOURCES	(5)
+#define T_BUF_SIZE	(64 * 1024)
+#define T_SEG_MAX	(512 * 1024)	/* Several segments */
+
+static int failures = 0;
+
+#define CHECK(c,msg)	do { if ( !(c) ) fail(__LINE__,msg); } while (0)
+
+
+static void
+fail(int line, const char* msg)
+{
+    printf("FAIL line %d: %s\n", line, msg);
+    ++failures;
+}
+
+
+// Record i of the test, the same whenever it is written.
+static void
+t_rec(uint64_t i, char* id, unsigned* id_len, unsigned* sev,
+      char* text, unsigned* text_len)
+{
+    *id_len = sprintf(id, "src%u", (unsigned)(i % T_SOURCES));
+    *sev = i % MQL_S_MAX;
+    *text_len = sprintf(text, "record %llu word%u of the store test",
+			(unsigned long long)i, (unsigned)(i % 97));
+}
+
+static void
+t_append(mql_store_t* st, uint64_t i)
+{
+    char id[ 16 ], text[ 80 ];
+    unsigned id_len, sev, text_len;
+    t_rec(i, id, &id_len, &sev, text, &text_len);
+    CHECK( !mql_store_append(st, id, id_len, sev, text, text_len), "append" );
+}
+
+static mql_store_t*
+t_open(const char* dir)
+{
+    mql_store_conf_t conf;
+    mql_store_t* st;
+
+    mql_store_defaults(&conf);
+    conf.dir = dir;
+    conf.buf_size = T_BUF_SIZE;
+    conf.seg_max = T_SEG_MAX;
+    st = mql_store_open(&conf);
+    if ( !st ) {
+	perror("mql_store_open: ");
+	exit( EXIT_FAILURE );
+    }
+    return st;
+}
+
+// Read all segments of dir, check that the records are those of t_rec()
+// in sequence from the first, without gaps.  The last may end in a
+// damaged record when torn is set.
+//	RETURNS	records, *end_seq after the last
+static uint64_t
+t_read(const char* dir, int torn, uint64_t* end_seq)
+{
+    char path[ 4096 ], id[ 16 ], text[ 80 ];
+    unsigned id_len, sev, text_len;
+    uint64_t n = 0, first = 0;
+    char** names;
+    int n_names, i, bad = 0;
+
+    n_names = mql_seg_list(dir, &names);
+    CHECK( n_names > 0, "segments" );
+    for ( i = 0; i < n_names; ++i ) {
+	const mql_rec_t* r;
+	mql_seg_t seg;
+	size_t pos = 0;
+	int k;
+
+	snprintf( path, sizeof(path), "%s/%s", dir, names[i] );
+	if ( mql_seg_open(&seg, path) ) {
+	    CHECK( 0, "open segment" );
+	    continue;
+	}
+	if ( !n )
+	    first = seg.hdr->first_seq;
+	CHECK( seg.hdr->first_seq == first + n, "segment first_seq" );
+	while ( (k = mql_seg_next(&seg, &pos, &r)) > 0 ) {
+	    t_rec(n, id, &id_len, &sev, text, &text_len);
+	    if ( r->seq != first + n || r->sev != sev
+		 || r->id_len != id_len || memcmp(MQL_REC_ID(r), id, id_len)
+		 || r->text_len != text_len
+		 || memcmp(MQL_REC_TEXT(r), text, text_len) )
+		++bad;
+	    ++n;
+	}
+	CHECK( k == 0 || (torn && i + 1 == n_names), "damaged record" );
+	CHECK( i + 1 == n_names || mql_seg_footer(&seg), "footer" );
+	mql_seg_close(&seg);
+    }
+    mql_seg_list_free(names, n_names);
+    CHECK( !bad, "records in sequence and as written" );
+    *end_seq = first + n;
+    return n;
+}
+
+// Total of the rollup day counts of dir.
+static uint64_t
+t_roll_total(const char* dir, uint64_t* end_seq)
+{
+    mql_roll_t r;
+    uint64_t n = 0;
+    unsigned i;
+
+    mql_roll_init(&r);
+    if ( mql_roll_load(&r, dir) ) {
+	CHECK( 0, "rollup load" );
+	return 0;
+    }
+    for ( i = 0; i < r.hdr.n_slots; ++i )
+	if ( r.ent[i].count
+	     && MQL_ROLL_KEY_TIER(r.ent[i].key) == MQL_ROLL_DAY )
+	    n += r.ent[i].count;
+    *end_seq = r.hdr.end_seq;
+    mql_roll_free(&r);
+    return n;
+}
+
+// Append T_FLUSHED records, flush, tell the parent and go on until
+// killed.
+static void
+t_writer(const char* dir, int fd)
+{
+    mql_store_t* st = t_open(dir);
+    uint64_t i;
+
+    for ( i = 0; i < T_FLUSHED; ++i )
+	t_append(st, i);
+    mql_store_flush(st);
+    if ( write(fd, "", 1) != 1 )
+	_exit( EXIT_FAILURE );
+    for ( ;; )
+	t_append(st, i++);
+}
+
+// Write half a record after the last good one of the last segment, as a
+// write cut short would.
+static void
+t_tear(const char* dir)
+{
+    char path[ 4096 ];
+    const mql_rec_t* r;
+    mql_rec_t half;
+    mql_seg_t seg;
+    uint64_t seq = 0;
+    size_t pos = 0;
+    char** names;
+    int n, fd;
+
+    n = mql_seg_list(dir, &names);
+    if ( n <= 0 )
+	return;
+    snprintf( path, sizeof(path), "%s/%s", dir, names[n-1] );
+    mql_seg_list_free(names, n);
+    if ( mql_seg_open(&seg, path) ) {
+	CHECK( 0, "open last segment" );
+	return;
+    }
+    seq = seg.hdr->first_seq;
+    while ( mql_seg_next(&seg, &pos, &r) > 0 )
+	seq = r->seq + 1;
+    mql_seg_close(&seg);
+
+    memset( &half, 0, sizeof(half) );
+    half.text_len = 40;
+    half.id_len = 4;
+    half.len = MQL_REC_LEN(half.id_len, half.text_len);
+    half.seq = seq;
+    fd = open(path, O_WRONLY);
+    CHECK( fd >= 0
+	   && pwrite(fd, &half, sizeof(half), pos) == sizeof(half)
+	   && !ftruncate(fd, pos + sizeof(half)), "tear" );
+    if ( fd >= 0 )
+	close(fd);
+}
+
+
+static void
+t_crash(const char* dir)
+{
+    uint64_t n, n2, end, roll_end;
+    mql_store_t* st;
+    int fd[2], status;
+    pid_t pid;
+    char c;
+
+    if ( pipe(fd) ) {
+	perror("pipe: ");
+	exit( EXIT_FAILURE );
+    }
+    pid = fork();
+    if ( pid < 0 ) {
+	perror("fork: ");
+	exit( EXIT_FAILURE );
+    }
+    if ( !pid ) {
+	close(fd[0]);
+	t_writer(dir, fd[1]);
+    }
+    close(fd[1]);
+    CHECK( read(fd[0], &c, 1) == 1, "writer flushed" );
+    usleep(20000);			/* Into the next buffers */
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    close(fd[0]);
+
+    n = t_read(dir, 1, &end);
+    printf("crash: %llu records on disk, %d flushed\n",
+	   (unsigned long long)n, T_FLUSHED);
+    CHECK( n >= T_FLUSHED, "flushed records kept" );
+
+    /* Cut on reopen, numbering goes on from the last good one. */
+    t_tear(dir);
+    st = t_open(dir);
+    for ( n2 = n; n2 < n + T_MORE; ++n2 )
+	t_append(st, n2);
+    mql_store_close(st);
+    n2 = t_read(dir, 0, &end);
+    CHECK( n2 == n + T_MORE, "records after restart" );
+    CHECK( t_roll_total(dir, &roll_end) == n2, "rollup total" );
+    CHECK( roll_end == end, "rollup end_seq" );
+}
+
+
+// Decompress src[n] into cap bytes with a guard after them.
+//	RETURNS	as mql_lz_decompress(), -2 when it wrote past cap
+static long
+t_unlz(const void* src, size_t n, char* dst, size_t cap)
+{
+    long r;
+    memset( dst + cap, 0xa5, 64 );
+    r = mql_lz_decompress(src, n, dst, cap);
+    for ( n = 0; n < 64; ++n )
+	if ( (unsigned char)dst[ cap + n ] != 0xa5 )
+	    return -2;
+    return r;
+}
+
+static void
+t_lz_one(const char* what, const char* src, size_t n)
+{
+    char* z = malloc(MQL_LZ_BOUND(n));
+    char* d = malloc(n + 64);
+    char msg[ 128 ];
+    size_t zn, k;
+    int hc, bad;
+
+    if ( !z || !d ) {
+	perror("lz: ");
+	exit( EXIT_FAILURE );
+    }
+    for ( hc = 0; hc < 2; ++hc ) {
+	zn = hc ? mql_lz_compress_hc(src, n, z) : mql_lz_compress(src, n, z);
+	snprintf( msg, sizeof(msg), "lz%s round trip of %s",
+		  hc ? " hc" : "", what );
+	CHECK( zn <= MQL_LZ_BOUND(n) && t_unlz(z, zn, d, n) == (long)n
+	       && !memcmp(d, src, n), msg );
+	snprintf( msg, sizeof(msg), "lz%s too small a buffer for %s",
+		  hc ? " hc" : "", what );
+	CHECK( !n || t_unlz(z, zn, d, n - 1) == -1, msg );
+
+	/* Cut short: rejected or the start of it, never past the end. */
+	bad = 0;
+	for ( k = 0; k < zn; k += 1 + zn / 500 ) {
+	    long r = t_unlz(z, k, d, n);
+	    if ( r == -2 || (r >= 0 && memcmp(d, src, r)) )
+		++bad;
+	}
+	snprintf( msg, sizeof(msg), "lz%s truncated %s", hc ? " hc" : "", what );
+	CHECK( !bad, msg );
+
+	/* Bytes changed: never past the end. */
+	bad = 0;
+	for ( k = 0; k < 1000 && zn; ++k ) {
+	    size_t at = rand() % zn;
+	    char was = z[at];
+	    z[at] ^= 1 + rand() % 255;
+	    if ( t_unlz(z, zn, d, n) == -2 )
+		++bad;
+	    z[at] = was;
+	}
+	snprintf( msg, sizeof(msg), "lz%s damaged %s", hc ? " hc" : "", what );
+	CHECK( !bad, msg );
+    }
+    free(z);
+    free(d);
+}
+
+static void
+t_lz(void)
+{
+    char id[ 16 ], text[ 80 ];
+    unsigned id_len, sev, text_len;
+    size_t n = 1 << 18, k;
+    char* b = malloc(n);
+    uint64_t i;
+
+    if ( !b ) {
+	perror("lz: ");
+	exit( EXIT_FAILURE );
+    }
+    t_lz_one("nothing", "", 0);
+    t_lz_one("one byte", "x", 1);
+    memset( b, 'a', n );
+    t_lz_one("one byte repeated", b, n);
+    srand(1);
+    for ( k = 0; k < n; ++k )
+	b[k] = rand();
+    t_lz_one("random bytes", b, n);
+    for ( i = 0, k = 0; k + 80 < n; ++i ) {
+	t_rec(i, id, &id_len, &sev, text, &text_len);
+	memcpy( b + k, text, text_len );
+	k += text_len;
+    }
+    t_lz_one("record texts", b, k);
+    free(b);
+}
+
+
+// Output of mql query on dir into out, by as --by or 0 to print.
+static void
+t_query(const char* dir, const char* out, const char* by,
+	int n_words, const char** words)
+{
+    const char* mql = getenv("MQL") ? getenv("MQL") : "./mql";
+    const char* argv[ 16 ];
+    int fd, status, n = 0;
+    pid_t pid;
+
+    argv[n++] = mql;
+    argv[n++] = "query";
+    argv[n++] = "--dir";
+    argv[n++] = dir;
+    argv[n++] = "--threads";
+    argv[n++] = "4";
+    if ( by ) {
+	argv[n++] = "--by";
+	argv[n++] = by;
+    }
+    argv[n++] = "ALL";
+    argv[n++] = "ALL";
+    while ( n_words-- )
+	argv[n++] = *words++;
+    argv[n] = 0;
+
+    pid = fork();
+    if ( pid < 0 ) {
+	perror("fork: ");
+	exit( EXIT_FAILURE );
+    }
+    if ( !pid ) {
+	fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if ( fd < 0 || dup2(fd, 1) < 0 )
+	    _exit( EXIT_FAILURE );
+	execv(mql, (char* const*)argv);
+	perror(mql);
+	_exit( EXIT_FAILURE );
+    }
+    waitpid(pid, &status, 0);
+    CHECK( WIFEXITED(status) && !WEXITSTATUS(status), "query" );
+}
+
+// Files a and b have the same bytes, and some.
+static int
+t_same(const char* a, const char* b)
+{
+    FILE* fa = fopen(a, "r");
+    FILE* fb = fopen(b, "r");
+    int ca = 0, cb = 0;
+    long n = 0;
+
+    if ( fa && fb )
+	do {
+	    ca = getc(fa);
+	    cb = getc(fb);
+	    ++n;
+	} while ( ca == cb && ca != EOF );
+    if ( fa )
+	fclose(fa);
+    if ( fb )
+	fclose(fb);
+    return fa && fb && ca == EOF && cb == EOF && n > 1;
+}
+
+static void
+t_compact(const char* dir)
+{
+    static const char* what[][2] = {
+	{ "print", 0 }, { "count", "source" }, { "words", 0 }
+    };
+    const char* words[] = { "word7", "store" };
+    char path[ 4096 ], before[ 4096 ], after[ 4096 ];
+    char** names;
+    int n, i, n_col = 0;
+
+    for ( i = 0; i < 3; ++i ) {
+	snprintf( before, sizeof(before), "%s/query.%s.1", dir, what[i][0] );
+	t_query(dir, before, what[i][1], i == 2 ? 2 : 0, words);
+    }
+
+    n = mql_seg_list(dir, &names);
+    for ( i = 0; i < n; ++i ) {
+	snprintf( path, sizeof(path), "%s/%s", dir, names[i] );
+	if ( mql_col_compact(path, 0) ) {
+	    CHECK( 0, "compact" );
+	    continue;
+	}
+	++n_col;
+	unlink(path);
+	strcpy( path + strlen(path) - strlen(MQL_SEG_SUFFIX), MQL_IDX_SUFFIX );
+	unlink(path);
+    }
+    mql_seg_list_free(names, n);
+    printf("compaction: %d segments\n", n_col);
+    CHECK( n_col > 1, "segments compacted" );
+
+    for ( i = 0; i < 3; ++i ) {
+	snprintf( before, sizeof(before), "%s/query.%s.1", dir, what[i][0] );
+	snprintf( after, sizeof(after), "%s/query.%s.2", dir, what[i][0] );
+	t_query(dir, after, what[i][1], i == 2 ? 2 : 0, words);
+	snprintf( path, sizeof(path), "query %s the same after compaction",
+		  what[i][0] );
+	CHECK( t_same(before, after), path );
+    }
+}
+
+
+// Remove dir and what is in it.
+static void
+t_remove(const char* dir)
+{
+    char path[ 4096 ];
+    struct dirent* e;
+    DIR* d = opendir(dir);
+
+    if ( !d )
+	return;
+    while ( (e = readdir(d)) ) {
+	if ( !strcmp(e->d_name, ".") || !strcmp(e->d_name, "..") )
+	    continue;
+	snprintf( path, sizeof(path), "%s/%s", dir, e->d_name );
+	unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+
+int
+main(int argc, const char** argv)
+{
+    char dir[] = "/tmp/t-store.XXXXXX";
+    int keep = argc > 1 && !strcmp(argv[1], "-k");
+
+    setbuf(stdout,0);
+    if ( argc > 1 && !keep ) {
+	printf("t-store [-k]\n");
+	return EXIT_FAILURE;
+    }
+    if ( !mkdtemp(dir) ) {
+	perror("mkdtemp: ");
+	return EXIT_FAILURE;
+    }
+
+    t_crash(dir);
+    t_lz();
+    t_compact(dir);
+
+    if ( keep || failures )
+	printf("store in %s\n", dir);
+    else
+	t_remove(dir);
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}